@@ -0,0 +1,12 @@
+#!/bin/sh
+# Headless build for Linux, see main/headless.cpp
+
+mkdir -p ./build
+cd ./build
+
+SOURCES="../main/headless.cpp"
+# The core of Dear ImGui for the widgets, which are exercised without a window or renderer
+SOURCES="$SOURCES ../main/imgui/imgui.cpp ../main/imgui/imgui_draw.cpp ../main/imgui/imgui_tables.cpp"
+SOURCES="$SOURCES ../main/imgui/imgui_widgets.cpp"
+
+g++ -std=c++17 -O2 -g -pthread $SOURCES -o pedro_headless
@@ -0,0 +1,327 @@
+// Alarms.
+// A rule watches one channel for a value above a level, below one, or outside a range. It raises once the value
+// has been there for debounce_us and clears once it has been back, past the hysteresis, for as long. The ingest
+// store thread runs the rules of a channel on every batch of it as it comes in: the compare kernels of query.cpp
+// turn the batch into a bitmask of samples in the raise region and one of samples in the clear region, and the
+// state machine of every rule only looks at the samples where the bit it waits for changes, so a quiet channel
+// costs the masks and little else.
+// Every raise and clear is an event. Events go to the UI through a single-producer single-consumer ring that
+// drops them when it is full rather than wait, and into the store and the capture as a channel per rule,
+// channel n of device ALARM_DEVICE, that is 1 while the alarm is raised and 0 once it clears.
+// Events carry the time their batch was pushed and the time they were found, for measuring how long an alarm
+// takes to show.
+
+#define ALARM_DEVICE 0xFFFE
+#define ALARM_MAX_RULES 1024
+#define ALARM_MAX_CHANNELS 1024
+#define ALARM_MAX_CHANNEL_RULES 16
+// Power of two, more than twice ALARM_MAX_CHANNELS
+#define ALARM_TABLE_SIZE 4096
+#define ALARM_CHUNK 1024
+#define ALARM_QUEUE_SIZE 4096
+#define ALARM_MAX_FIRED 256
+#define ALARM_MAX_NAME 32
+
+enum alarm_kind {
+    // value >= high
+    alarm_kind_above = 0,
+    // value <= low
+    alarm_kind_below = 1,
+    // value <= low or value >= high
+    alarm_kind_outside = 2
+};
+
+enum alarm_state {
+    alarm_state_clear = 0,
+    // In the raise region for less than the debounce time so far
+    alarm_state_raising = 1,
+    alarm_state_raised = 2,
+    alarm_state_clearing = 3
+};
+
+typedef struct {
+    char name[ALARM_MAX_NAME];
+    uint32_t channel_id;
+    int kind;
+    float low;
+    float high;
+    // How far back past the level the value has to go to clear, 0 or more
+    float hysteresis;
+    int64_t debounce_us;
+} alarm_rule;
+
+typedef struct {
+    int rule;
+    uint32_t channel_id;
+    bool raised;
+    // The sample that raised or cleared it
+    int64_t timestamp_us;
+    float value;
+    // platform_time_ns of the batch being pushed and of the store thread finding the event
+    uint64_t pushed_ns;
+    uint64_t detected_ns;
+} alarm_event;
+
+typedef struct {
+    bool used;
+    alarm_rule rule;
+    // Store thread only
+    int state;
+    int64_t since_us;
+} alarm_slot;
+
+typedef struct {
+    uint32_t channel_id;
+    int rules[ALARM_MAX_CHANNEL_RULES];
+    int rule_count;
+} alarm_channel;
+
+typedef struct {
+    // Held by the store thread while it evaluates and to change the rules
+    platform_mutex lock;
+    alarm_slot slots[ALARM_MAX_RULES];
+    // Rebuilt whenever the rules change, table holds indices into channels or -1
+    alarm_channel channels[ALARM_MAX_CHANNELS];
+    int channel_count;
+    int16_t table[ALARM_TABLE_SIZE];
+    const query_kernels *kernels;
+
+    // Store thread only
+    uint64_t raise[ALARM_CHUNK / 64];
+    uint64_t clear[ALARM_CHUNK / 64];
+    uint64_t scratch[ALARM_CHUNK / 64];
+    // Events of the last alarm_evaluate
+    alarm_event fired[ALARM_MAX_FIRED];
+    int fired_count;
+    uint64_t samples;
+
+    // To the UI
+    alarm_event queue[ALARM_QUEUE_SIZE];
+    std::atomic<uint64_t> queue_head;
+    std::atomic<uint64_t> queue_tail;
+    std::atomic<uint64_t> dropped;
+} alarm_engine;
+
+void alarm_init(alarm_engine *alarms) {
+    platform_mutex_init(&alarms->lock);
+    memset(alarms->slots, 0, sizeof(alarms->slots));
+    alarms->channel_count = 0;
+    memset(alarms->table, 0xFF, sizeof(alarms->table));
+    alarms->kernels = query_active_kernels();
+    alarms->fired_count = 0;
+    alarms->samples = 0;
+    alarms->queue_head.store(0);
+    alarms->queue_tail.store(0);
+    alarms->dropped.store(0);
+}
+
+void alarm_destroy(alarm_engine *alarms) {
+    platform_mutex_destroy(&alarms->lock);
+}
+
+int alarm_table_slot(uint32_t channel_id) {
+    return (int)((channel_id * 2654435761U) >> 20) & (ALARM_TABLE_SIZE - 1);
+}
+
+alarm_channel *alarm_find_channel(alarm_engine *alarms, uint32_t channel_id) {
+    for(int slot = alarm_table_slot(channel_id); alarms->table[slot] >= 0; slot = (slot + 1) & (ALARM_TABLE_SIZE - 1)) {
+        alarm_channel *channel = &alarms->channels[alarms->table[slot]];
+        if(channel->channel_id == channel_id) {
+            return channel;
+        }
+    }
+    return NULL;
+}
+
+// Caller holds the lock. False if a channel would have more than ALARM_MAX_CHANNEL_RULES rules.
+bool alarm_rebuild(alarm_engine *alarms) {
+    alarms->channel_count = 0;
+    memset(alarms->table, 0xFF, sizeof(alarms->table));
+    for(int i = 0; i < ALARM_MAX_RULES; i++) {
+        if(!alarms->slots[i].used) {
+            continue;
+        }
+        uint32_t channel_id = alarms->slots[i].rule.channel_id;
+        alarm_channel *channel = alarm_find_channel(alarms, channel_id);
+        if(!channel) {
+            int slot = alarm_table_slot(channel_id);
+            while(alarms->table[slot] >= 0) {
+                slot = (slot + 1) & (ALARM_TABLE_SIZE - 1);
+            }
+            alarms->table[slot] = (int16_t)alarms->channel_count;
+            channel = &alarms->channels[alarms->channel_count++];
+            channel->channel_id = channel_id;
+            channel->rule_count = 0;
+        }
+        if(channel->rule_count == ALARM_MAX_CHANNEL_RULES) {
+            return false;
+        }
+        channel->rules[channel->rule_count++] = i;
+    }
+    return true;
+}
+
+// Any thread. Returns the slot of the rule, its state channel is channel slot of ALARM_DEVICE, or -1 if there is
+// no room for it. The rule starts out clear.
+int alarm_add(alarm_engine *alarms, const alarm_rule *rule) {
+    platform_mutex_lock(&alarms->lock);
+    int slot = -1;
+    for(int i = 0; i < ALARM_MAX_RULES && slot < 0; i++) {
+        slot = alarms->slots[i].used ? -1 : i;
+    }
+    if(slot >= 0) {
+        alarm_slot *target = &alarms->slots[slot];
+        target->used = true;
+        target->rule = *rule;
+        target->rule.name[ALARM_MAX_NAME - 1] = 0;
+        target->rule.hysteresis = rule->hysteresis > 0.0f ? rule->hysteresis : 0.0f;
+        target->rule.debounce_us = rule->debounce_us > 0 ? rule->debounce_us : 0;
+        target->state = alarm_state_clear;
+        target->since_us = 0;
+        if(!alarm_rebuild(alarms)) {
+            target->used = false;
+            alarm_rebuild(alarms);
+            slot = -1;
+        }
+    }
+    platform_mutex_unlock(&alarms->lock);
+    return slot;
+}
+
+// Any thread. A raised alarm goes away without a clear event.
+void alarm_remove(alarm_engine *alarms, int slot) {
+    platform_mutex_lock(&alarms->lock);
+    alarms->slots[slot].used = false;
+    alarm_rebuild(alarms);
+    platform_mutex_unlock(&alarms->lock);
+}
+
+// First bit at or after from that is set, or clear if set is false, count if there is none
+int alarm_next_bit(const uint64_t *bits, int from, int count, bool set) {
+    uint64_t mask = ~0ULL << (from & 63);
+    for(int word = from >> 6; word * 64 < count; word++) {
+        uint64_t value = (set ? bits[word] : ~bits[word]) & mask;
+        if(value) {
+            int bit = word * 64 + query_count_trailing_zeros(value);
+            return bit < count ? bit : count;
+        }
+        mask = ~0ULL;
+    }
+    return count;
+}
+
+// Samples in the raise and the clear region, clear is exclusive of its level so the two never overlap
+void alarm_masks(alarm_engine *alarms, const alarm_rule *rule, const float *values, int count) {
+    query_mask_proc mask = alarms->kernels->mask;
+    int words = (count + 63) / 64;
+    if(rule->kind == alarm_kind_above) {
+        mask(values, count, rule->high, INFINITY, alarms->raise);
+        mask(values, count, -INFINITY, nextafterf(rule->high - rule->hysteresis, -INFINITY), alarms->clear);
+    } else if(rule->kind == alarm_kind_below) {
+        mask(values, count, -INFINITY, rule->low, alarms->raise);
+        mask(values, count, nextafterf(rule->low + rule->hysteresis, INFINITY), INFINITY, alarms->clear);
+    } else {
+        mask(values, count, -INFINITY, rule->low, alarms->raise);
+        mask(values, count, rule->high, INFINITY, alarms->scratch);
+        for(int i = 0; i < words; i++) {
+            alarms->raise[i] |= alarms->scratch[i];
+        }
+        mask(values, count, nextafterf(rule->low + rule->hysteresis, INFINITY),
+             nextafterf(rule->high - rule->hysteresis, -INFINITY), alarms->clear);
+    }
+}
+
+void alarm_fire(alarm_engine *alarms, int rule, bool raised, int64_t timestamp_us, float value, uint64_t pushed_ns) {
+    alarm_event event;
+    event.rule = rule;
+    event.channel_id = alarms->slots[rule].rule.channel_id;
+    event.raised = raised;
+    event.timestamp_us = timestamp_us;
+    event.value = value;
+    event.pushed_ns = pushed_ns;
+    event.detected_ns = platform_time_ns();
+    if(alarms->fired_count < ALARM_MAX_FIRED) {
+        alarms->fired[alarms->fired_count++] = event;
+    }
+    uint64_t head = alarms->queue_head.load(std::memory_order_relaxed);
+    if(head - alarms->queue_tail.load(std::memory_order_acquire) == ALARM_QUEUE_SIZE) {
+        alarms->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    alarms->queue[head & (ALARM_QUEUE_SIZE - 1)] = event;
+    alarms->queue_head.store(head + 1, std::memory_order_release);
+}
+
+// Runs the state machine of a rule over a chunk whose masks are in place
+void alarm_walk(alarm_engine *alarms, int rule, const int64_t *timestamps_us, const float *values, int count,
+                uint64_t pushed_ns) {
+    alarm_slot *slot = &alarms->slots[rule];
+    int i = 0;
+    while(i < count) {
+        if(slot->state == alarm_state_clear || slot->state == alarm_state_raised) {
+            bool raised = slot->state == alarm_state_raised;
+            int j = alarm_next_bit(raised ? alarms->clear : alarms->raise, i, count, true);
+            if(j == count) {
+                break;
+            }
+            slot->state = raised ? alarm_state_clearing : alarm_state_raising;
+            slot->since_us = timestamps_us[j];
+            i = j;
+        } else {
+            // Still in the region up to j, the first of those samples that is past the debounce time does it
+            bool raising = slot->state == alarm_state_raising;
+            int j = alarm_next_bit(raising ? alarms->raise : alarms->clear, i, count, false);
+            int64_t due_us = slot->since_us + slot->rule.debounce_us;
+            int first = i;
+            int last = j;
+            while(first < last) {
+                int middle = (first + last) / 2;
+                if(timestamps_us[middle] < due_us) {
+                    first = middle + 1;
+                } else {
+                    last = middle;
+                }
+            }
+            if(first < j) {
+                alarm_fire(alarms, rule, raising, timestamps_us[first], values[first], pushed_ns);
+                slot->state = raising ? alarm_state_raised : alarm_state_clear;
+                i = first + 1;
+            } else {
+                // Left the region too soon, or the region goes on into the next batch
+                slot->state = j < count ? (raising ? alarm_state_clear : alarm_state_raised) : slot->state;
+                i = j;
+            }
+        }
+    }
+}
+
+// Store thread. Runs the rules of the channel over a batch of it, the events end up in fired and in the queue.
+// Returns how many there are in fired.
+int alarm_evaluate(alarm_engine *alarms, uint32_t channel_id, const int64_t *timestamps_us, const float *values,
+                   int count, uint64_t pushed_ns) {
+    alarms->fired_count = 0;
+    platform_mutex_lock(&alarms->lock);
+    alarm_channel *channel = alarms->channel_count ? alarm_find_channel(alarms, channel_id) : NULL;
+    for(int first = 0; channel && first < count; first += ALARM_CHUNK) {
+        int n = count - first < ALARM_CHUNK ? count - first : ALARM_CHUNK;
+        for(int i = 0; i < channel->rule_count; i++) {
+            int rule = channel->rules[i];
+            alarm_masks(alarms, &alarms->slots[rule].rule, values + first, n);
+            alarm_walk(alarms, rule, timestamps_us + first, values + first, n, pushed_ns);
+        }
+        alarms->samples += n;
+    }
+    platform_mutex_unlock(&alarms->lock);
+    return alarms->fired_count;
+}
+
+// UI thread. The oldest event not taken yet, false if there is none.
+bool alarm_pop(alarm_engine *alarms, alarm_event *event) {
+    uint64_t tail = alarms->queue_tail.load(std::memory_order_relaxed);
+    if(tail == alarms->queue_head.load(std::memory_order_acquire)) {
+        return false;
+    }
+    *event = alarms->queue[tail & (ALARM_QUEUE_SIZE - 1)];
+    alarms->queue_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,826 @@
+// Capture files.
+// A recording is a header with the schema of every channel, then blocks of up to CAPTURE_BLOCK_SAMPLES samples
+// of one channel each, then an index of all blocks and a footer pointing at it. Every so often the writer
+// puts down a checkpoint record and syncs the file. A file that never got its index, because the client
+// crashed or the disk filled up, is read by walking the blocks up to the last checkpoint.
+// The ingest store thread copies samples into per-channel blocks and hands full ones to a small pool of encoder
+// threads that compress them, then to the writer thread, which does the file I/O in large buffered writes.
+// Every block is compressed on its own so that any of them can be read without the ones before it.
+// Records start at multiples of 8 bytes so that a mapped file can be read in place.
+// Block headers and index entries carry a zone map of the block, the min, max, first and last value, so that
+// searches can rule blocks out without reading them.
+
+#define CAPTURE_MAGIC 0x43444550            // "PEDC"
+#define CAPTURE_BLOCK_MAGIC 0x4B4C4250      // "PBLK"
+#define CAPTURE_CHECKPOINT_MAGIC 0x54504B43 // "CKPT"
+#define CAPTURE_INDEX_MAGIC 0x58444950      // "PIDX"
+#define CAPTURE_VERSION 4
+
+#define CAPTURE_BLOCK_SAMPLES 4096
+#define CAPTURE_MAX_CHANNELS 1024
+// Blocks that can be filling or queued at once, past that samples are dropped rather than stalling ingest
+#define CAPTURE_MAX_BLOCKS 512
+#define CAPTURE_WRITE_BUFFER_SIZE megabytes(4)
+#define CAPTURE_DEFAULT_CHECKPOINT_MS 1000
+#define CAPTURE_MAX_ENCODERS 4
+#define CAPTURE_PLANES_SIZE (CAPTURE_BLOCK_SAMPLES * (int)(sizeof(int64_t) + sizeof(float)))
+#define CAPTURE_ENCODED_BOUND lz_bound(CAPTURE_PLANES_SIZE)
+
+enum capture_encoding {
+    // int64_t timestamps_us[sample_count] then float values[sample_count]
+    capture_encoding_raw = 0,
+    // The same split into byte planes after delta coding, then LZ compressed, see capture_encode_block
+    capture_encoding_delta_lz = 1
+};
+
+#pragma pack(push, 1)
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t channel_count;
+    int64_t created_unix_us;
+} capture_file_header;
+
+// Follows the header channel_count times, channel_id is a device_channel_id
+typedef struct {
+    uint32_t channel_id;
+    schema_channel schema;
+} capture_channel;
+
+// size is the bytes that follow the header, including the padding up to the next record
+typedef struct {
+    uint32_t magic;
+    uint32_t channel_id;
+    uint32_t sample_count;
+    uint32_t size;
+    uint8_t encoding;
+    uint8_t padding;
+    uint8_t reserved[6];
+    int64_t first_timestamp_us;
+    int64_t last_timestamp_us;
+    float min_value;
+    float max_value;
+    float first_value;
+    float last_value;
+} capture_block_header;
+
+// Everything before it is on the disk
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t block_count;
+} capture_checkpoint;
+
+// size includes the block header
+typedef struct {
+    uint32_t channel_id;
+    uint32_t sample_count;
+    uint32_t size;
+    uint32_t encoding;
+    int64_t first_timestamp_us;
+    int64_t last_timestamp_us;
+    float min_value;
+    float max_value;
+    float first_value;
+    float last_value;
+    uint64_t offset;
+} capture_index_entry;
+
+// Last thing in a complete file
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t index_offset;
+    uint64_t block_count;
+} capture_footer;
+#pragma pack(pop)
+
+typedef struct capture_block capture_block;
+struct capture_block {
+    // In the order they go to the file
+    capture_block *next;
+    // Waiting for an encoder
+    capture_block *next_to_encode;
+    std::atomic<int> encoded;
+    capture_block_header header;
+    int64_t timestamps_us[CAPTURE_BLOCK_SAMPLES];
+    float values[CAPTURE_BLOCK_SAMPLES];
+    int encoded_size;
+    uint8_t encoded_data[CAPTURE_ENCODED_BOUND];
+};
+
+typedef struct {
+    uint32_t channel_id;
+    capture_block *block;
+} capture_staging;
+
+typedef struct {
+    platform_file file;
+    platform_thread thread;
+    platform_event wake;
+    std::atomic<int> running;
+    int checkpoint_ms;
+
+    // Appending thread only
+    capture_staging staging[CAPTURE_MAX_CHANNELS];
+    int staging_count;
+    capture_staging *last_staging;
+
+    // Full blocks go to the encoders and the writer thread, which writes them in the order they came in once
+    // they are encoded and gives them back through free_blocks
+    platform_mutex lock;
+    capture_block *queue_head;
+    capture_block *queue_tail;
+    capture_block *encode_head;
+    capture_block *encode_tail;
+    capture_block *free_blocks;
+    int blocks_allocated;
+    std::atomic<int> queued;
+
+    // No encoders when the capture isn't compressed
+    platform_thread encoders[CAPTURE_MAX_ENCODERS];
+    int encoder_count;
+    platform_event encode_wake;
+    std::atomic<int> encoding;
+
+    // Writer thread only
+    char *buffer;
+    int64_t buffered;
+    int64_t offset;
+    capture_index_entry *index;
+    int64_t index_count;
+    int64_t index_capacity;
+    int64_t checkpointed_blocks;
+
+    std::atomic<uint64_t> bytes_written;
+    // What the written blocks would have taken uncompressed
+    std::atomic<uint64_t> raw_bytes_written;
+    std::atomic<uint64_t> samples_written;
+    std::atomic<uint64_t> samples_dropped;
+    std::atomic<uint64_t> checkpoints;
+    std::atomic<int> failed;
+} capture_writer;
+
+// Writer thread only, goes to the file once the buffer is full
+bool capture_buffer(capture_writer *writer, const void *data, int64_t size) {
+    if(writer->buffered + size > CAPTURE_WRITE_BUFFER_SIZE) {
+        if(!platform_file_write(&writer->file, writer->buffer, writer->buffered)) {
+            return false;
+        }
+        writer->bytes_written.fetch_add(writer->buffered, std::memory_order_relaxed);
+        writer->buffered = 0;
+    }
+    if(size > CAPTURE_WRITE_BUFFER_SIZE) {
+        if(!platform_file_write(&writer->file, data, size)) {
+            return false;
+        }
+        writer->bytes_written.fetch_add(size, std::memory_order_relaxed);
+    } else {
+        memcpy(writer->buffer + writer->buffered, data, size);
+        writer->buffered += size;
+    }
+    writer->offset += size;
+    return true;
+}
+
+uint64_t capture_zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int64_t capture_unzigzag(uint64_t value) {
+    return (int64_t)((value >> 1) ^ (0 - (value & 1)));
+}
+
+// Timestamps become zigzagged deltas of their deltas and values the XOR of their bits with the previous value,
+// so evenly spaced timestamps turn into zeros and slowly changing values mostly into zero high bytes. Both are
+// split into byte planes, byte 0 of every sample, then byte 1 and so on, which puts the zeros next to each other
+// for the LZ stage. planes needs CAPTURE_PLANES_SIZE bytes and out CAPTURE_ENCODED_BOUND.
+// Returns the encoded size, 0 if it didn't fit.
+int capture_encode_block(const int64_t *timestamps_us, const float *values, int count, uint8_t *planes,
+                         uint8_t *out, int capacity) {
+    int64_t previous = 0;
+    int64_t previous_delta = 0;
+    for(int i = 0; i < count; i++) {
+        int64_t delta = (int64_t)((uint64_t)timestamps_us[i] - (uint64_t)previous);
+        uint64_t encoded = capture_zigzag((int64_t)((uint64_t)delta - (uint64_t)previous_delta));
+        previous = timestamps_us[i];
+        previous_delta = i ? delta : 0;
+        for(int byte = 0; byte < 8; byte++) {
+            planes[byte * count + i] = (uint8_t)(encoded >> (byte * 8));
+        }
+    }
+    uint8_t *value_planes = planes + 8 * count;
+    uint32_t previous_bits = 0;
+    for(int i = 0; i < count; i++) {
+        uint32_t bits;
+        memcpy(&bits, &values[i], sizeof(bits));
+        uint32_t encoded = bits ^ previous_bits;
+        previous_bits = bits;
+        for(int byte = 0; byte < 4; byte++) {
+            value_planes[byte * count + i] = (uint8_t)(encoded >> (byte * 8));
+        }
+    }
+    return lz_compress(planes, count * (int)(sizeof(int64_t) + sizeof(float)), out, capacity);
+}
+
+// Undoes capture_encode_block, planes needs CAPTURE_PLANES_SIZE bytes
+bool capture_decode_block(const uint8_t *data, int size, int count, int64_t *timestamps_us, float *values,
+                          uint8_t *planes) {
+    int planes_size = count * (int)(sizeof(int64_t) + sizeof(float));
+    if(count > CAPTURE_BLOCK_SAMPLES || lz_decompress(data, size, planes, planes_size) != planes_size) {
+        return false;
+    }
+    uint64_t previous = 0;
+    uint64_t previous_delta = 0;
+    for(int i = 0; i < count; i++) {
+        uint64_t encoded = 0;
+        for(int byte = 0; byte < 8; byte++) {
+            encoded |= (uint64_t)planes[byte * count + i] << (byte * 8);
+        }
+        uint64_t delta = (uint64_t)capture_unzigzag(encoded) + previous_delta;
+        previous += delta;
+        previous_delta = i ? delta : 0;
+        timestamps_us[i] = (int64_t)previous;
+    }
+    const uint8_t *value_planes = planes + 8 * count;
+    uint32_t previous_bits = 0;
+    for(int i = 0; i < count; i++) {
+        uint32_t encoded = (uint32_t)value_planes[i] | (uint32_t)value_planes[count + i] << 8 |
+                           (uint32_t)value_planes[2 * count + i] << 16 | (uint32_t)value_planes[3 * count + i] << 24;
+        previous_bits ^= encoded;
+        memcpy(&values[i], &previous_bits, sizeof(float));
+    }
+    return true;
+}
+
+// Samples of a block record of either encoding, planes as for capture_decode_block
+bool capture_decode_record(const capture_block_header *header, int64_t *timestamps_us, float *values,
+                           uint8_t *planes) {
+    int count = header->sample_count;
+    if(count > CAPTURE_BLOCK_SAMPLES) {
+        return false;
+    }
+    const uint8_t *data = (const uint8_t *)(header + 1);
+    if(header->encoding == capture_encoding_raw) {
+        memcpy(timestamps_us, data, count * sizeof(int64_t));
+        memcpy(values, data + count * sizeof(int64_t), count * sizeof(float));
+        return true;
+    }
+    return header->encoding == capture_encoding_delta_lz &&
+           capture_decode_block(data, header->size - header->padding, count, timestamps_us, values, planes);
+}
+
+// Blocks that don't get smaller stay raw
+void capture_encode(capture_block *block, uint8_t *planes) {
+    int count = block->header.sample_count;
+    int raw_size = count * (int)(sizeof(int64_t) + sizeof(float));
+    int size = capture_encode_block(block->timestamps_us, block->values, count, planes, block->encoded_data,
+                                    sizeof(block->encoded_data));
+    block->encoded_size = size > 0 && size < raw_size ? size : 0;
+}
+
+bool capture_write_block(capture_writer *writer, capture_block *block) {
+    capture_block_header *header = &block->header;
+    int count = header->sample_count;
+    header->magic = CAPTURE_BLOCK_MAGIC;
+    header->encoding = block->encoded_size ? capture_encoding_delta_lz : capture_encoding_raw;
+    int64_t raw_size = count * (sizeof(int64_t) + sizeof(float));
+    int64_t data_size = block->encoded_size ? block->encoded_size : raw_size;
+    header->size = (uint32_t)((data_size + 7) & ~7LL);
+    header->padding = (uint8_t)(header->size - data_size);
+    memset(header->reserved, 0, sizeof(header->reserved));
+    header->first_timestamp_us = block->timestamps_us[0];
+    header->last_timestamp_us = block->timestamps_us[count - 1];
+    float min = block->values[0];
+    float max = block->values[0];
+    for(int i = 1; i < count; i++) {
+        min = block->values[i] < min ? block->values[i] : min;
+        max = block->values[i] > max ? block->values[i] : max;
+    }
+    header->min_value = min;
+    header->max_value = max;
+    header->first_value = block->values[0];
+    header->last_value = block->values[count - 1];
+
+    if(writer->index_count == writer->index_capacity) {
+        int64_t capacity = writer->index_capacity ? writer->index_capacity * 2 : 1024;
+        capture_index_entry *index = (capture_index_entry *)realloc(writer->index,
+                                                                    capacity * sizeof(capture_index_entry));
+        if(!index) {
+            return false;
+        }
+        writer->index = index;
+        writer->index_capacity = capacity;
+    }
+    capture_index_entry *entry = &writer->index[writer->index_count];
+    entry->channel_id = header->channel_id;
+    entry->sample_count = count;
+    entry->size = sizeof(capture_block_header) + header->size;
+    entry->encoding = header->encoding;
+    entry->first_timestamp_us = header->first_timestamp_us;
+    entry->last_timestamp_us = header->last_timestamp_us;
+    entry->min_value = header->min_value;
+    entry->max_value = header->max_value;
+    entry->first_value = header->first_value;
+    entry->last_value = header->last_value;
+    entry->offset = writer->offset;
+
+    if(!capture_buffer(writer, header, sizeof(*header))) {
+        return false;
+    }
+    if(block->encoded_size) {
+        if(!capture_buffer(writer, block->encoded_data, block->encoded_size)) {
+            return false;
+        }
+    } else if(!capture_buffer(writer, block->timestamps_us, count * sizeof(int64_t)) ||
+              !capture_buffer(writer, block->values, count * sizeof(float))) {
+        return false;
+    }
+    uint64_t padding = 0;
+    if(header->size != data_size && !capture_buffer(writer, &padding, header->size - data_size)) {
+        return false;
+    }
+    writer->index_count++;
+    writer->samples_written.fetch_add(count, std::memory_order_relaxed);
+    writer->raw_bytes_written.fetch_add(sizeof(capture_block_header) + raw_size, std::memory_order_relaxed);
+    return true;
+}
+
+// Writes out the buffer, marks everything so far as complete and syncs
+bool capture_checkpoint_now(capture_writer *writer) {
+    capture_checkpoint checkpoint = {};
+    checkpoint.magic = CAPTURE_CHECKPOINT_MAGIC;
+    checkpoint.block_count = writer->index_count;
+    if(!capture_buffer(writer, &checkpoint, sizeof(checkpoint)) ||
+       !platform_file_write(&writer->file, writer->buffer, writer->buffered)) {
+        return false;
+    }
+    writer->bytes_written.fetch_add(writer->buffered, std::memory_order_relaxed);
+    writer->buffered = 0;
+    if(!platform_file_sync(&writer->file)) {
+        return false;
+    }
+    writer->checkpointed_blocks = writer->index_count;
+    writer->checkpoints.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void capture_writer_thread(void *parameters) {
+    capture_writer *writer = (capture_writer *)parameters;
+    uint64_t last_checkpoint_ns = platform_time_ns();
+    bool running = true;
+    while(running) {
+        running = writer->running.load(std::memory_order_acquire) != 0;
+        uint64_t since_checkpoint_ms = (platform_time_ns() - last_checkpoint_ns) / 1000000;
+        int timeout_ms = since_checkpoint_ms < (uint64_t)writer->checkpoint_ms
+                       ? writer->checkpoint_ms - (int)since_checkpoint_ms : 0;
+        if(running) {
+            platform_event_wait(&writer->wake, timeout_ms);
+        }
+
+        // Blocks are written in the order they were queued, up to the first one that isn't encoded yet
+        platform_mutex_lock(&writer->lock);
+        capture_block *blocks = writer->queue_head;
+        capture_block *end = blocks;
+        capture_block *last_ready = NULL;
+        while(end && end->encoded.load(std::memory_order_acquire)) {
+            last_ready = end;
+            end = end->next;
+        }
+        if(last_ready) {
+            last_ready->next = NULL;
+            writer->queue_head = end;
+            writer->queue_tail = end ? writer->queue_tail : NULL;
+        } else {
+            blocks = NULL;
+        }
+        platform_mutex_unlock(&writer->lock);
+
+        // Blocks keep getting recycled after a failure so that ingest doesn't run out of them
+        capture_block *last = NULL;
+        int count = 0;
+        for(capture_block *block = blocks; block; block = block->next) {
+            if(!writer->failed.load(std::memory_order_relaxed) && !capture_write_block(writer, block)) {
+                writer->failed.store(1);
+            }
+            last = block;
+            count++;
+        }
+        if(last) {
+            platform_mutex_lock(&writer->lock);
+            last->next = writer->free_blocks;
+            writer->free_blocks = blocks;
+            platform_mutex_unlock(&writer->lock);
+            writer->queued.fetch_sub(count, std::memory_order_relaxed);
+        }
+
+        if(platform_time_ns() - last_checkpoint_ns >= (uint64_t)writer->checkpoint_ms * 1000000 &&
+           writer->index_count > writer->checkpointed_blocks && !writer->failed.load(std::memory_order_relaxed)) {
+            if(!capture_checkpoint_now(writer)) {
+                writer->failed.store(1);
+            }
+            last_checkpoint_ns = platform_time_ns();
+        }
+    }
+}
+
+void capture_encoder_thread(void *parameters) {
+    capture_writer *writer = (capture_writer *)parameters;
+    uint8_t *planes = (uint8_t *)malloc(CAPTURE_PLANES_SIZE);
+    for(;;) {
+        platform_mutex_lock(&writer->lock);
+        capture_block *block = writer->encode_head;
+        if(block) {
+            writer->encode_head = block->next_to_encode;
+            writer->encode_tail = writer->encode_head ? writer->encode_tail : NULL;
+        }
+        bool more = writer->encode_head != NULL;
+        platform_mutex_unlock(&writer->lock);
+        if(!block) {
+            // Only stops once nothing can be queued any more and the queue is empty
+            if(!writer->encoding.load(std::memory_order_acquire)) {
+                break;
+            }
+            platform_event_wait(&writer->encode_wake, 100);
+            continue;
+        }
+        if(more) {
+            platform_event_signal(&writer->encode_wake);
+        }
+        if(planes) {
+            capture_encode(block, planes);
+        } else {
+            block->encoded_size = 0;
+        }
+        block->encoded.store(1, std::memory_order_release);
+        platform_event_signal(&writer->wake);
+    }
+    free(planes);
+}
+
+// compress starts the encoder threads, one less than there are processors so that ingest keeps one
+bool capture_writer_start(capture_writer *writer, const char *path, const capture_channel *channels,
+                          int channel_count, bool compress) {
+    // Value-initialized in place, the atomics keep it from being assigned
+    new(writer) capture_writer();
+    writer->checkpoint_ms = CAPTURE_DEFAULT_CHECKPOINT_MS;
+    writer->buffer = (char *)malloc(CAPTURE_WRITE_BUFFER_SIZE);
+    if(!writer->buffer || !platform_file_create(&writer->file, path)) {
+        free(writer->buffer);
+        return false;
+    }
+
+    capture_file_header header = {};
+    header.magic = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    header.channel_count = (uint16_t)channel_count;
+    header.created_unix_us = platform_unix_time_us();
+    capture_buffer(writer, &header, sizeof(header));
+    capture_buffer(writer, channels, channel_count * sizeof(capture_channel));
+
+    platform_mutex_init(&writer->lock);
+    platform_event_init(&writer->wake);
+    platform_event_init(&writer->encode_wake);
+    writer->running.store(1);
+    writer->encoding.store(1);
+    int encoder_count = compress ? platform_cpu_count() - 1 : 0;
+    encoder_count = compress && encoder_count < 1 ? 1 : encoder_count;
+    encoder_count = encoder_count < CAPTURE_MAX_ENCODERS ? encoder_count : CAPTURE_MAX_ENCODERS;
+    while(writer->encoder_count < encoder_count &&
+          platform_thread_start(&writer->encoders[writer->encoder_count], capture_encoder_thread, writer)) {
+        writer->encoder_count++;
+    }
+    if((compress && writer->encoder_count == 0) ||
+       !platform_thread_start(&writer->thread, capture_writer_thread, writer)) {
+        writer->encoding.store(0);
+        platform_event_signal(&writer->encode_wake);
+        for(int i = 0; i < writer->encoder_count; i++) {
+            platform_thread_join(&writer->encoders[i]);
+        }
+        platform_event_destroy(&writer->encode_wake);
+        platform_event_destroy(&writer->wake);
+        platform_mutex_destroy(&writer->lock);
+        platform_file_close(&writer->file);
+        free(writer->buffer);
+        return false;
+    }
+    return true;
+}
+
+void capture_submit(capture_writer *writer, capture_block *block) {
+    block->next = NULL;
+    block->next_to_encode = NULL;
+    block->encoded_size = 0;
+    bool encode = writer->encoder_count > 0;
+    block->encoded.store(encode ? 0 : 1, std::memory_order_relaxed);
+    platform_mutex_lock(&writer->lock);
+    if(writer->queue_tail) {
+        writer->queue_tail->next = block;
+    } else {
+        writer->queue_head = block;
+    }
+    writer->queue_tail = block;
+    if(encode) {
+        if(writer->encode_tail) {
+            writer->encode_tail->next_to_encode = block;
+        } else {
+            writer->encode_head = block;
+        }
+        writer->encode_tail = block;
+    }
+    platform_mutex_unlock(&writer->lock);
+    writer->queued.fetch_add(1, std::memory_order_relaxed);
+    platform_event_signal(encode ? &writer->encode_wake : &writer->wake);
+}
+
+capture_block *capture_take_block(capture_writer *writer) {
+    platform_mutex_lock(&writer->lock);
+    capture_block *block = writer->free_blocks;
+    if(block) {
+        writer->free_blocks = block->next;
+    } else if(writer->blocks_allocated < CAPTURE_MAX_BLOCKS) {
+        block = (capture_block *)malloc(sizeof(capture_block));
+        if(block) {
+            new(&block->encoded) std::atomic<int>(0);
+            writer->blocks_allocated++;
+        }
+    }
+    platform_mutex_unlock(&writer->lock);
+    return block;
+}
+
+capture_staging *capture_staging_for(capture_writer *writer, uint32_t channel_id) {
+    if(writer->last_staging && writer->last_staging->channel_id == channel_id) {
+        return writer->last_staging;
+    }
+    capture_staging *staging = NULL;
+    for(int i = 0; i < writer->staging_count; i++) {
+        if(writer->staging[i].channel_id == channel_id) {
+            staging = &writer->staging[i];
+            break;
+        }
+    }
+    if(!staging && writer->staging_count < CAPTURE_MAX_CHANNELS) {
+        staging = &writer->staging[writer->staging_count++];
+        staging->channel_id = channel_id;
+        staging->block = NULL;
+    }
+    writer->last_staging = staging;
+    return staging;
+}
+
+// Called from one thread only, the ingest store thread. Never waits on the disk.
+void capture_writer_append(capture_writer *writer, uint32_t channel_id, const int64_t *timestamps_us,
+                           const float *values, int count) {
+    capture_staging *staging = capture_staging_for(writer, channel_id);
+    if(!staging) {
+        writer->samples_dropped.fetch_add(count, std::memory_order_relaxed);
+        return;
+    }
+    int i = 0;
+    while(i < count) {
+        capture_block *block = staging->block;
+        if(!block) {
+            block = capture_take_block(writer);
+            if(!block) {
+                writer->samples_dropped.fetch_add(count - i, std::memory_order_relaxed);
+                return;
+            }
+            block->header.channel_id = channel_id;
+            block->header.sample_count = 0;
+            staging->block = block;
+        }
+        int used = block->header.sample_count;
+        int run = CAPTURE_BLOCK_SAMPLES - used < count - i ? CAPTURE_BLOCK_SAMPLES - used : count - i;
+        memcpy(block->timestamps_us + used, timestamps_us + i, run * sizeof(int64_t));
+        memcpy(block->values + used, values + i, run * sizeof(float));
+        block->header.sample_count = used + run;
+        i += run;
+        if(block->header.sample_count == CAPTURE_BLOCK_SAMPLES) {
+            staging->block = NULL;
+            capture_submit(writer, block);
+        }
+    }
+}
+
+// Blocks that are queued and not yet written, for callers that want to pace themselves
+int capture_writer_backlog(capture_writer *writer) {
+    return writer->queued.load(std::memory_order_relaxed);
+}
+
+// Call once nothing appends any more. Writes out the partial blocks, the index and the footer.
+// Returns false if anything failed to be written.
+bool capture_writer_stop(capture_writer *writer) {
+    for(int i = 0; i < writer->staging_count; i++) {
+        if(writer->staging[i].block) {
+            capture_submit(writer, writer->staging[i].block);
+            writer->staging[i].block = NULL;
+        }
+    }
+    // The encoders finish the queue before the writer thread's last pass
+    writer->encoding.store(0, std::memory_order_release);
+    for(int i = 0; i < writer->encoder_count; i++) {
+        platform_event_signal(&writer->encode_wake);
+    }
+    for(int i = 0; i < writer->encoder_count; i++) {
+        platform_thread_join(&writer->encoders[i]);
+    }
+    writer->running.store(0, std::memory_order_release);
+    platform_event_signal(&writer->wake);
+    platform_thread_join(&writer->thread);
+
+    bool ok = !writer->failed.load();
+    if(ok) {
+        capture_footer footer = {};
+        footer.magic = CAPTURE_INDEX_MAGIC;
+        footer.block_count = writer->index_count;
+        ok = capture_checkpoint_now(writer);
+        footer.index_offset = writer->offset;
+        ok = ok && capture_buffer(writer, writer->index, writer->index_count * sizeof(capture_index_entry)) &&
+             capture_buffer(writer, &footer, sizeof(footer)) &&
+             platform_file_write(&writer->file, writer->buffer, writer->buffered) &&
+             platform_file_sync(&writer->file);
+        writer->bytes_written.fetch_add(writer->buffered, std::memory_order_relaxed);
+        writer->buffered = 0;
+    }
+    platform_file_close(&writer->file);
+
+    while(writer->free_blocks) {
+        capture_block *next = writer->free_blocks->next;
+        free(writer->free_blocks);
+        writer->free_blocks = next;
+    }
+    platform_event_destroy(&writer->encode_wake);
+    platform_event_destroy(&writer->wake);
+    platform_mutex_destroy(&writer->lock);
+    free(writer->index);
+    free(writer->buffer);
+    return ok;
+}
+
+typedef struct {
+    platform_file file;
+    int64_t file_size;
+    capture_file_header header;
+    capture_channel *channels;
+    capture_index_entry *index;
+    int64_t block_count;
+    // No index at the end, the blocks up to the last checkpoint were found by walking the file
+    bool recovered;
+    // Compressed blocks are read into record and decoded through planes, allocated on first use
+    uint8_t *record;
+    uint8_t *planes;
+} capture_reader;
+
+// Rebuilds the index of a file that wasn't closed properly, keeping what came before the last checkpoint
+bool capture_recover_index(capture_reader *reader, int64_t offset) {
+    int64_t capacity = 0;
+    int64_t count = 0;
+    while(offset + (int64_t)sizeof(uint32_t) <= reader->file_size) {
+        uint32_t magic;
+        if(!platform_file_read(&reader->file, offset, &magic, sizeof(magic))) {
+            break;
+        }
+        if(magic == CAPTURE_CHECKPOINT_MAGIC) {
+            capture_checkpoint checkpoint;
+            if(!platform_file_read(&reader->file, offset, &checkpoint, sizeof(checkpoint)) ||
+               checkpoint.block_count != (uint64_t)count) {
+                break;
+            }
+            reader->block_count = count;
+            offset += sizeof(checkpoint);
+            continue;
+        }
+
+        capture_block_header header;
+        if(magic != CAPTURE_BLOCK_MAGIC || !platform_file_read(&reader->file, offset, &header, sizeof(header)) ||
+           header.sample_count == 0 || header.sample_count > CAPTURE_BLOCK_SAMPLES ||
+           offset + (int64_t)sizeof(header) + header.size > reader->file_size) {
+            break;
+        }
+        if(count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            capture_index_entry *index = (capture_index_entry *)realloc(reader->index,
+                                                                        capacity * sizeof(capture_index_entry));
+            if(!index) {
+                return false;
+            }
+            reader->index = index;
+        }
+        capture_index_entry *entry = &reader->index[count++];
+        entry->channel_id = header.channel_id;
+        entry->sample_count = header.sample_count;
+        entry->size = sizeof(header) + header.size;
+        entry->encoding = header.encoding;
+        entry->first_timestamp_us = header.first_timestamp_us;
+        entry->last_timestamp_us = header.last_timestamp_us;
+        entry->min_value = header.min_value;
+        entry->max_value = header.max_value;
+        entry->first_value = header.first_value;
+        entry->last_value = header.last_value;
+        entry->offset = offset;
+        offset += entry->size;
+    }
+    reader->recovered = true;
+    return true;
+}
+
+bool capture_reader_open(capture_reader *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+    if(!platform_file_open(&reader->file, path)) {
+        return false;
+    }
+    reader->file_size = platform_file_size(&reader->file);
+    capture_file_header *header = &reader->header;
+    if(!platform_file_read(&reader->file, 0, header, sizeof(*header)) || header->magic != CAPTURE_MAGIC ||
+       header->version != CAPTURE_VERSION) {
+        platform_file_close(&reader->file);
+        return false;
+    }
+    int64_t channels_size = header->channel_count * sizeof(capture_channel);
+    reader->channels = (capture_channel *)malloc(channels_size + 1);
+    if(!reader->channels || !platform_file_read(&reader->file, sizeof(*header), reader->channels, channels_size)) {
+        free(reader->channels);
+        platform_file_close(&reader->file);
+        return false;
+    }
+    int64_t data_offset = sizeof(*header) + channels_size;
+
+    capture_footer footer = {};
+    bool has_footer = reader->file_size >= data_offset + (int64_t)sizeof(footer) &&
+                      platform_file_read(&reader->file, reader->file_size - sizeof(footer), &footer, sizeof(footer)) &&
+                      footer.magic == CAPTURE_INDEX_MAGIC &&
+                      footer.index_offset + footer.block_count * sizeof(capture_index_entry) + sizeof(footer) ==
+                      (uint64_t)reader->file_size;
+    if(has_footer) {
+        reader->index = (capture_index_entry *)malloc(footer.block_count * sizeof(capture_index_entry) + 1);
+        has_footer = reader->index && platform_file_read(&reader->file, footer.index_offset, reader->index,
+                                                         footer.block_count * sizeof(capture_index_entry));
+        reader->block_count = footer.block_count;
+    }
+    if(!has_footer && !capture_recover_index(reader, data_offset)) {
+        free(reader->index);
+        free(reader->channels);
+        platform_file_close(&reader->file);
+        return false;
+    }
+    return true;
+}
+
+void capture_reader_close(capture_reader *reader) {
+    free(reader->record);
+    free(reader->planes);
+    free(reader->index);
+    free(reader->channels);
+    platform_file_close(&reader->file);
+}
+
+// Reads a block into arrays of at least CAPTURE_BLOCK_SAMPLES, returns the sample count or -1
+int capture_reader_read_block(capture_reader *reader, int64_t block, int64_t *timestamps_us, float *values) {
+    if(block < 0 || block >= reader->block_count) {
+        return -1;
+    }
+    capture_index_entry *entry = &reader->index[block];
+    int count = entry->sample_count;
+    uint64_t data_offset = entry->offset + sizeof(capture_block_header);
+    if(count > CAPTURE_BLOCK_SAMPLES) {
+        return -1;
+    }
+    if(entry->encoding == capture_encoding_raw) {
+        bool read = platform_file_read(&reader->file, data_offset, timestamps_us, count * sizeof(int64_t)) &&
+                    platform_file_read(&reader->file, data_offset + count * sizeof(int64_t), values,
+                                       count * sizeof(float));
+        return read ? count : -1;
+    }
+    if(!reader->record) {
+        reader->record = (uint8_t *)malloc(sizeof(capture_block_header) + CAPTURE_ENCODED_BOUND + 8);
+        reader->planes = (uint8_t *)malloc(CAPTURE_PLANES_SIZE);
+        if(!reader->record || !reader->planes) {
+            free(reader->record);
+            free(reader->planes);
+            reader->record = NULL;
+            reader->planes = NULL;
+            return -1;
+        }
+    }
+    if(entry->size > sizeof(capture_block_header) + CAPTURE_ENCODED_BOUND + 8 ||
+       !platform_file_read(&reader->file, entry->offset, reader->record, entry->size)) {
+        return -1;
+    }
+    const capture_block_header *header = (const capture_block_header *)reader->record;
+    if(header->sample_count != (uint32_t)count ||
+       !capture_decode_record(header, timestamps_us, values, reader->planes)) {
+        return -1;
+    }
+    return count;
+}
+
+// Schema of a channel, NULL if the header doesn't have one
+capture_channel *capture_reader_channel(capture_reader *reader, uint32_t channel_id) {
+    for(int i = 0; i < reader->header.channel_count; i++) {
+        if(reader->channels[i].channel_id == channel_id) {
+            return &reader->channels[i];
+        }
+    }
+    return NULL;
+}
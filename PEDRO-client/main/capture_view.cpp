@@ -0,0 +1,640 @@
+// Capture viewer.
+// Opens a recording without loading it: the file is mapped, only the index is read, and the pages of a block
+// are faulted in when a view needs its samples. Zoomed out views come from a min/max/mean pyramid kept next
+// to the capture in a sidecar file, which is built on a background thread the first time a capture is opened.
+// What was looked at last stays resident up to the cache budget, the OS gets the rest back. The cache works
+// in aligned regions of the size Linux maps around a page fault, so that whatever a fault pulls in is tracked.
+// Compressed blocks are decoded into a small cache of their own, raw ones are read in place.
+// Everything but the builder thread is for the UI thread only.
+
+#define CAPTURE_PYRAMID_MAGIC 0x52595050 // "PPYR"
+#define CAPTURE_PYRAMID_VERSION 1
+#define CAPTURE_VIEW_DEFAULT_CACHE_BYTES megabytes(256)
+#define CAPTURE_VIEW_MAX_PATH 512
+#define CAPTURE_VIEW_REGION_SIZE kilobytes(64)
+// About two screens worth of samples at the widest view that doesn't use the pyramid
+#define CAPTURE_VIEW_DECODED_BLOCKS 128
+
+#pragma pack(push, 1)
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t channel_count;
+    // Of the capture it was built from, the sidecar is stale if they don't match
+    uint64_t capture_size;
+    uint64_t block_count;
+} capture_pyramid_header;
+
+// Level n of a channel is counts[n] buckets at offsets[n]: int64_t timestamps_us[], then float mins[], maxs[]
+// and means[], padded to 8 bytes. The last bucket of a level can be a partial one.
+typedef struct {
+    uint32_t channel_id;
+    uint32_t level_count;
+    uint64_t offsets[STORE_PYRAMID_LEVELS];
+    uint64_t counts[STORE_PYRAMID_LEVELS];
+} capture_pyramid_channel;
+#pragma pack(pop)
+
+typedef struct {
+    const int64_t *timestamps_us;
+    const float *mins;
+    const float *maxs;
+    const float *means;
+    int64_t count;
+} capture_view_level;
+
+typedef struct {
+    uint32_t channel_id;
+    // Index entries of the channel's blocks, in time order
+    int64_t *blocks;
+    int64_t block_count;
+    uint64_t sample_count;
+    int level_count;
+    capture_view_level levels[STORE_PYRAMID_LEVELS];
+} capture_view_channel;
+
+typedef struct {
+    // -1 when free
+    int64_t region;
+    bool pyramid;
+    bool referenced;
+} capture_cache_slot;
+
+typedef struct {
+    // -1 when free
+    int64_t block;
+    bool referenced;
+    int64_t timestamps_us[CAPTURE_BLOCK_SAMPLES];
+    float values[CAPTURE_BLOCK_SAMPLES];
+} capture_decoded_block;
+
+typedef struct {
+    capture_reader reader;
+    platform_map map;
+    char pyramid_path[CAPTURE_VIEW_MAX_PATH];
+
+    capture_view_channel *channels;
+    int channel_count;
+
+    // Regions of the capture and the sidecar whose pages are resident, replaced with the clock algorithm
+    capture_cache_slot *slots;
+    int slot_count;
+    int clock_hand;
+    int *region_slots;
+    int *pyramid_region_slots;
+    uint64_t regions_paged_in;
+    uint64_t regions_released;
+
+    // Decoded compressed blocks, also replaced with the clock algorithm. Allocated on first use.
+    capture_decoded_block *decoded;
+    int decoded_hand;
+    int *block_slots;
+    uint8_t *planes;
+    uint64_t blocks_decoded;
+
+    // The levels of the channels point into the sidecar once pyramid_ready is set
+    platform_file pyramid_file;
+    platform_map pyramid_map;
+    bool pyramid_mapped;
+    platform_thread builder;
+    bool building;
+    std::atomic<int> pyramid_ready;
+    std::atomic<int> cancel;
+    std::atomic<int64_t> blocks_built;
+} capture_view;
+
+capture_view_channel *capture_view_find_channel(capture_view *view, uint32_t channel_id) {
+    for(int i = 0; i < view->channel_count; i++) {
+        if(view->channels[i].channel_id == channel_id) {
+            return &view->channels[i];
+        }
+    }
+    return NULL;
+}
+
+bool capture_pyramid_write_level(platform_file *file, store_level *level) {
+    // Nothing is ever evicted while building, the ring starts at 0
+    int count = level->count;
+    float mean = level->partial_count ? (float)(level->partial_sum / level->partial_count) : 0.0f;
+    int64_t padding = 0;
+    bool partial = level->partial_count > 0;
+    return platform_file_write(file, level->timestamps_us, count * sizeof(int64_t)) &&
+           (!partial || platform_file_write(file, &level->partial_timestamp_us, sizeof(int64_t))) &&
+           platform_file_write(file, level->mins, count * sizeof(float)) &&
+           (!partial || platform_file_write(file, &level->partial_min, sizeof(float))) &&
+           platform_file_write(file, level->maxs, count * sizeof(float)) &&
+           (!partial || platform_file_write(file, &level->partial_max, sizeof(float))) &&
+           platform_file_write(file, level->means, count * sizeof(float)) &&
+           (!partial || platform_file_write(file, &mean, sizeof(float))) &&
+           platform_file_write(file, &padding, (8 - ((count + partial) * 3 * sizeof(float)) % 8) % 8);
+}
+
+// Writes the pyramids of a scratch store next to the capture, through a temporary file so that a sidecar is
+// either complete or not there
+bool capture_pyramid_write(capture_view *view, sample_store *scratch) {
+    char temporary_path[CAPTURE_VIEW_MAX_PATH + 8];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", view->pyramid_path);
+    platform_file file;
+    if(!platform_file_create(&file, temporary_path)) {
+        return false;
+    }
+
+    int channel_count = scratch->column_count.load();
+    capture_pyramid_header header = {};
+    header.magic = CAPTURE_PYRAMID_MAGIC;
+    header.version = CAPTURE_PYRAMID_VERSION;
+    header.channel_count = (uint16_t)channel_count;
+    header.capture_size = view->reader.file_size;
+    header.block_count = view->reader.block_count;
+    capture_pyramid_channel *table = (capture_pyramid_channel *)calloc(channel_count + 1,
+                                                                       sizeof(capture_pyramid_channel));
+    if(!table) {
+        platform_file_close(&file);
+        return false;
+    }
+    uint64_t offset = sizeof(header) + channel_count * sizeof(capture_pyramid_channel);
+    offset = (offset + 7) & ~7ULL;
+    for(int i = 0; i < channel_count; i++) {
+        store_column *column = scratch->columns[i];
+        table[i].channel_id = column->channel_id;
+        for(int j = 0; j < STORE_PYRAMID_LEVELS; j++) {
+            store_level *level = &column->levels[j];
+            uint64_t count = level->count + (level->partial_count > 0 ? 1 : 0);
+            if(count == 0) {
+                break;
+            }
+            table[i].level_count = j + 1;
+            table[i].offsets[j] = offset;
+            table[i].counts[j] = count;
+            offset += (count * (sizeof(int64_t) + 3 * sizeof(float)) + 7) & ~7ULL;
+        }
+    }
+
+    int64_t padding = 0;
+    int64_t table_end = sizeof(header) + channel_count * sizeof(capture_pyramid_channel);
+    bool ok = platform_file_write(&file, &header, sizeof(header)) &&
+              platform_file_write(&file, table, channel_count * sizeof(capture_pyramid_channel)) &&
+              platform_file_write(&file, &padding, ((table_end + 7) & ~7LL) - table_end);
+    for(int i = 0; i < channel_count && ok; i++) {
+        for(uint32_t j = 0; j < table[i].level_count && ok; j++) {
+            ok = capture_pyramid_write_level(&file, &scratch->columns[i]->levels[j]);
+        }
+    }
+    ok = ok && platform_file_sync(&file);
+    platform_file_close(&file);
+    free(table);
+    remove(view->pyramid_path);
+    return ok && rename(temporary_path, view->pyramid_path) == 0;
+}
+
+// Maps the sidecar and points the channels at it, false if there is none or it doesn't match the capture
+bool capture_view_load_pyramid(capture_view *view) {
+    if(!platform_file_open(&view->pyramid_file, view->pyramid_path)) {
+        return false;
+    }
+    if(!platform_file_map(&view->pyramid_file, &view->pyramid_map)) {
+        platform_file_close(&view->pyramid_file);
+        return false;
+    }
+    const capture_pyramid_header *header = (const capture_pyramid_header *)view->pyramid_map.data;
+    bool valid = view->pyramid_map.size >= (int64_t)sizeof(*header) && header->magic == CAPTURE_PYRAMID_MAGIC &&
+                 header->version == CAPTURE_PYRAMID_VERSION &&
+                 header->capture_size == (uint64_t)view->reader.file_size &&
+                 header->block_count == (uint64_t)view->reader.block_count &&
+                 (int64_t)(sizeof(*header) + header->channel_count * sizeof(capture_pyramid_channel)) <=
+                 view->pyramid_map.size;
+    const capture_pyramid_channel *table = (const capture_pyramid_channel *)(header + 1);
+    for(int i = 0; valid && i < header->channel_count; i++) {
+        capture_view_channel *channel = capture_view_find_channel(view, table[i].channel_id);
+        if(!channel || table[i].level_count > STORE_PYRAMID_LEVELS) {
+            valid = false;
+            break;
+        }
+        for(uint32_t j = 0; j < table[i].level_count; j++) {
+            uint64_t count = table[i].counts[j];
+            uint64_t offset = table[i].offsets[j];
+            uint64_t size = count * (sizeof(int64_t) + 3 * sizeof(float));
+            if(offset % 8 || offset + size > (uint64_t)view->pyramid_map.size) {
+                valid = false;
+                break;
+            }
+            capture_view_level *level = &channel->levels[j];
+            level->timestamps_us = (const int64_t *)(view->pyramid_map.data + offset);
+            level->mins = (const float *)(level->timestamps_us + count);
+            level->maxs = level->mins + count;
+            level->means = level->maxs + count;
+            level->count = count;
+        }
+        channel->level_count = valid ? table[i].level_count : 0;
+    }
+    if(!valid) {
+        for(int i = 0; i < view->channel_count; i++) {
+            view->channels[i].level_count = 0;
+        }
+        platform_unmap(&view->pyramid_map);
+        platform_file_close(&view->pyramid_file);
+        return false;
+    }
+    int64_t region_count = (view->pyramid_map.size + CAPTURE_VIEW_REGION_SIZE - 1) / CAPTURE_VIEW_REGION_SIZE;
+    view->pyramid_region_slots = (int *)malloc(region_count * sizeof(int));
+    if(!view->pyramid_region_slots) {
+        platform_unmap(&view->pyramid_map);
+        platform_file_close(&view->pyramid_file);
+        return false;
+    }
+    for(int64_t i = 0; i < region_count; i++) {
+        view->pyramid_region_slots[i] = -1;
+    }
+    view->pyramid_mapped = true;
+    view->pyramid_ready.store(1, std::memory_order_release);
+    return true;
+}
+
+// Reads the capture once in file order, feeding a scratch store that only keeps the pyramids. Pages are given
+// back behind it so building doesn't pull the whole file into memory.
+void capture_view_build_thread(void *parameters) {
+    capture_view *view = (capture_view *)parameters;
+    sample_store *scratch = (sample_store *)calloc(1, sizeof(sample_store));
+    if(!scratch) {
+        return;
+    }
+    int64_t *decoded_timestamps_us = (int64_t *)malloc(CAPTURE_BLOCK_SAMPLES * sizeof(int64_t));
+    float *decoded_values = (float *)malloc(CAPTURE_BLOCK_SAMPLES * sizeof(float));
+    uint8_t *planes = (uint8_t *)malloc(CAPTURE_PLANES_SIZE);
+    if(!decoded_timestamps_us || !decoded_values || !planes) {
+        free(decoded_timestamps_us);
+        free(decoded_values);
+        free(planes);
+        free(scratch);
+        return;
+    }
+    store_init(scratch, 0, 0);
+    int64_t released = 0;
+    bool decoded = true;
+    for(int64_t block = 0; block < view->reader.block_count && decoded; block++) {
+        if(view->cancel.load(std::memory_order_relaxed)) {
+            break;
+        }
+        capture_index_entry *entry = &view->reader.index[block];
+        const capture_block_header *header = (const capture_block_header *)(view->map.data + entry->offset);
+        const int64_t *timestamps_us = (const int64_t *)(header + 1);
+        const float *values = (const float *)(timestamps_us + entry->sample_count);
+        if(entry->encoding != capture_encoding_raw) {
+            decoded = capture_decode_record(header, decoded_timestamps_us, decoded_values, planes);
+            timestamps_us = decoded_timestamps_us;
+            values = decoded_values;
+        }
+        store_column *column = decoded ? store_column_for(scratch, entry->channel_id) : NULL;
+        if(column) {
+            platform_mutex_lock(&column->lock);
+            store_pyramid_append(scratch, column, timestamps_us, values, entry->sample_count, NULL);
+            platform_mutex_unlock(&column->lock);
+        }
+        // Up to a region behind, a fault maps the rest of its region back in
+        int64_t behind = (int64_t)(entry->offset & ~(CAPTURE_VIEW_REGION_SIZE - 1)) - CAPTURE_VIEW_REGION_SIZE;
+        if(behind - released >= megabytes(4)) {
+            platform_map_release(&view->map, released, behind - released);
+            released = behind;
+        }
+        view->blocks_built.store(block + 1, std::memory_order_relaxed);
+    }
+    platform_map_release(&view->map, released, view->map.size - released);
+    if(decoded && !view->cancel.load() && capture_pyramid_write(view, scratch)) {
+        capture_view_load_pyramid(view);
+    }
+    store_destroy(scratch);
+    free(scratch);
+    free(decoded_timestamps_us);
+    free(decoded_values);
+    free(planes);
+}
+
+// cache_bytes bounds how much of the capture stays resident, 0 for CAPTURE_VIEW_DEFAULT_CACHE_BYTES.
+// Starts building the pyramid sidecar if there is none yet.
+bool capture_view_open(capture_view *view, const char *path, int64_t cache_bytes) {
+    new(view) capture_view();
+    if(!capture_reader_open(&view->reader, path)) {
+        return false;
+    }
+    capture_reader *reader = &view->reader;
+    if(!platform_file_map(&reader->file, &view->map)) {
+        capture_reader_close(reader);
+        return false;
+    }
+
+    // Channels in order of appearance, then their blocks
+    view->channels = (capture_view_channel *)calloc(CAPTURE_MAX_CHANNELS, sizeof(capture_view_channel));
+    int64_t region_count = (view->map.size + CAPTURE_VIEW_REGION_SIZE - 1) / CAPTURE_VIEW_REGION_SIZE;
+    view->region_slots = (int *)malloc(region_count * sizeof(int));
+    cache_bytes = cache_bytes ? cache_bytes : CAPTURE_VIEW_DEFAULT_CACHE_BYTES;
+    view->slot_count = (int)(cache_bytes / CAPTURE_VIEW_REGION_SIZE) + 1;
+    view->slots = (capture_cache_slot *)malloc(view->slot_count * sizeof(capture_cache_slot));
+    view->block_slots = (int *)malloc(reader->block_count * sizeof(int) + 1);
+    bool ok = view->channels && view->region_slots && view->slots && view->block_slots;
+    capture_view_channel *last = NULL;
+    for(int64_t i = 0; i < reader->block_count && ok; i++) {
+        uint32_t channel_id = reader->index[i].channel_id;
+        capture_view_channel *channel = last && last->channel_id == channel_id ? last
+                                      : capture_view_find_channel(view, channel_id);
+        if(!channel && view->channel_count < CAPTURE_MAX_CHANNELS) {
+            channel = &view->channels[view->channel_count++];
+            channel->channel_id = channel_id;
+        }
+        if(channel) {
+            channel->block_count++;
+            channel->sample_count += reader->index[i].sample_count;
+        }
+        last = channel;
+    }
+    for(int i = 0; i < view->channel_count && ok; i++) {
+        view->channels[i].blocks = (int64_t *)malloc(view->channels[i].block_count * sizeof(int64_t));
+        ok = view->channels[i].blocks != NULL;
+        view->channels[i].block_count = 0;
+    }
+    last = NULL;
+    for(int64_t i = 0; i < reader->block_count && ok; i++) {
+        uint32_t channel_id = reader->index[i].channel_id;
+        capture_view_channel *channel = last && last->channel_id == channel_id ? last
+                                      : capture_view_find_channel(view, channel_id);
+        if(channel) {
+            channel->blocks[channel->block_count++] = i;
+        }
+        last = channel;
+    }
+    for(int64_t i = 0; i < region_count && ok; i++) {
+        view->region_slots[i] = -1;
+    }
+    for(int i = 0; i < view->slot_count && ok; i++) {
+        view->slots[i].region = -1;
+        view->slots[i].referenced = false;
+    }
+    for(int64_t i = 0; i < reader->block_count && ok; i++) {
+        view->block_slots[i] = -1;
+    }
+    if(!ok) {
+        for(int i = 0; i < view->channel_count; i++) {
+            free(view->channels[i].blocks);
+        }
+        free(view->channels);
+        free(view->region_slots);
+        free(view->slots);
+        free(view->block_slots);
+        platform_unmap(&view->map);
+        capture_reader_close(reader);
+        return false;
+    }
+
+    snprintf(view->pyramid_path, sizeof(view->pyramid_path), "%s.pyramid", path);
+    if(!capture_view_load_pyramid(view)) {
+        view->building = platform_thread_start(&view->builder, capture_view_build_thread, view);
+    }
+    return true;
+}
+
+void capture_view_close(capture_view *view) {
+    if(view->building) {
+        view->cancel.store(1);
+        platform_thread_join(&view->builder);
+    }
+    if(view->pyramid_mapped) {
+        platform_unmap(&view->pyramid_map);
+        platform_file_close(&view->pyramid_file);
+        free(view->pyramid_region_slots);
+    }
+    for(int i = 0; i < view->channel_count; i++) {
+        free(view->channels[i].blocks);
+    }
+    free(view->channels);
+    free(view->region_slots);
+    free(view->slots);
+    free(view->block_slots);
+    free(view->decoded);
+    free(view->planes);
+    platform_unmap(&view->map);
+    capture_reader_close(&view->reader);
+}
+
+// Marks a region as recently used, releasing the least recently used one if the cache is full
+void capture_view_touch_region(capture_view *view, int64_t region, bool pyramid) {
+    int *region_slots = pyramid ? view->pyramid_region_slots : view->region_slots;
+    int slot = region_slots[region];
+    if(slot >= 0) {
+        view->slots[slot].referenced = true;
+        return;
+    }
+    capture_cache_slot *victim;
+    for(;;) {
+        victim = &view->slots[view->clock_hand];
+        if(victim->region < 0 || !victim->referenced) {
+            break;
+        }
+        victim->referenced = false;
+        view->clock_hand = (view->clock_hand + 1) % view->slot_count;
+    }
+    if(victim->region >= 0) {
+        platform_map *map = victim->pyramid ? &view->pyramid_map : &view->map;
+        platform_map_release(map, victim->region * CAPTURE_VIEW_REGION_SIZE, CAPTURE_VIEW_REGION_SIZE);
+        (victim->pyramid ? view->pyramid_region_slots : view->region_slots)[victim->region] = -1;
+        view->regions_released++;
+    }
+    victim->region = region;
+    victim->pyramid = pyramid;
+    victim->referenced = true;
+    region_slots[region] = view->clock_hand;
+    view->clock_hand = (view->clock_hand + 1) % view->slot_count;
+    view->regions_paged_in++;
+}
+
+// Call before reading anything of the capture or the sidecar through the mappings
+void capture_view_touch(capture_view *view, const void *data, int64_t size) {
+    const char *bytes = (const char *)data;
+    bool pyramid = bytes < view->map.data || bytes >= view->map.data + view->map.size;
+    int64_t offset = bytes - (pyramid ? view->pyramid_map.data : view->map.data);
+    for(int64_t region = offset / CAPTURE_VIEW_REGION_SIZE; region <= (offset + size - 1) / CAPTURE_VIEW_REGION_SIZE;
+        region++) {
+        capture_view_touch_region(view, region, pyramid);
+    }
+}
+
+// Samples of a block, in place in the mapping if it is raw and from the decoded blocks otherwise. They stay valid
+// until the next call. Returns the sample count, -1 if the block can't be decoded.
+int capture_view_samples(capture_view *view, int64_t block, const int64_t **timestamps_us, const float **values) {
+    capture_index_entry *entry = &view->reader.index[block];
+    const capture_block_header *header = (const capture_block_header *)(view->map.data + entry->offset);
+    int count = entry->sample_count;
+    if(entry->encoding == capture_encoding_raw) {
+        capture_view_touch(view, header, entry->size);
+        *timestamps_us = (const int64_t *)(header + 1);
+        *values = (const float *)(*timestamps_us + count);
+        return count;
+    }
+
+    int slot = view->block_slots[block];
+    if(slot < 0) {
+        if(!view->decoded) {
+            view->decoded = (capture_decoded_block *)malloc(CAPTURE_VIEW_DECODED_BLOCKS *
+                                                            sizeof(capture_decoded_block));
+            view->planes = (uint8_t *)malloc(CAPTURE_PLANES_SIZE);
+            if(!view->decoded || !view->planes) {
+                free(view->decoded);
+                free(view->planes);
+                view->decoded = NULL;
+                view->planes = NULL;
+                return -1;
+            }
+            for(int i = 0; i < CAPTURE_VIEW_DECODED_BLOCKS; i++) {
+                view->decoded[i].block = -1;
+                view->decoded[i].referenced = false;
+            }
+        }
+        capture_decoded_block *victim;
+        for(;;) {
+            victim = &view->decoded[view->decoded_hand];
+            if(victim->block < 0 || !victim->referenced) {
+                break;
+            }
+            victim->referenced = false;
+            view->decoded_hand = (view->decoded_hand + 1) % CAPTURE_VIEW_DECODED_BLOCKS;
+        }
+        if(victim->block >= 0) {
+            view->block_slots[victim->block] = -1;
+            victim->block = -1;
+        }
+        capture_view_touch(view, header, entry->size);
+        if(header->sample_count != (uint32_t)count ||
+           !capture_decode_record(header, victim->timestamps_us, victim->values, view->planes)) {
+            return -1;
+        }
+        slot = view->decoded_hand;
+        victim->block = block;
+        view->block_slots[block] = slot;
+        view->decoded_hand = (view->decoded_hand + 1) % CAPTURE_VIEW_DECODED_BLOCKS;
+        view->blocks_decoded++;
+    }
+    capture_decoded_block *decoded = &view->decoded[slot];
+    decoded->referenced = true;
+    *timestamps_us = decoded->timestamps_us;
+    *values = decoded->values;
+    return count;
+}
+
+// First of the channel's blocks that ends at or after timestamp_us
+int64_t capture_view_first_block(capture_view *view, capture_view_channel *channel, int64_t timestamp_us) {
+    int64_t low = 0;
+    int64_t high = channel->block_count;
+    while(low < high) {
+        int64_t middle = (low + high) / 2;
+        if(view->reader.index[channel->blocks[middle]].last_timestamp_us < timestamp_us) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// First sample of a block at or after timestamp_us
+int capture_block_lower_bound(const int64_t *timestamps_us, int count, int64_t timestamp_us) {
+    int low = 0;
+    int high = count;
+    while(low < high) {
+        int middle = (low + high) / 2;
+        if(timestamps_us[middle] < timestamp_us) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+int64_t capture_level_lower_bound(capture_view *view, const capture_view_level *level, int64_t timestamp_us) {
+    int64_t low = 0;
+    int64_t high = level->count;
+    while(low < high) {
+        int64_t middle = (low + high) / 2;
+        capture_view_touch(view, &level->timestamps_us[middle], sizeof(int64_t));
+        if(level->timestamps_us[middle] < timestamp_us) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Same as store_envelope for a capture. Returns the pyramid level that was used, -1 for the samples, or -2 if the
+// view has too many samples to draw them and the pyramid isn't built yet.
+int capture_view_envelope(capture_view *view, uint32_t channel_id, int64_t from_us, int64_t to_us, int pixel_count,
+                          store_envelope_pixel *pixels) {
+    memset(pixels, 0, pixel_count * sizeof(store_envelope_pixel));
+    capture_view_channel *channel = capture_view_find_channel(view, channel_id);
+    if(!channel || to_us <= from_us || pixel_count <= 0) {
+        return -1;
+    }
+    double pixels_per_us = (double)pixel_count / (double)(to_us - from_us);
+    int64_t first_block = capture_view_first_block(view, channel, from_us);
+    int64_t last_block = capture_view_first_block(view, channel, to_us + 1);
+
+    int level_index = -1;
+    if(view->pyramid_ready.load(std::memory_order_acquire) && channel->level_count > 0) {
+        const capture_view_level *base = &channel->levels[0];
+        int64_t buckets = capture_level_lower_bound(view, base, to_us + 1) -
+                          capture_level_lower_bound(view, base, from_us);
+        if(buckets > 2 * pixel_count) {
+            level_index = 0;
+            while(level_index + 1 < channel->level_count && (buckets >> level_index) > 2 * pixel_count) {
+                level_index++;
+            }
+        }
+    } else if((last_block - first_block) * CAPTURE_BLOCK_SAMPLES > 2 * pixel_count * STORE_PYRAMID_BASE) {
+        return -2;
+    }
+
+    if(level_index < 0) {
+        for(int64_t i = first_block; i < channel->block_count; i++) {
+            const int64_t *timestamps_us;
+            const float *values;
+            int count = capture_view_samples(view, channel->blocks[i], &timestamps_us, &values);
+            if(count < 0) {
+                continue;
+            }
+            int first = i == first_block ? capture_block_lower_bound(timestamps_us, count, from_us) : 0;
+            if(!store_envelope_fold(timestamps_us, values, first, count, from_us, to_us, pixels_per_us, pixel_count,
+                                    pixels)) {
+                break;
+            }
+        }
+    } else {
+        const capture_view_level *level = &channel->levels[level_index];
+        // The bucket that started before the view is drawn at its left edge
+        int64_t first = capture_level_lower_bound(view, level, from_us);
+        first = first > 0 ? first - 1 : 0;
+        int64_t count = capture_level_lower_bound(view, level, to_us + 1) - first;
+        if(count > 0) {
+            capture_view_touch(view, &level->timestamps_us[first], count * sizeof(int64_t));
+            capture_view_touch(view, &level->mins[first], count * sizeof(float));
+            capture_view_touch(view, &level->maxs[first], count * sizeof(float));
+            capture_view_touch(view, &level->means[first], count * sizeof(float));
+        }
+        for(int64_t bucket = first; bucket < first + count; bucket++) {
+            int64_t offset_us = level->timestamps_us[bucket] - from_us;
+            int x = offset_us > 0 ? (int)(offset_us * pixels_per_us) : 0;
+            x = x < pixel_count ? x : pixel_count - 1;
+            store_envelope_add(&pixels[x], level->mins[bucket], level->maxs[bucket], level->means[bucket], 1);
+        }
+    }
+    store_envelope_finish(pixels, pixel_count);
+    return level_index;
+}
+
+// First and last timestamp of a channel, false if the capture doesn't have it
+bool capture_view_span(capture_view *view, uint32_t channel_id, int64_t *first_us, int64_t *last_us) {
+    capture_view_channel *channel = capture_view_find_channel(view, channel_id);
+    if(!channel || channel->block_count == 0) {
+        return false;
+    }
+    *first_us = view->reader.index[channel->blocks[0]].first_timestamp_us;
+    *last_us = view->reader.index[channel->blocks[channel->block_count - 1]].last_timestamp_us;
+    return true;
+}
@@ -0,0 +1,176 @@
+// Byte-oriented LZ77 compression, the same sequence layout as LZ4 blocks.
+// A sequence is a token byte, literal length extension bytes, the literals, a 2 byte little-endian match
+// offset and match length extension bytes. The high nibble of the token is the literal length and the low
+// nibble the match length minus LZ_MIN_MATCH, 15 in either means extension bytes follow, each adding up to 255.
+// The last sequence has literals only. Inputs are at most 64 KB so that every offset fits.
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+// Matches don't start in the last LZ_MATCH_LIMIT bytes and the last LZ_LAST_LITERALS bytes are always literals,
+// which lets the decoder copy in 8 byte steps
+#define LZ_MATCH_LIMIT 12
+#define LZ_LAST_LITERALS 5
+#define LZ_MAX_INPUT 65536
+#define lz_bound(size) ((size) + (size) / 255 + 16)
+
+uint32_t lz_read32(const uint8_t *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+uint8_t *lz_write_length(uint8_t *out, int length) {
+    while(length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+// Returns the compressed size, 0 if the input is too big or out_capacity smaller than lz_bound(in_size)
+int lz_compress(const uint8_t *in, int in_size, uint8_t *out, int out_capacity) {
+    if(in_size > LZ_MAX_INPUT || out_capacity < lz_bound(in_size)) {
+        return 0;
+    }
+    int table[1 << LZ_HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    uint8_t *op = out;
+    int anchor = 0;
+    int ip = 0;
+    int misses = 0;
+    int match_limit = in_size - LZ_MATCH_LIMIT;
+    while(ip < match_limit) {
+        uint32_t sequence = lz_read32(in + ip);
+        uint32_t hash = lz_hash(sequence);
+        int reference = table[hash];
+        table[hash] = ip;
+        if(reference < 0 || ip - reference > 65535 || lz_read32(in + reference) != sequence) {
+            // Incompressible stretches are skipped faster the longer they go on
+            ip += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+        int length = LZ_MIN_MATCH;
+        int length_limit = in_size - LZ_LAST_LITERALS - ip;
+        while(length < length_limit && in[reference + length] == in[ip + length]) {
+            length++;
+        }
+
+        int literals = ip - anchor;
+        uint8_t *token = op++;
+        *token = (uint8_t)((literals >= 15 ? 15 : literals) << 4);
+        if(literals >= 15) {
+            op = lz_write_length(op, literals - 15);
+        }
+        memcpy(op, in + anchor, literals);
+        op += literals;
+        int offset = ip - reference;
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        int extra = length - LZ_MIN_MATCH;
+        *token |= (uint8_t)(extra >= 15 ? 15 : extra);
+        if(extra >= 15) {
+            op = lz_write_length(op, extra - 15);
+        }
+
+        ip += length;
+        anchor = ip;
+        if(ip - 2 < match_limit) {
+            table[lz_hash(lz_read32(in + ip - 2))] = ip - 2;
+        }
+    }
+
+    int literals = in_size - anchor;
+    *op++ = (uint8_t)((literals >= 15 ? 15 : literals) << 4);
+    if(literals >= 15) {
+        op = lz_write_length(op, literals - 15);
+    }
+    memcpy(op, in + anchor, literals);
+    op += literals;
+    return (int)(op - out);
+}
+
+// Returns the decompressed size, -1 if the input is malformed or wouldn't fit in out_size
+int lz_decompress(const uint8_t *in, int in_size, uint8_t *out, int out_size) {
+    const uint8_t *ip = in;
+    const uint8_t *in_end = in + in_size;
+    uint8_t *op = out;
+    uint8_t *out_end = out + out_size;
+    while(ip < in_end) {
+        int token = *ip++;
+        int literals = token >> 4;
+        if(literals == 15) {
+            int byte;
+            do {
+                if(ip >= in_end) {
+                    return -1;
+                }
+                byte = *ip++;
+                literals += byte;
+            } while(byte == 255);
+        }
+        if(literals > in_end - ip || literals > out_end - op) {
+            return -1;
+        }
+        if(in_end - ip >= literals + 16 && out_end - op >= literals + 16) {
+            // 16 bytes at a time when there's room to copy past the end
+            for(int i = 0; i < literals; i += 16) {
+                memcpy(op + i, ip + i, 16);
+            }
+        } else {
+            memcpy(op, ip, literals);
+        }
+        ip += literals;
+        op += literals;
+        if(ip == in_end) {
+            break;
+        }
+
+        if(in_end - ip < 2) {
+            return -1;
+        }
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int length = (token & 15) + LZ_MIN_MATCH;
+        if((token & 15) == 15) {
+            int byte;
+            do {
+                if(ip >= in_end) {
+                    return -1;
+                }
+                byte = *ip++;
+                length += byte;
+            } while(byte == 255);
+        }
+        if(offset == 0 || offset > op - out || length > out_end - op) {
+            return -1;
+        }
+
+        const uint8_t *match = op - offset;
+        if(offset == 1) {
+            memset(op, *match, length);
+            op += length;
+        } else if(offset >= 8 && out_end - op >= length + 8) {
+            // 8 bytes at a time, the source is always far enough behind
+            uint8_t *end = op + length;
+            while(op < end) {
+                memcpy(op, match, 8);
+                op += 8;
+                match += 8;
+            }
+            op = end;
+        } else {
+            for(int i = 0; i < length; i++) {
+                op[i] = match[i];
+            }
+            op += length;
+        }
+    }
+    return (int)(op - out);
+}
@@ -0,0 +1,1085 @@
+// Connection manager, owns the I/O thread and every socket of the client.
+// The UI only ever posts commands and reads the published state, so a slow or dead server
+// can't stall a frame. Host names are looked up on a resolver thread of their own, a slow DNS server
+// can't stall the I/O thread and with it every other device.
+
+#define DEFAULT_CONNECT_TIMEOUT_MS 3000
+// Every device is a session of its own on the same I/O thread
+#define CONNECTION_MAX_DEVICES 32
+#define CONNECTION_MAX_ATTEMPTS 8
+#define CONNECTION_MAX_SUBSCRIPTIONS 16
+#define SUBSCRIPTION_MAX_CHANNELS 32
+
+// A connection that hasn't received anything, not even a keepalive echo, for this long is considered lost
+#define KEEPALIVE_INTERVAL_MS 1000
+#define KEEPALIVE_TIMEOUT_MS 3500
+
+// Reconnect delays are picked at random from [0, min(cap, base * 2^attempt)]
+#define RECONNECT_BACKOFF_BASE_MS 100
+#define RECONNECT_BACKOFF_CAP_MS 5000
+// Has to hold at least one full frame
+#define CONNECTION_RECEIVE_BUFFER_SIZE kilobytes(128)
+#define CONNECTION_SEND_BUFFER_SIZE kilobytes(64)
+
+enum connection_state {
+    connection_state_idle = 0,
+    connection_state_resolving,
+    connection_state_connecting,
+    connection_state_connected,
+    connection_state_disconnected,
+    connection_state_failed,
+    connection_state_timed_out,
+    connection_state_cancelled,
+    connection_state_reconnecting
+};
+
+enum connection_command {
+    connection_command_none = 0,
+    connection_command_connect = 1 << 0,
+    connection_command_cancel = 1 << 1,
+    connection_command_quit = 1 << 2,
+    connection_command_subscribe = 1 << 3
+};
+
+typedef struct connection connection;
+
+typedef struct {
+    uint32_t sample_period_us;
+    int channel_count;
+    uint16_t channel_ids[SUBSCRIPTION_MAX_CHANNELS];
+} subscription;
+
+typedef struct {
+    std::atomic<uint32_t> reconnect_count;
+    // From detecting the loss to being connected again
+    std::atomic<uint64_t> last_reconnect_ns;
+    std::atomic<uint64_t> total_reconnect_ns;
+    // Device time between the last sample before the loss and the first one after it.
+    // One sample period when the history ring covered the whole outage.
+    std::atomic<int64_t> last_gap_us;
+
+    std::atomic<uint64_t> requests_completed;
+    std::atomic<uint64_t> request_round_trip_ns;
+    // send() calls, requests queued in the same pass go out in a single write
+    std::atomic<uint64_t> writes;
+
+    // host_us = device_us + clock_offset_us, the smallest offset seen is the one with the least network delay.
+    // INT64_MAX until the first samples are in, starts over on every connect since the device might have rebooted.
+    std::atomic<int64_t> clock_offset_us;
+} connection_metrics;
+
+// One in-flight connect() per resolved address, the first one to succeed wins
+typedef struct {
+    connection *owner;
+    SOCKET socket;
+} connect_attempt;
+
+struct connection {
+    // Device-qualified channel ids are built from this, see device_channel_id
+    int index;
+
+    // Written by the UI under command_lock
+    uint32_t pending_commands;
+    // Framed messages queued by the UI, moved to the send buffer on the I/O thread
+    char *pending_send;
+    int pending_send_length;
+    char host[64];
+    char port[8];
+    int timeout_ms;
+    subscription subscriptions[CONNECTION_MAX_SUBSCRIPTIONS];
+    int subscription_count;
+    request_queue requests;
+    int request_window;
+    // Written by the I/O thread under command_lock, survives reconnects
+    device_schema schema;
+    bool has_schema;
+
+    // Owned by the I/O thread
+    connect_attempt attempts[CONNECTION_MAX_ATTEMPTS];
+    int attempt_count;
+    uint64_t deadline_ns;
+    SOCKET socket;
+    char *receive_buffer;
+    int receive_length;
+    char *send_buffer;
+    int send_length;
+    bool want_write;
+    int subscriptions_sent;
+    request_table in_flight;
+
+    int64_t clock_offset_us;
+    uint64_t last_receive_ns;
+    uint64_t next_keepalive_ns;
+    int64_t last_timestamp_us;
+
+    bool reconnecting;
+    int reconnect_attempt;
+    uint64_t reconnect_at_ns;
+    uint64_t lost_at_ns;
+    int64_t lost_timestamp_us;
+    bool measure_gap;
+    uint32_t random_state;
+    // A host name lookup was handed to the resolver thread
+    bool resolving;
+
+    // Shared with the resolver thread under resolve_lock. A lookup that finishes after its generation moved
+    // on was cancelled or superseded and is thrown away.
+    bool resolve_requested;
+    bool resolve_done;
+    uint32_t resolve_generation;
+    char resolve_host[64];
+    char resolve_port[8];
+    struct addrinfo *resolved;
+    int resolve_error;
+
+    // Published to the UI
+    std::atomic<int> state;
+    std::atomic<int> last_error;
+    connection_metrics metrics;
+};
+
+typedef struct {
+    platform_thread io_thread;
+    net_poller poller;
+
+    platform_thread resolver_thread;
+    platform_mutex resolve_lock;
+    platform_event resolve_wake;
+    bool resolver_quit;
+
+    platform_mutex command_lock;
+    // Only connection_command_quit, everything else is per device
+    uint32_t pending_commands;
+
+    ingest_pipeline *ingest;
+    // Allocated up front so the I/O thread can walk them while the UI adds more
+    connection *devices;
+    std::atomic<int> device_count;
+} connection_manager;
+
+const char *connection_state_name(int state) {
+    switch(state) {
+        case connection_state_idle: return "Idle";
+        case connection_state_resolving: return "Resolving";
+        case connection_state_connecting: return "Connecting";
+        case connection_state_connected: return "Connected";
+        case connection_state_disconnected: return "Disconnected";
+        case connection_state_failed: return "Failed to connect";
+        case connection_state_timed_out: return "Timed out";
+        case connection_state_cancelled: return "Cancelled";
+        case connection_state_reconnecting: return "Reconnecting";
+        default: return "Unknown";
+    }
+}
+
+void connection_close_attempts(connection_manager *manager, connection *conn) {
+    for(int i = 0; i < conn->attempt_count; i++) {
+        if(conn->attempts[i].socket != INVALID_SOCKET) {
+            net_poller_remove(&manager->poller, conn->attempts[i].socket);
+            closesocket(conn->attempts[i].socket);
+            conn->attempts[i].socket = INVALID_SOCKET;
+        }
+    }
+    conn->attempt_count = 0;
+    conn->deadline_ns = 0;
+}
+
+// While reconnecting the UI only sees connection_state_reconnecting until it either works or gets cancelled
+void connection_set_state(connection *conn, int state) {
+    if(conn->reconnecting && state != connection_state_connected) {
+        state = connection_state_reconnecting;
+    }
+    conn->state.store(state, std::memory_order_release);
+}
+
+// A lookup still running is left to finish on the resolver thread, its result is dropped
+void connection_abandon_resolve(connection_manager *manager, connection *conn) {
+    platform_mutex_lock(&manager->resolve_lock);
+    conn->resolve_generation++;
+    conn->resolve_requested = false;
+    if(conn->resolve_done) {
+        freeaddrinfo(conn->resolved);
+        conn->resolved = NULL;
+        conn->resolve_done = false;
+    }
+    platform_mutex_unlock(&manager->resolve_lock);
+    conn->resolving = false;
+}
+
+void connection_close(connection_manager *manager, connection *conn, int state) {
+    connection_close_attempts(manager, conn);
+    if(conn->resolving) {
+        connection_abandon_resolve(manager, conn);
+    }
+    // Replies can't arrive on a new connection, whatever was in flight is lost
+    request_table_fail(&conn->in_flight, request_status_failed, 0, 0);
+    if(conn->socket != INVALID_SOCKET) {
+        net_poller_remove(&manager->poller, conn->socket);
+        closesocket(conn->socket);
+        conn->socket = INVALID_SOCKET;
+    }
+    conn->receive_length = 0;
+    conn->send_length = 0;
+    conn->want_write = false;
+    connection_set_state(conn, state);
+}
+
+uint32_t connection_random(connection *conn) {
+    uint32_t x = conn->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    conn->random_state = x;
+    return x;
+}
+
+void connection_schedule_reconnect(connection *conn) {
+    uint64_t window_ms = RECONNECT_BACKOFF_CAP_MS;
+    if(conn->reconnect_attempt < 16) {
+        window_ms = (uint64_t)RECONNECT_BACKOFF_BASE_MS << conn->reconnect_attempt;
+        window_ms = window_ms < RECONNECT_BACKOFF_CAP_MS ? window_ms : RECONNECT_BACKOFF_CAP_MS;
+    }
+    uint64_t delay_ms = connection_random(conn) % (window_ms + 1);
+    conn->reconnect_attempt++;
+    conn->reconnect_at_ns = platform_time_ns() + delay_ms * 1000000ULL;
+}
+
+// A connect that didn't work out, either reported as such or retried later when reconnecting
+void connection_connect_failed(connection_manager *manager, connection *conn, int state) {
+    connection_close(manager, conn, state);
+    if(conn->reconnecting) {
+        connection_schedule_reconnect(conn);
+    }
+}
+
+// Read/write errors and missed keepalives end up here
+void connection_lost(connection_manager *manager, connection *conn) {
+    if(!conn->reconnecting) {
+        conn->reconnecting = true;
+        conn->reconnect_attempt = 0;
+        conn->lost_at_ns = platform_time_ns();
+        conn->lost_timestamp_us = conn->last_timestamp_us;
+    }
+    connection_close(manager, conn, connection_state_disconnected);
+    connection_schedule_reconnect(conn);
+}
+
+// Starts a non-blocking connect to every resolved address at once, takes the addresses
+void connection_connect_addresses(connection_manager *manager, connection *conn, struct addrinfo *addresses) {
+    connection_set_state(conn, connection_state_connecting);
+
+    for(struct addrinfo *address = addresses; address && conn->attempt_count < CONNECTION_MAX_ATTEMPTS;
+        address = address->ai_next) {
+        SOCKET attempt_socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if(attempt_socket == INVALID_SOCKET) {
+            continue;
+        }
+        if(!net_set_nonblocking(attempt_socket)) {
+            closesocket(attempt_socket);
+            continue;
+        }
+
+        int result = connect(attempt_socket, address->ai_addr, (int)address->ai_addrlen);
+        if(result == SOCKET_ERROR && !net_error_would_block(net_last_error())) {
+            conn->last_error.store(net_last_error(), std::memory_order_relaxed);
+            closesocket(attempt_socket);
+            continue;
+        }
+
+        connect_attempt *attempt = &conn->attempts[conn->attempt_count++];
+        attempt->owner = conn;
+        attempt->socket = attempt_socket;
+        net_poller_add(&manager->poller, attempt_socket, net_event_write, attempt);
+    }
+    freeaddrinfo(addresses);
+
+    if(conn->attempt_count == 0) {
+        connection_connect_failed(manager, conn, connection_state_failed);
+    }
+}
+
+// Numeric addresses are connected to right away, names are handed to the resolver thread and the connect
+// starts once connection_take_resolved picks up the result. The timeout covers the lookup as well.
+void connection_begin_connect(connection_manager *manager, connection *conn, const char *host, const char *port,
+                              int timeout_ms) {
+    connection_close(manager, conn, connection_state_resolving);
+    conn->deadline_ns = platform_time_ns() + (uint64_t)timeout_ms * 1000000ULL;
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    // Never goes to the network, fails on anything but an address
+    hints.ai_flags = AI_NUMERICHOST;
+
+    struct addrinfo *addresses = NULL;
+    if(getaddrinfo(host, port, &hints, &addresses) == 0) {
+        connection_connect_addresses(manager, conn, addresses);
+        return;
+    }
+
+    platform_mutex_lock(&manager->resolve_lock);
+    snprintf(conn->resolve_host, sizeof(conn->resolve_host), "%s", host);
+    snprintf(conn->resolve_port, sizeof(conn->resolve_port), "%s", port);
+    conn->resolve_requested = true;
+    platform_mutex_unlock(&manager->resolve_lock);
+    conn->resolving = true;
+    platform_event_signal(&manager->resolve_wake);
+}
+
+// Connects once the resolver thread is done with the device's lookup
+void connection_take_resolved(connection_manager *manager, connection *conn) {
+    platform_mutex_lock(&manager->resolve_lock);
+    bool done = conn->resolve_done;
+    struct addrinfo *addresses = conn->resolved;
+    int error = conn->resolve_error;
+    conn->resolve_done = false;
+    conn->resolved = NULL;
+    platform_mutex_unlock(&manager->resolve_lock);
+    if(!done) {
+        return;
+    }
+
+    conn->resolving = false;
+    if(error != 0) {
+        conn->last_error.store(error, std::memory_order_relaxed);
+        connection_connect_failed(manager, conn, connection_state_failed);
+        return;
+    }
+    connection_connect_addresses(manager, conn, addresses);
+}
+
+// Looks up host names one at a time. getaddrinfo can't be cancelled, a lookup nobody waits for any more is
+// finished and thrown away.
+void connection_resolver_thread(void *parameters) {
+    connection_manager *manager = (connection_manager *)parameters;
+    while(true) {
+        platform_mutex_lock(&manager->resolve_lock);
+        if(manager->resolver_quit) {
+            platform_mutex_unlock(&manager->resolve_lock);
+            return;
+        }
+        connection *conn = NULL;
+        int device_count = manager->device_count.load(std::memory_order_acquire);
+        for(int i = 0; i < device_count && !conn; i++) {
+            if(manager->devices[i].resolve_requested) {
+                conn = &manager->devices[i];
+            }
+        }
+        if(!conn) {
+            platform_mutex_unlock(&manager->resolve_lock);
+            platform_event_wait(&manager->resolve_wake, -1);
+            continue;
+        }
+        char host[sizeof(conn->resolve_host)];
+        char port[sizeof(conn->resolve_port)];
+        memcpy(host, conn->resolve_host, sizeof(host));
+        memcpy(port, conn->resolve_port, sizeof(port));
+        uint32_t generation = conn->resolve_generation;
+        conn->resolve_requested = false;
+        platform_mutex_unlock(&manager->resolve_lock);
+
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        struct addrinfo *addresses = NULL;
+        int result = getaddrinfo(host, port, &hints, &addresses);
+
+        platform_mutex_lock(&manager->resolve_lock);
+        bool current = generation == conn->resolve_generation;
+        if(current) {
+            conn->resolved = result == 0 ? addresses : NULL;
+            conn->resolve_error = result;
+            conn->resolve_done = true;
+        }
+        platform_mutex_unlock(&manager->resolve_lock);
+        if(!current && result == 0) {
+            freeaddrinfo(addresses);
+        }
+        net_poller_wake(&manager->poller);
+    }
+}
+
+// Appends a frame to what the I/O thread sends next, frames that don't fit are dropped
+bool connection_queue_frame(connection *conn, const tcp_message *message) {
+    int length = message->bytes_to_transmit;
+    if(length <= 0 || conn->send_length + length > CONNECTION_SEND_BUFFER_SIZE) {
+        return false;
+    }
+    memcpy(conn->send_buffer + conn->send_length, message->buffer, length);
+    conn->send_length += length;
+    return true;
+}
+
+void connection_queue_empty(connection *conn, char message_type) {
+    char buffer[sizeof(frame_header)];
+    tcp_message message = {};
+    message.buffer = buffer;
+    message.buffer_length = sizeof(buffer);
+    encode_empty(&message, message_type);
+    connection_queue_frame(conn, &message);
+}
+
+// Sends the subscriptions the device hasn't seen yet
+void connection_send_subscriptions(connection_manager *manager, connection *conn) {
+    char buffer[sizeof(frame_header) + sizeof(uint32_t) + SUBSCRIPTION_MAX_CHANNELS * sizeof(uint16_t)];
+    tcp_message message = {};
+    message.buffer = buffer;
+    message.buffer_length = sizeof(buffer);
+
+    platform_mutex_lock(&manager->command_lock);
+    for(; conn->subscriptions_sent < conn->subscription_count; conn->subscriptions_sent++) {
+        subscription *sub = &conn->subscriptions[conn->subscriptions_sent];
+        encode_subscribe(&message, sub->channel_ids, sub->channel_count, sub->sample_period_us);
+        connection_queue_frame(conn, &message);
+    }
+    platform_mutex_unlock(&manager->command_lock);
+}
+
+// Everything the device has to be told again after a (re)connect, the cached schema stays in use
+// until the device answers the schema request
+void connection_replay(connection_manager *manager, connection *conn) {
+    connection_queue_empty(conn, message_type_schema_request);
+    conn->subscriptions_sent = 0;
+    connection_send_subscriptions(manager, conn);
+
+    if(conn->reconnecting) {
+        uint64_t now = platform_time_ns();
+        uint64_t reconnect_ns = now - conn->lost_at_ns;
+        conn->metrics.reconnect_count.fetch_add(1, std::memory_order_relaxed);
+        conn->metrics.last_reconnect_ns.store(reconnect_ns, std::memory_order_relaxed);
+        conn->metrics.total_reconnect_ns.fetch_add(reconnect_ns, std::memory_order_relaxed);
+
+        // Fill the gap from the device's history ring
+        if(conn->lost_timestamp_us != INT64_MIN) {
+            char buffer[sizeof(frame_header) + sizeof(uint64_t)];
+            tcp_message message = {};
+            message.buffer = buffer;
+            message.buffer_length = sizeof(buffer);
+            encode_history_request(&message, (uint64_t)(conn->lost_timestamp_us + 1));
+            connection_queue_frame(conn, &message);
+            conn->measure_gap = true;
+        }
+        conn->reconnecting = false;
+    }
+}
+
+void connection_on_connected(connection_manager *manager, connection *conn, connect_attempt *winner) {
+    SOCKET connected_socket = winner->socket;
+    net_poller_remove(&manager->poller, connected_socket);
+    winner->socket = INVALID_SOCKET;
+    connection_close_attempts(manager, conn);
+
+    net_set_nodelay(connected_socket);
+    conn->socket = connected_socket;
+    conn->receive_length = 0;
+    conn->send_length = 0;
+    conn->want_write = false;
+    conn->last_receive_ns = platform_time_ns();
+    conn->next_keepalive_ns = conn->last_receive_ns + KEEPALIVE_INTERVAL_MS * 1000000ULL;
+    conn->clock_offset_us = INT64_MAX;
+    conn->metrics.clock_offset_us.store(INT64_MAX, std::memory_order_relaxed);
+    net_poller_add(&manager->poller, connected_socket, net_event_read, conn);
+    connection_replay(manager, conn);
+    connection_set_state(conn, connection_state_connected);
+}
+
+void connection_on_attempt_ready(connection_manager *manager, connect_attempt *attempt, uint32_t events) {
+    connection *conn = attempt->owner;
+    int error = net_socket_error(attempt->socket);
+    if(error == 0 && !(events & net_event_error)) {
+        connection_on_connected(manager, conn, attempt);
+        return;
+    }
+
+    conn->last_error.store(error, std::memory_order_relaxed);
+    net_poller_remove(&manager->poller, attempt->socket);
+    closesocket(attempt->socket);
+    attempt->socket = INVALID_SOCKET;
+
+    bool any_pending = false;
+    for(int i = 0; i < conn->attempt_count; i++) {
+        any_pending |= conn->attempts[i].socket != INVALID_SOCKET;
+    }
+    if(!any_pending) {
+        connection_connect_failed(manager, conn, connection_state_failed);
+    }
+}
+
+void connection_dispatch_frame(connection_manager *manager, connection *conn, const frame_header *header,
+                               const char *payload) {
+    uint64_t round_trip_ns;
+    if(header->sequence != 0 && request_table_complete(&conn->in_flight, header, payload, &round_trip_ns)) {
+        conn->metrics.requests_completed.fetch_add(1, std::memory_order_relaxed);
+        conn->metrics.request_round_trip_ns.fetch_add(round_trip_ns, std::memory_order_relaxed);
+    }
+
+    switch(header->message_type) {
+        case message_type_sample_batch: {
+            sample_range range;
+            ingest_decode_sample_batch(manager->ingest, conn->index, payload, header->payload_length,
+                                       conn->has_schema ? &conn->schema : NULL, &range);
+            if(range.sample_count == 0) {
+                break;
+            }
+            int64_t clock_offset_us = (int64_t)(conn->last_receive_ns / 1000) - range.last_timestamp_us;
+            if(clock_offset_us < conn->clock_offset_us) {
+                conn->clock_offset_us = clock_offset_us;
+                conn->metrics.clock_offset_us.store(clock_offset_us, std::memory_order_relaxed);
+            }
+            if(conn->measure_gap) {
+                conn->measure_gap = false;
+                conn->metrics.last_gap_us.store(range.first_timestamp_us - conn->lost_timestamp_us, 
+                                                std::memory_order_relaxed);
+            }
+            if(range.last_timestamp_us > conn->last_timestamp_us) {
+                conn->last_timestamp_us = range.last_timestamp_us;
+            }
+        } break;
+
+        case message_type_schema: {
+            device_schema schema;
+            if(decode_schema(payload, header->payload_length, &schema)) {
+                platform_mutex_lock(&manager->command_lock);
+                conn->schema = schema;
+                conn->has_schema = true;
+                platform_mutex_unlock(&manager->command_lock);
+            }
+        } break;
+
+        case message_type_keepalive: {
+            // Only there to keep last_receive_ns fresh
+        } break;
+
+        default: {
+            // Not handled yet
+        } break;
+    }
+}
+
+// Cuts the received bytes into frames, a partial frame stays at the start of the buffer
+void connection_process_frames(connection_manager *manager, connection *conn) {
+    int offset = 0;
+    frame_header header;
+    while(frame_peek(conn->receive_buffer + offset, conn->receive_length - offset, &header)) {
+        connection_dispatch_frame(manager, conn, &header, conn->receive_buffer + offset + sizeof(header));
+        offset += sizeof(header) + header.payload_length;
+    }
+    if(offset > 0) {
+        memmove(conn->receive_buffer, conn->receive_buffer + offset, conn->receive_length - offset);
+        conn->receive_length -= offset;
+        ingest_notify(manager->ingest);
+    }
+}
+
+// Reads at most one receive buffer's worth per wakeup, a device that sends faster than it is taken in can't keep
+// the I/O thread from the others. The poller is level-triggered, the rest is picked up on the next pass.
+void connection_on_readable(connection_manager *manager, connection *conn) {
+    int received = 0;
+    while(received < CONNECTION_RECEIVE_BUFFER_SIZE) {
+        int space = CONNECTION_RECEIVE_BUFFER_SIZE - conn->receive_length;
+        int result = recv(conn->socket, conn->receive_buffer + conn->receive_length, space, 0);
+        if(result > 0) {
+            conn->receive_length += result;
+            received += result;
+            conn->last_receive_ns = platform_time_ns();
+            connection_process_frames(manager, conn);
+            continue;
+        }
+        if(result < 0 && net_error_would_block(net_last_error())) {
+            return;
+        }
+        conn->last_error.store(result < 0 ? net_last_error() : 0, std::memory_order_relaxed);
+        connection_lost(manager, conn);
+        return;
+    }
+}
+
+void connection_on_writable(connection_manager *manager, connection *conn) {
+    while(conn->send_length > 0) {
+        int result = send(conn->socket, conn->send_buffer, conn->send_length, 0);
+        conn->metrics.writes.fetch_add(1, std::memory_order_relaxed);
+        if(result > 0) {
+            memmove(conn->send_buffer, conn->send_buffer + result, conn->send_length - result);
+            conn->send_length -= result;
+            continue;
+        }
+        if(result < 0 && net_error_would_block(net_last_error())) {
+            break;
+        }
+        conn->last_error.store(net_last_error(), std::memory_order_relaxed);
+        connection_lost(manager, conn);
+        return;
+    }
+
+    // Only ask for write readiness while there is something left over
+    bool want_write = conn->send_length > 0;
+    if(want_write != conn->want_write) {
+        conn->want_write = want_write;
+        net_poller_modify(&manager->poller, conn->socket, net_event_read | (want_write ? net_event_write : 0), conn);
+    }
+}
+
+// Queued messages wait for a connection, a cancel throws them away
+void connection_take_pending_send(connection_manager *manager, connection *conn) {
+    platform_mutex_lock(&manager->command_lock);
+    int send_space = CONNECTION_SEND_BUFFER_SIZE - conn->send_length;
+    int send_bytes = conn->pending_send_length < send_space ? conn->pending_send_length : send_space;
+    if(send_bytes > 0) {
+        memcpy(conn->send_buffer + conn->send_length, conn->pending_send, send_bytes);
+        conn->send_length += send_bytes;
+        conn->pending_send_length -= send_bytes;
+        memmove(conn->pending_send, conn->pending_send + send_bytes, conn->pending_send_length);
+    }
+    platform_mutex_unlock(&manager->command_lock);
+}
+
+// Moves queued requests into the in-flight window, as many as the window and the send buffer allow
+void connection_send_requests(connection_manager *manager, connection *conn) {
+    uint64_t now = platform_time_ns();
+    platform_mutex_lock(&manager->command_lock);
+    request *entry;
+    while((entry = request_queue_front(&conn->requests)) != NULL && conn->in_flight.in_flight < conn->request_window) {
+        in_flight_request *slot = request_table_next_slot(&conn->in_flight);
+        if(!slot || conn->send_length + entry->length > CONNECTION_SEND_BUFFER_SIZE) {
+            break;
+        }
+        request_table_begin(&conn->in_flight, slot, entry, now);
+        memcpy(conn->send_buffer + conn->send_length, entry->frame, entry->length);
+        conn->send_length += entry->length;
+        request_queue_pop(&conn->requests);
+    }
+    platform_mutex_unlock(&manager->command_lock);
+}
+
+// Requests that never made it out, called on cancel and quit
+void connection_fail_queued_requests(connection_manager *manager, connection *conn) {
+    request_queue failed;
+    platform_mutex_lock(&manager->command_lock);
+    failed = conn->requests;
+    conn->requests.head = 0;
+    conn->requests.count = 0;
+    platform_mutex_unlock(&manager->command_lock);
+
+    // Callbacks run outside the lock, they might queue new requests
+    for(request *entry; (entry = request_queue_front(&failed)) != NULL; request_queue_pop(&failed)) {
+        if(entry->callback) {
+            entry->callback(entry->user_data, request_status_failed, NULL, NULL);
+        }
+    }
+}
+
+// Poller user data is either a connection or one of its connect attempts, both live inside the devices array
+connection *connection_from_user_data(connection_manager *manager, void *user_data) {
+    char *devices = (char *)manager->devices;
+    if((char *)user_data < devices || (char *)user_data >= devices + CONNECTION_MAX_DEVICES * sizeof(connection)) {
+        return NULL;
+    }
+    return &manager->devices[((char *)user_data - devices) / sizeof(connection)];
+}
+
+int connection_timeout_ms(uint64_t now, uint64_t due_ns, int timeout_ms) {
+    if(due_ns == 0) {
+        return timeout_ms;
+    }
+    int due_ms = (now >= due_ns) ? 0 : (int)((due_ns - now) / 1000000ULL) + 1;
+    return (timeout_ms < 0 || due_ms < timeout_ms) ? due_ms : timeout_ms;
+}
+
+// Earliest of the device's timers, the I/O thread sleeps until the first one of all devices is due
+int connection_next_timeout_ms(connection *conn, uint64_t now, int timeout_ms) {
+    timeout_ms = connection_timeout_ms(now, conn->deadline_ns, timeout_ms);
+    if(conn->reconnecting && conn->socket == INVALID_SOCKET && conn->attempt_count == 0) {
+        timeout_ms = connection_timeout_ms(now, conn->reconnect_at_ns, timeout_ms);
+    }
+    if(conn->socket != INVALID_SOCKET) {
+        timeout_ms = connection_timeout_ms(now, conn->next_keepalive_ns, timeout_ms);
+    }
+    if(conn->in_flight.in_flight > 0) {
+        // Coarse, only there to time requests out
+        timeout_ms = (timeout_ms < 0 || timeout_ms > 100) ? 100 : timeout_ms;
+    }
+    return timeout_ms;
+}
+
+// Keepalives are sent on a timer, the device echoes them back
+void connection_check_keepalive(connection *conn, connection_manager *manager, uint64_t now) {
+    if(now - conn->last_receive_ns > KEEPALIVE_TIMEOUT_MS * 1000000ULL) {
+        connection_lost(manager, conn);
+        return;
+    }
+    if(now >= conn->next_keepalive_ns) {
+        connection_queue_empty(conn, message_type_keepalive);
+        conn->next_keepalive_ns = now + KEEPALIVE_INTERVAL_MS * 1000000ULL;
+    }
+}
+
+// The address is copied under the lock, the UI might be changing it
+void connection_start_connect(connection_manager *manager, connection *conn) {
+    char host[sizeof(conn->host)];
+    char port[sizeof(conn->port)];
+    platform_mutex_lock(&manager->command_lock);
+    int timeout_ms = conn->timeout_ms;
+    memcpy(host, conn->host, sizeof(host));
+    memcpy(port, conn->port, sizeof(port));
+    platform_mutex_unlock(&manager->command_lock);
+    connection_begin_connect(manager, conn, host, port, timeout_ms);
+}
+
+// Returns true if the device's sockets were closed or replaced, events gathered before that are stale
+bool connection_handle_commands(connection_manager *manager, connection *conn, uint32_t commands) {
+    if(commands & connection_command_cancel) {
+        conn->reconnecting = false;
+        connection_close(manager, conn, connection_state_cancelled);
+        connection_fail_queued_requests(manager, conn);
+    }
+    if(commands & connection_command_connect) {
+        conn->reconnecting = false;
+        conn->measure_gap = false;
+        conn->last_timestamp_us = INT64_MIN;
+        connection_start_connect(manager, conn);
+    }
+    return (commands & (connection_command_cancel | connection_command_connect)) != 0;
+}
+
+// Timers and everything the UI queued, once per pass after the socket events
+void connection_service(connection_manager *manager, connection *conn, uint32_t commands, uint64_t now) {
+    if(conn->deadline_ns && now >= conn->deadline_ns) {
+        connection_connect_failed(manager, conn, connection_state_timed_out);
+    }
+    if(conn->resolving) {
+        connection_take_resolved(manager, conn);
+    }
+    if(conn->reconnecting && conn->socket == INVALID_SOCKET && conn->attempt_count == 0 && 
+       now >= conn->reconnect_at_ns) {
+        connection_start_connect(manager, conn);
+    }
+
+    if(conn->socket != INVALID_SOCKET) {
+        if(commands & connection_command_subscribe) {
+            connection_send_subscriptions(manager, conn);
+        }
+        connection_check_keepalive(conn, manager, now);
+        request_table_fail(&conn->in_flight, request_status_timed_out, now, REQUEST_TIMEOUT_MS * 1000000ULL);
+    }
+    if(conn->socket != INVALID_SOCKET) {
+        // Everything queued since the last pass ends up in the send buffer and goes out in one write
+        connection_take_pending_send(manager, conn);
+        connection_send_requests(manager, conn);
+        if(conn->send_length > 0) {
+            connection_on_writable(manager, conn);
+        }
+    }
+}
+
+void connection_io_thread(void *parameters) {
+    connection_manager *manager = (connection_manager *)parameters;
+    net_poll_event events[NET_POLL_MAX_SOCKETS];
+    uint32_t commands[CONNECTION_MAX_DEVICES];
+    bool stale[CONNECTION_MAX_DEVICES];
+
+    while(true) {
+        // Devices added after this are picked up on the next pass
+        int device_count = manager->device_count.load(std::memory_order_acquire);
+        uint64_t now = platform_time_ns();
+        int timeout_ms = -1;
+        for(int i = 0; i < device_count; i++) {
+            timeout_ms = connection_next_timeout_ms(&manager->devices[i], now, timeout_ms);
+        }
+
+        int event_count = net_poller_wait(&manager->poller, events, array_count(events), timeout_ms);
+
+        platform_mutex_lock(&manager->command_lock);
+        bool quit = (manager->pending_commands & connection_command_quit) != 0;
+        for(int i = 0; i < device_count; i++) {
+            connection *conn = &manager->devices[i];
+            commands[i] = conn->pending_commands;
+            conn->pending_commands = connection_command_none;
+            if(commands[i] & connection_command_connect) {
+                // A different device might be on the other end this time
+                conn->has_schema = false;
+            }
+        }
+        platform_mutex_unlock(&manager->command_lock);
+
+        if(quit) {
+            for(int i = 0; i < device_count; i++) {
+                connection *conn = &manager->devices[i];
+                conn->reconnecting = false;
+                connection_close(manager, conn, connection_state_idle);
+                connection_fail_queued_requests(manager, conn);
+            }
+            break;
+        }
+        for(int i = 0; i < device_count; i++) {
+            stale[i] = connection_handle_commands(manager, &manager->devices[i], commands[i]);
+        }
+
+        for(int i = 0; i < event_count; i++) {
+            void *user_data = events[i].user_data;
+            connection *conn = connection_from_user_data(manager, user_data);
+            if(!conn || conn->index >= device_count || stale[conn->index]) {
+                continue;
+            }
+            if(user_data == conn) {
+                if(conn->socket != INVALID_SOCKET && (events[i].events & (net_event_read | net_event_error))) {
+                    connection_on_readable(manager, conn);
+                }
+            } else {
+                connect_attempt *attempt = (connect_attempt *)user_data;
+                if(attempt->socket != INVALID_SOCKET) {
+                    connection_on_attempt_ready(manager, attempt, events[i].events);
+                }
+            }
+        }
+
+        now = platform_time_ns();
+        for(int i = 0; i < device_count; i++) {
+            connection_service(manager, &manager->devices[i], commands[i], now);
+        }
+    }
+}
+
+// Waits for a lookup that is still running, it can't be cancelled
+void connection_resolver_stop(connection_manager *manager) {
+    platform_mutex_lock(&manager->resolve_lock);
+    manager->resolver_quit = true;
+    platform_mutex_unlock(&manager->resolve_lock);
+    platform_event_signal(&manager->resolve_wake);
+    platform_thread_join(&manager->resolver_thread);
+    platform_event_destroy(&manager->resolve_wake);
+    platform_mutex_destroy(&manager->resolve_lock);
+}
+
+bool connection_manager_start(connection_manager *manager, ingest_pipeline *ingest) {
+    manager->ingest = ingest;
+    manager->pending_commands = connection_command_none;
+    manager->device_count.store(0);
+    manager->devices = (connection *)calloc(CONNECTION_MAX_DEVICES, sizeof(connection));
+    if(!manager->devices) {
+        return false;
+    }
+
+    if(!net_poller_init(&manager->poller)) {
+        free(manager->devices);
+        return false;
+    }
+    platform_mutex_init(&manager->command_lock);
+    platform_mutex_init(&manager->resolve_lock);
+    platform_event_init(&manager->resolve_wake);
+    manager->resolver_quit = false;
+    if(!platform_thread_start(&manager->resolver_thread, connection_resolver_thread, manager)) {
+        platform_event_destroy(&manager->resolve_wake);
+        platform_mutex_destroy(&manager->resolve_lock);
+        platform_mutex_destroy(&manager->command_lock);
+        net_poller_destroy(&manager->poller);
+        free(manager->devices);
+        return false;
+    }
+    if(!platform_thread_start(&manager->io_thread, connection_io_thread, manager)) {
+        connection_resolver_stop(manager);
+        platform_mutex_destroy(&manager->command_lock);
+        net_poller_destroy(&manager->poller);
+        free(manager->devices);
+        return false;
+    }
+    return true;
+}
+
+// Adds a device session and returns its index, -1 if there is no room left.
+// Sessions stay around until the manager is stopped, a device that is gone is simply cancelled.
+int connection_manager_add_device(connection_manager *manager) {
+    platform_mutex_lock(&manager->command_lock);
+    int index = manager->device_count.load(std::memory_order_relaxed);
+    if(index == CONNECTION_MAX_DEVICES) {
+        platform_mutex_unlock(&manager->command_lock);
+        return -1;
+    }
+
+    connection *conn = &manager->devices[index];
+    conn->receive_buffer = (char *)malloc(CONNECTION_RECEIVE_BUFFER_SIZE);
+    conn->send_buffer = (char *)malloc(CONNECTION_SEND_BUFFER_SIZE);
+    conn->pending_send = (char *)malloc(CONNECTION_SEND_BUFFER_SIZE);
+    if(!conn->receive_buffer || !conn->send_buffer || !conn->pending_send) {
+        free(conn->receive_buffer);
+        free(conn->send_buffer);
+        free(conn->pending_send);
+        platform_mutex_unlock(&manager->command_lock);
+        return -1;
+    }
+
+    conn->index = index;
+    conn->pending_commands = connection_command_none;
+    conn->pending_send_length = 0;
+    conn->subscription_count = 0;
+    conn->subscriptions_sent = 0;
+    conn->requests.head = 0;
+    conn->requests.count = 0;
+    conn->request_window = REQUEST_DEFAULT_WINDOW;
+    memset(&conn->in_flight, 0, sizeof(conn->in_flight));
+    conn->has_schema = false;
+    conn->socket = INVALID_SOCKET;
+    conn->attempt_count = 0;
+    conn->deadline_ns = 0;
+    conn->receive_length = 0;
+    conn->send_length = 0;
+    conn->want_write = false;
+    conn->clock_offset_us = INT64_MAX;
+    conn->last_timestamp_us = INT64_MIN;
+    conn->reconnecting = false;
+    conn->measure_gap = false;
+    conn->resolving = false;
+    conn->resolve_requested = false;
+    conn->resolve_done = false;
+    conn->resolve_generation = 0;
+    conn->resolved = NULL;
+    conn->resolve_error = 0;
+    conn->random_state = ((uint32_t)platform_time_ns() + index * 2654435761u) | 1;
+    conn->state.store(connection_state_idle);
+    conn->last_error.store(0);
+    conn->metrics.reconnect_count.store(0);
+    conn->metrics.last_reconnect_ns.store(0);
+    conn->metrics.total_reconnect_ns.store(0);
+    conn->metrics.last_gap_us.store(0);
+    conn->metrics.requests_completed.store(0);
+    conn->metrics.request_round_trip_ns.store(0);
+    conn->metrics.writes.store(0);
+    conn->metrics.clock_offset_us.store(INT64_MAX);
+
+    manager->device_count.store(index + 1, std::memory_order_release);
+    platform_mutex_unlock(&manager->command_lock);
+    return index;
+}
+
+int connection_manager_device_count(connection_manager *manager) {
+    return manager->device_count.load(std::memory_order_acquire);
+}
+
+void connection_manager_post(connection_manager *manager, uint32_t command) {
+    platform_mutex_lock(&manager->command_lock);
+    manager->pending_commands |= command;
+    platform_mutex_unlock(&manager->command_lock);
+    net_poller_wake(&manager->poller);
+}
+
+// Everything below takes a device index returned by connection_manager_add_device
+
+// Returns immediately, progress is reported through connection_manager_state
+void connection_manager_connect(connection_manager *manager, int device, const char *host, const char *port,
+                                int timeout_ms) {
+    connection *conn = &manager->devices[device];
+    platform_mutex_lock(&manager->command_lock);
+    snprintf(conn->host, sizeof(conn->host), "%s", (host && host[0]) ? host : DEFAULT_IP);
+    snprintf(conn->port, sizeof(conn->port), "%s", (port && port[0]) ? port : DEFAULT_PORT);
+    conn->timeout_ms = timeout_ms > 0 ? timeout_ms : DEFAULT_CONNECT_TIMEOUT_MS;
+    // A new connect supersedes a cancel that hasn't been picked up yet
+    conn->pending_commands &= ~connection_command_cancel;
+    conn->pending_commands |= connection_command_connect;
+    platform_mutex_unlock(&manager->command_lock);
+    net_poller_wake(&manager->poller);
+}
+
+// Cancels a connect or reconnect in progress or drops the current connection
+void connection_manager_cancel(connection_manager *manager, int device) {
+    connection *conn = &manager->devices[device];
+    platform_mutex_lock(&manager->command_lock);
+    conn->pending_commands &= ~connection_command_connect;
+    conn->pending_commands |= connection_command_cancel;
+    conn->pending_send_length = 0;
+    platform_mutex_unlock(&manager->command_lock);
+    net_poller_wake(&manager->poller);
+}
+
+// Subscriptions are kept and replayed on every reconnect, returns false if there is no room left
+bool connection_manager_subscribe(connection_manager *manager, int device, const uint16_t *channel_ids,
+                                  int channel_count, uint32_t sample_period_us) {
+    connection *conn = &manager->devices[device];
+    if(channel_count > SUBSCRIPTION_MAX_CHANNELS) {
+        return false;
+    }
+    platform_mutex_lock(&manager->command_lock);
+    bool added = conn->subscription_count < CONNECTION_MAX_SUBSCRIPTIONS;
+    if(added) {
+        subscription *sub = &conn->subscriptions[conn->subscription_count++];
+        sub->sample_period_us = sample_period_us;
+        sub->channel_count = channel_count;
+        memcpy(sub->channel_ids, channel_ids, channel_count * sizeof(uint16_t));
+        conn->pending_commands |= connection_command_subscribe;
+    }
+    platform_mutex_unlock(&manager->command_lock);
+    net_poller_wake(&manager->poller);
+    return added;
+}
+
+// Queues a framed request (see encode_*), the sequence id is filled in when it is sent.
+// callback runs on the I/O thread once the reply is in or the request failed.
+bool connection_manager_request(connection_manager *manager, int device, const tcp_message *message,
+                                request_callback callback, void *user_data) {
+    platform_mutex_lock(&manager->command_lock);
+    bool queued = request_queue_push(&manager->devices[device].requests, message, callback, user_data);
+    platform_mutex_unlock(&manager->command_lock);
+    if(queued) {
+        net_poller_wake(&manager->poller);
+    }
+    return queued;
+}
+
+// How many requests may wait for a reply at once
+void connection_manager_set_window(connection_manager *manager, int device, int window) {
+    window = window < 1 ? 1 : (window > REQUEST_MAX_IN_FLIGHT ? REQUEST_MAX_IN_FLIGHT : window);
+    platform_mutex_lock(&manager->command_lock);
+    manager->devices[device].request_window = window;
+    platform_mutex_unlock(&manager->command_lock);
+    net_poller_wake(&manager->poller);
+}
+
+int connection_manager_state(connection_manager *manager, int device) {
+    return manager->devices[device].state.load(std::memory_order_acquire);
+}
+
+// Copies out the cached schema, returns false if the device hasn't sent one yet
+bool connection_manager_schema(connection_manager *manager, int device, device_schema *schema) {
+    platform_mutex_lock(&manager->command_lock);
+    bool has_schema = manager->devices[device].has_schema;
+    if(has_schema) {
+        *schema = manager->devices[device].schema;
+    }
+    platform_mutex_unlock(&manager->command_lock);
+    return has_schema;
+}
+
+connection_metrics *connection_manager_metrics(connection_manager *manager, int device) {
+    return &manager->devices[device].metrics;
+}
+
+void connection_manager_stop(connection_manager *manager) {
+    connection_manager_post(manager, connection_command_quit);
+    platform_thread_join(&manager->io_thread);
+    // Closing the devices on the way out dropped every lookup result, none can come in after this
+    connection_resolver_stop(manager);
+    platform_mutex_destroy(&manager->command_lock);
+    net_poller_destroy(&manager->poller);
+    for(int i = 0; i < manager->device_count.load(); i++) {
+        free(manager->devices[i].receive_buffer);
+        free(manager->devices[i].send_buffer);
+        free(manager->devices[i].pending_send);
+    }
+    free(manager->devices);
+}
+
+// Queues a complete framed message, returns false if the queue is full
+bool connection_manager_send(connection_manager *manager, int device, const char *data, int length) {
+    connection *conn = &manager->devices[device];
+    platform_mutex_lock(&manager->command_lock);
+    bool queued = conn->pending_send_length + length <= CONNECTION_SEND_BUFFER_SIZE;
+    if(queued) {
+        memcpy(conn->pending_send + conn->pending_send_length, data, length);
+        conn->pending_send_length += length;
+    }
+    platform_mutex_unlock(&manager->command_lock);
+    if(queued) {
+        net_poller_wake(&manager->poller);
+    }
+    return queued;
+}
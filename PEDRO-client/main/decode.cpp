@@ -0,0 +1,366 @@
+// Sample decoding.
+// Turns the values of a sample block into floats in engineering units, raw * scale + offset, and spells out its
+// timestamps, into arrays laid out like the store's column chunks. Every sample format and byte order has a
+// scalar kernel that works everywhere, an SSE2 one, which every x86-64 CPU has, and an AVX2 one. The best set the
+// CPU supports is picked on first use. They all round the same way, so which one ran never shows in the data.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DECODE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define DECODE_TARGET_SSE2
+#define DECODE_TARGET_AVX2
+#else
+#define DECODE_TARGET_SSE2 __attribute__((target("sse2")))
+#define DECODE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef void (*decode_values_proc)(const uint8_t *data, int count, float scale, float offset, float *out);
+typedef void (*decode_timestamps_proc)(uint64_t first_us, uint32_t period_us, int count, int64_t *out);
+
+typedef struct {
+    const char *name;
+    // Indexed by sample_format * 2 + 1 if big-endian
+    decode_values_proc values[8];
+    decode_timestamps_proc timestamps;
+} decode_kernels;
+
+uint16_t decode_swap16(uint16_t value) {
+    return (uint16_t)((value << 8) | (value >> 8));
+}
+
+uint32_t decode_swap32(uint32_t value) {
+    return (value << 24) | ((value << 8) & 0x00FF0000) | ((value >> 8) & 0x0000FF00) | (value >> 24);
+}
+
+void decode_u8_scalar(const uint8_t *data, int count, float scale, float offset, float *out) {
+    for(int i = 0; i < count; i++) {
+        out[i] = (float)data[i] * scale + offset;
+    }
+}
+
+void decode_i16_scalar(const uint8_t *data, int count, float scale, float offset, float *out) {
+    for(int i = 0; i < count; i++) {
+        uint16_t raw;
+        memcpy(&raw, data + i * sizeof(raw), sizeof(raw));
+        out[i] = (float)(int16_t)raw * scale + offset;
+    }
+}
+
+void decode_i16_swapped_scalar(const uint8_t *data, int count, float scale, float offset, float *out) {
+    for(int i = 0; i < count; i++) {
+        uint16_t raw;
+        memcpy(&raw, data + i * sizeof(raw), sizeof(raw));
+        out[i] = (float)(int16_t)decode_swap16(raw) * scale + offset;
+    }
+}
+
+void decode_i32_scalar(const uint8_t *data, int count, float scale, float offset, float *out) {
+    for(int i = 0; i < count; i++) {
+        uint32_t raw;
+        memcpy(&raw, data + i * sizeof(raw), sizeof(raw));
+        out[i] = (float)(int32_t)raw * scale + offset;
+    }
+}
+
+void decode_i32_swapped_scalar(const uint8_t *data, int count, float scale, float offset, float *out) {
+    for(int i = 0; i < count; i++) {
+        uint32_t raw;
+        memcpy(&raw, data + i * sizeof(raw), sizeof(raw));
+        out[i] = (float)(int32_t)decode_swap32(raw) * scale + offset;
+    }
+}
+
+void decode_f32_scalar(const uint8_t *data, int count, float scale, float offset, float *out) {
+    for(int i = 0; i < count; i++) {
+        float raw;
+        memcpy(&raw, data + i * sizeof(raw), sizeof(raw));
+        out[i] = raw * scale + offset;
+    }
+}
+
+void decode_f32_swapped_scalar(const uint8_t *data, int count, float scale, float offset, float *out) {
+    for(int i = 0; i < count; i++) {
+        uint32_t raw;
+        memcpy(&raw, data + i * sizeof(raw), sizeof(raw));
+        raw = decode_swap32(raw);
+        float value;
+        memcpy(&value, &raw, sizeof(value));
+        out[i] = value * scale + offset;
+    }
+}
+
+void decode_timestamps_scalar(uint64_t first_us, uint32_t period_us, int count, int64_t *out) {
+    for(int i = 0; i < count; i++) {
+        out[i] = (int64_t)(first_us + (uint64_t)i * period_us);
+    }
+}
+
+decode_kernels decode_scalar_kernels = {
+    "scalar",
+    {decode_u8_scalar, decode_u8_scalar, decode_i16_scalar, decode_i16_swapped_scalar, decode_i32_scalar,
+     decode_i32_swapped_scalar, decode_f32_scalar, decode_f32_swapped_scalar},
+    decode_timestamps_scalar
+};
+
+#ifdef DECODE_X86
+// Byte order of 32 bit lanes, SSE2 has no byte shuffle so it swaps bytes in 16 bit lanes, then the lanes
+DECODE_TARGET_SSE2 __m128i decode_swap32_sse2(__m128i value) {
+    value = _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+    value = _mm_shufflelo_epi16(value, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_shufflehi_epi16(value, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+DECODE_TARGET_SSE2 void decode_u8_sse2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    __m128 scales = _mm_set1_ps(scale);
+    __m128 offsets = _mm_set1_ps(offset);
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for(; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        __m128i words[4] = {_mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+                            _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)};
+        for(int j = 0; j < 4; j++) {
+            _mm_storeu_ps(out + i + 4 * j, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(words[j]), scales), offsets));
+        }
+    }
+    decode_u8_scalar(data + i, count - i, scale, offset, out + i);
+}
+
+DECODE_TARGET_SSE2 void decode_i16_sse2_any(const uint8_t *data, int count, float scale, float offset, float *out,
+                                            bool swap) {
+    __m128 scales = _mm_set1_ps(scale);
+    __m128 offsets = _mm_set1_ps(offset);
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m128i words = _mm_loadu_si128((const __m128i *)(data + i * sizeof(int16_t)));
+        if(swap) {
+            words = _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8));
+        }
+        // Each word into the top half of a lane, then shifted down with its sign
+        __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16);
+        __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(low), scales), offsets));
+        _mm_storeu_ps(out + i + 4, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(high), scales), offsets));
+    }
+    if(swap) {
+        decode_i16_swapped_scalar(data + i * sizeof(int16_t), count - i, scale, offset, out + i);
+    } else {
+        decode_i16_scalar(data + i * sizeof(int16_t), count - i, scale, offset, out + i);
+    }
+}
+
+DECODE_TARGET_SSE2 void decode_32_sse2_any(const uint8_t *data, int count, float scale, float offset, float *out,
+                                           bool swap, bool is_float) {
+    __m128 scales = _mm_set1_ps(scale);
+    __m128 offsets = _mm_set1_ps(offset);
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i raw = _mm_loadu_si128((const __m128i *)(data + i * sizeof(int32_t)));
+        if(swap) {
+            raw = decode_swap32_sse2(raw);
+        }
+        __m128 values = is_float ? _mm_castsi128_ps(raw) : _mm_cvtepi32_ps(raw);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(values, scales), offsets));
+    }
+    int format = is_float ? sample_format_f32 : sample_format_i32;
+    decode_scalar_kernels.values[format * 2 + swap](data + i * sizeof(int32_t), count - i, scale, offset, out + i);
+}
+
+void decode_i16_sse2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_i16_sse2_any(data, count, scale, offset, out, false);
+}
+
+void decode_i16_swapped_sse2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_i16_sse2_any(data, count, scale, offset, out, true);
+}
+
+void decode_i32_sse2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_32_sse2_any(data, count, scale, offset, out, false, false);
+}
+
+void decode_i32_swapped_sse2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_32_sse2_any(data, count, scale, offset, out, true, false);
+}
+
+void decode_f32_sse2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_32_sse2_any(data, count, scale, offset, out, false, true);
+}
+
+void decode_f32_swapped_sse2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_32_sse2_any(data, count, scale, offset, out, true, true);
+}
+
+DECODE_TARGET_SSE2 void decode_timestamps_sse2(uint64_t first_us, uint32_t period_us, int count, int64_t *out) {
+    uint64_t start[2] = {first_us, first_us + period_us};
+    uint64_t step[2] = {2ULL * period_us, 2ULL * period_us};
+    __m128i timestamps = _mm_loadu_si128((const __m128i *)start);
+    __m128i steps = _mm_loadu_si128((const __m128i *)step);
+    int i = 0;
+    for(; i + 2 <= count; i += 2) {
+        _mm_storeu_si128((__m128i *)(out + i), timestamps);
+        timestamps = _mm_add_epi64(timestamps, steps);
+    }
+    decode_timestamps_scalar(first_us + (uint64_t)i * period_us, period_us, count - i, out + i);
+}
+
+decode_kernels decode_sse2_kernels = {
+    "SSE2",
+    {decode_u8_sse2, decode_u8_sse2, decode_i16_sse2, decode_i16_swapped_sse2, decode_i32_sse2,
+     decode_i32_swapped_sse2, decode_f32_sse2, decode_f32_swapped_sse2},
+    decode_timestamps_sse2
+};
+
+DECODE_TARGET_AVX2 void decode_u8_avx2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    __m256 scales = _mm256_set1_ps(scale);
+    __m256 offsets = _mm256_set1_ps(offset);
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i lanes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(data + i)));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(lanes), scales), offsets));
+    }
+    decode_u8_scalar(data + i, count - i, scale, offset, out + i);
+}
+
+DECODE_TARGET_AVX2 void decode_i16_avx2_any(const uint8_t *data, int count, float scale, float offset, float *out,
+                                            bool swap) {
+    __m256 scales = _mm256_set1_ps(scale);
+    __m256 offsets = _mm256_set1_ps(offset);
+    __m128i swap16 = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m128i words = _mm_loadu_si128((const __m128i *)(data + i * sizeof(int16_t)));
+        if(swap) {
+            words = _mm_shuffle_epi8(words, swap16);
+        }
+        __m256i lanes = _mm256_cvtepi16_epi32(words);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(lanes), scales), offsets));
+    }
+    if(swap) {
+        decode_i16_swapped_scalar(data + i * sizeof(int16_t), count - i, scale, offset, out + i);
+    } else {
+        decode_i16_scalar(data + i * sizeof(int16_t), count - i, scale, offset, out + i);
+    }
+}
+
+DECODE_TARGET_AVX2 void decode_32_avx2_any(const uint8_t *data, int count, float scale, float offset, float *out,
+                                           bool swap, bool is_float) {
+    __m256 scales = _mm256_set1_ps(scale);
+    __m256 offsets = _mm256_set1_ps(offset);
+    __m256i swap32 = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i raw = _mm256_loadu_si256((const __m256i *)(data + i * sizeof(int32_t)));
+        if(swap) {
+            raw = _mm256_shuffle_epi8(raw, swap32);
+        }
+        __m256 values = is_float ? _mm256_castsi256_ps(raw) : _mm256_cvtepi32_ps(raw);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(values, scales), offsets));
+    }
+    int format = is_float ? sample_format_f32 : sample_format_i32;
+    decode_scalar_kernels.values[format * 2 + swap](data + i * sizeof(int32_t), count - i, scale, offset, out + i);
+}
+
+void decode_i16_avx2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_i16_avx2_any(data, count, scale, offset, out, false);
+}
+
+void decode_i16_swapped_avx2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_i16_avx2_any(data, count, scale, offset, out, true);
+}
+
+void decode_i32_avx2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_32_avx2_any(data, count, scale, offset, out, false, false);
+}
+
+void decode_i32_swapped_avx2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_32_avx2_any(data, count, scale, offset, out, true, false);
+}
+
+void decode_f32_avx2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_32_avx2_any(data, count, scale, offset, out, false, true);
+}
+
+void decode_f32_swapped_avx2(const uint8_t *data, int count, float scale, float offset, float *out) {
+    decode_32_avx2_any(data, count, scale, offset, out, true, true);
+}
+
+DECODE_TARGET_AVX2 void decode_timestamps_avx2(uint64_t first_us, uint32_t period_us, int count, int64_t *out) {
+    uint64_t start[4] = {first_us, first_us + period_us, first_us + 2ULL * period_us, first_us + 3ULL * period_us};
+    __m256i timestamps = _mm256_loadu_si256((const __m256i *)start);
+    uint64_t step[4] = {4ULL * period_us, 4ULL * period_us, 4ULL * period_us, 4ULL * period_us};
+    __m256i steps = _mm256_loadu_si256((const __m256i *)step);
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        _mm256_storeu_si256((__m256i *)(out + i), timestamps);
+        timestamps = _mm256_add_epi64(timestamps, steps);
+    }
+    decode_timestamps_scalar(first_us + (uint64_t)i * period_us, period_us, count - i, out + i);
+}
+
+decode_kernels decode_avx2_kernels = {
+    "AVX2",
+    {decode_u8_avx2, decode_u8_avx2, decode_i16_avx2, decode_i16_swapped_avx2, decode_i32_avx2,
+     decode_i32_swapped_avx2, decode_f32_avx2, decode_f32_swapped_avx2},
+    decode_timestamps_avx2
+};
+#endif
+
+// Every kernel set this build has, best last, whether the CPU can run it or not
+decode_kernels *decode_kernel_sets[] = {
+    &decode_scalar_kernels,
+#ifdef DECODE_X86
+    &decode_sse2_kernels,
+    &decode_avx2_kernels,
+#endif
+};
+
+bool decode_kernels_supported(const decode_kernels *kernels) {
+#ifdef DECODE_X86
+    if(kernels == &decode_avx2_kernels) {
+        return platform_cpu_has_avx2();
+    }
+    if(kernels == &decode_sse2_kernels) {
+        return platform_cpu_has_sse2();
+    }
+#endif
+    return true;
+}
+
+const decode_kernels *decode_pick_kernels() {
+    for(int i = (int)array_count(decode_kernel_sets) - 1; i > 0; i--) {
+        if(decode_kernels_supported(decode_kernel_sets[i])) {
+            return decode_kernel_sets[i];
+        }
+    }
+    return &decode_scalar_kernels;
+}
+
+// The best kernels for this CPU, safe to call from any thread
+const decode_kernels *decode_active_kernels() {
+    static const decode_kernels *kernels = decode_pick_kernels();
+    return kernels;
+}
+
+// Writes the timestamps and calibrated values of a block, values holds block->sample_count of its format.
+// Returns false for a format it doesn't know.
+bool decode_sample_block_with(const decode_kernels *kernels, const sample_block_header *block, const char *values,
+                              float scale, float offset, int64_t *timestamps_us, float *out) {
+    if(sample_format_size(block->sample_format) == 0) {
+        return false;
+    }
+    int big_endian = (block->flags & sample_block_flag_big_endian) ? 1 : 0;
+    kernels->values[block->sample_format * 2 + big_endian]((const uint8_t *)values, block->sample_count, scale, offset,
+                                                            out);
+    kernels->timestamps(block->first_timestamp_us, block->sample_period_us, block->sample_count, timestamps_us);
+    return true;
+}
+
+bool decode_sample_block(const sample_block_header *block, const char *values, float scale, float offset,
+                         int64_t *timestamps_us, float *out) {
+    return decode_sample_block_with(decode_active_kernels(), block, values, scale, offset, timestamps_us, out);
+}
@@ -0,0 +1,774 @@
+// Derived channels.
+// A derived channel is an expression over other channels, "(c0 - c1) * 0.5" or "bit(c4, 2) && c0 > 2.1", compiled
+// once to register bytecode and evaluated by the ingest store thread as samples come in. Its samples go into the
+// store next to the ones from the devices, as channel n of device DERIVED_DEVICE, x<n> in expressions.
+// The first channel of an expression sets the timestamps, the others hold their newest value at or before each of
+// them. A derived channel only gets as far as the slowest of its other channels, so a value is never used before
+// the one that was current at the time has arrived. Only samples after the last one evaluated are read, a batch of
+// DERIVED_BATCH at a time.
+// Registers are whole batches and an instruction runs over the whole batch, which is where the SIMD kernels come
+// in, their targets come from decode.cpp. The inputs come first, then constants, then temporaries that are handed
+// out like a stack while compiling, so an expression needs as many as it nests deep.
+//
+// Loosest first:
+//     a || b    a && b    < <= > >= == !=    + -    * /    unary - !
+//     numbers, c<n> (device 0), d<d>c<n>, x<n>, abs(a) sqrt(a) min(a, b) max(a, b) bit(a, n) if(condition, a, b)
+// Comparisons and logic give 1 or 0, anything but 0 is true, NaN included. bit looks at the integer part of a.
+
+#define DERIVED_DEVICE 0xFFFF
+#define DERIVED_MAX_CHANNELS 16
+#define DERIVED_MAX_SOURCE 256
+#define DERIVED_BATCH 256
+#define DERIVED_MAX_INPUTS 8
+#define DERIVED_MAX_CONSTANTS 16
+#define DERIVED_MAX_TEMPORARIES 16
+#define DERIVED_FIRST_CONSTANT DERIVED_MAX_INPUTS
+#define DERIVED_FIRST_TEMPORARY (DERIVED_FIRST_CONSTANT + DERIVED_MAX_CONSTANTS)
+#define DERIVED_REGISTERS (DERIVED_FIRST_TEMPORARY + DERIVED_MAX_TEMPORARIES)
+#define DERIVED_MAX_CODE 64
+
+enum derived_op {
+    derived_op_add = 0,
+    derived_op_subtract = 1,
+    derived_op_multiply = 2,
+    derived_op_divide = 3,
+    derived_op_min = 4,
+    derived_op_max = 5,
+    derived_op_less = 6,
+    derived_op_less_equal = 7,
+    derived_op_greater = 8,
+    derived_op_greater_equal = 9,
+    derived_op_equal = 10,
+    derived_op_not_equal = 11,
+    derived_op_and = 12,
+    derived_op_or = 13,
+    // Of a alone
+    derived_op_negate = 14,
+    derived_op_not = 15,
+    derived_op_abs = 16,
+    derived_op_sqrt = 17,
+    // Bit b of the integer part of a
+    derived_op_bit = 18,
+    // a where c is true, b elsewhere
+    derived_op_select = 19
+};
+
+// Operands that an op doesn't use are the same as a
+typedef struct {
+    uint8_t op;
+    uint8_t dst;
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+} derived_instruction;
+
+typedef struct {
+    derived_instruction code[DERIVED_MAX_CODE];
+    int code_count;
+    // Registers 0 to input_count - 1 hold the inputs
+    uint32_t inputs[DERIVED_MAX_INPUTS];
+    int input_count;
+    float constants[DERIVED_MAX_CONSTANTS];
+    int constant_count;
+    int result;
+} derived_program;
+
+typedef void (*derived_run_proc)(const derived_instruction *instruction, float (*registers)[DERIVED_BATCH],
+                                 int count);
+
+typedef struct {
+    const char *name;
+    derived_run_proc run;
+} derived_kernels;
+
+typedef struct {
+    uint32_t channel_id;
+    bool started;
+    // Newest sample taken so far, its value holds from then on
+    bool has_value;
+    int64_t value_us;
+    float value;
+    // Read ahead from the store
+    int64_t timestamps_us[DERIVED_BATCH];
+    float values[DERIVED_BATCH];
+    int count;
+    int position;
+} derived_input;
+
+typedef struct {
+    char source[DERIVED_MAX_SOURCE];
+    uint32_t output_id;
+    derived_program program;
+    // Input 0 is read straight into its register
+    derived_input inputs[DERIVED_MAX_INPUTS];
+    // Samples of input 0 up to here have been evaluated
+    int64_t done_us;
+    int64_t timestamps_us[DERIVED_BATCH];
+    float registers[DERIVED_REGISTERS][DERIVED_BATCH];
+} derived_channel;
+
+// A batch of a derived channel, valid until the next derived_next
+typedef struct {
+    uint32_t channel_id;
+    const int64_t *timestamps_us;
+    const float *values;
+    int count;
+} derived_output;
+
+typedef struct {
+    // Held by the store thread while it evaluates, and to add or remove a channel
+    platform_mutex lock;
+    derived_channel *channels[DERIVED_MAX_CHANNELS];
+    const derived_kernels *kernels;
+    // Store thread only
+    int next;
+    int64_t timestamps_us[DERIVED_BATCH];
+    float values[DERIVED_BATCH];
+} derived_set;
+
+// Like the SIMD conversion, NaN and whatever doesn't fit comes out as INT32_MIN
+int32_t derived_integer(float value) {
+    return value >= -2147483648.0f && value < 2147483648.0f ? (int32_t)value : INT32_MIN;
+}
+
+float derived_bit(float value, float bit) {
+    return (float)(((uint32_t)derived_integer(value) >> (derived_integer(bit) & 31)) & 1);
+}
+
+// Samples first to count - 1
+void derived_run_range(const derived_instruction *instruction, float (*registers)[DERIVED_BATCH], int first,
+                       int count) {
+    float *out = registers[instruction->dst];
+    const float *a = registers[instruction->a];
+    const float *b = registers[instruction->b];
+    const float *c = registers[instruction->c];
+    int i = first;
+    switch(instruction->op) {
+        case derived_op_add: for(; i < count; i++) out[i] = a[i] + b[i]; break;
+        case derived_op_subtract: for(; i < count; i++) out[i] = a[i] - b[i]; break;
+        case derived_op_multiply: for(; i < count; i++) out[i] = a[i] * b[i]; break;
+        case derived_op_divide: for(; i < count; i++) out[i] = a[i] / b[i]; break;
+        case derived_op_min: for(; i < count; i++) out[i] = a[i] < b[i] ? a[i] : b[i]; break;
+        case derived_op_max: for(; i < count; i++) out[i] = a[i] > b[i] ? a[i] : b[i]; break;
+        case derived_op_less: for(; i < count; i++) out[i] = a[i] < b[i] ? 1.0f : 0.0f; break;
+        case derived_op_less_equal: for(; i < count; i++) out[i] = a[i] <= b[i] ? 1.0f : 0.0f; break;
+        case derived_op_greater: for(; i < count; i++) out[i] = a[i] > b[i] ? 1.0f : 0.0f; break;
+        case derived_op_greater_equal: for(; i < count; i++) out[i] = a[i] >= b[i] ? 1.0f : 0.0f; break;
+        case derived_op_equal: for(; i < count; i++) out[i] = a[i] == b[i] ? 1.0f : 0.0f; break;
+        case derived_op_not_equal: for(; i < count; i++) out[i] = a[i] != b[i] ? 1.0f : 0.0f; break;
+        case derived_op_and: for(; i < count; i++) out[i] = a[i] != 0.0f && b[i] != 0.0f ? 1.0f : 0.0f; break;
+        case derived_op_or: for(; i < count; i++) out[i] = a[i] != 0.0f || b[i] != 0.0f ? 1.0f : 0.0f; break;
+        case derived_op_negate: for(; i < count; i++) out[i] = -a[i]; break;
+        case derived_op_not: for(; i < count; i++) out[i] = a[i] == 0.0f ? 1.0f : 0.0f; break;
+        case derived_op_abs: for(; i < count; i++) out[i] = fabsf(a[i]); break;
+        case derived_op_sqrt: for(; i < count; i++) out[i] = sqrtf(a[i]); break;
+        case derived_op_bit: for(; i < count; i++) out[i] = derived_bit(a[i], b[i]); break;
+        case derived_op_select: for(; i < count; i++) out[i] = c[i] != 0.0f ? a[i] : b[i]; break;
+    }
+}
+
+void derived_run_scalar(const derived_instruction *instruction, float (*registers)[DERIVED_BATCH], int count) {
+    derived_run_range(instruction, registers, 0, count);
+}
+
+derived_kernels derived_scalar_kernels = {"scalar", derived_run_scalar};
+
+#ifdef DECODE_X86
+// bit needs shifts by a different count in every lane, SSE2 doesn't have them
+DECODE_TARGET_SSE2 void derived_run_sse2(const derived_instruction *instruction, float (*registers)[DERIVED_BATCH],
+                                         int count) {
+    int op = instruction->op;
+    if(op == derived_op_bit) {
+        derived_run_range(instruction, registers, 0, count);
+        return;
+    }
+    float *out = registers[instruction->dst];
+    const float *a = registers[instruction->a];
+    const float *b = registers[instruction->b];
+    const float *c = registers[instruction->c];
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 zero = _mm_setzero_ps();
+    __m128 sign = _mm_set1_ps(-0.0f);
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(a + i);
+        __m128 y = _mm_loadu_ps(b + i);
+        __m128 result;
+        switch(op) {
+            case derived_op_add: result = _mm_add_ps(x, y); break;
+            case derived_op_subtract: result = _mm_sub_ps(x, y); break;
+            case derived_op_multiply: result = _mm_mul_ps(x, y); break;
+            case derived_op_divide: result = _mm_div_ps(x, y); break;
+            case derived_op_min: result = _mm_min_ps(x, y); break;
+            case derived_op_max: result = _mm_max_ps(x, y); break;
+            case derived_op_less: result = _mm_and_ps(_mm_cmplt_ps(x, y), one); break;
+            case derived_op_less_equal: result = _mm_and_ps(_mm_cmple_ps(x, y), one); break;
+            case derived_op_greater: result = _mm_and_ps(_mm_cmpgt_ps(x, y), one); break;
+            case derived_op_greater_equal: result = _mm_and_ps(_mm_cmpge_ps(x, y), one); break;
+            case derived_op_equal: result = _mm_and_ps(_mm_cmpeq_ps(x, y), one); break;
+            case derived_op_not_equal: result = _mm_and_ps(_mm_cmpneq_ps(x, y), one); break;
+            case derived_op_and:
+                result = _mm_and_ps(_mm_and_ps(_mm_cmpneq_ps(x, zero), _mm_cmpneq_ps(y, zero)), one);
+                break;
+            case derived_op_or:
+                result = _mm_and_ps(_mm_or_ps(_mm_cmpneq_ps(x, zero), _mm_cmpneq_ps(y, zero)), one);
+                break;
+            case derived_op_negate: result = _mm_xor_ps(x, sign); break;
+            case derived_op_not: result = _mm_and_ps(_mm_cmpeq_ps(x, zero), one); break;
+            case derived_op_abs: result = _mm_andnot_ps(sign, x); break;
+            case derived_op_sqrt: result = _mm_sqrt_ps(x); break;
+            default: {
+                __m128 condition = _mm_cmpneq_ps(_mm_loadu_ps(c + i), zero);
+                result = _mm_or_ps(_mm_and_ps(condition, x), _mm_andnot_ps(condition, y));
+            } break;
+        }
+        _mm_storeu_ps(out + i, result);
+    }
+    derived_run_range(instruction, registers, i, count);
+}
+
+derived_kernels derived_sse2_kernels = {"SSE2", derived_run_sse2};
+
+DECODE_TARGET_AVX2 void derived_run_avx2(const derived_instruction *instruction, float (*registers)[DERIVED_BATCH],
+                                         int count) {
+    int op = instruction->op;
+    float *out = registers[instruction->dst];
+    const float *a = registers[instruction->a];
+    const float *b = registers[instruction->b];
+    const float *c = registers[instruction->c];
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(a + i);
+        __m256 y = _mm256_loadu_ps(b + i);
+        __m256 result;
+        switch(op) {
+            case derived_op_add: result = _mm256_add_ps(x, y); break;
+            case derived_op_subtract: result = _mm256_sub_ps(x, y); break;
+            case derived_op_multiply: result = _mm256_mul_ps(x, y); break;
+            case derived_op_divide: result = _mm256_div_ps(x, y); break;
+            case derived_op_min: result = _mm256_min_ps(x, y); break;
+            case derived_op_max: result = _mm256_max_ps(x, y); break;
+            case derived_op_less: result = _mm256_and_ps(_mm256_cmp_ps(x, y, _CMP_LT_OQ), one); break;
+            case derived_op_less_equal: result = _mm256_and_ps(_mm256_cmp_ps(x, y, _CMP_LE_OQ), one); break;
+            case derived_op_greater: result = _mm256_and_ps(_mm256_cmp_ps(x, y, _CMP_GT_OQ), one); break;
+            case derived_op_greater_equal: result = _mm256_and_ps(_mm256_cmp_ps(x, y, _CMP_GE_OQ), one); break;
+            case derived_op_equal: result = _mm256_and_ps(_mm256_cmp_ps(x, y, _CMP_EQ_OQ), one); break;
+            case derived_op_not_equal: result = _mm256_and_ps(_mm256_cmp_ps(x, y, _CMP_NEQ_UQ), one); break;
+            case derived_op_and:
+                result = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_NEQ_UQ),
+                                                     _mm256_cmp_ps(y, zero, _CMP_NEQ_UQ)), one);
+                break;
+            case derived_op_or:
+                result = _mm256_and_ps(_mm256_or_ps(_mm256_cmp_ps(x, zero, _CMP_NEQ_UQ),
+                                                    _mm256_cmp_ps(y, zero, _CMP_NEQ_UQ)), one);
+                break;
+            case derived_op_negate: result = _mm256_xor_ps(x, sign); break;
+            case derived_op_not: result = _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_EQ_OQ), one); break;
+            case derived_op_abs: result = _mm256_andnot_ps(sign, x); break;
+            case derived_op_sqrt: result = _mm256_sqrt_ps(x); break;
+            case derived_op_bit: {
+                __m256i shift = _mm256_and_si256(_mm256_cvttps_epi32(y), _mm256_set1_epi32(31));
+                __m256i bits = _mm256_srlv_epi32(_mm256_cvttps_epi32(x), shift);
+                result = _mm256_cvtepi32_ps(_mm256_and_si256(bits, _mm256_set1_epi32(1)));
+            } break;
+            default: {
+                __m256 condition = _mm256_cmp_ps(_mm256_loadu_ps(c + i), zero, _CMP_NEQ_UQ);
+                result = _mm256_blendv_ps(y, x, condition);
+            } break;
+        }
+        _mm256_storeu_ps(out + i, result);
+    }
+    derived_run_range(instruction, registers, i, count);
+}
+
+derived_kernels derived_avx2_kernels = {"AVX2", derived_run_avx2};
+#endif
+
+// Every kernel set this build has, best last
+derived_kernels *derived_kernel_sets[] = {
+    &derived_scalar_kernels,
+#ifdef DECODE_X86
+    &derived_sse2_kernels,
+    &derived_avx2_kernels,
+#endif
+};
+
+bool derived_kernels_supported(const derived_kernels *kernels) {
+#ifdef DECODE_X86
+    if(kernels == &derived_avx2_kernels) {
+        return platform_cpu_has_avx2();
+    }
+    if(kernels == &derived_sse2_kernels) {
+        return platform_cpu_has_sse2();
+    }
+#endif
+    return true;
+}
+
+const derived_kernels *derived_pick_kernels() {
+    for(int i = (int)array_count(derived_kernel_sets) - 1; i > 0; i--) {
+        if(derived_kernels_supported(derived_kernel_sets[i])) {
+            return derived_kernel_sets[i];
+        }
+    }
+    return &derived_scalar_kernels;
+}
+
+const derived_kernels *derived_active_kernels() {
+    static const derived_kernels *kernels = derived_pick_kernels();
+    return kernels;
+}
+
+// Runs the program over the first count samples of the registers, the inputs have to be in place
+void derived_execute(const derived_program *program, const derived_kernels *kernels,
+                     float (*registers)[DERIVED_BATCH], int count) {
+    for(int i = 0; i < program->code_count; i++) {
+        kernels->run(&program->code[i], registers, count);
+    }
+}
+
+typedef struct {
+    const char *source;
+    const char *at;
+    derived_program *program;
+    int temporaries;
+    char *error;
+    int error_size;
+} derived_parser;
+
+// Always -1, for returning straight from a parse function. Only the first error is kept.
+int derived_fail(derived_parser *parser, const char *message) {
+    if(parser->error[0] == 0) {
+        snprintf(parser->error, parser->error_size, "%s at column %d", message, (int)(parser->at - parser->source) + 1);
+    }
+    return -1;
+}
+
+bool derived_accept(derived_parser *parser, const char *token) {
+    while(*parser->at == ' ' || *parser->at == '\t') {
+        parser->at++;
+    }
+    size_t length = strlen(token);
+    if(strncmp(parser->at, token, length) != 0) {
+        return false;
+    }
+    parser->at += length;
+    return true;
+}
+
+int derived_constant(derived_parser *parser, float value) {
+    derived_program *program = parser->program;
+    for(int i = 0; i < program->constant_count; i++) {
+        if(program->constants[i] == value) {
+            return DERIVED_FIRST_CONSTANT + i;
+        }
+    }
+    if(program->constant_count == DERIVED_MAX_CONSTANTS) {
+        return derived_fail(parser, "too many constants");
+    }
+    program->constants[program->constant_count] = value;
+    return DERIVED_FIRST_CONSTANT + program->constant_count++;
+}
+
+int derived_input_register(derived_parser *parser, uint32_t channel_id) {
+    derived_program *program = parser->program;
+    for(int i = 0; i < program->input_count; i++) {
+        if(program->inputs[i] == channel_id) {
+            return i;
+        }
+    }
+    if(program->input_count == DERIVED_MAX_INPUTS) {
+        return derived_fail(parser, "too many channels");
+    }
+    program->inputs[program->input_count] = channel_id;
+    return program->input_count++;
+}
+
+// The operands' temporaries are the newest ones, the result takes the place of the first of them. Ops on
+// constants alone are worked out here and become a constant.
+int derived_emit(derived_parser *parser, int op, int a, int b, int c) {
+    if(a < 0 || b < 0 || c < 0) {
+        return -1;
+    }
+    if(a >= DERIVED_FIRST_CONSTANT && a < DERIVED_FIRST_TEMPORARY && b >= DERIVED_FIRST_CONSTANT &&
+       b < DERIVED_FIRST_TEMPORARY && c >= DERIVED_FIRST_CONSTANT && c < DERIVED_FIRST_TEMPORARY) {
+        float operands[4][DERIVED_BATCH];
+        operands[1][0] = parser->program->constants[a - DERIVED_FIRST_CONSTANT];
+        operands[2][0] = parser->program->constants[b - DERIVED_FIRST_CONSTANT];
+        operands[3][0] = parser->program->constants[c - DERIVED_FIRST_CONSTANT];
+        derived_instruction instruction = {(uint8_t)op, 0, 1, 2, 3};
+        derived_run_range(&instruction, operands, 0, 1);
+        return derived_constant(parser, operands[0][0]);
+    }
+    parser->temporaries -= (a >= DERIVED_FIRST_TEMPORARY) + (b >= DERIVED_FIRST_TEMPORARY && b != a) +
+                           (c >= DERIVED_FIRST_TEMPORARY && c != a && c != b);
+    if(parser->temporaries == DERIVED_MAX_TEMPORARIES) {
+        return derived_fail(parser, "expression nests too deep");
+    }
+    if(parser->program->code_count == DERIVED_MAX_CODE) {
+        return derived_fail(parser, "expression too long");
+    }
+    int dst = DERIVED_FIRST_TEMPORARY + parser->temporaries++;
+    derived_instruction *instruction = &parser->program->code[parser->program->code_count++];
+    instruction->op = (uint8_t)op;
+    instruction->dst = (uint8_t)dst;
+    instruction->a = (uint8_t)a;
+    instruction->b = (uint8_t)b;
+    instruction->c = (uint8_t)c;
+    return dst;
+}
+
+int derived_parse_or(derived_parser *parser);
+
+// c<n>, d<d>c<n> or x<n>, false if name is none of them
+bool derived_channel_name(const char *name, uint32_t *channel_id) {
+    char *end;
+    unsigned long device = name[0] == 'x' ? DERIVED_DEVICE : 0;
+    if(name[0] == 'd' && isdigit((unsigned char)name[1])) {
+        device = strtoul(name + 1, &end, 10);
+        if(*end != 'c') {
+            return false;
+        }
+        name = end;
+    }
+    if((name[0] != 'c' && name[0] != 'x') || !isdigit((unsigned char)name[1])) {
+        return false;
+    }
+    unsigned long channel = strtoul(name + 1, &end, 10);
+    if(*end != 0 || device > 0xFFFF || channel > 0xFFFF) {
+        return false;
+    }
+    // Same as device_channel_id
+    *channel_id = ((uint32_t)device << 16) | (uint32_t)channel;
+    return true;
+}
+
+int derived_parse_primary(derived_parser *parser) {
+    if(derived_accept(parser, "(")) {
+        int value = derived_parse_or(parser);
+        if(value >= 0 && !derived_accept(parser, ")")) {
+            return derived_fail(parser, "expected )");
+        }
+        return value;
+    }
+    if(isdigit((unsigned char)*parser->at) || *parser->at == '.') {
+        char *end;
+        double value = strtod(parser->at, &end);
+        if(end == parser->at) {
+            return derived_fail(parser, "expected a number");
+        }
+        parser->at = end;
+        return derived_constant(parser, (float)value);
+    }
+
+    char name[32];
+    int length = 0;
+    while(isalnum((unsigned char)parser->at[length]) || parser->at[length] == '_') {
+        length++;
+    }
+    if(length == 0 || length >= (int)sizeof(name)) {
+        return derived_fail(parser, length ? "name too long" : "expected a value");
+    }
+    memcpy(name, parser->at, length);
+    name[length] = 0;
+    uint32_t channel_id;
+    if(derived_channel_name(name, &channel_id)) {
+        parser->at += length;
+        return derived_input_register(parser, channel_id);
+    }
+
+    static const struct {
+        const char *name;
+        int op;
+        int arguments;
+    } functions[] = {
+        {"abs", derived_op_abs, 1}, {"sqrt", derived_op_sqrt, 1}, {"min", derived_op_min, 2},
+        {"max", derived_op_max, 2}, {"bit", derived_op_bit, 2}, {"if", derived_op_select, 3},
+    };
+    for(int i = 0; i < (int)array_count(functions); i++) {
+        if(strcmp(name, functions[i].name) != 0) {
+            continue;
+        }
+        parser->at += length;
+        if(!derived_accept(parser, "(")) {
+            return derived_fail(parser, "expected (");
+        }
+        int arguments[3];
+        for(int j = 0; j < functions[i].arguments; j++) {
+            if(j > 0 && !derived_accept(parser, ",")) {
+                return derived_fail(parser, "expected ,");
+            }
+            arguments[j] = derived_parse_or(parser);
+            if(arguments[j] < 0) {
+                return -1;
+            }
+        }
+        if(!derived_accept(parser, ")")) {
+            return derived_fail(parser, "expected )");
+        }
+        if(functions[i].arguments == 1) {
+            return derived_emit(parser, functions[i].op, arguments[0], arguments[0], arguments[0]);
+        }
+        if(functions[i].arguments == 2) {
+            return derived_emit(parser, functions[i].op, arguments[0], arguments[1], arguments[0]);
+        }
+        // if(condition, a, b) is select with the condition in c
+        return derived_emit(parser, functions[i].op, arguments[1], arguments[2], arguments[0]);
+    }
+    return derived_fail(parser, "unknown name");
+}
+
+int derived_parse_unary(derived_parser *parser) {
+    if(derived_accept(parser, "-")) {
+        int value = derived_parse_unary(parser);
+        return derived_emit(parser, derived_op_negate, value, value, value);
+    }
+    if(derived_accept(parser, "!")) {
+        int value = derived_parse_unary(parser);
+        return derived_emit(parser, derived_op_not, value, value, value);
+    }
+    return derived_parse_primary(parser);
+}
+
+int derived_parse_product(derived_parser *parser) {
+    int value = derived_parse_unary(parser);
+    while(value >= 0) {
+        int op = derived_accept(parser, "*") ? derived_op_multiply : derived_accept(parser, "/") ? derived_op_divide
+                                                                                               : -1;
+        if(op < 0) {
+            break;
+        }
+        value = derived_emit(parser, op, value, derived_parse_unary(parser), value);
+    }
+    return value;
+}
+
+int derived_parse_sum(derived_parser *parser) {
+    int value = derived_parse_product(parser);
+    while(value >= 0) {
+        int op = derived_accept(parser, "+") ? derived_op_add : derived_accept(parser, "-") ? derived_op_subtract
+                                                                                            : -1;
+        if(op < 0) {
+            break;
+        }
+        value = derived_emit(parser, op, value, derived_parse_product(parser), value);
+    }
+    return value;
+}
+
+int derived_parse_comparison(derived_parser *parser) {
+    static const struct {
+        const char *token;
+        int op;
+    } comparisons[] = {
+        // Longer tokens first, < would take the start of <=
+        {"<=", derived_op_less_equal}, {">=", derived_op_greater_equal}, {"==", derived_op_equal},
+        {"!=", derived_op_not_equal}, {"<", derived_op_less}, {">", derived_op_greater},
+    };
+    int value = derived_parse_sum(parser);
+    while(value >= 0) {
+        int op = -1;
+        for(int i = 0; i < (int)array_count(comparisons) && op < 0; i++) {
+            op = derived_accept(parser, comparisons[i].token) ? comparisons[i].op : -1;
+        }
+        if(op < 0) {
+            break;
+        }
+        value = derived_emit(parser, op, value, derived_parse_sum(parser), value);
+    }
+    return value;
+}
+
+int derived_parse_and(derived_parser *parser) {
+    int value = derived_parse_comparison(parser);
+    while(value >= 0 && derived_accept(parser, "&&")) {
+        value = derived_emit(parser, derived_op_and, value, derived_parse_comparison(parser), value);
+    }
+    return value;
+}
+
+int derived_parse_or(derived_parser *parser) {
+    int value = derived_parse_and(parser);
+    while(value >= 0 && derived_accept(parser, "||")) {
+        value = derived_emit(parser, derived_op_or, value, derived_parse_and(parser), value);
+    }
+    return value;
+}
+
+// False with a message in error if the source doesn't parse or uses no channel
+bool derived_compile(const char *source, derived_program *program, char *error, int error_size) {
+    memset(program, 0, sizeof(*program));
+    error[0] = 0;
+    derived_parser parser = {source, source, program, 0, error, error_size};
+    int result = derived_parse_or(&parser);
+    // Takes the trailing spaces
+    derived_accept(&parser, "");
+    if(result >= 0 && *parser.at != 0) {
+        result = derived_fail(&parser, "expected an operator");
+    }
+    if(result >= 0 && program->input_count == 0) {
+        result = derived_fail(&parser, "no channel in the expression");
+    }
+    program->result = result;
+    return result >= 0;
+}
+
+void derived_init(derived_set *set) {
+    platform_mutex_init(&set->lock);
+    memset(set->channels, 0, sizeof(set->channels));
+    set->kernels = derived_active_kernels();
+    set->next = 0;
+}
+
+void derived_destroy(derived_set *set) {
+    for(int i = 0; i < DERIVED_MAX_CHANNELS; i++) {
+        free(set->channels[i]);
+        set->channels[i] = NULL;
+    }
+    platform_mutex_destroy(&set->lock);
+}
+
+// Any thread. Returns the slot, the samples go to channel slot of DERIVED_DEVICE, or -1 with a message in error.
+// Only samples of the first channel that come after the ones already in the store are evaluated.
+int derived_add(derived_set *set, sample_store *store, const char *source, char *error, int error_size) {
+    derived_channel *channel = (derived_channel *)calloc(1, sizeof(derived_channel));
+    if(!channel) {
+        snprintf(error, error_size, "out of memory");
+        return -1;
+    }
+    derived_program *program = &channel->program;
+    if(!derived_compile(source, program, error, error_size)) {
+        free(channel);
+        return -1;
+    }
+    snprintf(channel->source, sizeof(channel->source), "%s", source);
+    for(int i = 0; i < program->input_count; i++) {
+        channel->inputs[i].channel_id = program->inputs[i];
+    }
+    for(int i = 0; i < program->constant_count; i++) {
+        for(int j = 0; j < DERIVED_BATCH; j++) {
+            channel->registers[DERIVED_FIRST_CONSTANT + i][j] = program->constants[i];
+        }
+    }
+    int64_t first_us;
+    uint64_t count;
+    channel->done_us = INT64_MIN;
+    store_span(store, program->inputs[0], &first_us, &channel->done_us, &count);
+
+    int slot = -1;
+    platform_mutex_lock(&set->lock);
+    for(int i = 0; i < DERIVED_MAX_CHANNELS && slot < 0; i++) {
+        slot = set->channels[i] ? -1 : i;
+    }
+    if(slot >= 0) {
+        channel->output_id = ((uint32_t)DERIVED_DEVICE << 16) | (uint32_t)slot;
+        set->channels[slot] = channel;
+    }
+    platform_mutex_unlock(&set->lock);
+    if(slot < 0) {
+        snprintf(error, error_size, "no free derived channel");
+        free(channel);
+    }
+    return slot;
+}
+
+// Any thread. What the channel put in the store stays there, a channel added in the same slot later appends to it.
+void derived_remove(derived_set *set, int slot) {
+    platform_mutex_lock(&set->lock);
+    free(set->channels[slot]);
+    set->channels[slot] = NULL;
+    platform_mutex_unlock(&set->lock);
+}
+
+// Moves the input on to its newest sample at or before timestamp_us
+void derived_hold(derived_input *input, sample_store *store, int64_t timestamp_us, int64_t ready_us) {
+    while(true) {
+        while(input->position < input->count && input->timestamps_us[input->position] <= timestamp_us) {
+            input->value = input->values[input->position];
+            input->value_us = input->timestamps_us[input->position];
+            input->has_value = true;
+            input->position++;
+        }
+        if(input->position < input->count) {
+            return;
+        }
+        input->position = 0;
+        input->count = store_read(store, input->channel_id, input->value_us + 1, ready_us, input->timestamps_us,
+                                  input->values, DERIVED_BATCH);
+        if(input->count == 0) {
+            return;
+        }
+    }
+}
+
+// Evaluates the next batch of samples of the first input, false if there are none that can be done yet.
+// Samples from before every input has a value are left out, output->count can be 0.
+bool derived_step(derived_set *set, derived_channel *channel, sample_store *store, derived_output *output) {
+    derived_program *program = &channel->program;
+    int64_t ready_us = INT64_MAX;
+    for(int i = 1; i < program->input_count; i++) {
+        int64_t first_us, last_us;
+        uint64_t count;
+        if(!store_span(store, program->inputs[i], &first_us, &last_us, &count)) {
+            return false;
+        }
+        ready_us = last_us < ready_us ? last_us : ready_us;
+    }
+    if(channel->done_us >= ready_us) {
+        return false;
+    }
+    int count = store_read(store, program->inputs[0], channel->done_us + 1, ready_us, channel->timestamps_us,
+                           channel->registers[0], DERIVED_BATCH);
+    if(count == 0) {
+        return false;
+    }
+
+    int first = 0;
+    for(int i = 1; i < program->input_count; i++) {
+        derived_input *input = &channel->inputs[i];
+        if(!input->started) {
+            // From the value that was current at the first sample rather than the whole history
+            input->value_us = INT64_MIN;
+            input->has_value = store_value_at(store, input->channel_id, channel->timestamps_us[0], &input->value_us,
+                                              &input->value);
+            input->started = true;
+        }
+        float *values = channel->registers[i];
+        for(int j = 0; j < count; j++) {
+            derived_hold(input, store, channel->timestamps_us[j], ready_us);
+            values[j] = input->value;
+            first = input->has_value ? first : j + 1;
+        }
+    }
+    derived_execute(program, set->kernels, channel->registers, count);
+    channel->done_us = channel->timestamps_us[count - 1];
+
+    output->channel_id = channel->output_id;
+    output->count = count - first;
+    memcpy(set->timestamps_us, channel->timestamps_us + first, output->count * sizeof(int64_t));
+    memcpy(set->values, channel->registers[program->result] + first, output->count * sizeof(float));
+    output->timestamps_us = set->timestamps_us;
+    output->values = set->values;
+    return true;
+}
+
+// Store thread. The next batch of any derived channel that has one, false once they are all caught up.
+bool derived_next(derived_set *set, sample_store *store, derived_output *output) {
+    platform_mutex_lock(&set->lock);
+    bool found = false;
+    for(int tried = 0; tried < DERIVED_MAX_CHANNELS && !found; tried++) {
+        derived_channel *channel = set->channels[set->next];
+        // A channel gets to go on until it is caught up
+        while(channel && !found && derived_step(set, channel, store, output)) {
+            found = output->count > 0;
+        }
+        if(!found) {
+            set->next = (set->next + 1) % DERIVED_MAX_CHANNELS;
+        }
+    }
+    platform_mutex_unlock(&set->lock);
+    return found;
+}
@@ -0,0 +1,335 @@
+// Device discovery.
+// Devices broadcast a beacon every second, which a background listener picks up. On top of that a probe can
+// be sent to every address of the local subnets at once, devices answer it right away, so a scan doesn't
+// have to wait for the next beacon. Both end up in the same device list.
+
+#ifndef _WIN32
+#include <ifaddrs.h>
+#include <net/if.h>
+#endif
+
+#define DISCOVERY_MAX_DEVICES 64
+#define DISCOVERY_MAX_SUBNETS 8
+// Subnets larger than this are only probed around the local address
+#define DISCOVERY_MIN_PREFIX_LENGTH 22
+// Probes are plain datagrams, a few rounds cover the ones that got lost to ARP resolution
+#define DISCOVERY_PROBE_ROUNDS 3
+#define DISCOVERY_PROBE_INTERVAL_MS 150
+// Devices that haven't been heard from for this long drop off the list
+#define DISCOVERY_EXPIRY_MS 5000
+
+typedef struct {
+    char address[INET_ADDRSTRLEN];
+    char port[8];
+    // Host byte order
+    uint32_t ipv4;
+    discovery_packet beacon;
+    uint64_t first_seen_ns;
+    uint64_t last_seen_ns;
+} discovered_device;
+
+typedef struct {
+    // Host byte order
+    uint32_t address;
+    int prefix_length;
+} discovery_subnet;
+
+typedef struct {
+    platform_thread thread;
+    net_poller poller;
+    SOCKET socket;
+    uint16_t device_port;
+    std::atomic<int> running;
+
+    platform_mutex lock;
+    // Under lock
+    discovered_device devices[DISCOVERY_MAX_DEVICES];
+    int device_count;
+    discovery_subnet subnets[DISCOVERY_MAX_SUBNETS];
+    int subnet_count;
+    bool probe_requested;
+
+    // Thread only
+    int probe_rounds_left;
+    uint64_t next_probe_ns;
+
+    // From the last probe request to the first device heard from after it, 0 until then
+    uint64_t probe_started_ns;
+    std::atomic<uint64_t> first_found_ns;
+    std::atomic<uint32_t> probes_sent;
+} discovery;
+
+// Adds the subnet unless it is already in the list, the caller holds the lock
+void discovery_add_subnet(discovery *disc, uint32_t address, int prefix_length) {
+    prefix_length = prefix_length < DISCOVERY_MIN_PREFIX_LENGTH ? DISCOVERY_MIN_PREFIX_LENGTH : prefix_length;
+    uint32_t mask = prefix_length >= 32 ? 0xFFFFFFFFu : ~(0xFFFFFFFFu >> prefix_length);
+    for(int i = 0; i < disc->subnet_count; i++) {
+        if(disc->subnets[i].prefix_length == prefix_length && (disc->subnets[i].address & mask) == (address & mask)) {
+            return;
+        }
+    }
+    if(disc->subnet_count < DISCOVERY_MAX_SUBNETS) {
+        disc->subnets[disc->subnet_count].address = address & mask;
+        disc->subnets[disc->subnet_count].prefix_length = prefix_length;
+        disc->subnet_count++;
+    }
+}
+
+// IPv4 subnets of the local interfaces, loopback excluded
+void discovery_add_local_subnets(discovery *disc) {
+#ifdef _WIN32
+    // No netmask this way, /24 is what the access point and most benches use
+    char host_name[256];
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    struct addrinfo *addresses = NULL;
+    if(gethostname(host_name, sizeof(host_name)) != 0 || getaddrinfo(host_name, NULL, &hints, &addresses) != 0) {
+        return;
+    }
+    for(struct addrinfo *address = addresses; address; address = address->ai_next) {
+        uint32_t ipv4 = ntohl(((struct sockaddr_in *)address->ai_addr)->sin_addr.s_addr);
+        if((ipv4 >> 24) != 127) {
+            discovery_add_subnet(disc, ipv4, 24);
+        }
+    }
+    freeaddrinfo(addresses);
+#else
+    struct ifaddrs *interfaces = NULL;
+    if(getifaddrs(&interfaces) != 0) {
+        return;
+    }
+    for(struct ifaddrs *interface = interfaces; interface; interface = interface->ifa_next) {
+        if(!interface->ifa_addr || !interface->ifa_netmask || interface->ifa_addr->sa_family != AF_INET ||
+           (interface->ifa_flags & IFF_LOOPBACK) || !(interface->ifa_flags & IFF_UP)) {
+            continue;
+        }
+        uint32_t ipv4 = ntohl(((struct sockaddr_in *)interface->ifa_addr)->sin_addr.s_addr);
+        uint32_t mask = ntohl(((struct sockaddr_in *)interface->ifa_netmask)->sin_addr.s_addr);
+        int prefix_length = 0;
+        while(prefix_length < 32 && (mask & (0x80000000u >> prefix_length))) {
+            prefix_length++;
+        }
+        discovery_add_subnet(disc, ipv4, prefix_length);
+    }
+    freeifaddrs(interfaces);
+#endif
+}
+
+void discovery_send_probe(discovery *disc, uint32_t ipv4) {
+    discovery_packet probe = {};
+    probe.magic = DISCOVERY_MAGIC;
+    probe.version = DISCOVERY_VERSION;
+    probe.kind = discovery_kind_probe;
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(disc->device_port);
+    address.sin_addr.s_addr = htonl(ipv4);
+    // Datagrams the socket has no room for are simply covered by the next round
+    if(sendto(disc->socket, (const char *)&probe, sizeof(probe), 0, (struct sockaddr *)&address,
+              sizeof(address)) == sizeof(probe)) {
+        disc->probes_sent.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// One datagram to every host address of every subnet and one to its broadcast address
+void discovery_probe_round(discovery *disc) {
+    discovery_subnet subnets[DISCOVERY_MAX_SUBNETS];
+    platform_mutex_lock(&disc->lock);
+    int subnet_count = disc->subnet_count;
+    memcpy(subnets, disc->subnets, subnet_count * sizeof(discovery_subnet));
+    platform_mutex_unlock(&disc->lock);
+
+    for(int i = 0; i < subnet_count; i++) {
+        uint32_t host_count = subnets[i].prefix_length >= 32 ? 1 : 1u << (32 - subnets[i].prefix_length);
+        if(host_count <= 2) {
+            discovery_send_probe(disc, subnets[i].address);
+            continue;
+        }
+        for(uint32_t host = 1; host < host_count; host++) {
+            discovery_send_probe(disc, subnets[i].address + host);
+        }
+    }
+}
+
+void discovery_on_packet(discovery *disc, const discovery_packet *beacon, uint32_t ipv4, uint64_t now) {
+    platform_mutex_lock(&disc->lock);
+    discovered_device *device = NULL;
+    for(int i = 0; i < disc->device_count && !device; i++) {
+        if(disc->devices[i].ipv4 == ipv4 && disc->devices[i].beacon.tcp_port == beacon->tcp_port) {
+            device = &disc->devices[i];
+        }
+    }
+    if(!device && disc->device_count < DISCOVERY_MAX_DEVICES) {
+        device = &disc->devices[disc->device_count++];
+        struct in_addr address;
+        address.s_addr = htonl(ipv4);
+        inet_ntop(AF_INET, &address, device->address, sizeof(device->address));
+        snprintf(device->port, sizeof(device->port), "%u", beacon->tcp_port);
+        device->ipv4 = ipv4;
+        device->first_seen_ns = now;
+    }
+    if(device) {
+        device->beacon = *beacon;
+        device->last_seen_ns = now;
+    }
+    platform_mutex_unlock(&disc->lock);
+
+    if(disc->probe_started_ns && disc->first_found_ns.load(std::memory_order_relaxed) == 0) {
+        disc->first_found_ns.store(now - disc->probe_started_ns, std::memory_order_relaxed);
+    }
+}
+
+void discovery_receive(discovery *disc, uint64_t now) {
+    while(true) {
+        discovery_packet beacon;
+        struct sockaddr_in source = {};
+        socklen_t source_length = sizeof(source);
+        int result = recvfrom(disc->socket, (char *)&beacon, sizeof(beacon), 0, (struct sockaddr *)&source,
+                              &source_length);
+        if(result < 0) {
+            return;
+        }
+        if(result >= (int)sizeof(beacon) && beacon.magic == DISCOVERY_MAGIC && beacon.version == DISCOVERY_VERSION &&
+           beacon.kind == discovery_kind_beacon) {
+            discovery_on_packet(disc, &beacon, ntohl(source.sin_addr.s_addr), now);
+        }
+    }
+}
+
+void discovery_expire(discovery *disc, uint64_t now) {
+    platform_mutex_lock(&disc->lock);
+    for(int i = 0; i < disc->device_count;) {
+        if(now - disc->devices[i].last_seen_ns > DISCOVERY_EXPIRY_MS * 1000000ULL) {
+            disc->devices[i] = disc->devices[--disc->device_count];
+        } else {
+            i++;
+        }
+    }
+    platform_mutex_unlock(&disc->lock);
+}
+
+void discovery_thread(void *parameters) {
+    discovery *disc = (discovery *)parameters;
+    net_poll_event events[2];
+
+    while(disc->running.load(std::memory_order_acquire)) {
+        uint64_t now = platform_time_ns();
+        // Woken up once a second anyway to expire devices
+        int timeout_ms = 1000;
+        if(disc->probe_rounds_left > 0) {
+            timeout_ms = now >= disc->next_probe_ns ? 0 : (int)((disc->next_probe_ns - now) / 1000000ULL) + 1;
+        }
+        net_poller_wait(&disc->poller, events, array_count(events), timeout_ms);
+
+        now = platform_time_ns();
+        discovery_receive(disc, now);
+
+        platform_mutex_lock(&disc->lock);
+        bool probe_requested = disc->probe_requested;
+        disc->probe_requested = false;
+        platform_mutex_unlock(&disc->lock);
+        if(probe_requested) {
+            disc->probe_rounds_left = DISCOVERY_PROBE_ROUNDS;
+            disc->next_probe_ns = now;
+            disc->probe_started_ns = now;
+            disc->first_found_ns.store(0, std::memory_order_relaxed);
+        }
+        if(disc->probe_rounds_left > 0 && now >= disc->next_probe_ns) {
+            discovery_probe_round(disc);
+            disc->probe_rounds_left--;
+            disc->next_probe_ns = now + DISCOVERY_PROBE_INTERVAL_MS * 1000000ULL;
+        }
+        discovery_expire(disc, now);
+    }
+}
+
+// Beacons and probe replies come in on listen_port, probes go out to device_port
+bool discovery_start(discovery *disc, uint16_t listen_port, uint16_t device_port) {
+    disc->device_port = device_port;
+    disc->device_count = 0;
+    disc->subnet_count = 0;
+    disc->probe_requested = false;
+    disc->probe_rounds_left = 0;
+    disc->probe_started_ns = 0;
+    disc->first_found_ns.store(0);
+    disc->probes_sent.store(0);
+
+    disc->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(disc->socket == INVALID_SOCKET) {
+        return false;
+    }
+    int enable = 1;
+    setsockopt(disc->socket, SOL_SOCKET, SO_REUSEADDR, (const char *)&enable, sizeof(enable));
+    setsockopt(disc->socket, SOL_SOCKET, SO_BROADCAST, (const char *)&enable, sizeof(enable));
+#ifdef _WIN32
+    // Otherwise every probe to an address without a device makes the next recvfrom fail with WSAECONNRESET
+    DWORD disable = FALSE;
+    DWORD returned = 0;
+    WSAIoctl(disc->socket, _WSAIOW(IOC_VENDOR, 12), &disable, sizeof(disable), NULL, 0, &returned, NULL, NULL);
+#endif
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(listen_port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(disc->socket, (struct sockaddr *)&address, sizeof(address)) != 0 || !net_set_nonblocking(disc->socket)) {
+        closesocket(disc->socket);
+        return false;
+    }
+
+    if(!net_poller_init(&disc->poller)) {
+        closesocket(disc->socket);
+        return false;
+    }
+    net_poller_add(&disc->poller, disc->socket, net_event_read, disc);
+    platform_mutex_init(&disc->lock);
+    disc->running.store(1);
+    if(!platform_thread_start(&disc->thread, discovery_thread, disc)) {
+        platform_mutex_destroy(&disc->lock);
+        net_poller_destroy(&disc->poller);
+        closesocket(disc->socket);
+        return false;
+    }
+    return true;
+}
+
+void discovery_stop(discovery *disc) {
+    disc->running.store(0, std::memory_order_release);
+    net_poller_wake(&disc->poller);
+    platform_thread_join(&disc->thread);
+    platform_mutex_destroy(&disc->lock);
+    net_poller_remove(&disc->poller, disc->socket);
+    net_poller_destroy(&disc->poller);
+    closesocket(disc->socket);
+}
+
+// Probes a subnet given as an address inside it, like "192.168.4.1" with 24
+bool discovery_probe_subnet(discovery *disc, const char *address, int prefix_length) {
+    struct in_addr parsed;
+    if(inet_pton(AF_INET, address, &parsed) != 1) {
+        return false;
+    }
+    platform_mutex_lock(&disc->lock);
+    discovery_add_subnet(disc, ntohl(parsed.s_addr), prefix_length);
+    disc->probe_requested = true;
+    platform_mutex_unlock(&disc->lock);
+    net_poller_wake(&disc->poller);
+    return true;
+}
+
+// Probes every local subnet and the device's own access point subnet
+void discovery_probe(discovery *disc) {
+    platform_mutex_lock(&disc->lock);
+    discovery_add_local_subnets(disc);
+    platform_mutex_unlock(&disc->lock);
+    discovery_probe_subnet(disc, DEFAULT_IP, 24);
+}
+
+// Copies out the devices heard from recently, returns how many
+int discovery_devices(discovery *disc, discovered_device *devices, int max_devices) {
+    platform_mutex_lock(&disc->lock);
+    int count = disc->device_count < max_devices ? disc->device_count : max_devices;
+    memcpy(devices, disc->devices, count * sizeof(discovered_device));
+    platform_mutex_unlock(&disc->lock);
+    return count;
+}
@@ -0,0 +1,238 @@
+// Draw data hashing.
+// A frame the scheduler rendered often comes out the same as the one on screen, a timer frame over a static view, a
+// mouse moving over nothing. Every draw list of the frame is hashed on its own, its vertices, its indices and per
+// command the clip rect, the texture and the ranges, and compared with the hash of the list in the same place last
+// frame. When the frame has the lists it had and all of them are the same, the backend submit and the present are
+// skipped and the last frame stays on screen. A list with a callback is never the same, a callback can draw
+// anything.
+// The bytes go 32 at a time into four 64 bit lanes, as in XXH3: every word is keyed with a key that changes with
+// its place, its two halves are multiplied together and the product and the word next to it are added to its lane,
+// and every 1 KB the lanes are scrambled. That takes a multiply per 8 bytes, which SSE2 and AVX2 do two and four at
+// a time, the best set the CPU supports is picked on first use and all of them come to the same hash.
+
+#define DRAW_HASH_MAX_LISTS 256
+
+typedef struct {
+    bool valid;
+    ImVec2 display_pos;
+    ImVec2 display_size;
+    ImVec2 framebuffer_scale;
+    int list_count;
+    uint64_t hashes[DRAW_HASH_MAX_LISTS];
+
+    uint64_t submitted;
+    uint64_t skipped;
+    uint64_t hash_ns;
+} draw_hash;
+
+typedef void (*draw_hash_stripes_proc)(const uint8_t *data, size_t stripe_count, uint64_t *lanes);
+
+typedef struct {
+    const char *name;
+    // Folds 32 byte stripes into the four lanes, the kernels of every set come to the same lanes
+    draw_hash_stripes_proc stripes;
+} draw_hash_kernels;
+
+static const uint64_t draw_hash_keys[4] = {
+    0xBE4BA423396CFEB8ull, 0x1CAD21F72C81017Cull, 0xDB979083E96DD4DEull, 0x1F67B3B7A4A44072ull
+};
+// Added to the keys for every stripe, so that the same bytes count differently in another place
+#define DRAW_HASH_KEY_STEP 0x9E3779B97F4A7C15ull
+// Stripes between scrambles of the lanes
+#define DRAW_HASH_BLOCK 32
+
+void draw_hash_stripes_scalar(const uint8_t *data, size_t stripe_count, uint64_t *lanes) {
+    for(size_t i = 0; i < stripe_count; i++) {
+        uint64_t words[4];
+        memcpy(words, data + i * 32, 32);
+        for(int j = 0; j < 4; j++) {
+            uint64_t keyed = words[j] ^ (draw_hash_keys[j] + i * DRAW_HASH_KEY_STEP);
+            lanes[j] += words[j ^ 1] + (keyed & 0xFFFFFFFF) * (keyed >> 32);
+        }
+        if(i % DRAW_HASH_BLOCK == DRAW_HASH_BLOCK - 1) {
+            for(int j = 0; j < 4; j++) {
+                lanes[j] = (lanes[j] ^ (lanes[j] >> 47)) * 0x9E3779B1ull;
+            }
+        }
+    }
+}
+
+draw_hash_kernels draw_hash_scalar_kernels = {"scalar", draw_hash_stripes_scalar};
+
+#ifdef DECODE_X86
+// lanes * 0x9E3779B1 for 64 bit lanes, out of 32 bit multiplies
+DECODE_TARGET_SSE2 __m128i draw_hash_scramble_sse2(__m128i lanes) {
+    const __m128i prime = _mm_set1_epi32((int)0x9E3779B1);
+    lanes = _mm_xor_si128(lanes, _mm_srli_epi64(lanes, 47));
+    __m128i low = _mm_mul_epu32(lanes, prime);
+    __m128i high = _mm_mul_epu32(_mm_srli_epi64(lanes, 32), prime);
+    return _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+}
+
+DECODE_TARGET_SSE2 void draw_hash_stripes_sse2(const uint8_t *data, size_t stripe_count, uint64_t *lanes) {
+    __m128i lanes_01 = _mm_loadu_si128((const __m128i *)lanes);
+    __m128i lanes_23 = _mm_loadu_si128((const __m128i *)(lanes + 2));
+    __m128i keys_01 = _mm_loadu_si128((const __m128i *)draw_hash_keys);
+    __m128i keys_23 = _mm_loadu_si128((const __m128i *)(draw_hash_keys + 2));
+    const __m128i step = _mm_set1_epi64x((long long)DRAW_HASH_KEY_STEP);
+    for(size_t i = 0; i < stripe_count; i++) {
+        __m128i words_01 = _mm_loadu_si128((const __m128i *)(data + i * 32));
+        __m128i words_23 = _mm_loadu_si128((const __m128i *)(data + i * 32 + 16));
+        __m128i keyed_01 = _mm_xor_si128(words_01, keys_01);
+        __m128i keyed_23 = _mm_xor_si128(words_23, keys_23);
+        __m128i product_01 = _mm_mul_epu32(keyed_01, _mm_srli_epi64(keyed_01, 32));
+        __m128i product_23 = _mm_mul_epu32(keyed_23, _mm_srli_epi64(keyed_23, 32));
+        lanes_01 = _mm_add_epi64(lanes_01, _mm_add_epi64(_mm_shuffle_epi32(words_01, 0x4E), product_01));
+        lanes_23 = _mm_add_epi64(lanes_23, _mm_add_epi64(_mm_shuffle_epi32(words_23, 0x4E), product_23));
+        keys_01 = _mm_add_epi64(keys_01, step);
+        keys_23 = _mm_add_epi64(keys_23, step);
+        if(i % DRAW_HASH_BLOCK == DRAW_HASH_BLOCK - 1) {
+            lanes_01 = draw_hash_scramble_sse2(lanes_01);
+            lanes_23 = draw_hash_scramble_sse2(lanes_23);
+        }
+    }
+    _mm_storeu_si128((__m128i *)lanes, lanes_01);
+    _mm_storeu_si128((__m128i *)(lanes + 2), lanes_23);
+}
+
+draw_hash_kernels draw_hash_sse2_kernels = {"SSE2", draw_hash_stripes_sse2};
+
+DECODE_TARGET_AVX2 void draw_hash_stripes_avx2(const uint8_t *data, size_t stripe_count, uint64_t *lanes) {
+    __m256i sums = _mm256_loadu_si256((const __m256i *)lanes);
+    __m256i keys = _mm256_loadu_si256((const __m256i *)draw_hash_keys);
+    const __m256i step = _mm256_set1_epi64x((long long)DRAW_HASH_KEY_STEP);
+    const __m256i prime = _mm256_set1_epi32((int)0x9E3779B1);
+    for(size_t i = 0; i < stripe_count; i++) {
+        __m256i words = _mm256_loadu_si256((const __m256i *)(data + i * 32));
+        __m256i keyed = _mm256_xor_si256(words, keys);
+        __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+        // Swaps the words of each 128 bit half, word j ^ 1
+        sums = _mm256_add_epi64(sums, _mm256_add_epi64(_mm256_shuffle_epi32(words, 0x4E), product));
+        keys = _mm256_add_epi64(keys, step);
+        if(i % DRAW_HASH_BLOCK == DRAW_HASH_BLOCK - 1) {
+            sums = _mm256_xor_si256(sums, _mm256_srli_epi64(sums, 47));
+            __m256i low = _mm256_mul_epu32(sums, prime);
+            __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(sums, 32), prime);
+            sums = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+        }
+    }
+    _mm256_storeu_si256((__m256i *)lanes, sums);
+    _mm256_zeroupper();
+}
+
+draw_hash_kernels draw_hash_avx2_kernels = {"AVX2", draw_hash_stripes_avx2};
+#endif
+
+// Every kernel set this build has, best last, whether the CPU can run it or not
+draw_hash_kernels *draw_hash_kernel_sets[] = {
+    &draw_hash_scalar_kernels,
+#ifdef DECODE_X86
+    &draw_hash_sse2_kernels,
+    &draw_hash_avx2_kernels,
+#endif
+};
+
+bool draw_hash_kernels_supported(const draw_hash_kernels *kernels) {
+#ifdef DECODE_X86
+    if(kernels == &draw_hash_avx2_kernels) {
+        return platform_cpu_has_avx2();
+    }
+    if(kernels == &draw_hash_sse2_kernels) {
+        return platform_cpu_has_sse2();
+    }
+#endif
+    return true;
+}
+
+const draw_hash_kernels *draw_hash_pick_kernels() {
+    for(int i = (int)array_count(draw_hash_kernel_sets) - 1; i > 0; i--) {
+        if(draw_hash_kernels_supported(draw_hash_kernel_sets[i])) {
+            return draw_hash_kernel_sets[i];
+        }
+    }
+    return &draw_hash_scalar_kernels;
+}
+
+// The best kernels for this CPU, safe to call from any thread
+const draw_hash_kernels *draw_hash_active_kernels() {
+    static const draw_hash_kernels *kernels = draw_hash_pick_kernels();
+    return kernels;
+}
+
+uint64_t draw_hash_bytes_with(const draw_hash_kernels *kernels, const void *data, size_t size, uint64_t seed) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint64_t lanes[4] = {seed, seed ^ draw_hash_keys[0], seed ^ draw_hash_keys[1], seed ^ draw_hash_keys[2]};
+    size_t stripe_count = size / 32;
+    kernels->stripes(bytes, stripe_count, lanes);
+    uint64_t hash = size;
+    for(int j = 0; j < 4; j++) {
+        hash = (hash ^ lanes[j]) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    for(size_t i = stripe_count * 32; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+uint64_t draw_hash_bytes(const void *data, size_t size, uint64_t seed) {
+    return draw_hash_bytes_with(draw_hash_active_kernels(), data, size, seed);
+}
+
+// False if the list has a callback
+bool draw_hash_list(const ImDrawList *list, uint64_t *hash) {
+    uint64_t commands = (uint64_t)list->CmdBuffer.Size;
+    for(int c = 0; c < list->CmdBuffer.Size; c++) {
+        const ImDrawCmd *command = &list->CmdBuffer[c];
+        if(command->UserCallback) {
+            return false;
+        }
+        // Field by field, the padding of a command isn't always zero
+        uint32_t fields[7];
+        memcpy(fields, &command->ClipRect, sizeof(ImVec4));
+        fields[4] = command->VtxOffset;
+        fields[5] = command->IdxOffset;
+        fields[6] = command->ElemCount;
+        ImTextureID texture = command->TextureId;
+        commands = draw_hash_bytes(fields, sizeof(fields), commands);
+        commands = draw_hash_bytes(&texture, sizeof(texture), commands);
+    }
+    uint64_t vertices = draw_hash_bytes(list->VtxBuffer.Data, list->VtxBuffer.Size * sizeof(ImDrawVert), commands);
+    *hash = draw_hash_bytes(list->IdxBuffer.Data, list->IdxBuffer.Size * sizeof(ImDrawIdx), vertices);
+    return true;
+}
+
+// The next frame is submitted whatever it looks like, for after the back buffers were lost to a resize
+void draw_hash_invalidate(draw_hash *hashes) {
+    hashes->valid = false;
+}
+
+// True if draw_data is the same as the last frame that was submitted and there is no need to submit it. Otherwise
+// it is counted as submitted and compared against from now on.
+bool draw_hash_unchanged(draw_hash *hashes, const ImDrawData *draw_data) {
+    uint64_t start_ns = platform_time_ns();
+    int list_count = draw_data->CmdListsCount;
+    bool same = hashes->valid && hashes->list_count == list_count &&
+                memcmp(&hashes->display_pos, &draw_data->DisplayPos, sizeof(ImVec2)) == 0 &&
+                memcmp(&hashes->display_size, &draw_data->DisplaySize, sizeof(ImVec2)) == 0 &&
+                memcmp(&hashes->framebuffer_scale, &draw_data->FramebufferScale, sizeof(ImVec2)) == 0;
+    bool hashable = list_count <= DRAW_HASH_MAX_LISTS;
+    for(int i = 0; i < list_count && hashable; i++) {
+        uint64_t hash;
+        hashable = draw_hash_list(draw_data->CmdLists[i], &hash);
+        same = same && hashable && hashes->hashes[i] == hash;
+        hashes->hashes[i] = hash;
+    }
+    hashes->valid = hashable;
+    hashes->list_count = list_count;
+    hashes->display_pos = draw_data->DisplayPos;
+    hashes->display_size = draw_data->DisplaySize;
+    hashes->framebuffer_scale = draw_data->FramebufferScale;
+    hashes->hash_ns += platform_time_ns() - start_ns;
+    if(same) {
+        hashes->skipped++;
+    } else {
+        hashes->submitted++;
+    }
+    return same;
+}
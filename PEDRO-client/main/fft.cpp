@@ -0,0 +1,657 @@
+// Spectrum analysis.
+// A worker thread turns the newest history of a channel in the store into a magnitude spectrum, so the UI thread
+// never runs a transform. The span is cut into segments of a power-of-two size that overlap, every segment is
+// multiplied by a window (Hann, Blackman or flat-top) and transformed, and the power of the segments is averaged
+// (Welch's method). Samples are taken as evenly spaced, the bin width comes from the mean rate over the span.
+// N real samples go through a complex FFT of N/2 points and are separated afterwards. The complex FFT is radix 2
+// on separate real and imaginary arrays so a stage vectorizes across its butterflies, the kernel targets come
+// from decode.cpp. Plans, windows and scratch space are made once per size and kept by the worker.
+// Every analysis publishes through a triple buffer: the worker fills the back spectrum and swaps it with the
+// ready one, the UI swaps the ready one with its front when there is a new one. Neither side ever waits.
+
+#define FFT_MIN_LOG2 4
+#define FFT_MAX_LOG2 20
+#define FFT_MAX_ANALYSES 8
+#define FFT_MAX_SEGMENTS 64
+// Set in fft_analysis.ready while the ready spectrum hasn't been taken
+#define FFT_FRESH 4
+#define FFT_PI 3.14159265358979323846
+
+enum fft_window_kind {
+    fft_window_rectangular = 0,
+    fft_window_hann = 1,
+    fft_window_blackman = 2,
+    // Wide main lobe but reads the amplitude of a sine right wherever it falls between bins
+    fft_window_flat_top = 3,
+    fft_window_count = 4
+};
+
+typedef struct {
+    bool enabled;
+    uint32_t channel_id;
+    int log2_size;
+    int window;
+    // Fraction of a segment that the next one overlaps, 0 to 0.9
+    float overlap;
+    // Of the newest history, no more than FFT_MAX_SEGMENTS segments of it are used
+    int64_t span_us;
+    bool decibels;
+} fft_config;
+
+// Amplitude of a sine centred on each bin, in the units of the channel or in dB relative to one of them.
+// Bin i is at i * bin_hz, there are size / 2 + 1 of them.
+typedef struct {
+    uint64_t sequence;
+    uint32_t channel_id;
+    int size;
+    int window;
+    int segments;
+    bool decibels;
+    int64_t first_us;
+    int64_t last_us;
+    double bin_hz;
+    int bin_count;
+    int capacity;
+    float *magnitudes;
+} fft_spectrum;
+
+// One radix 2 stage over count points, butterflies half apart
+typedef void (*fft_stage_proc)(float *re, float *im, int count, int half, const float *twiddle_re,
+                               const float *twiddle_im);
+// sums[i] += re[i]^2 + im[i]^2
+typedef void (*fft_power_proc)(const float *re, const float *im, int count, float *sums);
+
+typedef struct {
+    const char *name;
+    fft_stage_proc stage;
+    fft_power_proc power;
+} fft_kernels;
+
+typedef struct {
+    int log2_size;
+    // Real samples, the complex transform has half as many points
+    int size;
+    uint32_t *bit_reverse;
+    // The stage with butterflies half apart uses entries half..2 * half - 1
+    float *twiddle_re;
+    float *twiddle_im;
+    // exp(-2 pi i k / size), for separating the real transform
+    float *split_re;
+    float *split_im;
+    float *windows[fft_window_count];
+    // What a constant 1 comes out as in bin 0
+    double window_sums[fft_window_count];
+    // size / 2 + 1 bins of the last transform, and the power sums
+    float *re;
+    float *im;
+    float *power;
+} fft_plan;
+
+typedef struct {
+    // Under the worker lock
+    fft_config config;
+    bool changed;
+
+    fft_spectrum spectra[3];
+    // Worker only
+    int back;
+    int64_t analyzed_last_us;
+    // UI only
+    int front;
+    std::atomic<int> ready;
+} fft_analysis;
+
+typedef struct {
+    sample_store *store;
+    const fft_kernels *kernels;
+    int interval_ms;
+    // Worker only, made on first use
+    fft_plan *plans[FFT_MAX_LOG2 + 1];
+    int64_t *timestamps_us;
+    float *values;
+    int sample_capacity;
+
+    fft_analysis analyses[FFT_MAX_ANALYSES];
+    platform_mutex lock;
+    platform_event wake;
+    platform_thread thread;
+    std::atomic<int> stop;
+    uint64_t sequence;
+
+    std::atomic<uint64_t> transforms;
+    std::atomic<uint64_t> busy_ns;
+} fft_worker;
+
+const char *fft_window_name(int window) {
+    switch(window) {
+        case fft_window_rectangular: return "Rectangular";
+        case fft_window_hann: return "Hann";
+        case fft_window_blackman: return "Blackman";
+        case fft_window_flat_top: return "Flat-top";
+    }
+    return "Unknown";
+}
+
+void fft_stage_scalar(float *re, float *im, int count, int half, const float *twiddle_re, const float *twiddle_im) {
+    for(int start = 0; start < count; start += 2 * half) {
+        for(int j = 0; j < half; j++) {
+            int a = start + j;
+            int b = a + half;
+            float w_re = twiddle_re[half + j];
+            float w_im = twiddle_im[half + j];
+            float t_re = re[b] * w_re - im[b] * w_im;
+            float t_im = re[b] * w_im + im[b] * w_re;
+            re[b] = re[a] - t_re;
+            im[b] = im[a] - t_im;
+            re[a] += t_re;
+            im[a] += t_im;
+        }
+    }
+}
+
+void fft_power_scalar(const float *re, const float *im, int count, float *sums) {
+    for(int i = 0; i < count; i++) {
+        sums[i] += re[i] * re[i] + im[i] * im[i];
+    }
+}
+
+fft_kernels fft_scalar_kernels = {"scalar", fft_stage_scalar, fft_power_scalar};
+
+#ifdef DECODE_X86
+DECODE_TARGET_SSE2 void fft_stage_sse2(float *re, float *im, int count, int half, const float *twiddle_re,
+                                       const float *twiddle_im) {
+    if(half < 4) {
+        fft_stage_scalar(re, im, count, half, twiddle_re, twiddle_im);
+        return;
+    }
+    for(int start = 0; start < count; start += 2 * half) {
+        float *a_re = re + start;
+        float *a_im = im + start;
+        float *b_re = a_re + half;
+        float *b_im = a_im + half;
+        for(int j = 0; j < half; j += 4) {
+            __m128 w_re = _mm_loadu_ps(twiddle_re + half + j);
+            __m128 w_im = _mm_loadu_ps(twiddle_im + half + j);
+            __m128 x_re = _mm_loadu_ps(b_re + j);
+            __m128 x_im = _mm_loadu_ps(b_im + j);
+            __m128 t_re = _mm_sub_ps(_mm_mul_ps(x_re, w_re), _mm_mul_ps(x_im, w_im));
+            __m128 t_im = _mm_add_ps(_mm_mul_ps(x_re, w_im), _mm_mul_ps(x_im, w_re));
+            __m128 y_re = _mm_loadu_ps(a_re + j);
+            __m128 y_im = _mm_loadu_ps(a_im + j);
+            _mm_storeu_ps(b_re + j, _mm_sub_ps(y_re, t_re));
+            _mm_storeu_ps(b_im + j, _mm_sub_ps(y_im, t_im));
+            _mm_storeu_ps(a_re + j, _mm_add_ps(y_re, t_re));
+            _mm_storeu_ps(a_im + j, _mm_add_ps(y_im, t_im));
+        }
+    }
+}
+
+DECODE_TARGET_SSE2 void fft_power_sse2(const float *re, const float *im, int count, float *sums) {
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128 x_re = _mm_loadu_ps(re + i);
+        __m128 x_im = _mm_loadu_ps(im + i);
+        __m128 power = _mm_add_ps(_mm_mul_ps(x_re, x_re), _mm_mul_ps(x_im, x_im));
+        _mm_storeu_ps(sums + i, _mm_add_ps(_mm_loadu_ps(sums + i), power));
+    }
+    fft_power_scalar(re + i, im + i, count - i, sums + i);
+}
+
+fft_kernels fft_sse2_kernels = {"SSE2", fft_stage_sse2, fft_power_sse2};
+
+DECODE_TARGET_AVX2 void fft_stage_avx2(float *re, float *im, int count, int half, const float *twiddle_re,
+                                       const float *twiddle_im) {
+    if(half < 8) {
+        fft_stage_sse2(re, im, count, half, twiddle_re, twiddle_im);
+        return;
+    }
+    for(int start = 0; start < count; start += 2 * half) {
+        float *a_re = re + start;
+        float *a_im = im + start;
+        float *b_re = a_re + half;
+        float *b_im = a_im + half;
+        for(int j = 0; j < half; j += 8) {
+            __m256 w_re = _mm256_loadu_ps(twiddle_re + half + j);
+            __m256 w_im = _mm256_loadu_ps(twiddle_im + half + j);
+            __m256 x_re = _mm256_loadu_ps(b_re + j);
+            __m256 x_im = _mm256_loadu_ps(b_im + j);
+            __m256 t_re = _mm256_sub_ps(_mm256_mul_ps(x_re, w_re), _mm256_mul_ps(x_im, w_im));
+            __m256 t_im = _mm256_add_ps(_mm256_mul_ps(x_re, w_im), _mm256_mul_ps(x_im, w_re));
+            __m256 y_re = _mm256_loadu_ps(a_re + j);
+            __m256 y_im = _mm256_loadu_ps(a_im + j);
+            _mm256_storeu_ps(b_re + j, _mm256_sub_ps(y_re, t_re));
+            _mm256_storeu_ps(b_im + j, _mm256_sub_ps(y_im, t_im));
+            _mm256_storeu_ps(a_re + j, _mm256_add_ps(y_re, t_re));
+            _mm256_storeu_ps(a_im + j, _mm256_add_ps(y_im, t_im));
+        }
+    }
+}
+
+DECODE_TARGET_AVX2 void fft_power_avx2(const float *re, const float *im, int count, float *sums) {
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256 x_re = _mm256_loadu_ps(re + i);
+        __m256 x_im = _mm256_loadu_ps(im + i);
+        __m256 power = _mm256_add_ps(_mm256_mul_ps(x_re, x_re), _mm256_mul_ps(x_im, x_im));
+        _mm256_storeu_ps(sums + i, _mm256_add_ps(_mm256_loadu_ps(sums + i), power));
+    }
+    fft_power_scalar(re + i, im + i, count - i, sums + i);
+}
+
+fft_kernels fft_avx2_kernels = {"AVX2", fft_stage_avx2, fft_power_avx2};
+#endif
+
+// Every kernel set this build has, best last
+fft_kernels *fft_kernel_sets[] = {
+    &fft_scalar_kernels,
+#ifdef DECODE_X86
+    &fft_sse2_kernels,
+    &fft_avx2_kernels,
+#endif
+};
+
+bool fft_kernels_supported(const fft_kernels *kernels) {
+#ifdef DECODE_X86
+    if(kernels == &fft_avx2_kernels) {
+        return platform_cpu_has_avx2();
+    }
+    if(kernels == &fft_sse2_kernels) {
+        return platform_cpu_has_sse2();
+    }
+#endif
+    return true;
+}
+
+const fft_kernels *fft_pick_kernels() {
+    for(int i = (int)array_count(fft_kernel_sets) - 1; i > 0; i--) {
+        if(fft_kernels_supported(fft_kernel_sets[i])) {
+            return fft_kernel_sets[i];
+        }
+    }
+    return &fft_scalar_kernels;
+}
+
+const fft_kernels *fft_active_kernels() {
+    static const fft_kernels *kernels = fft_pick_kernels();
+    return kernels;
+}
+
+void fft_plan_destroy(fft_plan *plan) {
+    if(!plan) {
+        return;
+    }
+    free(plan->bit_reverse);
+    free(plan->twiddle_re);
+    free(plan->twiddle_im);
+    free(plan->split_re);
+    free(plan->split_im);
+    for(int i = 0; i < fft_window_count; i++) {
+        free(plan->windows[i]);
+    }
+    free(plan->re);
+    free(plan->im);
+    free(plan->power);
+    free(plan);
+}
+
+fft_plan *fft_plan_create(int log2_size) {
+    if(log2_size < FFT_MIN_LOG2 || log2_size > FFT_MAX_LOG2) {
+        return NULL;
+    }
+    fft_plan *plan = (fft_plan *)calloc(1, sizeof(fft_plan));
+    if(!plan) {
+        return NULL;
+    }
+    int size = 1 << log2_size;
+    int points = size / 2;
+    plan->log2_size = log2_size;
+    plan->size = size;
+    plan->bit_reverse = (uint32_t *)malloc(points * sizeof(uint32_t));
+    plan->twiddle_re = (float *)malloc(points * sizeof(float));
+    plan->twiddle_im = (float *)malloc(points * sizeof(float));
+    plan->split_re = (float *)malloc(points * sizeof(float));
+    plan->split_im = (float *)malloc(points * sizeof(float));
+    plan->re = (float *)malloc((points + 1) * sizeof(float));
+    plan->im = (float *)malloc((points + 1) * sizeof(float));
+    plan->power = (float *)malloc((points + 1) * sizeof(float));
+    if(!plan->bit_reverse || !plan->twiddle_re || !plan->twiddle_im || !plan->split_re || !plan->split_im ||
+       !plan->re || !plan->im || !plan->power) {
+        fft_plan_destroy(plan);
+        return NULL;
+    }
+
+    int bits = log2_size - 1;
+    for(int i = 0; i < points; i++) {
+        uint32_t reversed = 0;
+        for(int bit = 0; bit < bits; bit++) {
+            reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+        }
+        plan->bit_reverse[i] = reversed;
+    }
+    // The first two stages don't multiply, entry 0 is never read
+    plan->twiddle_re[0] = 1.0f;
+    plan->twiddle_im[0] = 0.0f;
+    for(int half = 1; half < points; half *= 2) {
+        for(int j = 0; j < half; j++) {
+            double angle = -FFT_PI * j / half;
+            plan->twiddle_re[half + j] = (float)cos(angle);
+            plan->twiddle_im[half + j] = (float)sin(angle);
+        }
+    }
+    for(int k = 0; k < points; k++) {
+        double angle = -2.0 * FFT_PI * k / size;
+        plan->split_re[k] = (float)cos(angle);
+        plan->split_im[k] = (float)sin(angle);
+    }
+    return plan;
+}
+
+// Periodic windows, a segment is taken as one period of something that repeats
+const float *fft_plan_window(fft_plan *plan, int window) {
+    if(plan->windows[window]) {
+        return plan->windows[window];
+    }
+    float *coefficients = (float *)malloc(plan->size * sizeof(float));
+    if(!coefficients) {
+        return NULL;
+    }
+    // Sums of cosines, a[k] * cos(2 pi k n / size) with alternating signs
+    double a[5] = {1.0, 0.0, 0.0, 0.0, 0.0};
+    if(window == fft_window_hann) {
+        a[0] = 0.5;
+        a[1] = 0.5;
+    } else if(window == fft_window_blackman) {
+        a[0] = 0.42;
+        a[1] = 0.5;
+        a[2] = 0.08;
+    } else if(window == fft_window_flat_top) {
+        a[0] = 0.21557895;
+        a[1] = 0.41663158;
+        a[2] = 0.277263158;
+        a[3] = 0.083578947;
+        a[4] = 0.006947368;
+    }
+    double sum = 0.0;
+    for(int n = 0; n < plan->size; n++) {
+        double phase = 2.0 * FFT_PI * n / plan->size;
+        double value = a[0] - a[1] * cos(phase) + a[2] * cos(2.0 * phase) - a[3] * cos(3.0 * phase) +
+                       a[4] * cos(4.0 * phase);
+        coefficients[n] = (float)value;
+        sum += value;
+    }
+    plan->windows[window] = coefficients;
+    plan->window_sums[window] = sum;
+    return coefficients;
+}
+
+// Transform of plan->size real samples times the window, bins 0 to size / 2 end up in plan->re and plan->im.
+// NaN samples hold the value before them, 0 at the start.
+bool fft_real(fft_plan *plan, const fft_kernels *kernels, const float *samples, int window) {
+    const float *coefficients = fft_plan_window(plan, window);
+    if(!coefficients) {
+        return false;
+    }
+    int points = plan->size / 2;
+    float *re = plan->re;
+    float *im = plan->im;
+    // Even samples are the real parts, odd ones the imaginary parts, in bit reversed order
+    float last = 0.0f;
+    for(int k = 0; k < points; k++) {
+        float even = samples[2 * k] == samples[2 * k] ? samples[2 * k] : last;
+        float odd = samples[2 * k + 1] == samples[2 * k + 1] ? samples[2 * k + 1] : even;
+        last = odd;
+        uint32_t j = plan->bit_reverse[k];
+        re[j] = even * coefficients[2 * k];
+        im[j] = odd * coefficients[2 * k + 1];
+    }
+
+    // The first two stages together, their twiddles are 1 and -i
+    for(int start = 0; start < points; start += 4) {
+        float a0_re = re[start] + re[start + 1];
+        float a0_im = im[start] + im[start + 1];
+        float a1_re = re[start] - re[start + 1];
+        float a1_im = im[start] - im[start + 1];
+        float a2_re = re[start + 2] + re[start + 3];
+        float a2_im = im[start + 2] + im[start + 3];
+        float a3_re = re[start + 2] - re[start + 3];
+        float a3_im = im[start + 2] - im[start + 3];
+        re[start] = a0_re + a2_re;
+        im[start] = a0_im + a2_im;
+        re[start + 2] = a0_re - a2_re;
+        im[start + 2] = a0_im - a2_im;
+        re[start + 1] = a1_re + a3_im;
+        im[start + 1] = a1_im - a3_re;
+        re[start + 3] = a1_re - a3_im;
+        im[start + 3] = a1_im + a3_re;
+    }
+    for(int half = 4; half < points; half *= 2) {
+        kernels->stage(re, im, points, half, plan->twiddle_re, plan->twiddle_im);
+    }
+
+    // Z is the transform of the pairs, X[k] = E[k] + W^k O[k] with E and O the transforms of the even and odd
+    // samples, E[k] = (Z[k] + conj(Z[M - k])) / 2 and O[k] = (Z[k] - conj(Z[M - k])) / 2i. X[M - k] comes out
+    // as conj(E[k] - W^k O[k]), so bins are done in pairs, in place.
+    float z_re = re[0];
+    float z_im = im[0];
+    re[0] = z_re + z_im;
+    im[0] = 0.0f;
+    re[points] = z_re - z_im;
+    im[points] = 0.0f;
+    for(int k = 1; k <= points / 2; k++) {
+        int m = points - k;
+        float e_re = 0.5f * (re[k] + re[m]);
+        float e_im = 0.5f * (im[k] - im[m]);
+        float o_re = 0.5f * (im[k] + im[m]);
+        float o_im = 0.5f * (re[m] - re[k]);
+        float wo_re = plan->split_re[k] * o_re - plan->split_im[k] * o_im;
+        float wo_im = plan->split_re[k] * o_im + plan->split_im[k] * o_re;
+        re[k] = e_re + wo_re;
+        im[k] = e_im + wo_im;
+        re[m] = e_re - wo_re;
+        im[m] = wo_im - e_im;
+    }
+    return true;
+}
+
+// Amplitudes from power summed over segments, the window takes away its sum and a sine splits between the
+// positive and the negative frequency everywhere but at 0 and the Nyquist frequency
+void fft_magnitudes(const fft_plan *plan, int window, int segments, bool decibels, float *magnitudes) {
+    int bins = plan->size / 2 + 1;
+    double scale = 2.0 / plan->window_sums[window];
+    for(int i = 0; i < bins; i++) {
+        double amplitude = sqrt(plan->power[i] / segments) * (i == 0 || i == bins - 1 ? scale / 2.0 : scale);
+        magnitudes[i] = decibels ? (float)(20.0 * log10(amplitude > 1e-10 ? amplitude : 1e-10)) : (float)amplitude;
+    }
+}
+
+fft_plan *fft_worker_plan(fft_worker *worker, int log2_size) {
+    if(!worker->plans[log2_size]) {
+        worker->plans[log2_size] = fft_plan_create(log2_size);
+    }
+    return worker->plans[log2_size];
+}
+
+bool fft_worker_reserve(fft_worker *worker, int samples) {
+    if(samples <= worker->sample_capacity) {
+        return true;
+    }
+    int64_t *timestamps_us = (int64_t *)realloc(worker->timestamps_us, samples * sizeof(int64_t));
+    if(timestamps_us) {
+        worker->timestamps_us = timestamps_us;
+    }
+    float *values = (float *)realloc(worker->values, samples * sizeof(float));
+    if(values) {
+        worker->values = values;
+    }
+    if(!timestamps_us || !values) {
+        return false;
+    }
+    worker->sample_capacity = samples;
+    return true;
+}
+
+// Publishes a new spectrum if the channel has samples since the last one and enough of them for a segment
+void fft_analyze(fft_worker *worker, fft_analysis *analysis, const fft_config *config) {
+    int64_t first_us, last_us;
+    uint64_t count;
+    if(!store_span(worker->store, config->channel_id, &first_us, &last_us, &count) || count < 2 ||
+       last_us == analysis->analyzed_last_us) {
+        return;
+    }
+    fft_plan *plan = fft_worker_plan(worker, config->log2_size);
+    if(!plan) {
+        return;
+    }
+    int size = plan->size;
+    float overlap = config->overlap < 0.0f ? 0.0f : config->overlap > 0.9f ? 0.9f : config->overlap;
+    int hop = (int)(size * (1.0f - overlap));
+    hop = hop > 0 ? hop : 1;
+    int capacity = size + hop * (FFT_MAX_SEGMENTS - 1);
+    if(!fft_worker_reserve(worker, capacity)) {
+        return;
+    }
+    // The read goes forward from from_us, so it has to start late enough for the newest samples to fit
+    double samples_per_us = last_us > first_us ? (double)(count - 1) / (double)(last_us - first_us) : 0.0;
+    int64_t from_us = last_us - config->span_us;
+    if(samples_per_us > 0.0 && config->span_us * samples_per_us > capacity) {
+        from_us = last_us - (int64_t)((capacity - 1) / samples_per_us);
+    }
+    int read = store_read(worker->store, config->channel_id, from_us, last_us, worker->timestamps_us,
+                          worker->values, capacity);
+    if(read < size) {
+        return;
+    }
+
+    uint64_t start_ns = platform_time_ns();
+    int segments = (read - size) / hop + 1;
+    int first = read - size - (segments - 1) * hop;
+    int bins = size / 2 + 1;
+    memset(plan->power, 0, bins * sizeof(float));
+    for(int segment = 0; segment < segments; segment++) {
+        if(!fft_real(plan, worker->kernels, worker->values + first + segment * hop, config->window)) {
+            return;
+        }
+        worker->kernels->power(plan->re, plan->im, bins, plan->power);
+    }
+
+    fft_spectrum *spectrum = &analysis->spectra[analysis->back];
+    if(spectrum->capacity < bins) {
+        float *magnitudes = (float *)realloc(spectrum->magnitudes, bins * sizeof(float));
+        if(!magnitudes) {
+            return;
+        }
+        spectrum->magnitudes = magnitudes;
+        spectrum->capacity = bins;
+    }
+    fft_magnitudes(plan, config->window, segments, config->decibels, spectrum->magnitudes);
+    int64_t span_us = worker->timestamps_us[read - 1] - worker->timestamps_us[first];
+    int used = read - first;
+    spectrum->sequence = ++worker->sequence;
+    spectrum->channel_id = config->channel_id;
+    spectrum->size = size;
+    spectrum->window = config->window;
+    spectrum->segments = segments;
+    spectrum->decibels = config->decibels;
+    spectrum->first_us = worker->timestamps_us[first];
+    spectrum->last_us = worker->timestamps_us[read - 1];
+    spectrum->bin_hz = span_us > 0 ? (used - 1) * 1e6 / span_us / size : 0.0;
+    spectrum->bin_count = bins;
+    analysis->back = analysis->ready.exchange(analysis->back | FFT_FRESH, std::memory_order_acq_rel) & 3;
+    analysis->analyzed_last_us = last_us;
+    worker->transforms.fetch_add(segments, std::memory_order_relaxed);
+    worker->busy_ns.fetch_add(platform_time_ns() - start_ns, std::memory_order_relaxed);
+}
+
+// Goes over the analyses every interval, or right away when one is changed
+void fft_worker_thread(void *parameters) {
+    fft_worker *worker = (fft_worker *)parameters;
+    while(!worker->stop.load(std::memory_order_relaxed)) {
+        for(int i = 0; i < FFT_MAX_ANALYSES; i++) {
+            fft_analysis *analysis = &worker->analyses[i];
+            platform_mutex_lock(&worker->lock);
+            fft_config config = analysis->config;
+            if(analysis->changed) {
+                analysis->changed = false;
+                analysis->analyzed_last_us = INT64_MIN;
+            }
+            platform_mutex_unlock(&worker->lock);
+            if(config.enabled) {
+                fft_analyze(worker, analysis, &config);
+            }
+        }
+        platform_event_wait(&worker->wake, worker->interval_ms);
+    }
+}
+
+bool fft_worker_start(fft_worker *worker, sample_store *store, int interval_ms) {
+    worker->store = store;
+    worker->kernels = fft_active_kernels();
+    worker->interval_ms = interval_ms;
+    memset(worker->plans, 0, sizeof(worker->plans));
+    worker->timestamps_us = NULL;
+    worker->values = NULL;
+    worker->sample_capacity = 0;
+    worker->sequence = 0;
+    for(int i = 0; i < FFT_MAX_ANALYSES; i++) {
+        fft_analysis *analysis = &worker->analyses[i];
+        memset(&analysis->config, 0, sizeof(analysis->config));
+        memset(analysis->spectra, 0, sizeof(analysis->spectra));
+        analysis->changed = false;
+        analysis->back = 0;
+        analysis->ready.store(1);
+        analysis->front = 2;
+        analysis->analyzed_last_us = INT64_MIN;
+    }
+    worker->stop.store(0);
+    worker->transforms.store(0);
+    worker->busy_ns.store(0);
+    platform_mutex_init(&worker->lock);
+    platform_event_init(&worker->wake);
+    if(!platform_thread_start(&worker->thread, fft_worker_thread, worker)) {
+        platform_event_destroy(&worker->wake);
+        platform_mutex_destroy(&worker->lock);
+        return false;
+    }
+    return true;
+}
+
+void fft_worker_stop(fft_worker *worker) {
+    worker->stop.store(1);
+    platform_event_signal(&worker->wake);
+    platform_thread_join(&worker->thread);
+    platform_event_destroy(&worker->wake);
+    platform_mutex_destroy(&worker->lock);
+    for(int i = 0; i <= FFT_MAX_LOG2; i++) {
+        fft_plan_destroy(worker->plans[i]);
+    }
+    for(int i = 0; i < FFT_MAX_ANALYSES; i++) {
+        for(int j = 0; j < 3; j++) {
+            free(worker->analyses[i].spectra[j].magnitudes);
+        }
+    }
+    free(worker->timestamps_us);
+    free(worker->values);
+}
+
+// Any thread. The next spectrum of the analysis is made with the new settings right away.
+void fft_configure(fft_worker *worker, int analysis, const fft_config *config) {
+    platform_mutex_lock(&worker->lock);
+    fft_config *target = &worker->analyses[analysis].config;
+    *target = *config;
+    target->log2_size = config->log2_size > FFT_MIN_LOG2 ? config->log2_size : FFT_MIN_LOG2;
+    target->log2_size = target->log2_size < FFT_MAX_LOG2 ? target->log2_size : FFT_MAX_LOG2;
+    target->window = config->window >= 0 && config->window < fft_window_count ? config->window : fft_window_hann;
+    worker->analyses[analysis].changed = true;
+    platform_mutex_unlock(&worker->lock);
+    platform_event_signal(&worker->wake);
+}
+
+// UI thread. The newest spectrum of the analysis, bin_count is 0 until there is one. Stays valid until the next
+// call for the same analysis.
+const fft_spectrum *fft_read(fft_worker *worker, int analysis) {
+    fft_analysis *target = &worker->analyses[analysis];
+    if(target->ready.load(std::memory_order_relaxed) & FFT_FRESH) {
+        target->front = target->ready.exchange(target->front, std::memory_order_acq_rel) & 3;
+    }
+    return &target->spectra[target->front];
+}
@@ -0,0 +1,3430 @@
+// Headless build of the client, everything but the window and renderer.
+// Runs the pipeline against a stand-in device on loopback so it can be exercised on Linux.
+
+#include "imgui/imgui.h"
+#include "imgui/imgui_internal.h"
+
+#include "platform.cpp"
+#include "net_poll.cpp"
+#include "network.cpp"
+#include "requests.cpp"
+#include "discovery.cpp"
+#include "store.cpp"
+#include "compress.cpp"
+#include "capture.cpp"
+#include "capture_view.cpp"
+#include "decode.cpp"
+#include "query.cpp"
+#include "stats.cpp"
+#include "fft.cpp"
+#include "derived.cpp"
+#include "alarm.cpp"
+#include "scheduler.cpp"
+#include "draw_hash.cpp"
+#include "ingest.cpp"
+#include "connection.cpp"
+#include "replay.cpp"
+#include "logic.cpp"
+#include "retained.cpp"
+#include "plot.cpp"
+
+#include <math.h>
+
+#define HEADLESS_PORT 17777
+// Sessions mode puts one stand-in device on each port from here on
+#define HEADLESS_SESSION_PORT 17800
+#define HEADLESS_DISCOVERY_DEVICE_PORT 17778
+#define HEADLESS_DISCOVERY_CLIENT_PORT 17779
+
+#define STAND_IN_HISTORY_US 10000000ULL
+#define STAND_IN_MAX_DELAYED_REPLIES 256
+
+// Pretends to be the ESP32: samples are a function of the device clock, so the history ring is simply
+// how far back the stream cursor may be rewound. Can drop the connection periodically to exercise reconnects.
+typedef struct {
+    int port;
+    int channel_count;
+    int samples_per_block;
+    int sample_rate_hz;
+    int drop_after_ms;
+    int outage_ms;
+    // How long the device takes to answer a data_request
+    int reply_latency_ms;
+    // Answers discovery probes and sends beacons when set, loopback can't broadcast so beacons go to 127.0.0.1
+    int discovery_port;
+    int beacon_port;
+    SOCKET discovery_socket;
+    platform_thread discovery_thread;
+    std::atomic<int> running;
+    std::atomic<uint64_t> requests_answered;
+    std::atomic<uint64_t> samples_sent;
+    std::atomic<uint32_t> connections;
+    SOCKET listen_socket;
+    platform_thread thread;
+} stand_in_device;
+
+bool stand_in_send_all(stand_in_device *device, SOCKET client, const char *data, int length) {
+    int sent = 0;
+    while(sent < length && device->running.load(std::memory_order_relaxed)) {
+        int result = send(client, data + sent, length - sent, 0);
+        if(result > 0) {
+            sent += result;
+        } else if(result < 0 && net_error_would_block(net_last_error())) {
+            platform_sleep_ms(1);
+        } else {
+            return false;
+        }
+    }
+    return sent == length;
+}
+
+// Replies go out in order once due, the latency is the same for all of them
+typedef struct {
+    uint64_t due_ns;
+    int length;
+    char frame[REQUEST_MAX_FRAME_SIZE];
+} delayed_reply;
+
+typedef struct {
+    delayed_reply replies[STAND_IN_MAX_DELAYED_REPLIES];
+    int head;
+    int count;
+} delayed_reply_ring;
+
+// The value of a data point is its name echoed back, good enough to match replies to requests
+void stand_in_queue_reply(delayed_reply_ring *ring, const frame_header *request, const char *payload,
+                          uint64_t due_ns) {
+    if(ring->count == STAND_IN_MAX_DELAYED_REPLIES ||
+       sizeof(frame_header) + request->payload_length > REQUEST_MAX_FRAME_SIZE) {
+        return;
+    }
+    delayed_reply *reply = &ring->replies[(ring->head + ring->count++) % STAND_IN_MAX_DELAYED_REPLIES];
+    frame_header header = *request;
+    header.message_type = message_type_data_input;
+    memcpy(reply->frame, &header, sizeof(header));
+    memcpy(reply->frame + sizeof(header), payload, request->payload_length);
+    reply->length = sizeof(header) + request->payload_length;
+    reply->due_ns = due_ns;
+}
+
+// frame has room for the header in front of the payload
+void stand_in_send_frame(stand_in_device *device, SOCKET client, char *frame, int length) {
+    frame_header header = {};
+    header.payload_length = (uint16_t)(length - sizeof(frame_header));
+    header.message_type = message_type_sample_batch;
+    memcpy(frame, &header, sizeof(header));
+    stand_in_send_all(device, client, frame, length);
+}
+
+bool stand_in_listen(stand_in_device *device) {
+    device->listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(device->listen_socket == INVALID_SOCKET) {
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(device->listen_socket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)device->port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(device->listen_socket, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+       listen(device->listen_socket, 4) != 0) {
+        closesocket(device->listen_socket);
+        device->listen_socket = INVALID_SOCKET;
+        return false;
+    }
+    net_set_nonblocking(device->listen_socket);
+    return true;
+}
+
+// Serves one client until it goes away, the device is stopped or it is time to drop it
+void stand_in_serve(stand_in_device *device, SOCKET client, uint64_t clock_start_ns, uint32_t sample_period_us) {
+    char *receive_buffer = (char *)malloc(kilobytes(64));
+    int receive_length = 0;
+    char *frame = (char *)malloc(sizeof(frame_header) + FRAME_MAX_PAYLOAD);
+    bool subscribed[SUBSCRIPTION_MAX_CHANNELS * CONNECTION_MAX_SUBSCRIPTIONS] = {};
+    bool streaming = false;
+    uint64_t cursor = 0;
+    uint64_t connected_ns = platform_time_ns();
+    bool as_fast_as_possible = device->sample_rate_hz <= 0;
+    int block_size = sizeof(sample_block_header) + device->samples_per_block * sizeof(int16_t);
+    int blocks_per_frame = FRAME_MAX_PAYLOAD / block_size;
+    delayed_reply_ring *replies = (delayed_reply_ring *)malloc(sizeof(delayed_reply_ring));
+    replies->head = 0;
+    replies->count = 0;
+
+    while(device->running.load(std::memory_order_acquire)) {
+        uint64_t now_ns = platform_time_ns();
+        if(device->drop_after_ms > 0 && now_ns - connected_ns > (uint64_t)device->drop_after_ms * 1000000ULL) {
+            break;
+        }
+
+        int result = recv(client, receive_buffer + receive_length, kilobytes(64) - receive_length, 0);
+        if(result == 0 || (result < 0 && !net_error_would_block(net_last_error()))) {
+            break;
+        }
+        if(result > 0) {
+            receive_length += result;
+        }
+
+        uint64_t device_now = as_fast_as_possible ? cursor + device->samples_per_block
+                                                  : (now_ns - clock_start_ns) / 1000ULL / sample_period_us;
+        int offset = 0;
+        frame_header header;
+        while(frame_peek(receive_buffer + offset, receive_length - offset, &header)) {
+            const char *payload = receive_buffer + offset + sizeof(header);
+            switch(header.message_type) {
+                case message_type_keepalive: {
+                    stand_in_send_all(device, client, receive_buffer + offset, sizeof(header));
+                } break;
+
+                case message_type_data_request: {
+                    stand_in_queue_reply(replies, &header, payload,
+                                         now_ns + (uint64_t)device->reply_latency_ms * 1000000ULL);
+                } break;
+
+                case message_type_subscribe: {
+                    for(int i = sizeof(uint32_t); i + 1 < header.payload_length; i += sizeof(uint16_t)) {
+                        uint16_t channel_id;
+                        memcpy(&channel_id, payload + i, sizeof(channel_id));
+                        if(channel_id < array_count(subscribed)) {
+                            subscribed[channel_id] = true;
+                        }
+                    }
+                    if(!streaming) {
+                        streaming = true;
+                        cursor = device_now;
+                    }
+                } break;
+
+                case message_type_history_request: {
+                    uint64_t since_us;
+                    memcpy(&since_us, payload, sizeof(since_us));
+                    uint64_t since = (since_us + sample_period_us - 1) / sample_period_us;
+                    uint64_t oldest = device_now > STAND_IN_HISTORY_US / sample_period_us 
+                                    ? device_now - STAND_IN_HISTORY_US / sample_period_us : 0;
+                    cursor = since > oldest ? since : oldest;
+                } break;
+
+                default: {
+                } break;
+            }
+            offset += sizeof(header) + header.payload_length;
+        }
+        memmove(receive_buffer, receive_buffer + offset, receive_length - offset);
+        receive_length -= offset;
+
+        while(replies->count > 0 && replies->replies[replies->head].due_ns <= now_ns) {
+            delayed_reply *reply = &replies->replies[replies->head];
+            stand_in_send_all(device, client, reply->frame, reply->length);
+            device->requests_answered.fetch_add(1);
+            replies->head = (replies->head + 1) % STAND_IN_MAX_DELAYED_REPLIES;
+            replies->count--;
+        }
+
+        if(!streaming || cursor + device->samples_per_block > device_now) {
+            platform_sleep_ms(1);
+            continue;
+        }
+
+        // One block per subscribed channel, as many blocks per frame as fit
+        int payload_offset = sizeof(frame_header);
+        int blocks = 0;
+        uint64_t samples = 0;
+        for(int channel = 0; channel < device->channel_count; channel++) {
+            if(!subscribed[channel]) {
+                continue;
+            }
+            sample_block_header block = {};
+            block.channel_id = (uint16_t)channel;
+            block.sample_count = (uint16_t)device->samples_per_block;
+            block.sample_format = sample_format_i16;
+            block.first_timestamp_us = cursor * sample_period_us;
+            block.sample_period_us = sample_period_us;
+            memcpy(frame + payload_offset, &block, sizeof(block));
+            payload_offset += sizeof(block);
+            for(int i = 0; i < device->samples_per_block; i++) {
+                int16_t value = (int16_t)((cursor + i + channel * 100) % 4096);
+                memcpy(frame + payload_offset, &value, sizeof(value));
+                payload_offset += sizeof(value);
+            }
+            samples += device->samples_per_block;
+            if(++blocks == blocks_per_frame) {
+                stand_in_send_frame(device, client, frame, payload_offset);
+                payload_offset = sizeof(frame_header);
+                blocks = 0;
+            }
+        }
+        if(blocks > 0) {
+            stand_in_send_frame(device, client, frame, payload_offset);
+        }
+        device->samples_sent.fetch_add(samples);
+        cursor += device->samples_per_block;
+    }
+    free(replies);
+    free(frame);
+    free(receive_buffer);
+}
+
+void stand_in_device_thread(void *parameters) {
+    stand_in_device *device = (stand_in_device *)parameters;
+    uint32_t sample_period_us = device->sample_rate_hz > 0 ? 1000000 / device->sample_rate_hz : 1;
+    uint64_t clock_start_ns = platform_time_ns();
+
+    while(device->running.load(std::memory_order_acquire)) {
+        SOCKET client = accept(device->listen_socket, NULL, NULL);
+        if(client == INVALID_SOCKET) {
+            platform_sleep_ms(1);
+            continue;
+        }
+        device->connections.fetch_add(1);
+        net_set_nonblocking(client);
+        net_set_nodelay(client);
+        stand_in_serve(device, client, clock_start_ns, sample_period_us);
+        closesocket(client);
+
+        if(device->drop_after_ms > 0 && device->running.load()) {
+            // Drops off the network for a while, nobody can connect in the meantime
+            closesocket(device->listen_socket);
+            platform_sleep_ms(device->outage_ms);
+            while(device->running.load() && !stand_in_listen(device)) {
+                platform_sleep_ms(10);
+            }
+        }
+    }
+}
+
+void stand_in_send_beacon(stand_in_device *device, const struct sockaddr_in *destination) {
+    discovery_packet beacon = {};
+    beacon.magic = DISCOVERY_MAGIC;
+    beacon.version = DISCOVERY_VERSION;
+    beacon.kind = discovery_kind_beacon;
+    beacon.tcp_port = (uint16_t)device->port;
+    beacon.device_id[5] = (uint8_t)device->port;
+    beacon.connected_clients = device->connections.load() > 0;
+    beacon.firmware_hash = 0x5EED;
+    sendto(device->discovery_socket, (const char *)&beacon, sizeof(beacon), 0, (const struct sockaddr *)destination,
+           sizeof(*destination));
+}
+
+void stand_in_discovery_thread(void *parameters) {
+    stand_in_device *device = (stand_in_device *)parameters;
+    struct sockaddr_in beacon_address = {};
+    beacon_address.sin_family = AF_INET;
+    beacon_address.sin_port = htons((uint16_t)device->beacon_port);
+    beacon_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    uint64_t next_beacon_ns = platform_time_ns();
+    while(device->running.load(std::memory_order_acquire)) {
+        if(platform_time_ns() >= next_beacon_ns) {
+            stand_in_send_beacon(device, &beacon_address);
+            next_beacon_ns += DISCOVERY_BEACON_INTERVAL_MS * 1000000ULL;
+        }
+        discovery_packet probe;
+        struct sockaddr_in source = {};
+        socklen_t source_length = sizeof(source);
+        int result = recvfrom(device->discovery_socket, (char *)&probe, sizeof(probe), 0, (struct sockaddr *)&source,
+                              &source_length);
+        if(result < 0) {
+            platform_sleep_ms(1);
+        } else if(result >= (int)offsetof(discovery_packet, tcp_port) && probe.magic == DISCOVERY_MAGIC &&
+                  probe.kind == discovery_kind_probe) {
+            stand_in_send_beacon(device, &source);
+        }
+    }
+}
+
+bool stand_in_discovery_start(stand_in_device *device) {
+    device->discovery_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)device->discovery_port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(device->discovery_socket == INVALID_SOCKET || 
+       bind(device->discovery_socket, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        return false;
+    }
+    net_set_nonblocking(device->discovery_socket);
+    return platform_thread_start(&device->discovery_thread, stand_in_discovery_thread, device);
+}
+
+bool stand_in_device_start(stand_in_device *device) {
+    if(!stand_in_listen(device)) {
+        return false;
+    }
+    device->running.store(1);
+    device->samples_sent.store(0);
+    device->connections.store(0);
+    device->requests_answered.store(0);
+    if(device->discovery_port > 0 && !stand_in_discovery_start(device)) {
+        return false;
+    }
+    return platform_thread_start(&device->thread, stand_in_device_thread, device);
+}
+
+void stand_in_device_stop(stand_in_device *device) {
+    device->running.store(0);
+    platform_thread_join(&device->thread);
+    closesocket(device->listen_socket);
+    if(device->discovery_port > 0) {
+        platform_thread_join(&device->discovery_thread);
+        closesocket(device->discovery_socket);
+    }
+}
+
+void subscribe_all(connection_manager *connection, int device, int channel_count, uint32_t sample_period_us) {
+    for(int first = 0; first < channel_count; first += SUBSCRIPTION_MAX_CHANNELS) {
+        uint16_t channel_ids[SUBSCRIPTION_MAX_CHANNELS];
+        int count = 0;
+        for(int channel = first; channel < channel_count && count < SUBSCRIPTION_MAX_CHANNELS; channel++) {
+            channel_ids[count++] = (uint16_t)channel;
+        }
+        connection_manager_subscribe(connection, device, channel_ids, count, sample_period_us);
+    }
+}
+
+// Streams from the stand-in device while a fake UI thread reads the snapshot at 60 Hz
+int run_ingest(int seconds, int channel_count, int sample_rate_hz) {
+    ingest_pipeline pipeline = {};
+    connection_manager connection = {};
+    stand_in_device device = {};
+    device.port = HEADLESS_PORT;
+    device.channel_count = channel_count;
+    device.samples_per_block = 100;
+    device.sample_rate_hz = sample_rate_hz;
+
+    char port[8];
+    snprintf(port, sizeof(port), "%d", HEADLESS_PORT);
+    if(!stand_in_device_start(&device) || !ingest_pipeline_start(&pipeline) ||
+       !connection_manager_start(&connection, &pipeline) || connection_manager_add_device(&connection) != 0) {
+        printf("ingest: failed to start\n");
+        return 1;
+    }
+    subscribe_all(&connection, 0, channel_count, 0);
+    connection_manager_connect(&connection, 0, "127.0.0.1", port, 1000);
+
+    ingest_snapshot *snapshot = (ingest_snapshot *)malloc(sizeof(ingest_snapshot));
+    uint64_t frames = 0;
+    uint64_t failed_reads = 0;
+    uint64_t read_total_ns = 0;
+    uint64_t read_max_ns = 0;
+    uint64_t start_ns = platform_time_ns();
+    while(platform_time_ns() - start_ns < (uint64_t)seconds * 1000000000ULL) {
+        uint64_t before = platform_time_ns();
+        if(!ingest_read_snapshot(&pipeline, snapshot)) {
+            failed_reads++;
+        }
+        uint64_t elapsed = platform_time_ns() - before;
+        read_total_ns += elapsed;
+        read_max_ns = elapsed > read_max_ns ? elapsed : read_max_ns;
+        frames++;
+        platform_sleep_ms(16);
+    }
+
+    uint64_t sent = device.samples_sent.load();
+    int state = connection_manager_state(&connection, 0);
+    stand_in_device_stop(&device);
+    connection_manager_stop(&connection);
+    ingest_pipeline_stop(&pipeline);
+    ingest_read_snapshot(&pipeline, snapshot);
+
+    printf("ingest: %s, %d channels at %d Hz for %d s\n",
+           connection_state_name(state), channel_count, sample_rate_hz, seconds);
+    printf("ingest: samples sent %llu, received %llu (%.0f samples/s), batches %llu\n", (unsigned long long)sent,
+           (unsigned long long)snapshot->total_samples, (double)snapshot->total_samples / seconds,
+           (unsigned long long)snapshot->total_batches);
+    printf("ingest: snapshot reads %llu, avg %.0f ns, max %llu ns, failed %llu\n", (unsigned long long)frames,
+           frames ? (double)read_total_ns / frames : 0.0, (unsigned long long)read_max_ns,
+           (unsigned long long)failed_reads);
+    printf("ingest: store holds %llu samples in %.1f MB\n", (unsigned long long)snapshot->stored_samples,
+           snapshot->stored_bytes / 1048576.0);
+    int result = (snapshot->total_samples > 0 && snapshot->stored_samples == snapshot->total_samples) ? 0 : 1;
+    free(snapshot);
+    return result;
+}
+
+// The stand-in device drops off the network every drop_after_ms for outage_ms, the client has to come back
+// on its own and fill the hole from the history ring
+int run_reconnect(int seconds, int drop_after_ms, int outage_ms) {
+    ingest_pipeline pipeline = {};
+    connection_manager connection = {};
+    stand_in_device device = {};
+    device.port = HEADLESS_PORT;
+    device.channel_count = 4;
+    device.samples_per_block = 10;
+    device.sample_rate_hz = 1000;
+    device.drop_after_ms = drop_after_ms;
+    device.outage_ms = outage_ms;
+
+    char port[8];
+    snprintf(port, sizeof(port), "%d", HEADLESS_PORT);
+    if(!stand_in_device_start(&device) || !ingest_pipeline_start(&pipeline) ||
+       !connection_manager_start(&connection, &pipeline) || connection_manager_add_device(&connection) != 0) {
+        printf("reconnect: failed to start\n");
+        return 1;
+    }
+    subscribe_all(&connection, 0, device.channel_count, 1000);
+    // A name, every reconnect goes through the resolver thread
+    connection_manager_connect(&connection, 0, "localhost", port, 1000);
+
+    ingest_snapshot *snapshot = (ingest_snapshot *)malloc(sizeof(ingest_snapshot));
+    uint64_t start_ns = platform_time_ns();
+    uint64_t reconnecting_frames = 0;
+    uint64_t frames = 0;
+    while(platform_time_ns() - start_ns < (uint64_t)seconds * 1000000000ULL) {
+        reconnecting_frames += connection_manager_state(&connection, 0) == connection_state_reconnecting;
+        frames++;
+        platform_sleep_ms(16);
+    }
+    // Let the last history request come in
+    while(connection_manager_state(&connection, 0) != connection_state_connected && 
+          platform_time_ns() - start_ns < (uint64_t)(seconds + 10) * 1000000000ULL) {
+        platform_sleep_ms(16);
+    }
+    platform_sleep_ms(200);
+
+    int state = connection_manager_state(&connection, 0);
+    connection_metrics *metrics = connection_manager_metrics(&connection, 0);
+    uint32_t reconnects = metrics->reconnect_count.load();
+    printf("reconnect: %s, device accepted %u connections, reconnected %u times\n", connection_state_name(state),
+           device.connections.load(), reconnects);
+    printf("reconnect: last reconnect %.1f ms, average %.1f ms, last gap %lld us, %.0f%% of frames reconnecting\n",
+           metrics->last_reconnect_ns.load() / 1e6,
+           reconnects ? metrics->total_reconnect_ns.load() / 1e6 / reconnects : 0.0,
+           (long long)metrics->last_gap_us.load(), 100.0 * reconnecting_frames / frames);
+
+    // Metrics live with the device session, which goes away with the manager
+    connection_manager_stop(&connection);
+    stand_in_device_stop(&device);
+    ingest_pipeline_stop(&pipeline);
+    ingest_read_snapshot(&pipeline, snapshot);
+
+    // Samples are every 1000 us, anything the history ring didn't fill in shows up as missing
+    int64_t missing = 0;
+    for(int i = 0; i < snapshot->channel_count; i++) {
+        channel_latest *channel = &snapshot->channels[i];
+        int64_t expected = (channel->timestamp_us - channel->first_timestamp_us) / 1000 + 1;
+        missing += expected - (int64_t)channel->sample_count;
+    }
+    printf("reconnect: %llu samples received over %d channels, %lld missing\n",
+           (unsigned long long)snapshot->total_samples, snapshot->channel_count, (long long)missing);
+    int result = (reconnects > 0 && missing == 0) ? 0 : 1;
+    free(snapshot);
+    return result;
+}
+
+typedef struct {
+    std::atomic<int> completed;
+    std::atomic<int> failed;
+} pipeline_counter;
+
+void pipeline_request_done(void *user_data, int status, const frame_header *header, const char *payload) {
+    (void)header;
+    (void)payload;
+    pipeline_counter *counter = (pipeline_counter *)user_data;
+    if(status == request_status_ok) {
+        counter->completed.fetch_add(1);
+    } else {
+        counter->failed.fetch_add(1);
+    }
+}
+
+// Same number of data requests against a device with a fixed reply latency, once per window size.
+// With a window of 1 every request pays the full round trip.
+int run_pipeline(int request_count, int reply_latency_ms) {
+    ingest_pipeline pipeline = {};
+    connection_manager connection = {};
+    stand_in_device device = {};
+    device.port = HEADLESS_PORT;
+    device.channel_count = 1;
+    device.samples_per_block = 10;
+    device.sample_rate_hz = 1000;
+    device.reply_latency_ms = reply_latency_ms;
+
+    char port[8];
+    snprintf(port, sizeof(port), "%d", HEADLESS_PORT);
+    if(!stand_in_device_start(&device) || !ingest_pipeline_start(&pipeline) ||
+       !connection_manager_start(&connection, &pipeline) || connection_manager_add_device(&connection) != 0) {
+        printf("pipeline: failed to start\n");
+        return 1;
+    }
+    connection_manager_connect(&connection, 0, "127.0.0.1", port, 1000);
+    while(connection_manager_state(&connection, 0) != connection_state_connected) {
+        platform_sleep_ms(1);
+    }
+
+    char frame[64];
+    tcp_message message = {};
+    message.buffer = frame;
+    message.buffer_length = sizeof(frame);
+    char name[] = "GPIO0";
+    char *data_points[] = {name};
+    encode_data_request(&message, data_points, 1);
+
+    int result = 0;
+    int windows[] = {1, 4, 16, 64};
+    for(int w = 0; w < (int)array_count(windows); w++) {
+        pipeline_counter counter = {};
+        connection_manager_set_window(&connection, 0, windows[w]);
+        connection_metrics *metrics = connection_manager_metrics(&connection, 0);
+        uint64_t writes_before = metrics->writes.load();
+        uint64_t round_trip_before = metrics->request_round_trip_ns.load();
+        uint64_t completed_before = metrics->requests_completed.load();
+
+        uint64_t start_ns = platform_time_ns();
+        int submitted = 0;
+        while(counter.completed.load() + counter.failed.load() < request_count) {
+            // The queue is bounded, keep it topped up like a UI issuing requests would
+            while(submitted < request_count &&
+                  connection_manager_request(&connection, 0, &message, pipeline_request_done, &counter)) {
+                submitted++;
+            }
+            platform_sleep_ms(1);
+        }
+        double seconds = (platform_time_ns() - start_ns) / 1e9;
+
+        uint64_t completed = metrics->requests_completed.load() - completed_before;
+        printf("pipeline: window %2d, %d requests in %.2f s, %.0f requests/s, avg rtt %.1f ms, "
+               "%.2f writes/request, %d failed\n", windows[w], request_count, seconds, request_count / seconds,
+               completed ? (metrics->request_round_trip_ns.load() - round_trip_before) / 1e6 / completed : 0.0,
+               (double)(metrics->writes.load() - writes_before) / request_count, counter.failed.load());
+        result |= counter.failed.load() != 0;
+    }
+
+    connection_manager_stop(&connection);
+    stand_in_device_stop(&device);
+    ingest_pipeline_stop(&pipeline);
+    return result;
+}
+
+// One stand-in device per session, all streaming at once into the same store. The session count doubles up
+// to max_sessions, the CPU time of the I/O and store threads is reported per session.
+int run_sessions(int max_sessions, int seconds, int sample_rate_hz) {
+    if(max_sessions < 1 || max_sessions > CONNECTION_MAX_DEVICES) {
+        printf("sessions: between 1 and %d sessions\n", CONNECTION_MAX_DEVICES);
+        return 1;
+    }
+    stand_in_device *devices = (stand_in_device *)calloc(max_sessions, sizeof(stand_in_device));
+    ingest_snapshot *snapshot = (ingest_snapshot *)malloc(sizeof(ingest_snapshot));
+    int channels_per_device = 4;
+    int result = 0;
+
+    for(int session_count = 1; session_count <= max_sessions; session_count *= 2) {
+        if(session_count * 2 > max_sessions && session_count != max_sessions) {
+            // Always finish with max_sessions
+            session_count = max_sessions;
+        }
+        ingest_pipeline pipeline = {};
+        connection_manager connection = {};
+        if(!ingest_pipeline_start(&pipeline) || !connection_manager_start(&connection, &pipeline)) {
+            printf("sessions: failed to start\n");
+            result = 1;
+            break;
+        }
+        int started = 0;
+        for(; started < session_count; started++) {
+            stand_in_device *device = &devices[started];
+            device->port = HEADLESS_SESSION_PORT + started;
+            device->channel_count = channels_per_device;
+            device->samples_per_block = 100;
+            device->sample_rate_hz = sample_rate_hz;
+            int index = connection_manager_add_device(&connection);
+            if(index < 0 || !stand_in_device_start(device)) {
+                break;
+            }
+            char port[8];
+            snprintf(port, sizeof(port), "%d", device->port);
+            subscribe_all(&connection, index, channels_per_device, 0);
+            connection_manager_connect(&connection, index, "127.0.0.1", port, 1000);
+        }
+
+        uint64_t start_ns = platform_time_ns();
+        uint64_t io_before_ns = platform_thread_cpu_ns(&connection.io_thread);
+        uint64_t store_before_ns = platform_thread_cpu_ns(&pipeline.store_thread);
+        platform_sleep_ms(seconds * 1000);
+        uint64_t io_ns = platform_thread_cpu_ns(&connection.io_thread) - io_before_ns;
+        uint64_t store_ns = platform_thread_cpu_ns(&pipeline.store_thread) - store_before_ns;
+        double elapsed = (platform_time_ns() - start_ns) / 1e9;
+
+        int connected = 0;
+        for(int i = 0; i < connection_manager_device_count(&connection); i++) {
+            connected += connection_manager_state(&connection, i) == connection_state_connected;
+        }
+        connection_manager_stop(&connection);
+        for(int i = 0; i < started; i++) {
+            stand_in_device_stop(&devices[i]);
+        }
+        ingest_pipeline_stop(&pipeline);
+        ingest_read_snapshot(&pipeline, snapshot);
+
+        // Every device has its own channels 0..3, only the device-qualified ids keep them apart
+        int devices_seen = 0;
+        for(int i = 0; i < snapshot->channel_count; i++) {
+            uint32_t id = snapshot->channels[i].channel_id;
+            devices_seen += device_channel_channel(id) == 0 && device_channel_device(id) < session_count;
+        }
+        double io_percent = 100.0 * io_ns / 1e9 / elapsed;
+        printf("sessions: %2d/%2d connected, %4d channels from %2d devices, %.0f samples/s, "
+               "I/O thread %.2f%% CPU (%.3f%% per session), store thread %.2f%%\n",
+               connected, session_count, snapshot->channel_count, devices_seen,
+               snapshot->total_samples / elapsed, io_percent, io_percent / session_count,
+               100.0 * store_ns / 1e9 / elapsed);
+        result |= connected != session_count || devices_seen != session_count;
+        if(session_count == max_sessions) {
+            break;
+        }
+    }
+    free(snapshot);
+    free(devices);
+    return result;
+}
+
+// Cold start: the device is already up, the client knows nothing about it. Measures how long it takes from
+// starting the client to having a connection, either with a subnet probe or by waiting for a beacon.
+int run_discovery(bool probe) {
+    stand_in_device device = {};
+    device.port = HEADLESS_PORT;
+    device.channel_count = 1;
+    device.samples_per_block = 10;
+    device.sample_rate_hz = 1000;
+    device.discovery_port = HEADLESS_DISCOVERY_DEVICE_PORT;
+    device.beacon_port = HEADLESS_DISCOVERY_CLIENT_PORT;
+    if(!stand_in_device_start(&device)) {
+        printf("discovery: failed to start the device\n");
+        return 1;
+    }
+    // Somewhere in between two beacons, like a client started at a random time would be
+    platform_sleep_ms(DISCOVERY_BEACON_INTERVAL_MS / 2);
+
+    ingest_pipeline pipeline = {};
+    connection_manager connection = {};
+    discovery *disc = (discovery *)calloc(1, sizeof(discovery));
+    discovered_device found;
+    uint64_t start_ns = platform_time_ns();
+    if(!discovery_start(disc, HEADLESS_DISCOVERY_CLIENT_PORT, HEADLESS_DISCOVERY_DEVICE_PORT) ||
+       !ingest_pipeline_start(&pipeline) || !connection_manager_start(&connection, &pipeline) ||
+       connection_manager_add_device(&connection) != 0) {
+        printf("discovery: failed to start\n");
+        return 1;
+    }
+    if(probe) {
+        // Everything in 127.0.0.0/24 but 127.0.0.1 is silent, like the empty addresses of a bench subnet
+        discovery_probe_subnet(disc, "127.0.0.1", 24);
+    }
+
+    uint64_t found_ns = 0;
+    uint64_t connected_ns = 0;
+    while(platform_time_ns() - start_ns < 5000000000ULL) {
+        if(!found_ns && discovery_devices(disc, &found, 1) == 1) {
+            found_ns = platform_time_ns() - start_ns;
+            connection_manager_connect(&connection, 0, found.address, found.port, 1000);
+        }
+        if(found_ns && connection_manager_state(&connection, 0) == connection_state_connected) {
+            connected_ns = platform_time_ns() - start_ns;
+            break;
+        }
+        platform_sleep_ms(1);
+    }
+
+    printf("discovery: %s, %u probes sent, device found after %.1f ms at %s:%s, connected after %.1f ms\n",
+           probe ? "probe" : "beacon only", disc->probes_sent.load(), found_ns / 1e6, found_ns ? found.address : "-",
+           found_ns ? found.port : "-", connected_ns / 1e6);
+
+    connection_manager_stop(&connection);
+    ingest_pipeline_stop(&pipeline);
+    discovery_stop(disc);
+    stand_in_device_stop(&device);
+    free(disc);
+    return connected_ns > 0 ? 0 : 1;
+}
+
+// Appends sample_count samples spread over channel_count channels in batches like the ingest thread does,
+// then scans all of it and does random range lookups
+int run_store(uint64_t sample_count, int channel_count) {
+    const int batch_size = 1000;
+    int64_t *timestamps_us = (int64_t *)malloc(batch_size * sizeof(int64_t));
+    float *values = (float *)malloc(batch_size * sizeof(float));
+    sample_store *store = (sample_store *)calloc(1, sizeof(sample_store));
+    store_init(store, 0, 0);
+
+    uint64_t batches = sample_count / batch_size;
+    uint64_t start_ns = platform_time_ns();
+    for(uint64_t batch = 0; batch < batches; batch++) {
+        int channel = (int)(batch % channel_count);
+        int64_t first_us = (int64_t)(batch / channel_count) * batch_size * 100;
+        for(int i = 0; i < batch_size; i++) {
+            timestamps_us[i] = first_us + i * 100;
+            values[i] = (float)((batch + i) & 1023);
+        }
+        store_append(store, (uint32_t)channel, timestamps_us, values, batch_size);
+    }
+    double append_seconds = (platform_time_ns() - start_ns) / 1e9;
+    uint64_t stored = store->sample_count.load();
+    printf("store: appended %llu samples over %d channels in %.2f s, %.1f M samples/s, %.2f ns/sample\n",
+           (unsigned long long)stored, channel_count, append_seconds, stored / append_seconds / 1e6,
+           append_seconds * 1e9 / stored);
+    printf("store: %.1f MB, %.2f MB per million samples\n", store->bytes.load() / 1048576.0,
+           store_bytes_per_million_samples(store) / 1048576.0);
+
+    // Full scan, chunk by chunk like a reader holding the column lock would
+    start_ns = platform_time_ns();
+    double sum = 0.0;
+    uint64_t scanned = 0;
+    for(int c = 0; c < store->column_count.load(); c++) {
+        store_column *column = store->columns[c];
+        platform_mutex_lock(&column->lock);
+        for(int i = 0; i < column->chunk_count; i++) {
+            store_chunk *chunk = store_column_chunk(column, i);
+            float chunk_sum = 0.0f;
+            for(int j = 0; j < chunk->count; j++) {
+                chunk_sum += chunk->values[j];
+            }
+            sum += chunk_sum;
+            scanned += chunk->count;
+        }
+        platform_mutex_unlock(&column->lock);
+    }
+    double scan_seconds = (platform_time_ns() - start_ns) / 1e9;
+    printf("store: scanned %llu samples in %.3f s, %.0f M samples/s (sum %.0f)\n", (unsigned long long)scanned,
+           scan_seconds, scanned / scan_seconds / 1e6, sum);
+
+    // Random 100 sample windows anywhere in the history
+    const int lookups = 1000000;
+    int64_t last_us = (int64_t)(batches / channel_count) * batch_size * 100;
+    uint32_t random_state = 12345;
+    uint64_t found = 0;
+    start_ns = platform_time_ns();
+    for(int i = 0; i < lookups; i++) {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        int64_t from_us = (int64_t)(random_state % (uint64_t)last_us);
+        found += store_read(store, random_state % channel_count, from_us, from_us + 100 * 100, timestamps_us, values,
+                            batch_size);
+    }
+    double lookup_seconds = (platform_time_ns() - start_ns) / 1e9;
+    printf("store: %d range lookups in %.3f s, %.0f ns per lookup, %.1f samples each\n", lookups, lookup_seconds,
+           lookup_seconds * 1e9 / lookups, (double)found / lookups);
+
+    // Same appends against a 64 MB budget, the store has to stay within it
+    store_destroy(store);
+    store_init(store, 0, megabytes(64));
+    for(uint64_t batch = 0; batch < batches; batch++) {
+        int channel = (int)(batch % channel_count);
+        int64_t first_us = (int64_t)(batch / channel_count) * batch_size * 100;
+        for(int i = 0; i < batch_size; i++) {
+            timestamps_us[i] = first_us + i * 100;
+        }
+        store_append(store, (uint32_t)channel, timestamps_us, values, batch_size);
+    }
+    int64_t bounded_bytes = store->bytes.load();
+    printf("store: with a 64 MB budget, %.1f MB holding the newest %llu samples\n", bounded_bytes / 1048576.0,
+           (unsigned long long)store->sample_count.load());
+
+    store_destroy(store);
+    free(store);
+    free(timestamps_us);
+    free(values);
+    return (scanned == stored && bounded_bytes <= megabytes(64)) ? 0 : 1;
+}
+
+// Grows one channel to max_samples in decades and times drawing frames of it, the whole history and the
+// newest thousandth of it, pixel_count pixels wide. Samples over the memory budget only live on in the pyramid.
+// A frame depends on the width only, at no size may it cost more than flat_factor times the first one.
+int run_pyramid(uint64_t max_samples, int pixel_count) {
+    const int batch_size = 4096;
+    const int frames = 200;
+    const double flat_factor = 8.0;
+    int64_t *timestamps_us = (int64_t *)malloc(batch_size * sizeof(int64_t));
+    float *values = (float *)malloc(batch_size * sizeof(float));
+    store_envelope_pixel *pixels = (store_envelope_pixel *)malloc(pixel_count * sizeof(store_envelope_pixel));
+    sample_store *store = (sample_store *)calloc(1, sizeof(sample_store));
+    store_init(store, 0, megabytes(256));
+
+    int result = 0;
+    uint64_t appended = 0;
+    double first_us = 0.0;
+    for(uint64_t target = 1000; target <= max_samples; target *= 10) {
+        while(appended < target) {
+            int count = target - appended < batch_size ? (int)(target - appended) : batch_size;
+            for(int i = 0; i < count; i++) {
+                timestamps_us[i] = (int64_t)(appended + i) * 100;
+                values[i] = (float)((appended + i) % 1000);
+            }
+            store_append(store, 0, timestamps_us, values, count);
+            appended += count;
+        }
+        int64_t last_us = (int64_t)(appended - 1) * 100;
+
+        int full_level = 0;
+        int zoomed_level = 0;
+        uint64_t start_ns = platform_time_ns();
+        for(int i = 0; i < frames; i++) {
+            full_level = store_envelope(store, 0, 0, last_us, pixel_count, pixels);
+        }
+        double full_us = (platform_time_ns() - start_ns) / 1e3 / frames;
+        float min = 1e30f;
+        float max = -1e30f;
+        for(int x = 0; x < pixel_count; x++) {
+            if(pixels[x].count) {
+                min = pixels[x].min < min ? pixels[x].min : min;
+                max = pixels[x].max > max ? pixels[x].max : max;
+            }
+        }
+        if(min != 0.0f || max != 999.0f) {
+            result = 1;
+        }
+
+        start_ns = platform_time_ns();
+        for(int i = 0; i < frames; i++) {
+            zoomed_level = store_envelope(store, 0, last_us - last_us / 1000, last_us, pixel_count, pixels);
+        }
+        double zoomed_us = (platform_time_ns() - start_ns) / 1e3 / frames;
+        // Nothing has been dropped yet, a view that starts before the first sample still reads the samples
+        if(appended == 1000 && store_envelope(store, 0, -last_us, last_us, pixel_count, pixels) != -1) {
+            printf("pyramid: a view starting before the first sample didn't read the samples\n");
+            result = 1;
+        }
+
+        printf("pyramid: %11llu samples, whole history %7.1f us/frame (level %2d, range %.0f..%.0f), "
+               "newest 0.1%% %7.1f us/frame (level %2d), pyramid %.1f MB\n",
+               (unsigned long long)appended, full_us, full_level, min, max, zoomed_us, zoomed_level,
+               store->pyramid_bytes.load() / 1048576.0);
+        first_us = appended == 1000 ? (full_us > zoomed_us ? full_us : zoomed_us) : first_us;
+        if(full_us > first_us * flat_factor || zoomed_us > first_us * flat_factor) {
+            printf("pyramid: a frame costs more than %.0fx the one at 1000 samples\n", flat_factor);
+            result = 1;
+        }
+    }
+
+    store_destroy(store);
+    free(store);
+    free(pixels);
+    free(timestamps_us);
+    free(values);
+    return result;
+}
+
+// Channel c holds (timestamp / 100 + c) & 1023 at every timestamp in the capture benchmarks
+bool capture_write_pattern(capture_writer *writer, uint64_t sample_count, int channel_count, int sleep_every) {
+    const int batch_size = 1000;
+    int64_t timestamps_us[batch_size];
+    float values[batch_size];
+    uint64_t batches = sample_count / batch_size;
+    for(uint64_t batch = 0; batch < batches; batch++) {
+        int channel = (int)(batch % channel_count);
+        int64_t first = (int64_t)(batch / channel_count) * batch_size;
+        for(int i = 0; i < batch_size; i++) {
+            timestamps_us[i] = (first + i) * 100;
+            values[i] = (float)((first + i + channel) & 1023);
+        }
+        // Pace to the writer instead of dropping, this measures what it sustains
+        while(capture_writer_backlog(writer) > CAPTURE_MAX_BLOCKS / 2) {
+            platform_sleep_ms(1);
+        }
+        capture_writer_append(writer, (uint32_t)channel, timestamps_us, values, batch_size);
+        if(sleep_every && batch % sleep_every == 0) {
+            platform_sleep_ms(1);
+        }
+    }
+    return writer->samples_dropped.load() == 0;
+}
+
+// Reads every block back, returns the number of samples that match the pattern or -1 on any mismatch
+int64_t capture_verify_pattern(capture_reader *reader) {
+    int64_t *timestamps_us = (int64_t *)malloc(CAPTURE_BLOCK_SAMPLES * sizeof(int64_t));
+    float *values = (float *)malloc(CAPTURE_BLOCK_SAMPLES * sizeof(float));
+    int64_t verified = 0;
+    for(int64_t block = 0; block < reader->block_count && verified >= 0; block++) {
+        int count = capture_reader_read_block(reader, block, timestamps_us, values);
+        uint32_t channel = reader->index[block].channel_id;
+        for(int i = 0; i < count; i++) {
+            if(values[i] != (float)((timestamps_us[i] / 100 + channel) & 1023)) {
+                count = -1;
+                break;
+            }
+        }
+        verified = count < 0 ? -1 : verified + count;
+    }
+    free(timestamps_us);
+    free(values);
+    return verified;
+}
+
+// Write throughput to a file at path, then reading it back, then a recording that is cut short like after a
+// crash has to be readable up to its last checkpoint. Run it once on a tmpfs and once on a disk.
+int run_capture(const char *path, uint64_t sample_count, int channel_count, bool compress) {
+    capture_channel channels[16] = {};
+    for(int i = 0; i < channel_count && i < 16; i++) {
+        channels[i].channel_id = i;
+        channels[i].schema.channel_id = (uint16_t)i;
+        channels[i].schema.sample_format = sample_format_f32;
+        channels[i].schema.scale = 1.0f;
+        snprintf(channels[i].schema.name, sizeof(channels[i].schema.name), "channel %d", i);
+    }
+
+    capture_writer *writer = (capture_writer *)calloc(1, sizeof(capture_writer));
+    if(!capture_writer_start(writer, path, channels, channel_count < 16 ? channel_count : 16, compress)) {
+        printf("capture: can't create %s\n", path);
+        free(writer);
+        return 1;
+    }
+    uint64_t start_ns = platform_time_ns();
+    bool complete = capture_write_pattern(writer, sample_count, channel_count, 0);
+    bool written = capture_writer_stop(writer);
+    // Up to the final sync
+    double write_seconds = (platform_time_ns() - start_ns) / 1e9;
+    uint64_t bytes_written = writer->bytes_written.load();
+    uint64_t samples = writer->samples_written.load();
+    printf("capture: %s%s: %llu samples, %.1f MB in %.2f s, %.0f MB/s, %.1f M samples/s, %.1fx compressed, "
+           "%llu checkpoints\n", path, compress ? " compressed" : "", (unsigned long long)samples,
+           bytes_written / 1048576.0, write_seconds, bytes_written / 1048576.0 / write_seconds,
+           samples / write_seconds / 1e6, (double)writer->raw_bytes_written.load() / bytes_written,
+           (unsigned long long)writer->checkpoints.load());
+
+    capture_reader reader;
+    int64_t verified = -1;
+    start_ns = platform_time_ns();
+    if(capture_reader_open(&reader, path)) {
+        verified = capture_verify_pattern(&reader);
+        capture_reader_close(&reader);
+    }
+    double read_seconds = (platform_time_ns() - start_ns) / 1e9;
+    printf("capture: read back %lld samples in %.2f s, %.1f M samples/s\n", (long long)verified, read_seconds,
+           verified / read_seconds / 1e6);
+    int result = (complete && written && verified == (int64_t)samples && samples == sample_count) ? 0 : 1;
+
+    // Slow recording with frequent checkpoints, then cut off inside the last stretch of blocks
+    if(!capture_writer_start(writer, path, channels, 1, compress)) {
+        free(writer);
+        return 1;
+    }
+    writer->checkpoint_ms = 10;
+    capture_write_pattern(writer, 2000000, channel_count, 20);
+    capture_writer_stop(writer);
+    uint64_t crash_samples = writer->samples_written.load();
+    free(writer);
+
+    capture_footer footer = {};
+    platform_file file;
+    if(platform_file_open(&file, path)) {
+        platform_file_read(&file, platform_file_size(&file) - sizeof(footer), &footer, sizeof(footer));
+        platform_file_close(&file);
+    }
+    int64_t cut_at = (int64_t)footer.index_offset - 20000;
+    if(footer.magic != CAPTURE_INDEX_MAGIC || truncate(path, cut_at) != 0) {
+        return 1;
+    }
+    verified = -1;
+    bool recovered = false;
+    if(capture_reader_open(&reader, path)) {
+        recovered = reader.recovered;
+        verified = capture_verify_pattern(&reader);
+        capture_reader_close(&reader);
+    }
+    printf("capture: cut off at %lld bytes, recovered %lld of %llu samples up to the last checkpoint\n",
+           (long long)cut_at, (long long)verified, (unsigned long long)crash_samples);
+    remove(path);
+    return (result || !recovered || verified <= 0 || verified >= (int64_t)crash_samples) ? 1 : 0;
+}
+
+enum compress_trace {
+    compress_trace_adc,
+    compress_trace_temperature,
+    compress_trace_digital,
+    compress_trace_counter,
+    compress_trace_noise,
+    compress_trace_count
+};
+
+const char *compress_trace_names[compress_trace_count] = {
+    "12 bit ADC, 50 Hz sine at 10 kHz",
+    "temperature, 1/256 C at 10 Hz",
+    "digital line at 1 MHz",
+    "counter, jittered timestamps",
+    "white noise f32"
+};
+
+uint32_t compress_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Signals like the ones the devices sample, sample i of a trace is always the same
+void compress_trace_samples(int trace, int64_t first, int count, int64_t *timestamps_us, float *values,
+                            uint32_t *random_state) {
+    static float digital_level = 0.0f;
+    for(int i = 0; i < count; i++) {
+        int64_t n = first + i;
+        switch(trace) {
+        case compress_trace_adc: {
+            timestamps_us[i] = n * 100;
+            double volts = 1.65 + 0.8 * sin(2.0 * 3.14159265358979 * 50.0 * n / 10000.0) +
+                           0.01 * ((int)(compress_random(random_state) % 201) - 100) / 100.0;
+            values[i] = (float)(int)(volts / 3.3 * 4095.0 + 0.5) * (3.3f / 4095.0f);
+            break;
+        }
+        case compress_trace_temperature:
+            timestamps_us[i] = n * 100000;
+            values[i] = (float)(int)((21.5 + 2.0 * sin(n / 36000.0)) * 256.0) / 256.0f;
+            break;
+        case compress_trace_digital:
+            timestamps_us[i] = n;
+            if(compress_random(random_state) % 500 == 0) {
+                digital_level = 1.0f - digital_level;
+            }
+            values[i] = digital_level;
+            break;
+        case compress_trace_counter:
+            timestamps_us[i] = n * 1000 + (int)(compress_random(random_state) % 17) - 8;
+            values[i] = (float)n;
+            break;
+        default:
+            timestamps_us[i] = n * 100;
+            values[i] = (float)(compress_random(random_state) / 2147483648.0 - 1.0);
+            break;
+        }
+    }
+}
+
+// Compression ratio and single core encode and decode speed of the capture block encoding on every trace,
+// decoding every block on its own as a viewer seeking into the file does
+int run_compress(uint64_t sample_count) {
+    int block_count = (int)(sample_count / CAPTURE_BLOCK_SAMPLES);
+    int64_t *timestamps_us = (int64_t *)malloc(sample_count * sizeof(int64_t));
+    float *values = (float *)malloc(sample_count * sizeof(float));
+    uint8_t *encoded = (uint8_t *)malloc((uint64_t)block_count * CAPTURE_ENCODED_BOUND);
+    int *encoded_sizes = (int *)malloc(block_count * sizeof(int));
+    uint8_t *planes = (uint8_t *)malloc(CAPTURE_PLANES_SIZE);
+    int64_t decoded_timestamps_us[CAPTURE_BLOCK_SAMPLES];
+    float decoded_values[CAPTURE_BLOCK_SAMPLES];
+    if(!timestamps_us || !values || !encoded || !encoded_sizes || !planes || block_count == 0) {
+        return 1;
+    }
+    int result = 0;
+    for(int trace = 0; trace < compress_trace_count; trace++) {
+        uint32_t random_state = 12345;
+        compress_trace_samples(trace, 0, block_count * CAPTURE_BLOCK_SAMPLES, timestamps_us, values, &random_state);
+        double raw_megabytes = (double)block_count * CAPTURE_BLOCK_SAMPLES * 12 / 1048576.0;
+
+        uint64_t start_ns = platform_time_ns();
+        uint64_t encoded_bytes = 0;
+        for(int block = 0; block < block_count; block++) {
+            int64_t first = (int64_t)block * CAPTURE_BLOCK_SAMPLES;
+            encoded_sizes[block] = capture_encode_block(timestamps_us + first, values + first, CAPTURE_BLOCK_SAMPLES,
+                                                        planes, encoded + (int64_t)block * CAPTURE_ENCODED_BOUND,
+                                                        CAPTURE_ENCODED_BOUND);
+            encoded_bytes += encoded_sizes[block];
+        }
+        double encode_seconds = (platform_time_ns() - start_ns) / 1e9;
+
+        bool same = true;
+        start_ns = platform_time_ns();
+        for(int block = 0; block < block_count && same; block++) {
+            int64_t first = (int64_t)block * CAPTURE_BLOCK_SAMPLES;
+            same = capture_decode_block(encoded + (int64_t)block * CAPTURE_ENCODED_BOUND, encoded_sizes[block],
+                                        CAPTURE_BLOCK_SAMPLES, decoded_timestamps_us, decoded_values, planes) &&
+                   memcmp(decoded_timestamps_us, timestamps_us + first, sizeof(decoded_timestamps_us)) == 0 &&
+                   memcmp(decoded_values, values + first, sizeof(decoded_values)) == 0;
+        }
+        double decode_seconds = (platform_time_ns() - start_ns) / 1e9;
+        printf("compress: %-34s %6.2fx, encode %5.0f MB/s, decode %5.0f MB/s%s\n", compress_trace_names[trace],
+               raw_megabytes * 1048576.0 / encoded_bytes, raw_megabytes / encode_seconds,
+               raw_megabytes / decode_seconds, same ? "" : ", round trip differs");
+        result |= same ? 0 : 1;
+    }
+    free(timestamps_us);
+    free(values);
+    free(encoded);
+    free(encoded_sizes);
+    free(planes);
+    return result;
+}
+
+// Decode speed of every kernel set the CPU has, per sample format and byte order, checked against the scalar
+// kernels. Then whole sample_batch frames shaped like the device's, through decode_sample_block the way ingest
+// decodes them. Everything runs on one core.
+int run_decode(int sample_count, int rounds) {
+    const char *format_names[] = {"u8", "i16", "i32", "f32"};
+    uint8_t *data = (uint8_t *)malloc(sample_count * sizeof(uint32_t));
+    float *expected = (float *)malloc(sample_count * sizeof(float));
+    float *values = (float *)malloc(sample_count * sizeof(float));
+    int64_t *expected_timestamps_us = (int64_t *)malloc(sample_count * sizeof(int64_t));
+    int64_t *timestamps_us = (int64_t *)malloc(sample_count * sizeof(int64_t));
+    if(!data || !expected || !values || !expected_timestamps_us || !timestamps_us) {
+        return 1;
+    }
+    // Floats in both byte orders, random bits would be denormals often enough to time nothing but their slow path
+    uint8_t *float_data[2];
+    float_data[0] = (uint8_t *)malloc(sample_count * sizeof(float));
+    float_data[1] = (uint8_t *)malloc(sample_count * sizeof(float));
+    if(!float_data[0] || !float_data[1]) {
+        return 1;
+    }
+    uint32_t random_state = 12345;
+    for(int i = 0; i < sample_count * (int)sizeof(uint32_t); i++) {
+        data[i] = (uint8_t)compress_random(&random_state);
+    }
+    for(int i = 0; i < sample_count; i++) {
+        float value = (float)((int)(compress_random(&random_state) % 2000001) - 1000000) / 1000.0f;
+        memcpy(float_data[0] + i * sizeof(float), &value, sizeof(float));
+        for(int b = 0; b < (int)sizeof(float); b++) {
+            float_data[1][i * sizeof(float) + b] = float_data[0][i * sizeof(float) + sizeof(float) - 1 - b];
+        }
+    }
+    const float scale = 0.0008056640625f;
+    const float offset = -1.65f;
+
+    int result = 0;
+    for(int set = 0; set < (int)array_count(decode_kernel_sets); set++) {
+        const decode_kernels *kernels = decode_kernel_sets[set];
+        if(!decode_kernels_supported(kernels)) {
+            printf("decode: %s not supported on this CPU\n", kernels->name);
+            continue;
+        }
+        for(int format = sample_format_u8; format <= sample_format_f32; format++) {
+            for(int big_endian = 0; big_endian < 2; big_endian++) {
+                if(format == sample_format_u8 && big_endian) {
+                    continue;
+                }
+                int kernel = format * 2 + big_endian;
+                const uint8_t *input = format == sample_format_f32 ? float_data[big_endian] : data;
+                decode_scalar_kernels.values[kernel](input, sample_count, scale, offset, expected);
+                uint64_t start_ns = platform_time_ns();
+                for(int round = 0; round < rounds; round++) {
+                    kernels->values[kernel](input, sample_count, scale, offset, values);
+                }
+                double seconds = (platform_time_ns() - start_ns) / 1e9;
+                bool same = memcmp(values, expected, sample_count * sizeof(float)) == 0;
+                double wire_megabytes = (double)sample_count * sample_format_size(format) * rounds / 1048576.0;
+                printf("decode: %-6s %s %-13s %6.0f MB/s of wire data, %6.0f M samples/s%s\n", kernels->name,
+                       format_names[format], big_endian ? "big-endian" : "little-endian", wire_megabytes / seconds,
+                       (double)sample_count * rounds / seconds / 1e6, same ? "" : ", differs from scalar");
+                result |= same ? 0 : 1;
+            }
+        }
+        decode_timestamps_scalar(1234567890123ULL, 100, sample_count, expected_timestamps_us);
+        uint64_t start_ns = platform_time_ns();
+        for(int round = 0; round < rounds; round++) {
+            kernels->timestamps(1234567890123ULL, 100, sample_count, timestamps_us);
+        }
+        double seconds = (platform_time_ns() - start_ns) / 1e9;
+        bool same = memcmp(timestamps_us, expected_timestamps_us, sample_count * sizeof(int64_t)) == 0;
+        printf("decode: %-6s timestamps %23.0f M samples/s%s\n", kernels->name,
+               (double)sample_count * rounds / seconds / 1e6, same ? "" : ", differs from scalar");
+        result |= same ? 0 : 1;
+    }
+
+    // Frames of 16 channels with 100 i16 samples each, like the stand-in device sends
+    const int channel_count = 16;
+    const int block_samples = 100;
+    int frame_length = channel_count * (int)(sizeof(sample_block_header) + block_samples * sizeof(int16_t));
+    char *frame = (char *)malloc(frame_length);
+    int offset_in_frame = 0;
+    for(int channel = 0; channel < channel_count; channel++) {
+        sample_block_header block = {};
+        block.channel_id = (uint16_t)channel;
+        block.sample_count = (uint16_t)block_samples;
+        block.sample_format = sample_format_i16;
+        block.first_timestamp_us = 1000000;
+        block.sample_period_us = 100;
+        memcpy(frame + offset_in_frame, &block, sizeof(block));
+        memcpy(frame + offset_in_frame + sizeof(block), data + channel * block_samples * sizeof(int16_t),
+               block_samples * sizeof(int16_t));
+        offset_in_frame += sizeof(block) + block_samples * sizeof(int16_t);
+    }
+    const decode_kernels *frame_kernels[2] = {&decode_scalar_kernels, decode_active_kernels()};
+    int frames = (int)((int64_t)rounds * sample_count / (channel_count * block_samples));
+    for(int k = 0; k < 2; k++) {
+        uint64_t start_ns = platform_time_ns();
+        for(int f = 0; f < frames; f++) {
+            int position = 0;
+            while(position < frame_length) {
+                sample_block_header block;
+                memcpy(&block, frame + position, sizeof(block));
+                decode_sample_block_with(frame_kernels[k], &block, frame + position + sizeof(block), scale, offset,
+                                         timestamps_us, values);
+                position += sizeof(block) + block.sample_count * sample_format_size(block.sample_format);
+            }
+        }
+        double seconds = (platform_time_ns() - start_ns) / 1e9;
+        printf("decode: %-6s frames of %d x %d i16 samples, %6.0f MB/s of frames, %6.0f M samples/s\n",
+               frame_kernels[k]->name, channel_count, block_samples,
+               (double)frame_length * frames / 1048576.0 / seconds,
+               (double)frames * channel_count * block_samples / seconds / 1e6);
+    }
+    free(frame);
+    free(data);
+    free(float_data[0]);
+    free(float_data[1]);
+    free(expected);
+    free(values);
+    free(expected_timestamps_us);
+    free(timestamps_us);
+    return result;
+}
+
+int64_t resident_bytes() {
+    long pages = 0;
+    long resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if(statm) {
+        if(fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return (int64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+// Records gigabytes of 16 channels, builds the pyramid sidecar, then opens the capture again as cold as the
+// page cache allows and times the first frame and a pan/zoom session while watching resident memory
+// Channel 0 is an ADC idling around 1 V that goes up to 2.5 V for 30000 samples every million, channel 1 a GPIO
+// that is high for 100 samples every 50000, 25000 samples out of step with the ADC
+void query_trace_samples(int channel, int64_t first, int count, int64_t *timestamps_us, float *values,
+                         uint32_t *random_state) {
+    for(int i = 0; i < count; i++) {
+        int64_t n = first + i;
+        timestamps_us[i] = n * 100;
+        if(channel == 0) {
+            float noise = 0.02f * ((int)(compress_random(random_state) % 201) - 100) / 100.0f;
+            values[i] = (n % 1000000 >= 500000 && n % 1000000 < 530000 ? 2.5f : 1.0f) + noise;
+        } else {
+            values[i] = n % 50000 < 100 ? 1.0f : 0.0f;
+        }
+    }
+}
+
+// Runs a query to the end, returns the number of matches or -1 if there were more than max_matches
+int64_t query_collect(query_cursor *cursor, query_match *matches, int64_t max_matches) {
+    int64_t count = 0;
+    for(;;) {
+        int step = max_matches - count < 1024 ? (int)(max_matches - count) : 1024;
+        if(step == 0) {
+            return -1;
+        }
+        int found = query_next(cursor, matches + count, step);
+        count += found;
+        if(found == 0 && query_caught_up(cursor)) {
+            return count;
+        }
+    }
+}
+
+// Zone maps and compare kernels against a plain scalar scan of every sample, on the store and on a capture of the
+// same samples. Every configuration has to find the same matches.
+int run_query(const char *path, uint64_t sample_count) {
+    const int64_t max_matches = 1 << 20;
+    sample_store *store = (sample_store *)calloc(1, sizeof(sample_store));
+    query_match *expected = (query_match *)malloc(max_matches * sizeof(query_match));
+    query_match *matches = (query_match *)malloc(max_matches * sizeof(query_match));
+    query_cursor *cursor = (query_cursor *)malloc(sizeof(query_cursor));
+    capture_writer *writer = (capture_writer *)calloc(1, sizeof(capture_writer));
+    capture_view *view = (capture_view *)calloc(1, sizeof(capture_view));
+    if(!store || !expected || !matches || !cursor || !writer || !view) {
+        return 1;
+    }
+    store_init(store, 0, 0);
+    capture_channel channels[2] = {};
+    channels[1].channel_id = 1;
+    bool recording = capture_writer_start(writer, path, channels, 2, true);
+    const int batch_size = 1000;
+    int64_t timestamps_us[batch_size];
+    float values[batch_size];
+    uint32_t random_state = 12345;
+    for(uint64_t first = 0; first + batch_size <= sample_count; first += batch_size) {
+        for(int channel = 0; channel < 2; channel++) {
+            query_trace_samples(channel, (int64_t)first, batch_size, timestamps_us, values, &random_state);
+            store_append(store, channel, timestamps_us, values, batch_size);
+            while(recording && capture_writer_backlog(writer) > CAPTURE_MAX_BLOCKS / 2) {
+                platform_sleep_ms(1);
+            }
+            if(recording) {
+                capture_writer_append(writer, channel, timestamps_us, values, batch_size);
+            }
+        }
+    }
+    bool written = recording && capture_writer_stop(writer);
+    free(writer);
+    char pyramid_path[CAPTURE_VIEW_MAX_PATH + 16];
+    snprintf(pyramid_path, sizeof(pyramid_path), "%s.pyramid", path);
+    if(!written || !capture_view_open(view, path, 0)) {
+        printf("query: can't record %s\n", path);
+        return 1;
+    }
+    printf("query: %llu samples per channel in the store and in %s\n", (unsigned long long)sample_count, path);
+
+    query_condition adc_high = {query_kind_range, 0, 2.1f, INFINITY};
+    query_condition gpio_rising = {query_kind_rising, 1, 0.5f, 0.0f};
+    query_condition adc_crossing = {query_kind_crossing, 0, 2.1f, 0.0f};
+    struct {
+        const char *name;
+        const query_condition *condition;
+        const query_condition *gate;
+    } queries[] = {
+        {"ADC0 above 2.1 V", &adc_high, NULL},
+        {"ADC0 crosses 2.1 V", &adc_crossing, NULL},
+        {"GPIO rising", &gpio_rising, NULL},
+        {"GPIO rising while ADC0 above 2.1 V", &gpio_rising, &adc_high},
+    };
+    int result = 0;
+    for(int q = 0; q < (int)array_count(queries); q++) {
+        int64_t expected_count = 0;
+        for(int source = 0; source < 2; source++) {
+            capture_view *source_view = source ? view : NULL;
+            // The reference is a scalar scan of everything on the store
+            if(source == 0) {
+                query_open(cursor, queries[q].condition, queries[q].gate, store, NULL, 0);
+                query_set_kernels(cursor, &query_scalar_kernels, false);
+                uint64_t start_ns = platform_time_ns();
+                expected_count = query_collect(cursor, expected, max_matches);
+                printf("query: %-34s store,   scalar full scan %8.2f ms, %lld matches\n", queries[q].name,
+                       (platform_time_ns() - start_ns) / 1e6, (long long)expected_count);
+            }
+            for(int set = 0; set < (int)array_count(query_kernel_sets); set++) {
+                if(!query_kernels_supported(query_kernel_sets[set])) {
+                    continue;
+                }
+                query_open(cursor, queries[q].condition, queries[q].gate, store, source_view, 0);
+                query_set_kernels(cursor, query_kernel_sets[set], true);
+                uint64_t start_ns = platform_time_ns();
+                int64_t count = query_collect(cursor, matches, max_matches);
+                double ms = (platform_time_ns() - start_ns) / 1e6;
+                bool same = count >= 0 && count == expected_count &&
+                            memcmp(matches, expected, count * sizeof(query_match)) == 0;
+                query_scan *scan = &cursor->scan;
+                printf("query: %-34s %-7s %-6s zone maps %8.2f ms, %lld matches, %llu of %llu chunks scanned%s\n",
+                       queries[q].name, source ? "capture" : "store,", query_kernel_sets[set]->name, ms,
+                       (long long)count, (unsigned long long)(scan->chunks_scanned + cursor->gate.chunks_scanned),
+                       (unsigned long long)(scan->chunks_scanned + scan->chunks_skipped +
+                                            cursor->gate.chunks_scanned + cursor->gate.chunks_skipped),
+                       same ? "" : ", MISMATCH");
+                result |= same ? 0 : 1;
+            }
+        }
+    }
+
+    // Paging through a long result a page at a time as the UI does, one step per frame
+    query_condition gpio_high = {query_kind_range, 1, 0.5f, INFINITY};
+    query_open(cursor, &gpio_high, NULL, store, NULL, 0);
+    int steps = 0;
+    int64_t paged = 0;
+    uint64_t slowest_ns = 0;
+    for(;;) {
+        uint64_t start_ns = platform_time_ns();
+        int found = query_next(cursor, matches, 20);
+        uint64_t step_ns = platform_time_ns() - start_ns;
+        slowest_ns = step_ns > slowest_ns ? step_ns : slowest_ns;
+        paged += found;
+        steps++;
+        if(found == 0 && query_caught_up(cursor)) {
+            break;
+        }
+    }
+    printf("query: GPIO high in pages of 20, %lld matches in %d steps, slowest step %.3f ms\n", (long long)paged,
+           steps, slowest_ns / 1e6);
+
+    capture_view_close(view);
+    remove(path);
+    remove(pyramid_path);
+    store_destroy(store);
+    free(store);
+    free(view);
+    free(cursor);
+    free(expected);
+    free(matches);
+    return result;
+}
+
+// Sample n of channel c in the statistics benchmark, a sine on an offset that grows with c plus noise
+float stats_test_value(int channel, int64_t n) {
+    uint32_t hash = (uint32_t)n * 2654435761U ^ (uint32_t)channel * 40503U;
+    hash ^= hash >> 15;
+    return (float)(channel + sin(n * (0.001 + channel * 1e-6)) + (hash % 1000) / 10000.0);
+}
+
+// Channels at 10 kHz in batches of 100 samples the way the devices send them, interleaved. Reports the share of one
+// core that keeping up takes, then checks every summary against the window worked out from scratch.
+int run_stats(int channel_count, int seconds) {
+    const int sample_rate_hz = 10000;
+    const int batch_size = 100;
+    const int64_t window_us = STATS_DEFAULT_WINDOW_US;
+    stats_engine *stats = (stats_engine *)calloc(1, sizeof(stats_engine));
+    if(!stats) {
+        return 1;
+    }
+    stats_init(stats, window_us);
+    int64_t timestamps_us[batch_size];
+    float values[batch_size];
+    int64_t batches = (int64_t)seconds * sample_rate_hz / batch_size;
+    uint64_t busy_ns = 0;
+    for(int64_t batch = 0; batch < batches; batch++) {
+        // Generating the samples isn't timed
+        uint64_t channel_busy_ns = 0;
+        for(int channel = 0; channel < channel_count; channel++) {
+            for(int i = 0; i < batch_size; i++) {
+                int64_t n = batch * batch_size + i;
+                timestamps_us[i] = n * (1000000 / sample_rate_hz);
+                values[i] = stats_test_value(channel, n);
+            }
+            uint64_t start_ns = platform_time_ns();
+            stats_update(stats, channel, timestamps_us, values, batch_size);
+            channel_busy_ns += platform_time_ns() - start_ns;
+        }
+        busy_ns += channel_busy_ns;
+    }
+    uint64_t samples = (uint64_t)batches * batch_size * channel_count;
+    printf("stats: %d channels at %d Hz for %d s, %.1f ns per sample, %.1f%% of a core\n", channel_count,
+           sample_rate_hz, seconds, (double)busy_ns / samples, busy_ns / 1e9 / seconds * 100.0);
+
+    // Summaries are made once per batch in the pipeline
+    uint64_t start_ns = platform_time_ns();
+    stats_summary summary;
+    for(int round = 0; round < 100; round++) {
+        for(int channel = 0; channel < channel_count; channel++) {
+            stats_summarize(stats, channel, &summary);
+        }
+    }
+    printf("stats: %.1f ns per summary\n", (platform_time_ns() - start_ns) / 100.0 / channel_count);
+
+    int64_t last = batches * batch_size - 1;
+    int64_t first = last - (window_us * sample_rate_hz / 1000000) + 1;
+    first = first > 0 ? first : 0;
+    double worst = 0.0;
+    for(int channel = 0; channel < channel_count; channel++) {
+        double sum = 0.0;
+        float min = INFINITY;
+        float max = -INFINITY;
+        for(int64_t n = first; n <= last; n++) {
+            float value = stats_test_value(channel, n);
+            sum += value;
+            min = value < min ? value : min;
+            max = value > max ? value : max;
+        }
+        int64_t count = last - first + 1;
+        double mean = sum / count;
+        double m2 = 0.0;
+        double squares = 0.0;
+        for(int64_t n = first; n <= last; n++) {
+            double value = stats_test_value(channel, n);
+            m2 += (value - mean) * (value - mean);
+            squares += value * value;
+        }
+        double span_s = (double)(last - first) / sample_rate_hz;
+        double expected[6] = {mean, sqrt(m2 / count), min, max, sqrt(squares / count), (count - 1) / span_s};
+        stats_summarize(stats, channel, &summary);
+        double got[6] = {summary.mean, summary.stddev, summary.min, summary.max, summary.rms, summary.rate_hz};
+        for(int i = 0; i < 6; i++) {
+            // Relative to the spread for the mean and the extremes, their size is mostly the offset
+            double scale = i == 1 || i == 5 ? fabs(expected[i]) : sqrt(m2 / count) + 1e-6;
+            double error = fabs(got[i] - expected[i]) / scale;
+            worst = error > worst ? error : worst;
+        }
+        if(summary.count != (uint32_t)count) {
+            worst = INFINITY;
+        }
+    }
+    printf("stats: summaries against the window from scratch, worst relative error %.2g\n", worst);
+    stats_destroy(stats);
+    free(stats);
+    return worst < 1e-4 ? 0 : 1;
+}
+
+// Largest bin of a spectrum, and its magnitude
+int fft_peak(const float *magnitudes, int bin_count, float *peak) {
+    int best = 1;
+    for(int i = 1; i < bin_count; i++) {
+        best = magnitudes[i] > magnitudes[best] ? i : best;
+    }
+    *peak = magnitudes[best];
+    return best;
+}
+
+// Times every kernel set from 1K to 1M points against the scalar one and a DFT in doubles, reads the amplitude
+// of a sine between bins through each window, then has the worker analyse a tone in a store.
+int run_fft(int max_log2) {
+    max_log2 = max_log2 < FFT_MAX_LOG2 ? max_log2 : FFT_MAX_LOG2;
+    const fft_kernels *kernel_sets[array_count(fft_kernel_sets)];
+    int kernel_count = 0;
+    for(int i = 0; i < (int)array_count(fft_kernel_sets); i++) {
+        if(fft_kernels_supported(fft_kernel_sets[i])) {
+            kernel_sets[kernel_count++] = fft_kernel_sets[i];
+        }
+    }
+    bool ok = true;
+    float *samples = (float *)malloc(((size_t)1 << max_log2) * sizeof(float));
+    float *reference = (float *)malloc((((size_t)1 << max_log2) / 2 + 1) * sizeof(float));
+    if(!samples || !reference) {
+        free(samples);
+        free(reference);
+        return 1;
+    }
+    for(int log2_size = 10; log2_size <= max_log2; log2_size += 2) {
+        fft_plan *plan = fft_plan_create(log2_size);
+        if(!plan) {
+            ok = false;
+            break;
+        }
+        int size = plan->size;
+        int bins = size / 2 + 1;
+        uint32_t seed = 12345;
+        for(int i = 0; i < size; i++) {
+            seed = seed * 1664525U + 1013904223U;
+            samples[i] = (float)sin(i * 0.01) + (seed >> 8) / 16777216.0f - 0.5f;
+        }
+        int rounds = (1 << 24) >> log2_size;
+        printf("fft: %7d points", size);
+        double scalar_us = 0.0;
+        double worst = 0.0;
+        for(int k = 0; k < kernel_count; k++) {
+            fft_real(plan, kernel_sets[k], samples, fft_window_hann);
+            uint64_t start_ns = platform_time_ns();
+            for(int round = 0; round < rounds; round++) {
+                fft_real(plan, kernel_sets[k], samples, fft_window_hann);
+            }
+            double us = (platform_time_ns() - start_ns) / 1e3 / rounds;
+            scalar_us = k == 0 ? us : scalar_us;
+            printf(", %s %.1f us (%.1fx)", kernel_sets[k]->name, us, scalar_us / us);
+            float largest = 0.0f;
+            for(int i = 0; i < bins; i++) {
+                float magnitude = sqrtf(plan->re[i] * plan->re[i] + plan->im[i] * plan->im[i]);
+                if(k == 0) {
+                    reference[i] = magnitude;
+                }
+                largest = magnitude > largest ? magnitude : largest;
+            }
+            for(int i = 0; i < bins && k > 0; i++) {
+                float magnitude = sqrtf(plan->re[i] * plan->re[i] + plan->im[i] * plan->im[i]);
+                double difference = fabs(magnitude - reference[i]) / largest;
+                worst = difference > worst ? difference : worst;
+            }
+        }
+        printf(", kernels differ by %.2g\n", worst);
+        ok = ok && worst < 1e-5;
+
+        if(log2_size == 10) {
+            // Every bin against a DFT in doubles
+            const float *window = fft_plan_window(plan, fft_window_hann);
+            fft_real(plan, fft_active_kernels(), samples, fft_window_hann);
+            double largest = 0.0;
+            double error = 0.0;
+            for(int i = 0; i < bins; i++) {
+                double re = 0.0;
+                double im = 0.0;
+                for(int n = 0; n < size; n++) {
+                    double angle = -2.0 * FFT_PI * i * n / size;
+                    re += samples[n] * window[n] * cos(angle);
+                    im += samples[n] * window[n] * sin(angle);
+                }
+                double magnitude = sqrt(re * re + im * im);
+                largest = magnitude > largest ? magnitude : largest;
+                double difference = hypot(plan->re[i] - re, plan->im[i] - im);
+                error = difference > error ? difference : error;
+            }
+            printf("fft: %d points against a DFT in doubles, worst error %.2g of the largest bin\n", size,
+                   error / largest);
+            ok = ok && error / largest < 1e-5;
+        }
+        fft_plan_destroy(plan);
+    }
+
+    // An amplitude 1.5 sine right on bin 100 and halfway to bin 101
+    fft_plan *plan = fft_plan_create(12);
+    for(int window = 0; window < fft_window_count && plan; window++) {
+        printf("fft: %-11s window reads a 1.5 sine as", fft_window_name(window));
+        for(int offset = 0; offset < 2; offset++) {
+            double cycles = 100.0 + offset * 0.5;
+            for(int i = 0; i < plan->size; i++) {
+                samples[i] = (float)(0.25 + 1.5 * sin(2.0 * FFT_PI * cycles * i / plan->size));
+            }
+            float magnitude;
+            fft_real(plan, fft_active_kernels(), samples, window);
+            memset(plan->power, 0, (plan->size / 2 + 1) * sizeof(float));
+            fft_active_kernels()->power(plan->re, plan->im, plan->size / 2 + 1, plan->power);
+            fft_magnitudes(plan, window, 1, false, reference);
+            fft_peak(reference, plan->size / 2 + 1, &magnitude);
+            printf(" %.4f %s", magnitude, offset ? "between bins\n" : "on a bin,");
+            if(window == fft_window_flat_top) {
+                ok = ok && fabs(magnitude - 1.5) < 0.005;
+            }
+        }
+    }
+    fft_plan_destroy(plan);
+    free(samples);
+    free(reference);
+
+    // 10 s of a 1234.5 Hz tone sampled at 10 kHz through the worker
+    sample_store *store = (sample_store *)calloc(1, sizeof(sample_store));
+    fft_worker *worker = (fft_worker *)calloc(1, sizeof(fft_worker));
+    if(!store || !worker) {
+        free(store);
+        free(worker);
+        return 1;
+    }
+    store_init(store, 0, 0);
+    int64_t timestamps_us[1000];
+    float values[1000];
+    for(int batch = 0; batch < 100; batch++) {
+        for(int i = 0; i < 1000; i++) {
+            int64_t n = batch * 1000 + i;
+            timestamps_us[i] = n * 100;
+            values[i] = (float)(1.0 + 2.0 * sin(2.0 * FFT_PI * 1234.5 * n / 10000.0));
+        }
+        store_append(store, 7, timestamps_us, values, 1000);
+    }
+    if(!fft_worker_start(worker, store, 50)) {
+        store_destroy(store);
+        free(store);
+        free(worker);
+        return 1;
+    }
+    fft_config config = {true, 7, 14, fft_window_flat_top, 0.5f, 5000000, false};
+    uint64_t start_ns = platform_time_ns();
+    fft_configure(worker, 0, &config);
+    const fft_spectrum *spectrum = fft_read(worker, 0);
+    while(spectrum->bin_count == 0 && platform_time_ns() - start_ns < 2000000000ULL) {
+        platform_sleep_ms(1);
+        spectrum = fft_read(worker, 0);
+    }
+    double latency_ms = (platform_time_ns() - start_ns) / 1e6;
+    if(spectrum->bin_count == 0) {
+        printf("fft: worker published nothing\n");
+        ok = false;
+    } else {
+        float magnitude;
+        int peak = fft_peak(spectrum->magnitudes, spectrum->bin_count, &magnitude);
+        double peak_hz = peak * spectrum->bin_hz;
+        printf("fft: worker, %d point %s spectrum of %d segments over %.2f s after %.1f ms, %.1f ms of work, "
+               "peak %.4f at %.1f Hz\n", spectrum->size, fft_window_name(spectrum->window), spectrum->segments,
+               (spectrum->last_us - spectrum->first_us) / 1e6, latency_ms, worker->busy_ns.load() / 1e6, magnitude,
+               peak_hz);
+        ok = ok && fabs(peak_hz - 1234.5) <= spectrum->bin_hz && fabs(magnitude - 2.0f) < 0.01 &&
+             fabs(spectrum->magnitudes[0] - 1.0f) < 0.01;
+    }
+    fft_worker_stop(worker);
+    store_destroy(store);
+    free(store);
+    free(worker);
+    printf("fft: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+// Inputs of the derived channel benchmark: two analog channels and a GPIO port, c1 lags c0 by half a period.
+// c0 has a NaN now and then.
+float derived_test_value(int channel, int64_t n) {
+    if(channel == 0 && n % 997 == 0) {
+        return NAN;
+    }
+    if(channel == 2) {
+        return (float)((n / 7) & 0xFF);
+    }
+    return (float)(1.6 + sin(n * (channel ? 0.0011 : 0.0007)) + (channel ? 0.3 * sin(n * 0.05) : 0.0));
+}
+
+const char *derived_test_expressions[] = {
+    "(c0 - c1) * 0.5 + 1.25",
+    "bit(c2, 3) && !bit(c2, 5) || c0 > 2.1",
+    "sqrt(c0 * c0 + c1 * c1)",
+    "if(c0 > c1, c0 - c1, (c1 - c0) * 2) / max(abs(c1 - 1.5), 0.25)",
+};
+
+// Runs the program over count samples of the test channels a batch at a time, or a sample at a time through the
+// scalar code if kernels is NULL, and returns ns per sample
+double derived_run_program(const derived_program *program, const derived_kernels *kernels, float *const *inputs,
+                           int count, float *results) {
+    float (*registers)[DERIVED_BATCH] = (float (*)[DERIVED_BATCH])malloc(DERIVED_REGISTERS * DERIVED_BATCH * 4);
+    for(int i = 0; i < program->constant_count; i++) {
+        for(int j = 0; j < DERIVED_BATCH; j++) {
+            registers[DERIVED_FIRST_CONSTANT + i][j] = program->constants[i];
+        }
+    }
+    uint64_t start_ns = platform_time_ns();
+    for(int first = 0; first < count; first += DERIVED_BATCH) {
+        int n = count - first < DERIVED_BATCH ? count - first : DERIVED_BATCH;
+        for(int i = 0; i < program->input_count; i++) {
+            memcpy(registers[i], inputs[program->inputs[i]] + first, n * sizeof(float));
+        }
+        if(kernels) {
+            derived_execute(program, kernels, registers, n);
+        } else {
+            for(int j = 0; j < n; j++) {
+                for(int k = 0; k < program->code_count; k++) {
+                    derived_run_range(&program->code[k], registers, j, j + 1);
+                }
+            }
+        }
+        memcpy(results + first, registers[program->result], n * sizeof(float));
+    }
+    double ns = (double)(platform_time_ns() - start_ns) / count;
+    free(registers);
+    return ns;
+}
+
+// Compiles a few expressions and some broken ones, times them sample by sample and a batch at a time with every
+// kernel set, then evaluates them incrementally from a store as batches come in and checks the samples against
+// values worked out directly
+int run_derived(int sample_count) {
+    bool ok = true;
+    const char *broken[] = {"c0 +", "c0 * (c1 - 2", "foo(c0)", "2 * 3", "c0 c1", "bit(c0)"};
+    for(int i = 0; i < (int)array_count(broken); i++) {
+        derived_program program;
+        char error[128];
+        bool compiled = derived_compile(broken[i], &program, error, sizeof(error));
+        printf("derived: \"%s\": %s\n", broken[i], compiled ? "compiled" : error);
+        ok = ok && !compiled;
+    }
+
+    float *inputs[3];
+    float *expected = (float *)malloc(sample_count * sizeof(float));
+    float *results = (float *)malloc(sample_count * sizeof(float));
+    for(int channel = 0; channel < 3; channel++) {
+        inputs[channel] = (float *)malloc(sample_count * sizeof(float));
+        for(int i = 0; i < sample_count; i++) {
+            inputs[channel][i] = derived_test_value(channel, i);
+        }
+    }
+    for(int e = 0; e < (int)array_count(derived_test_expressions); e++) {
+        derived_program program;
+        char error[128];
+        if(!derived_compile(derived_test_expressions[e], &program, error, sizeof(error))) {
+            printf("derived: \"%s\": %s\n", derived_test_expressions[e], error);
+            ok = false;
+            continue;
+        }
+        printf("derived: \"%s\", %d instructions, %d constants\n", derived_test_expressions[e], program.code_count,
+               program.constant_count);
+        double per_sample_ns = derived_run_program(&program, NULL, inputs, sample_count, expected);
+        printf("derived:     per sample %.2f ns", per_sample_ns);
+        for(int k = 0; k < (int)array_count(derived_kernel_sets); k++) {
+            if(!derived_kernels_supported(derived_kernel_sets[k])) {
+                continue;
+            }
+            double ns = derived_run_program(&program, derived_kernel_sets[k], inputs, sample_count, results);
+            bool same = memcmp(results, expected, sample_count * sizeof(float)) == 0;
+            printf(", %s %.2f ns (%.1fx)%s", derived_kernel_sets[k]->name, ns, per_sample_ns / ns,
+                   same ? "" : " MISMATCH");
+            ok = ok && same;
+        }
+        printf("\n");
+    }
+
+    // Batches of 100 come in for each channel in turn, c1 half a period late, and the derived channels catch up
+    // after every round. c1 has no value before its first sample, so the derived channels start at sample 1.
+    sample_store *store = (sample_store *)calloc(1, sizeof(sample_store));
+    derived_set *set = (derived_set *)calloc(1, sizeof(derived_set));
+    store_init(store, 0, 0);
+    derived_init(set);
+    int slots[array_count(derived_test_expressions)];
+    for(int e = 0; e < (int)array_count(derived_test_expressions); e++) {
+        char error[128];
+        slots[e] = derived_add(set, store, derived_test_expressions[e], error, sizeof(error));
+        ok = ok && slots[e] >= 0;
+    }
+    int64_t timestamps_us[100];
+    float values[100];
+    uint64_t derived_ns = 0;
+    uint64_t derived_samples = 0;
+    for(int first = 0; first + 100 <= sample_count; first += 100) {
+        for(int channel = 0; channel < 3; channel++) {
+            for(int i = 0; i < 100; i++) {
+                timestamps_us[i] = (int64_t)(first + i) * 100 + (channel == 1 ? 50 : 0);
+                values[i] = inputs[channel][first + i];
+            }
+            store_append(store, device_channel_id(0, channel), timestamps_us, values, 100);
+        }
+        uint64_t start_ns = platform_time_ns();
+        derived_output output;
+        while(derived_next(set, store, &output)) {
+            store_append(store, output.channel_id, output.timestamps_us, output.values, output.count);
+            derived_samples += output.count;
+        }
+        derived_ns += platform_time_ns() - start_ns;
+    }
+    printf("derived: %d channels from the store a round of batches at a time, %.1f ns per derived sample with "
+           "the store reads and appends\n", (int)array_count(derived_test_expressions),
+           derived_samples ? (double)derived_ns / derived_samples : 0.0);
+
+    // Sample n of c1 is the one held at sample n + 1 of c0, whatever reads it starts a sample late
+    int stored = sample_count / 100 * 100;
+    float *shifted = inputs[1];
+    memmove(shifted + 1, shifted, (stored - 1) * sizeof(float));
+    int64_t *read_timestamps_us = (int64_t *)malloc(stored * sizeof(int64_t));
+    for(int e = 0; e < (int)array_count(derived_test_expressions) && slots[e] >= 0; e++) {
+        derived_program program;
+        char error[128];
+        derived_compile(derived_test_expressions[e], &program, error, sizeof(error));
+        derived_run_program(&program, &derived_scalar_kernels, inputs, stored, expected);
+        int read = store_read(store, device_channel_id(DERIVED_DEVICE, slots[e]), INT64_MIN, INT64_MAX,
+                              read_timestamps_us, results, stored);
+        int late = 0;
+        for(int i = 0; i < program.input_count; i++) {
+            late = program.inputs[i] == device_channel_id(0, 1) ? 1 : late;
+        }
+        bool same = read == stored - late && read_timestamps_us[0] == late * 100 &&
+                    memcmp(results, expected + late, read * sizeof(float)) == 0;
+        printf("derived: x%d = %s, %d samples %s\n", slots[e], derived_test_expressions[e], read,
+               same ? "match" : "MISMATCH");
+        ok = ok && same;
+    }
+    derived_destroy(set);
+    store_destroy(store);
+    free(set);
+    free(store);
+    free(read_timestamps_us);
+    for(int channel = 0; channel < 3; channel++) {
+        free(inputs[channel]);
+    }
+    free(expected);
+    free(results);
+    printf("derived: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+float alarm_test_value(int channel, int64_t n) {
+    uint32_t hash = (uint32_t)n * 2654435761U ^ (uint32_t)channel * 40503U;
+    hash ^= hash >> 15;
+    return (float)(sin(n * (0.0003 + channel * 1e-6)) + ((hash % 1000) / 1000.0 - 0.5) * 0.1);
+}
+
+typedef struct {
+    int state;
+    int64_t since_us;
+} alarm_reference;
+
+// The rules a sample at a time, the way they read
+bool alarm_reference_step(alarm_reference *reference, const alarm_rule *rule, int64_t timestamp_us, float value) {
+    bool raise = (rule->kind != alarm_kind_below && value >= rule->high) ||
+                 (rule->kind != alarm_kind_above && value <= rule->low);
+    bool clear = (rule->kind == alarm_kind_below || value < rule->high - rule->hysteresis) &&
+                 (rule->kind == alarm_kind_above || value > rule->low + rule->hysteresis);
+    if(reference->state == alarm_state_clear && raise) {
+        reference->state = alarm_state_raising;
+        reference->since_us = timestamp_us;
+    } else if(reference->state == alarm_state_raised && clear) {
+        reference->state = alarm_state_clearing;
+        reference->since_us = timestamp_us;
+    } else if(reference->state == alarm_state_raising && !raise) {
+        reference->state = alarm_state_clear;
+    } else if(reference->state == alarm_state_clearing && !clear) {
+        reference->state = alarm_state_raised;
+    }
+    bool pending = reference->state == alarm_state_raising || reference->state == alarm_state_clearing;
+    if(pending && timestamp_us - reference->since_us >= rule->debounce_us) {
+        reference->state = reference->state == alarm_state_raising ? alarm_state_raised : alarm_state_clear;
+        return true;
+    }
+    return false;
+}
+
+typedef struct {
+    ingest_pipeline *pipeline;
+    std::atomic<int> running;
+} alarm_latency_device;
+
+// A batch of 100 samples every 10 ms that goes over the level every tenth one
+void alarm_latency_device_thread(void *parameters) {
+    alarm_latency_device *device = (alarm_latency_device *)parameters;
+    for(int64_t batch_index = 0; device->running.load(); batch_index++) {
+        sample_batch *batch = sample_batch_alloc(100);
+        batch->channel_id = device_channel_id(0, 0);
+        for(int i = 0; i < 100; i++) {
+            batch->timestamps_us[i] = (batch_index * 100 + i) * 100;
+            batch->values[i] = batch_index % 20 >= 10 ? 1.0f : 0.0f;
+        }
+        ingest_push(device->pipeline, batch);
+        platform_sleep_ms(10);
+    }
+}
+
+// Channels at 10 kHz in batches of 100 samples with two rules each, one with a debounce time. Reports the share of
+// one core the rules take with the scalar and the active compare kernels, checks the events against the rules run
+// a sample at a time, then times alarms through the pipeline to a UI that looks at 60 Hz.
+int run_alarm(int channel_count, int seconds) {
+    const int sample_rate_hz = 10000;
+    const int batch_size = 100;
+    bool ok = true;
+    alarm_engine *alarms = (alarm_engine *)calloc(1, sizeof(alarm_engine));
+    alarm_init(alarms);
+    alarm_rule rules[2] = {};
+    snprintf(rules[0].name, ALARM_MAX_NAME, "high");
+    rules[0].kind = alarm_kind_above;
+    rules[0].high = 0.8f;
+    rules[0].hysteresis = 0.15f;
+    rules[0].debounce_us = 5000;
+    snprintf(rules[1].name, ALARM_MAX_NAME, "range");
+    rules[1].kind = alarm_kind_outside;
+    rules[1].low = -0.9f;
+    rules[1].high = 0.95f;
+    rules[1].hysteresis = 0.15f;
+    for(int channel = 0; channel < channel_count; channel++) {
+        for(int r = 0; r < 2; r++) {
+            rules[r].channel_id = device_channel_id(0, channel);
+            ok = ok && alarm_add(alarms, &rules[r]) == channel * 2 + r;
+        }
+    }
+
+    int64_t batches = (int64_t)seconds * sample_rate_hz / batch_size;
+    int64_t max_events = 1 << 20;
+    alarm_event *events = (alarm_event *)malloc(max_events * sizeof(alarm_event));
+    int64_t event_count = 0;
+    int64_t timestamps_us[batch_size];
+    float values[batch_size];
+    for(int k = 0; k < (int)array_count(query_kernel_sets); k++) {
+        if(!query_kernels_supported(query_kernel_sets[k])) {
+            continue;
+        }
+        for(int i = 0; i < ALARM_MAX_RULES; i++) {
+            alarms->slots[i].state = alarm_state_clear;
+        }
+        alarms->kernels = query_kernel_sets[k];
+        event_count = 0;
+        uint64_t busy_ns = 0;
+        for(int64_t batch = 0; batch < batches; batch++) {
+            for(int channel = 0; channel < channel_count; channel++) {
+                // Generating the samples and keeping the events isn't timed
+                for(int i = 0; i < batch_size; i++) {
+                    int64_t n = batch * batch_size + i;
+                    timestamps_us[i] = n * (1000000 / sample_rate_hz);
+                    values[i] = alarm_test_value(channel, n);
+                }
+                uint64_t start_ns = platform_time_ns();
+                int fired = alarm_evaluate(alarms, device_channel_id(0, channel), timestamps_us, values, batch_size, 0);
+                busy_ns += platform_time_ns() - start_ns;
+                for(int i = 0; i < fired && event_count < max_events; i++) {
+                    events[event_count++] = alarms->fired[i];
+                }
+                alarm_event event;
+                while(alarm_pop(alarms, &event)) {
+                }
+            }
+        }
+        uint64_t samples = (uint64_t)batches * batch_size * channel_count;
+        printf("alarm: %d channels at %d Hz for %d s, 2 rules each, %s masks %.2f ns per sample, %.1f%% of a core, "
+               "%lld events\n", channel_count, sample_rate_hz, seconds, query_kernel_sets[k]->name,
+               (double)busy_ns / samples, busy_ns / 1e9 / seconds * 100.0, (long long)event_count);
+    }
+
+    // Same events from the rules a sample at a time, in the same order
+    alarm_reference *references = (alarm_reference *)calloc(channel_count * 2, sizeof(alarm_reference));
+    int64_t matched = 0;
+    bool same = true;
+    for(int64_t batch = 0; batch < batches && same; batch++) {
+        for(int channel = 0; channel < channel_count && same; channel++) {
+            for(int r = 0; r < 2; r++) {
+                alarm_reference *reference = &references[channel * 2 + r];
+                for(int i = 0; i < batch_size; i++) {
+                    int64_t n = batch * batch_size + i;
+                    int64_t timestamp_us = n * (1000000 / sample_rate_hz);
+                    float value = alarm_test_value(channel, n);
+                    if(!alarm_reference_step(reference, &rules[r], timestamp_us, value)) {
+                        continue;
+                    }
+                    alarm_event *event = matched < event_count ? &events[matched] : NULL;
+                    same = event && event->rule == channel * 2 + r && event->timestamp_us == timestamp_us &&
+                           event->value == value && event->raised == (reference->state == alarm_state_raised);
+                    matched += same;
+                }
+            }
+        }
+    }
+    same = same && matched == event_count;
+    printf("alarm: against the rules a sample at a time, %lld events %s\n", (long long)matched,
+           same ? "match" : "MISMATCH");
+    ok = ok && same && event_count > 0;
+    free(references);
+    free(events);
+    alarm_destroy(alarms);
+    free(alarms);
+
+    // Through the pipeline, the UI takes the events once a frame
+    ingest_pipeline *pipeline = (ingest_pipeline *)calloc(1, sizeof(ingest_pipeline));
+    alarm_latency_device device;
+    device.pipeline = pipeline;
+    device.running.store(1);
+    platform_thread device_thread;
+    if(!ingest_pipeline_start(pipeline)) {
+        printf("alarm: failed to start\n");
+        return 1;
+    }
+    alarm_rule rule = {};
+    snprintf(rule.name, ALARM_MAX_NAME, "latency");
+    rule.channel_id = device_channel_id(0, 0);
+    rule.kind = alarm_kind_above;
+    rule.high = 0.5f;
+    int slot = ingest_add_alarm(pipeline, &rule);
+    platform_thread_start(&device_thread, alarm_latency_device_thread, &device);
+    uint64_t detect_total_ns = 0;
+    uint64_t detect_max_ns = 0;
+    uint64_t display_total_ns = 0;
+    uint64_t display_max_ns = 0;
+    int64_t popped = 0;
+    uint64_t start_ns = platform_time_ns();
+    while(platform_time_ns() - start_ns < 3000000000ULL) {
+        alarm_event event;
+        while(ingest_pop_alarm(pipeline, &event)) {
+            uint64_t detect_ns = event.detected_ns - event.pushed_ns;
+            uint64_t display_ns = platform_time_ns() - event.pushed_ns;
+            detect_total_ns += detect_ns;
+            detect_max_ns = detect_ns > detect_max_ns ? detect_ns : detect_max_ns;
+            display_total_ns += display_ns;
+            display_max_ns = display_ns > display_max_ns ? display_ns : display_max_ns;
+            popped++;
+        }
+        platform_sleep_ms(16);
+    }
+    device.running.store(0);
+    platform_thread_join(&device_thread);
+    int64_t timestamps[64];
+    float states[64];
+    int stored = store_read(&pipeline->store, device_channel_id(ALARM_DEVICE, slot), INT64_MIN, INT64_MAX, timestamps,
+                            states, 64);
+    ingest_pipeline_stop(pipeline);
+    printf("alarm: %lld events through the pipeline, pushed to found avg %.0f us max %.0f us, "
+           "pushed to shown at 60 Hz avg %.1f ms max %.1f ms\n", (long long)popped,
+           popped ? detect_total_ns / 1e3 / popped : 0.0, detect_max_ns / 1e3,
+           popped ? display_total_ns / 1e6 / popped : 0.0, display_max_ns / 1e6);
+    printf("alarm: %d state samples in the store\n", stored);
+    ok = ok && popped > 0 && stored >= popped;
+    free(pipeline);
+    printf("alarm: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+// Dear ImGui without a window, for timing what the widgets put into the draw lists
+void headless_imgui_start() {
+    ImGui::CreateContext();
+    ImGuiIO &io = ImGui::GetIO();
+    io.DisplaySize = ImVec2(1920.0f, 1080.0f);
+    io.DeltaTime = 1.0f / 60.0f;
+    io.IniFilename = NULL;
+    // As the DX11 renderer does, draw lists can go past 64k vertices
+    io.BackendFlags |= ImGuiBackendFlags_RendererHasVtxOffset;
+    unsigned char *pixels;
+    int atlas_width;
+    int atlas_height;
+    io.Fonts->GetTexDataAsRGBA32(&pixels, &atlas_width, &atlas_height);
+}
+
+// A frame with one window over the whole display
+void headless_frame_begin() {
+    ImGui::NewFrame();
+    ImGui::SetNextWindowPos(ImVec2(0.0f, 0.0f));
+    ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
+    ImGui::Begin("Headless", NULL, ImGuiWindowFlags_NoDecoration);
+}
+
+// Returns the vertices of the frame
+int headless_frame_end() {
+    ImGui::End();
+    ImGui::Render();
+    return ImGui::GetDrawData()->TotalVtxCount;
+}
+
+// Edges over span_us, about edge_count of them with bursts in between quiet stretches
+int logic_test_edges(int edge_count, int64_t span_us, logic_edge *edges) {
+    uint32_t random_state = 12345;
+    int64_t mean_us = span_us / edge_count > 1 ? span_us / edge_count : 1;
+    int64_t timestamp_us = 0;
+    int count = 0;
+    while(count < edge_count && timestamp_us < span_us) {
+        edges[count].timestamp_us = timestamp_us;
+        edges[count].value = (float)(count & 1);
+        count++;
+        uint32_t random = compress_random(&random_state);
+        // A tenth of the gaps are long, the rest come in bursts
+        int64_t gap_us = random % 10 == 0 ? mean_us * 5 + random % (mean_us * 5) : 1 + random % mean_us;
+        timestamp_us += gap_us;
+    }
+    return count;
+}
+
+// Checks every pixel of the runs against the edges counted one at a time
+bool logic_check_runs(const logic_edge *edges, int edge_count, int64_t from_us, int64_t to_us, int pixel_count,
+                      const logic_run *runs, int run_count) {
+    int run = 0;
+    int current = -1;
+    for(int x = 0; x < pixel_count; x++) {
+        int64_t start_us = logic_pixel_us(from_us, to_us, pixel_count, x);
+        int64_t end_us = logic_pixel_us(from_us, to_us, pixel_count, x + 1);
+        if(end_us <= start_us) {
+            continue;
+        }
+        while(current + 1 < edge_count && edges[current + 1].timestamp_us <= start_us) {
+            current++;
+        }
+        int inside = 0;
+        for(int i = current + 1; i < edge_count && edges[i].timestamp_us < end_us; i++) {
+            inside++;
+        }
+        int level = logic_level_of(current >= 0 ? edges[current].value : NAN, false, 0.5f);
+        int expected = inside >= 2 ? logic_level_busy : level;
+        while(run < run_count && runs[run].end_us <= start_us) {
+            run++;
+        }
+        if(run == run_count || runs[run].start_us > start_us || runs[run].level != expected) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Draws 32 lanes of edge lists with up to max_edges edges in a 10 s view at full width through Dear ImGui, without
+// a renderer, and reports what a frame costs and how many vertices it has for every edge count. Then the same
+// from the store, a GPIO line and a port sampled at 100 kHz, zoomed out and in.
+int run_logic(int max_edges) {
+    const int lane_count = 32;
+    const int64_t span_us = 10000000;
+    const int frames = 20;
+    bool ok = true;
+    headless_imgui_start();
+
+    logic_edge *edges = (logic_edge *)malloc((size_t)max_edges * sizeof(logic_edge));
+    logic_run *runs = (logic_run *)malloc(LOGIC_MAX_RUNS * sizeof(logic_run));
+    int pixel_count = 1800;
+    for(int edge_target = 1000; edge_target <= max_edges; edge_target *= 10) {
+        int edge_count = logic_test_edges(edge_target, span_us, edges);
+        // A few zoomed in views first, a busy pixel has to be busy at every zoom
+        for(int zoom = 1; zoom <= 1000; zoom *= 10) {
+            int64_t from_us = span_us / 3;
+            int64_t to_us = from_us + span_us / zoom;
+            int run_count = logic_runs_from_edges(edges, edge_count, from_us, to_us, pixel_count, false, 0.5f, runs);
+            ok = ok && logic_check_runs(edges, edge_count, from_us, to_us, pixel_count, runs, run_count);
+        }
+        int run_count = 0;
+        int vertex_count = 0;
+        uint64_t start_ns = platform_time_ns();
+        for(int frame = 0; frame < frames; frame++) {
+            headless_frame_begin();
+            ImDrawList *draw = ImGui::GetWindowDrawList();
+            run_count = 0;
+            for(int lane = 0; lane < lane_count; lane++) {
+                int count = logic_runs_from_edges(edges, edge_count, 0, span_us, pixel_count, false, 0.5f, runs);
+                float y = 10.0f + lane * 30.0f;
+                logic_draw_lane(draw, ImVec2(100.0f, y), ImVec2(100.0f + pixel_count, y + 20.0f), runs, count, 0,
+                                span_us, IM_COL32(80, 220, 120, 255));
+                run_count += count;
+            }
+            vertex_count = headless_frame_end();
+        }
+        double frame_ms = (platform_time_ns() - start_ns) / 1e6 / frames;
+        printf("logic: %d lanes of %9d edges at %d pixels, %6d runs, %6d vertices, %.2f ms per frame\n", lane_count,
+               edge_count, pixel_count, run_count, vertex_count, frame_ms);
+        // A rectangle or two per run and the odd label, whatever the edge count
+        ok = ok && vertex_count <= lane_count * pixel_count * 16;
+    }
+    printf("logic: runs from edges against every pixel counted one at a time %s\n", ok ? "match" : "MISMATCH");
+
+    sample_store *store = (sample_store *)calloc(1, sizeof(sample_store));
+    store_init(store, 0, 0);
+    int64_t timestamps_us[1000];
+    float values[1000];
+    float gpio = 0.0f;
+    uint32_t random_state = 777;
+    for(int64_t first = 0; first < span_us / 10; first += 1000) {
+        for(int i = 0; i < 1000; i++) {
+            timestamps_us[i] = (first + i) * 10;
+            gpio = compress_random(&random_state) % 50 == 0 ? 1.0f - gpio : gpio;
+            values[i] = gpio;
+        }
+        store_append(store, device_channel_id(0, 0), timestamps_us, values, 1000);
+        for(int i = 0; i < 1000; i++) {
+            values[i] = (float)(((first + i) / 37) & 0xFF);
+        }
+        store_append(store, device_channel_id(0, 1), timestamps_us, values, 1000);
+    }
+    logic_view *view = (logic_view *)calloc(1, sizeof(logic_view));
+    logic_view_init(view);
+    for(int lane = 0; lane < lane_count; lane++) {
+        logic_lane added = {"", device_channel_id(0, lane % 2), lane % 2 == 1, 0.5f};
+        snprintf(added.name, LOGIC_MAX_NAME, lane % 2 ? "PORT%d" : "GPIO%d", lane);
+        logic_add_lane(view, &added);
+    }
+    for(int64_t view_us = span_us; view_us >= 1000; view_us /= 100) {
+        view->from_us = span_us / 2;
+        view->to_us = view->from_us + view_us;
+        uint64_t start_ns = platform_time_ns();
+        int vertex_count = 0;
+        for(int frame = 0; frame < frames; frame++) {
+            headless_frame_begin();
+            logic_view_draw(view, store, NULL, LOGIC_NAME_WIDTH + pixel_count);
+            vertex_count = headless_frame_end();
+        }
+        printf("logic: %d lanes from the store, %.3f s in view, %6d runs, %6d vertices, %.2f ms per frame\n",
+               lane_count, view_us / 1e6, view->run_count, vertex_count,
+               (platform_time_ns() - start_ns) / 1e6 / frames);
+        ok = ok && view->run_count > 0 && vertex_count <= lane_count * pixel_count * 16;
+    }
+    store_destroy(store);
+    free(store);
+    free(view);
+    free(edges);
+    free(runs);
+    ImGui::DestroyContext();
+    printf("logic: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+// Envelopes of a float and an int16 series of point_count points with every kernel set, checked against the
+// scalar ones and for a spike of a single sample, then whole frames of one and of four such series through Dear
+// ImGui at 1800 columns, zoomed out and in, next to ImGui::PlotLines with the same points.
+int run_plot(int point_count) {
+    const int pixel_count = 1800;
+    const int rounds = 50;
+    bool ok = true;
+    // What building a frame takes, not reusing it
+    retained_enabled = false;
+    headless_imgui_start();
+    float *floats = (float *)malloc(point_count * sizeof(float));
+    int16_t *shorts = (int16_t *)malloc(point_count * sizeof(int16_t));
+    uint32_t random_state = 4242;
+    for(int i = 0; i < point_count; i++) {
+        floats[i] = (float)sin(i * 0.0001) + (compress_random(&random_state) % 1000) / 5000.0f;
+        floats[i] = i % 99991 == 0 ? NAN : floats[i];
+        shorts[i] = (int16_t)(sin(i * 0.00003) * 20000.0 + (int)(compress_random(&random_state) % 2000) - 1000);
+    }
+    int spike = point_count / 3 + 17;
+    floats[spike] = 5.0f;
+    plot_series series[4] = {};
+    const char *names[4] = {"float", "int16", "float, later", "int16, later"};
+    for(int s = 0; s < 4; s++) {
+        series[s].name = names[s];
+        series[s].color = s == 0 ? IM_COL32(90, 170, 255, 255) : s == 1 ? IM_COL32(255, 150, 60, 255)
+                                 : s == 2 ? IM_COL32(120, 220, 120, 255) : IM_COL32(220, 120, 220, 255);
+        series[s].format = s % 2 ? plot_format_i16 : plot_format_f32;
+        series[s].values = s % 2 ? (const void *)shorts : (const void *)floats;
+        series[s].count = point_count;
+        series[s].x0 = s < 2 ? 0.0 : 1.0e5;
+        series[s].dx = 1.0;
+        series[s].scale = 1.0f / 10000.0f;
+        series[s].offset = s < 2 ? 0.0f : 0.5f;
+    }
+
+    plot_view *view = (plot_view *)calloc(1, sizeof(plot_view));
+    float *expected = (float *)malloc(4 * pixel_count * sizeof(float));
+    for(int k = 0; k < (int)array_count(plot_kernel_sets); k++) {
+        if(!plot_kernels_supported(plot_kernel_sets[k])) {
+            continue;
+        }
+        bool same = true;
+        uint64_t start_ns = platform_time_ns();
+        for(int round = 0; round < rounds; round++) {
+            for(int s = 0; s < 2; s++) {
+                plot_envelope_span(plot_kernel_sets[k], &series[s], 0.0, (double)point_count, pixel_count,
+                                   view->mins[s], view->maxs[s]);
+            }
+        }
+        double envelope_ms = (platform_time_ns() - start_ns) / 1e6 / rounds / 2;
+        for(int s = 0; s < 2; s++) {
+            if(k == 0) {
+                memcpy(expected + s * 2 * pixel_count, view->mins[s], pixel_count * sizeof(float));
+                memcpy(expected + (s * 2 + 1) * pixel_count, view->maxs[s], pixel_count * sizeof(float));
+            }
+            same = same && memcmp(expected + s * 2 * pixel_count, view->mins[s], pixel_count * sizeof(float)) == 0;
+            same = same && memcmp(expected + (s * 2 + 1) * pixel_count, view->maxs[s],
+                                  pixel_count * sizeof(float)) == 0;
+        }
+        // Columns of a few samples, fewer than a vector, have to come out of the lane reduction the same
+        for(int count = 1; count <= 8; count++) {
+            for(int first = 0; first < 3; first++) {
+                float f32[2][2] = {{INFINITY, -INFINITY}, {INFINITY, -INFINITY}};
+                int16_t i16[2][2] = {{32767, -32768}, {32767, -32768}};
+                plot_kernel_sets[k]->minmax_f32(floats + 1 + first, count, &f32[0][0], &f32[0][1]);
+                plot_minmax_f32_scalar(floats + 1 + first, count, &f32[1][0], &f32[1][1]);
+                plot_kernel_sets[k]->minmax_i16(shorts + first, count, &i16[0][0], &i16[0][1]);
+                plot_minmax_i16_scalar(shorts + first, count, &i16[1][0], &i16[1][1]);
+                same = same && memcmp(f32[0], f32[1], sizeof(f32[0])) == 0 &&
+                       memcmp(i16[0], i16[1], sizeof(i16[0])) == 0;
+            }
+        }
+        bool spiked = view->maxs[0][(int)((int64_t)spike * pixel_count / point_count)] == 5.0f;
+        printf("plot: envelope of %d points at %d columns, %-6s %.3f ms per series%s%s\n", point_count,
+               pixel_count, plot_kernel_sets[k]->name, envelope_ms, same ? "" : " MISMATCH",
+               spiked ? "" : ", spike missing");
+        ok = ok && same && spiked;
+    }
+
+    int frames = 100;
+    for(int series_count = 1; series_count <= 4; series_count += 3) {
+        for(int zoomed = 0; zoomed < 2; zoomed++) {
+            plot_view_init(view);
+            view->fit = false;
+            view->x_from = zoomed ? point_count / 2.0 : 0.0;
+            view->x_to = zoomed ? view->x_from + 1000.0 : (double)point_count + 1.0e5;
+            view->y_min = -3.0;
+            view->y_max = 6.0;
+            int vertex_count = 0;
+            uint64_t start_ns = platform_time_ns();
+            for(int frame = 0; frame < frames; frame++) {
+                headless_frame_begin();
+                plot_draw(view, series, series_count, ImVec2(PLOT_AXIS_WIDTH + pixel_count, 400.0f), NULL);
+                vertex_count = headless_frame_end();
+            }
+            double frame_ms = (platform_time_ns() - start_ns) / 1e6 / frames;
+            printf("plot: %d series of %d points, %s, %6d vertices, %.3f ms per frame\n", series_count,
+                   point_count, zoomed ? "1000 points in view" : "all points in view", vertex_count, frame_ms);
+            ok = ok && (zoomed || series_count > 1 || frame_ms < 1.0);
+        }
+    }
+
+    uint64_t start_ns = platform_time_ns();
+    int vertex_count = 0;
+    for(int frame = 0; frame < 10; frame++) {
+        headless_frame_begin();
+        ImGui::PlotLines("##lines", floats, point_count, 0, NULL, FLT_MAX, FLT_MAX, ImVec2(pixel_count, 400.0f));
+        vertex_count = headless_frame_end();
+    }
+    printf("plot: ImGui::PlotLines of the same float series, a point per column, %6d vertices, %.3f ms per "
+           "frame\n", vertex_count, (platform_time_ns() - start_ns) / 1e6 / 10);
+
+    retained_enabled = true;
+    free(expected);
+    plot_view_free(view);
+    free(view);
+    free(floats);
+    free(shorts);
+    ImGui::DestroyContext();
+    printf("plot: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+// Same vertices and indices from every AddPolyline() path, and what each costs per point
+int run_polyline(int max_points) {
+    const char *level_names[3] = {"scalar", "SSE2", "AVX2"};
+    struct polyline_case { const char *name; float thickness; bool texture; };
+    const polyline_case cases[3] = {{"1 px, texture", 1.0f, true}, {"1 px", 1.0f, false}, {"2.5 px", 2.5f, false}};
+    bool ok = true;
+    headless_imgui_start();
+    // Sets up the shared draw data: white pixel, line texture and clip rect
+    headless_frame_begin();
+    headless_frame_end();
+    ImDrawListSharedData *shared = ImGui::GetDrawListSharedData();
+    const int best_level = shared->PolylineSimd;
+    ImDrawList *draw_list = IM_NEW(ImDrawList)(shared);
+
+    ImVec2 *points = (ImVec2 *)malloc(max_points * sizeof(ImVec2));
+    ImDrawVert *expected_vtx = NULL;
+    ImDrawIdx *expected_idx = NULL;
+    for(int point_count = 10000; point_count <= max_points; point_count *= 10) {
+        uint32_t random_state = 777;
+        for(int i = 0; i < point_count; i++) {
+            points[i].x = 10.0f + i * (1900.0f / point_count);
+            points[i].y = 540.0f + 300.0f * (float)sin(i * 0.001) + (compress_random(&random_state) % 1000) / 50.0f;
+            // Repeated points and turning back make the zero-length and near-zero normals
+            points[i] = i % 997 == 0 && i > 0 ? points[i - 1] : points[i];
+            points[i].x = i % 1009 == 0 && i > 1 ? points[i - 2].x : points[i].x;
+        }
+        int rounds = 2000000 / point_count;
+        for(int c = 0; c < (int)array_count(cases); c++) {
+            for(int closed = 0; closed < 2; closed++) {
+                double scalar_ns = 0.0;
+                for(int level = 0; level <= best_level; level++) {
+                    shared->PolylineSimd = level;
+                    // Round -1 grows the buffers
+                    uint64_t start_ns = 0;
+                    for(int round = -1; round < rounds; round++) {
+                        start_ns = round == 0 ? platform_time_ns() : start_ns;
+                        draw_list->_ResetForNewFrame();
+                        draw_list->PushClipRectFullScreen();
+                        draw_list->PushTextureID(ImGui::GetIO().Fonts->TexID);
+                        draw_list->Flags = ImDrawListFlags_AntiAliasedLines
+                                           | (cases[c].texture ? ImDrawListFlags_AntiAliasedLinesUseTex : 0);
+                        draw_list->AddPolyline(points, point_count, IM_COL32(90, 170, 255, 255),
+                                               closed ? ImDrawFlags_Closed : ImDrawFlags_None, cases[c].thickness);
+                    }
+                    double point_ns = (double)(platform_time_ns() - start_ns) / rounds / point_count;
+                    size_t vtx_bytes = draw_list->VtxBuffer.Size * sizeof(ImDrawVert);
+                    size_t idx_bytes = draw_list->IdxBuffer.Size * sizeof(ImDrawIdx);
+                    bool same = true;
+                    if(level == 0) {
+                        scalar_ns = point_ns;
+                        expected_vtx = (ImDrawVert *)realloc(expected_vtx, vtx_bytes);
+                        expected_idx = (ImDrawIdx *)realloc(expected_idx, idx_bytes);
+                        memcpy(expected_vtx, draw_list->VtxBuffer.Data, vtx_bytes);
+                        memcpy(expected_idx, draw_list->IdxBuffer.Data, idx_bytes);
+                    } else {
+                        same = memcmp(expected_vtx, draw_list->VtxBuffer.Data, vtx_bytes) == 0
+                               && memcmp(expected_idx, draw_list->IdxBuffer.Data, idx_bytes) == 0;
+                    }
+                    printf("polyline: %7d points, %-13s %-6s %-6s %5.2f ns per point, %4.2fx%s\n", point_count,
+                           cases[c].name, closed ? "closed" : "open", level_names[level], point_ns,
+                           scalar_ns / point_ns, same ? "" : " MISMATCH");
+                    ok = ok && same;
+                }
+            }
+        }
+    }
+    shared->PolylineSimd = best_level;
+
+    free(expected_vtx);
+    free(expected_idx);
+    free(points);
+    IM_DELETE(draw_list);
+    ImGui::DestroyContext();
+    printf("polyline: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+// Plot panels built on the UI thread and on workers: same geometry, in the right place in the draw data, and what
+// it does to the frame time
+int run_panels(int panel_count, int max_workers) {
+    const int point_count = 1000000;
+    const int frames = 20;
+    bool ok = true;
+    headless_imgui_start();
+    float *floats = (float *)malloc(point_count * sizeof(float));
+    int16_t *shorts = (int16_t *)malloc(point_count * sizeof(int16_t));
+    uint32_t random_state = 4242;
+    for(int i = 0; i < point_count; i++) {
+        floats[i] = (float)sin(i * 0.0001) + (compress_random(&random_state) % 1000) / 5000.0f;
+        shorts[i] = (int16_t)(sin(i * 0.00003) * 20000.0 + (int)(compress_random(&random_state) % 2000) - 1000);
+    }
+    plot_series series[4] = {};
+    const char *names[4] = {"float", "int16", "float, later", "int16, later"};
+    for(int s = 0; s < 4; s++) {
+        series[s].name = names[s];
+        series[s].color = IM_COL32(90 + s * 40, 170, 255 - s * 40, 255);
+        series[s].format = s % 2 ? plot_format_i16 : plot_format_f32;
+        series[s].values = s % 2 ? (const void *)shorts : (const void *)floats;
+        series[s].count = point_count;
+        series[s].x0 = s < 2 ? 0.0 : 1.0e5;
+        series[s].dx = 1.0;
+        series[s].scale = 1.0f / 10000.0f;
+        series[s].offset = s < 2 ? 0.0f : 0.5f;
+    }
+    plot_view *views = (plot_view *)calloc(panel_count, sizeof(plot_view));
+    plot_workers *workers = (plot_workers *)calloc(1, sizeof(plot_workers));
+    ImDrawVert *expected = NULL;
+    int expected_count = 0;
+    int inline_vertices = 0;
+    double inline_ms = 0.0;
+
+    // -1 draws them right away, like before there were workers
+    for(int thread_count = -1; thread_count <= max_workers; thread_count = thread_count < 1 ? thread_count + 1
+                                                                                           : thread_count * 2) {
+        if(thread_count >= 0 && !plot_workers_start(workers, thread_count)) {
+            printf("panels: could not start %d workers\n", thread_count);
+            ok = false;
+            break;
+        }
+        plot_workers *used = thread_count >= 0 ? workers : NULL;
+        int vertex_count = 0;
+        bool placed = true;
+        uint64_t start_ns = 0;
+        for(int frame = -1; frame < frames; frame++) {
+            start_ns = frame == 0 ? platform_time_ns() : start_ns;
+            headless_frame_begin();
+            for(int p = 0; p < panel_count; p++) {
+                plot_view_init(&views[p]);
+                views[p].fit = false;
+                views[p].x_from = p * 1000.0;
+                views[p].x_to = point_count + 1.0e5 - p * 1000.0;
+                views[p].y_min = -3.0;
+                views[p].y_max = 6.0;
+                ImGui::PushID(p);
+                plot_draw(&views[p], series, 4, ImVec2(900.0f, 150.0f), used);
+                ImGui::PopID();
+                if(p % 2 == 0) {
+                    ImGui::SameLine();
+                }
+            }
+            ImGui::End();
+            ImGui::Render();
+            ImDrawData *draw_data = ImGui::GetDrawData();
+            int host = -1;
+            if(used) {
+                host = draw_data->CmdLists.find_index(workers->panels[0].host);
+                plot_workers_finish(workers, draw_data);
+                for(int p = 0; p < panel_count; p++) {
+                    placed = placed && host >= 0 && draw_data->CmdLists[host + 1 + p] == workers->lists[p];
+                }
+            }
+            vertex_count = draw_data->TotalVtxCount;
+        }
+        double frame_ms = (platform_time_ns() - start_ns) / 1e6 / frames;
+
+        // Every panel's vertices in order, the same whoever built them
+        bool same = true;
+        if(used) {
+            int count = 0;
+            for(int p = 0; p < panel_count; p++) {
+                count += workers->lists[p]->VtxBuffer.Size;
+            }
+            ImDrawVert *vertices = (ImDrawVert *)malloc(count * sizeof(ImDrawVert));
+            count = 0;
+            for(int p = 0; p < panel_count; p++) {
+                memcpy(vertices + count, workers->lists[p]->VtxBuffer.Data,
+                       workers->lists[p]->VtxBuffer.Size * sizeof(ImDrawVert));
+                count += workers->lists[p]->VtxBuffer.Size;
+            }
+            if(!expected) {
+                expected = vertices;
+                expected_count = count;
+            } else {
+                same = count == expected_count && memcmp(vertices, expected, count * sizeof(ImDrawVert)) == 0;
+                free(vertices);
+            }
+            plot_workers_stop(workers);
+        } else {
+            inline_vertices = vertex_count;
+            inline_ms = frame_ms;
+        }
+        same = same && vertex_count == inline_vertices;
+        char built_by[32];
+        snprintf(built_by, sizeof(built_by), thread_count < 0 ? "in the UI pass" : thread_count == 0
+                 ? "after Render()" : "on %d worker%s", thread_count, thread_count == 1 ? "" : "s");
+        printf("panels: %d panels of 4 series, %-15s %7d vertices, %6.2f ms per frame, %4.2fx%s%s\n", panel_count,
+               built_by, vertex_count, frame_ms, inline_ms / frame_ms, same ? "" : " MISMATCH",
+               placed ? "" : " MISPLACED");
+        ok = ok && same && placed;
+    }
+
+    free(expected);
+    free(workers);
+    for(int p = 0; p < panel_count; p++) {
+        plot_view_free(&views[p]);
+    }
+    free(views);
+    free(floats);
+    free(shorts);
+    ImGui::DestroyContext();
+    printf("panels: %d processors\n", platform_cpu_count());
+    printf("panels: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+// A card of a dashboard: a frame, a title, a few readings and a sparkline
+void dashboard_card(ImDrawList *draw, ImVec2 min, ImVec2 max, int index) {
+    ImU32 text_color = ImGui::GetColorU32(ImGuiCol_Text);
+    draw->AddRectFilled(min, max, ImGui::GetColorU32(ImGuiCol_FrameBg), 4.0f);
+    draw->AddRect(min, max, ImGui::GetColorU32(ImGuiCol_Border), 4.0f);
+    char label[64];
+    snprintf(label, sizeof(label), "Device %d", index);
+    draw->AddText(ImVec2(min.x + 6.0f, min.y + 4.0f), text_color, label);
+    for(int i = 0; i < 3; i++) {
+        snprintf(label, sizeof(label), "Channel %d: %.3f V", i, sin(index * 3.0 + i) * 5.0);
+        draw->AddText(ImVec2(min.x + 6.0f, min.y + 22.0f + i * 15.0f), text_color, label);
+    }
+    ImVec2 points[128];
+    for(int i = 0; i < 128; i++) {
+        points[i] = ImVec2(min.x + 6.0f + i * (max.x - min.x - 12.0f) / 127.0f,
+                           max.y - 12.0f - 8.0f * (float)sin(i * 0.2 + index));
+    }
+    draw->AddPolyline(points, 128, IM_COL32(90, 170, 255, 255), ImDrawFlags_None, 1.5f);
+}
+
+typedef struct {
+    int panel_count;
+    // Every fifth panel is a plot, the rest are cards
+    retained_panel *cards;
+    plot_view *plots;
+    plot_series series;
+    // Under the panels if not empty
+    char status[64];
+    ImDrawList *window;
+} dashboard;
+
+// Draws every panel, reusing what it can. Returns the ms it took.
+double dashboard_frame(dashboard *board) {
+    const int columns = 10;
+    const ImVec2 card_size(186.0f, 100.0f);
+    uint64_t start_ns = platform_time_ns();
+    headless_frame_begin();
+    board->window = ImGui::GetWindowDrawList();
+    for(int p = 0; p < board->panel_count; p++) {
+        ImGui::PushID(p);
+        if(p % 5 == 4) {
+            plot_draw(&board->plots[p], &board->series, 1, card_size, NULL);
+        } else {
+            ImVec2 min = ImGui::GetCursorScreenPos();
+            ImVec2 max(min.x + card_size.x, min.y + card_size.y);
+            ImGui::Dummy(card_size);
+            // Nothing on a card changes, its index is all there is to it
+            if(!retained_reuse(&board->cards[p], board->window, (uint64_t)p, min, max)) {
+                retained_begin(&board->cards[p], board->window);
+                dashboard_card(board->window, min, max, p);
+                retained_end(&board->cards[p], board->window);
+            }
+        }
+        ImGui::PopID();
+        if(p % columns != columns - 1) {
+            ImGui::SameLine();
+        }
+    }
+    if(board->status[0]) {
+        ImGui::Text("%s", board->status);
+    }
+    headless_frame_end();
+    return (platform_time_ns() - start_ns) / 1e6;
+}
+
+uint64_t dashboard_drawn(const dashboard *board) {
+    uint64_t drawn = 0;
+    for(int p = 0; p < board->panel_count; p++) {
+        drawn += p % 5 == 4 ? board->plots[p].retained.drawn : board->cards[p].drawn;
+    }
+    return drawn;
+}
+
+// A dashboard of idle panels drawn every frame and then reused, the same geometry either way and what reusing it
+// saves. Changing the style or the font size has to draw all of them again.
+int run_retained(int panel_count, int frames) {
+    const int point_count = 100000;
+    bool ok = true;
+    headless_imgui_start();
+    float *floats = (float *)malloc(point_count * sizeof(float));
+    for(int i = 0; i < point_count; i++) {
+        floats[i] = (float)sin(i * 0.001) + (float)sin(i * 0.37) * 0.1f;
+    }
+    dashboard board = {};
+    board.panel_count = panel_count;
+    board.cards = (retained_panel *)calloc(panel_count, sizeof(retained_panel));
+    board.plots = (plot_view *)calloc(panel_count, sizeof(plot_view));
+    for(int p = 0; p < panel_count; p++) {
+        plot_view_init(&board.plots[p]);
+    }
+    board.series.name = "float";
+    board.series.color = IM_COL32(120, 220, 120, 255);
+    board.series.format = plot_format_f32;
+    board.series.values = floats;
+    board.series.count = point_count;
+    board.series.dx = 1.0;
+    ImVector<ImDrawVert> expected_vertices;
+    ImVector<ImDrawIdx> expected_indices;
+    double redrawn_ms = 0.0;
+
+    for(int enabled = 0; enabled < 2; enabled++) {
+        retained_enabled = enabled != 0;
+        // The first frame fits the plots, the second draws them where they stay
+        dashboard_frame(&board);
+        dashboard_frame(&board);
+        uint64_t drawn_before = dashboard_drawn(&board);
+        double total_ms = 0.0;
+        for(int frame = 0; frame < frames; frame++) {
+            total_ms += dashboard_frame(&board);
+        }
+        double frame_ms = total_ms / frames;
+        uint64_t drawn = dashboard_drawn(&board) - drawn_before;
+        ImDrawList *window = board.window;
+        bool same = true;
+        if(!enabled) {
+            redrawn_ms = frame_ms;
+            expected_vertices = window->VtxBuffer;
+            expected_indices = window->IdxBuffer;
+        } else {
+            same = window->VtxBuffer.Size == expected_vertices.Size &&
+                   window->IdxBuffer.Size == expected_indices.Size &&
+                   memcmp(window->VtxBuffer.Data, expected_vertices.Data,
+                          expected_vertices.Size * sizeof(ImDrawVert)) == 0 &&
+                   memcmp(window->IdxBuffer.Data, expected_indices.Data,
+                          expected_indices.Size * sizeof(ImDrawIdx)) == 0;
+            ok = ok && same && drawn == 0;
+        }
+        printf("retained: %d idle panels %-8s %6d vertices, %5.1f drawn per frame, %.3f ms per frame, %4.2fx%s\n",
+               panel_count, enabled ? "reused," : "redrawn,", window->VtxBuffer.Size, (double)drawn / frames,
+               frame_ms, redrawn_ms / frame_ms, same ? "" : " MISMATCH");
+    }
+
+    // Style and font changes draw every panel again, the frame after reuses them again
+    const char *changes[2] = {"a text color", "the font scale"};
+    for(int change = 0; change < 2; change++) {
+        if(change == 0) {
+            ImGui::GetStyle().Colors[ImGuiCol_Text].x = 0.5f;
+        } else {
+            ImGui::GetIO().FontGlobalScale = 1.25f;
+        }
+        uint64_t drawn_before = dashboard_drawn(&board);
+        dashboard_frame(&board);
+        uint64_t drawn = dashboard_drawn(&board) - drawn_before;
+        dashboard_frame(&board);
+        uint64_t drawn_after = dashboard_drawn(&board) - drawn_before - drawn;
+        printf("retained: changing %s drew %d of %d panels again, the frame after %d\n", changes[change], (int)drawn,
+               panel_count, (int)drawn_after);
+        ok = ok && drawn == (uint64_t)panel_count && drawn_after == 0;
+    }
+
+    for(int p = 0; p < panel_count; p++) {
+        retained_free(&board.cards[p]);
+        plot_view_free(&board.plots[p]);
+    }
+    free(board.cards);
+    free(board.plots);
+    free(floats);
+    ImGui::DestroyContext();
+    printf("retained: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+// Hashes the draw data of the dashboard of run_retained, against what building it takes. The dashboard stays the
+// same for the first half of the frames, which are all skipped, and a counter under it changes every frame of the
+// second half, which are all submitted. A vertex, an index, a clip rect or a texture changed in a frame that is
+// otherwise the same has to be seen too.
+int run_draw_hash(int panel_count, int frames) {
+    const int point_count = 100000;
+    bool ok = true;
+    headless_imgui_start();
+    float *floats = (float *)malloc(point_count * sizeof(float));
+    for(int i = 0; i < point_count; i++) {
+        floats[i] = (float)sin(i * 0.001) + (float)sin(i * 0.37) * 0.1f;
+    }
+    dashboard board = {};
+    board.panel_count = panel_count;
+    board.cards = (retained_panel *)calloc(panel_count, sizeof(retained_panel));
+    board.plots = (plot_view *)calloc(panel_count, sizeof(plot_view));
+    for(int p = 0; p < panel_count; p++) {
+        plot_view_init(&board.plots[p]);
+    }
+    board.series.name = "float";
+    board.series.color = IM_COL32(120, 220, 120, 255);
+    board.series.format = plot_format_f32;
+    board.series.values = floats;
+    board.series.count = point_count;
+    board.series.dx = 1.0;
+    draw_hash *presented = (draw_hash *)calloc(1, sizeof(draw_hash));
+    ImDrawVert *staging_vertices = (ImDrawVert *)malloc(megabytes(4));
+    ImDrawIdx *staging_indices = (ImDrawIdx *)malloc(megabytes(2));
+
+    // Every kernel set comes to the same hash, on lengths that end in and out of a stripe and a block
+    const size_t byte_count = megabytes(2) + 29;
+    uint8_t *bytes = (uint8_t *)malloc(byte_count);
+    uint32_t random_state = 777;
+    for(size_t i = 0; i < byte_count; i++) {
+        bytes[i] = (uint8_t)compress_random(&random_state);
+    }
+    for(int k = 0; k < (int)array_count(draw_hash_kernel_sets); k++) {
+        const draw_hash_kernels *kernels = draw_hash_kernel_sets[k];
+        if(!draw_hash_kernels_supported(kernels)) {
+            continue;
+        }
+        bool same = true;
+        for(size_t size = 0; size < 3000; size += 37) {
+            same = same && draw_hash_bytes_with(kernels, bytes + 3, size, size) ==
+                           draw_hash_bytes_with(&draw_hash_scalar_kernels, bytes + 3, size, size);
+        }
+        uint64_t hash = 0;
+        uint64_t start_ns = platform_time_ns();
+        for(int round = 0; round < 10; round++) {
+            hash ^= draw_hash_bytes_with(kernels, bytes, byte_count, round);
+        }
+        double seconds = (platform_time_ns() - start_ns) / 1e9;
+        same = same && draw_hash_bytes_with(kernels, bytes, byte_count, 0) ==
+                       draw_hash_bytes_with(&draw_hash_scalar_kernels, bytes, byte_count, 0);
+        printf("draw_hash: %-6s %5.1f GB/s%s%s\n", kernels->name, byte_count * 10 / seconds / 1e9,
+               kernels == draw_hash_active_kernels() ? ", active" : "", same ? "" : " MISMATCH");
+        ok = ok && same && hash != 0;
+    }
+    free(bytes);
+
+    // The first frame fits the plots, the second draws them where they stay
+    for(int frame = 0; frame < 2; frame++) {
+        dashboard_frame(&board);
+        draw_hash_unchanged(presented, ImGui::GetDrawData());
+    }
+    for(int changing = 0; changing < 2; changing++) {
+        uint64_t submitted = presented->submitted;
+        uint64_t skipped = presented->skipped;
+        uint64_t hash_ns = presented->hash_ns;
+        double build_ms = 0.0;
+        uint64_t copy_ns = 0;
+        for(int frame = 0; frame < frames; frame++) {
+            if(changing) {
+                snprintf(board.status, sizeof(board.status), "Frame %d", frame);
+            }
+            build_ms += dashboard_frame(&board);
+            ImDrawData *draw_data = ImGui::GetDrawData();
+            draw_hash_unchanged(presented, draw_data);
+            // What the backend copies into its vertex and index buffers at the least, were the frame submitted
+            uint64_t start_ns = platform_time_ns();
+            ImDrawVert *vertex_out = staging_vertices;
+            ImDrawIdx *index_out = staging_indices;
+            for(int i = 0; i < draw_data->CmdListsCount; i++) {
+                const ImDrawList *list = draw_data->CmdLists[i];
+                memcpy(vertex_out, list->VtxBuffer.Data, list->VtxBuffer.Size * sizeof(ImDrawVert));
+                memcpy(index_out, list->IdxBuffer.Data, list->IdxBuffer.Size * sizeof(ImDrawIdx));
+                vertex_out += list->VtxBuffer.Size;
+                index_out += list->IdxBuffer.Size;
+            }
+            copy_ns += platform_time_ns() - start_ns;
+        }
+        submitted = presented->submitted - submitted;
+        skipped = presented->skipped - skipped;
+        double hash_us = (presented->hash_ns - hash_ns) / 1e3 / frames;
+        ImDrawData *draw_data = ImGui::GetDrawData();
+        printf("draw_hash: %-8s %d lists, %6d vertices, %6d indices, %4llu submitted, %4llu skipped, "
+               "%.3f ms building, %5.1f us copying to submit, %5.1f us hashing\n", changing ? "changing" : "still",
+               draw_data->CmdListsCount, draw_data->TotalVtxCount, draw_data->TotalIdxCount,
+               (unsigned long long)submitted, (unsigned long long)skipped, build_ms / frames,
+               copy_ns / 1e3 / frames, hash_us);
+        // Has to be less than what submitting the frame would take
+        ok = ok && submitted == (uint64_t)(changing ? frames : 0) && skipped == (uint64_t)(changing ? 0 : frames) &&
+             hash_us < build_ms * 1e3 / frames + copy_ns / 1e3 / frames;
+    }
+
+    // Every change has to submit the frame, as has changing it back, and then it is the same again
+    ImDrawData *draw_data = ImGui::GetDrawData();
+    ImDrawList *list = draw_data->CmdLists[draw_data->CmdListsCount - 1];
+    const char *changes[4] = {"a vertex color", "an index", "a clip rect", "a texture"};
+    for(int change = 0; change < 4; change++) {
+        bool seen = true;
+        for(int step = 0; step < 3; step++) {
+            ImDrawVert *vertex = &list->VtxBuffer[list->VtxBuffer.Size / 2];
+            ImDrawIdx *index = &list->IdxBuffer[list->IdxBuffer.Size / 2];
+            ImDrawCmd *command = &list->CmdBuffer[0];
+            switch(step < 2 ? change : -1) {
+                case 0: vertex->col ^= 1; break;
+                case 1: *index ^= 1; break;
+                case 2: command->ClipRect.x += step ? -1.0f : 1.0f; break;
+                case 3: command->TextureId = (ImTextureID)((intptr_t)command->TextureId ^ 1); break;
+            }
+            seen = seen && draw_hash_unchanged(presented, draw_data) == (step == 2);
+        }
+        printf("draw_hash: changing %s and back %s\n", changes[change], seen ? "seen" : "MISSED");
+        ok = ok && seen;
+    }
+
+    for(int p = 0; p < panel_count; p++) {
+        retained_free(&board.cards[p]);
+        plot_view_free(&board.plots[p]);
+    }
+    free(board.cards);
+    free(board.plots);
+    free(floats);
+    free(presented);
+    free(staging_vertices);
+    free(staging_indices);
+    ImGui::DestroyContext();
+    printf("draw_hash: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+typedef struct {
+    ingest_pipeline *pipeline;
+    std::atomic<int> running;
+    // The watched channel only streams while this is set, the other one always does
+    std::atomic<int> watched_streaming;
+    std::atomic<uint64_t> watched_batches;
+    std::atomic<uint64_t> other_batches;
+} scheduler_device;
+
+// A batch of 10 samples every 5 ms on each channel that is streaming
+void scheduler_device_thread(void *parameters) {
+    scheduler_device *device = (scheduler_device *)parameters;
+    for(int64_t batch_index = 0; device->running.load(); batch_index++) {
+        for(int channel = 1; channel <= 2; channel++) {
+            if(channel == 1 && !device->watched_streaming.load()) {
+                continue;
+            }
+            sample_batch *batch = sample_batch_alloc(10);
+            batch->channel_id = device_channel_id(0, channel);
+            for(int i = 0; i < 10; i++) {
+                batch->timestamps_us[i] = (batch_index * 10 + i) * 500;
+                batch->values[i] = (float)sin((batch_index * 10 + i) * 0.01);
+            }
+            ingest_push(device->pipeline, batch);
+            (channel == 1 ? device->watched_batches : device->other_batches).fetch_add(1);
+        }
+        ingest_notify(device->pipeline);
+        platform_sleep_ms(5);
+    }
+}
+
+// The UI loop with the frame scheduler through four phases of phase_ms each. A channel nothing shows streams all
+// along, the channel on screen only in the second phase, the third has input about every 100 ms and in the
+// fourth an animation asks for a frame every 50 ms. Reports the frames rendered against the events that came in,
+// and against a loop that renders at 60 Hz no matter what, which samples on screen shouldn't go over.
+// What each phase may render follows from phase_ms and the scheduler's timer and data interval.
+int run_scheduler(int phase_ms) {
+    const int phase_count = 4;
+    const uint64_t input_interval_ns = 100 * 1000000ULL;
+    const uint64_t animation_ns = 50 * 1000000ULL;
+    const char *phase_names[phase_count] = {"idle", "data", "input", "animation"};
+    const uint32_t watched_channel = device_channel_id(0, 1);
+    bool ok = true;
+    headless_imgui_start();
+    ingest_pipeline *pipeline = (ingest_pipeline *)calloc(1, sizeof(ingest_pipeline));
+    frame_scheduler *scheduler = (frame_scheduler *)calloc(1, sizeof(frame_scheduler));
+    frame_scheduler_init(scheduler, SCHEDULER_DEFAULT_SETTLE_FRAMES, SCHEDULER_DEFAULT_TIMER_NS,
+                         SCHEDULER_DEFAULT_DATA_INTERVAL_NS);
+    ingest_snapshot *snapshot = (ingest_snapshot *)malloc(sizeof(ingest_snapshot));
+    scheduler_device device = {};
+    device.pipeline = pipeline;
+    device.running.store(1);
+    platform_thread device_thread;
+    if(!ingest_pipeline_start(pipeline) || !platform_thread_start(&device_thread, scheduler_device_thread, &device)) {
+        printf("scheduler: failed to start\n");
+        return 1;
+    }
+    ingest_set_scheduler(pipeline, scheduler);
+
+    uint64_t phase_ns = (uint64_t)phase_ms * 1000000ULL;
+    int inputs_per_phase = phase_ns / input_interval_ns > 0 ? (int)(phase_ns / input_interval_ns) : 1;
+    for(int phase = 0; phase < phase_count; phase++) {
+        // Counters at the start of the phase
+        uint64_t frames = scheduler->frames;
+        uint64_t inputs = scheduler->input_events;
+        uint64_t data_events = scheduler->data_version.load();
+        uint64_t watched_batches = device.watched_batches.load();
+        uint64_t other_batches = device.other_batches.load();
+        uint64_t reason_frames[frame_reason_count];
+        memcpy(reason_frames, scheduler->reason_frames, sizeof(reason_frames));
+        uint64_t frame_total_ns = 0;
+
+        device.watched_streaming.store(phase == 1);
+        uint64_t start_ns = platform_time_ns();
+        uint64_t next_input_ns = start_ns + phase_ns / inputs_per_phase / 2;
+        int input_count = 0;
+        while(true) {
+            uint64_t now_ns = platform_time_ns();
+            if(now_ns - start_ns >= phase_ns) {
+                break;
+            }
+            // Stands in for the messages of a window
+            if(phase == 2 && input_count < inputs_per_phase && now_ns >= next_input_ns) {
+                frame_scheduler_input(scheduler);
+                next_input_ns += phase_ns / inputs_per_phase;
+                input_count++;
+            }
+            uint64_t wait_ns;
+            if(!frame_scheduler_due(scheduler, now_ns, &wait_ns)) {
+                uint64_t until_ns = phase == 2 && input_count < inputs_per_phase ? next_input_ns : start_ns + phase_ns;
+                wait_ns = until_ns - now_ns < wait_ns ? until_ns - now_ns : wait_ns;
+                platform_event_wait(&scheduler->wake, frame_scheduler_wait_ms(wait_ns));
+                continue;
+            }
+            frame_scheduler_begin(scheduler, now_ns);
+            headless_frame_begin();
+            ingest_read_snapshot(pipeline, snapshot);
+            for(int i = 0; i < snapshot->channel_count; i++) {
+                ImGui::Text("Channel %u: %.3f", snapshot->channels[i].channel_id, snapshot->channels[i].value);
+            }
+            frame_scheduler_watch(scheduler, watched_channel);
+            if(phase == 3) {
+                frame_scheduler_animate(scheduler, now_ns, animation_ns);
+            }
+            headless_frame_end();
+            frame_scheduler_end(scheduler);
+            frame_total_ns += platform_time_ns() - now_ns;
+        }
+
+        frames = scheduler->frames - frames;
+        inputs = scheduler->input_events - inputs;
+        data_events = scheduler->data_version.load() - data_events;
+        watched_batches = device.watched_batches.load() - watched_batches;
+        other_batches = device.other_batches.load() - other_batches;
+        for(int reason = 0; reason < frame_reason_count; reason++) {
+            reason_frames[reason] = scheduler->reason_frames[reason] - reason_frames[reason];
+        }
+        uint64_t continuous_frames = (uint64_t)phase_ms * 60 / 1000;
+        printf("scheduler: %-9s %4llu batches on screen, %4llu off, %3llu data wakes, %2llu inputs -> %3llu frames "
+               "(input %llu, data %llu, animation %llu, timer %llu) of %llu at 60 Hz, %.2f ms rendering\n",
+               phase_names[phase], (unsigned long long)watched_batches, (unsigned long long)other_batches,
+               (unsigned long long)data_events, (unsigned long long)inputs, (unsigned long long)frames,
+               (unsigned long long)reason_frames[frame_reason_input],
+               (unsigned long long)reason_frames[frame_reason_data],
+               (unsigned long long)reason_frames[frame_reason_animation],
+               (unsigned long long)reason_frames[frame_reason_timer], (unsigned long long)continuous_frames,
+               frame_total_ns / 1e6);
+
+        // Allowing for the frame at the start and one for the phase before that shows up late
+        uint64_t timer_frames = phase_ns / SCHEDULER_DEFAULT_TIMER_NS + 2;
+        bool phase_ok = true;
+        switch(phase) {
+            case 0: {
+                phase_ok = data_events <= 1 && other_batches > 0 && frames <= timer_frames + 1;
+            } break;
+            case 1: {
+                uint64_t data_frames = phase_ns / SCHEDULER_DEFAULT_DATA_INTERVAL_NS + 1;
+                phase_ok = reason_frames[frame_reason_data] > data_frames / 2 &&
+                           reason_frames[frame_reason_data] <= data_frames && frames <= data_frames + timer_frames;
+            } break;
+            case 2: {
+                phase_ok = inputs == (uint64_t)inputs_per_phase &&
+                           reason_frames[frame_reason_input] == inputs * SCHEDULER_DEFAULT_SETTLE_FRAMES &&
+                           reason_frames[frame_reason_data] <= 1 &&
+                           frames <= inputs * SCHEDULER_DEFAULT_SETTLE_FRAMES + timer_frames;
+            } break;
+            case 3: {
+                // Nothing asks for the animation before the first timer frame of the phase
+                uint64_t animation_frames = phase_ns / animation_ns;
+                uint64_t late_frames = SCHEDULER_DEFAULT_TIMER_NS / animation_ns;
+                phase_ok = reason_frames[frame_reason_animation] + late_frames + 2 >= animation_frames &&
+                           reason_frames[frame_reason_animation] <= animation_frames + 1 &&
+                           frames <= animation_frames + 1 + timer_frames;
+            } break;
+        }
+        ok = ok && phase_ok;
+    }
+
+    device.running.store(0);
+    platform_thread_join(&device_thread);
+    ingest_pipeline_stop(pipeline);
+    frame_scheduler_destroy(scheduler);
+    free(scheduler);
+    free(pipeline);
+    free(snapshot);
+    ImGui::DestroyContext();
+    printf("scheduler: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int run_view(const char *path, double gigabytes, int64_t cache_bytes) {
+    const int channel_count = 16;
+    const int pixel_count = 1920;
+    uint64_t sample_count = (uint64_t)(gigabytes * 1024 * 1024 * 1024 / 12) / 16000 * 16000;
+    capture_channel channels[channel_count] = {};
+    for(int i = 0; i < channel_count; i++) {
+        channels[i].channel_id = i;
+    }
+    capture_writer *writer = (capture_writer *)calloc(1, sizeof(capture_writer));
+    if(!capture_writer_start(writer, path, channels, channel_count, true)) {
+        free(writer);
+        return 1;
+    }
+    uint64_t start_ns = platform_time_ns();
+    capture_write_pattern(writer, sample_count, channel_count, 0);
+    bool written = capture_writer_stop(writer);
+    printf("view: recorded %llu samples, %.2f GB in %.1f s\n", (unsigned long long)writer->samples_written.load(),
+           writer->bytes_written.load() / 1073741824.0, (platform_time_ns() - start_ns) / 1e9);
+    free(writer);
+
+    char pyramid_path[CAPTURE_VIEW_MAX_PATH + 16];
+    snprintf(pyramid_path, sizeof(pyramid_path), "%s.pyramid", path);
+    remove(pyramid_path);
+    capture_view *view = (capture_view *)calloc(1, sizeof(capture_view));
+    store_envelope_pixel *pixels = (store_envelope_pixel *)malloc(pixel_count * sizeof(store_envelope_pixel));
+    start_ns = platform_time_ns();
+    if(!written || !capture_view_open(view, path, cache_bytes)) {
+        free(view);
+        free(pixels);
+        return 1;
+    }
+    int64_t peak_resident = 0;
+    while(!view->pyramid_ready.load()) {
+        platform_sleep_ms(50);
+        int64_t resident = resident_bytes();
+        peak_resident = resident > peak_resident ? resident : peak_resident;
+    }
+    printf("view: built the pyramid sidecar in %.1f s, peak resident %.0f MB\n", (platform_time_ns() - start_ns) / 1e9,
+           peak_resident / 1048576.0);
+    capture_view_close(view);
+
+    // Push the capture out of the page cache if we're allowed to
+    FILE *drop = fopen("/proc/sys/vm/drop_caches", "w");
+    bool cold = drop && fputs("1", drop) >= 0;
+    if(drop) {
+        cold = (fclose(drop) == 0) && cold;
+    }
+
+    int64_t resident_before = resident_bytes();
+    start_ns = platform_time_ns();
+    int result = capture_view_open(view, path, cache_bytes) ? 0 : 1;
+    int64_t first_us = 0;
+    int64_t last_us = 0;
+    int level = -3;
+    if(result == 0 && capture_view_span(view, 0, &first_us, &last_us)) {
+        level = capture_view_envelope(view, 0, first_us, last_us, pixel_count, pixels);
+    }
+    double first_frame_ms = (platform_time_ns() - start_ns) / 1e6;
+    float min = 1e30f;
+    float max = -1e30f;
+    for(int x = 0; x < pixel_count; x++) {
+        if(pixels[x].count) {
+            min = pixels[x].min < min ? pixels[x].min : min;
+            max = pixels[x].max > max ? pixels[x].max : max;
+        }
+    }
+    printf("view: %s open to first frame %.1f ms (level %d, range %.0f..%.0f)\n", cold ? "cold" : "warm",
+           first_frame_ms, level, min, max);
+    result |= (level < 0 || min != 0.0f || max != 1023.0f) ? 1 : 0;
+
+    // Zooming in and out and panning over every channel, deep enough to end up on the samples
+    const int frames = 2000;
+    uint32_t random_state = 12345;
+    double worst_ms = 0.0;
+    int raw_frames = 0;
+    start_ns = platform_time_ns();
+    for(int frame = 0; frame < frames && result == 0; frame++) {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        int64_t width_us = (last_us - first_us) >> (random_state % 24);
+        int64_t from_us = first_us + (int64_t)((random_state >> 5) % (uint64_t)(last_us - first_us - width_us + 1));
+        uint64_t frame_ns = platform_time_ns();
+        raw_frames += capture_view_envelope(view, frame % channel_count, from_us, from_us + width_us, pixel_count,
+                                            pixels) == -1;
+        double frame_ms = (platform_time_ns() - frame_ns) / 1e6;
+        worst_ms = frame_ms > worst_ms ? frame_ms : worst_ms;
+    }
+    double frames_ms = (platform_time_ns() - start_ns) / 1e6;
+    int64_t resident = resident_bytes();
+    printf("view: %d frames, %.2f ms average, %.2f ms worst, %d from samples, %llu regions paged in, %llu released\n",
+           frames, frames_ms / frames, worst_ms, raw_frames, (unsigned long long)view->regions_paged_in,
+           (unsigned long long)view->regions_released);
+    printf("view: resident %.0f MB before open, %.0f MB after, cache %.0f MB\n", resident_before / 1048576.0,
+           resident / 1048576.0, cache_bytes / 1048576.0);
+
+    capture_view_close(view);
+    free(view);
+    free(pixels);
+    remove(pyramid_path);
+    remove(path);
+    return result;
+}
+
+// Records a capture, replays it as fast as possible, which doubles as an ingest benchmark, then at 1x and 10x
+// for a second each, then twice deterministically, which has to give the same store contents at every step
+int run_replay(const char *path, uint64_t sample_count) {
+    const int channel_count = 16;
+    capture_channel channels[channel_count] = {};
+    for(int i = 0; i < channel_count; i++) {
+        channels[i].channel_id = i;
+    }
+    capture_writer *writer = (capture_writer *)calloc(1, sizeof(capture_writer));
+    bool written = capture_writer_start(writer, path, channels, channel_count, true) &&
+                   capture_write_pattern(writer, sample_count, channel_count, 0);
+    written = capture_writer_stop(writer) && written;
+    free(writer);
+    if(!written) {
+        return 1;
+    }
+
+    ingest_pipeline *pipeline = (ingest_pipeline *)calloc(1, sizeof(ingest_pipeline));
+    replay *rep = (replay *)calloc(1, sizeof(replay));
+    ingest_pipeline_start(pipeline);
+    ingest_set_retention(pipeline, 0, 0);
+    uint64_t start_ns = platform_time_ns();
+    if(!replay_start(rep, path, pipeline, 0.0, false)) {
+        return 1;
+    }
+    while(!replay_finished(rep) || pipeline->consumed_batches.load() < rep->batches_pushed) {
+        platform_sleep_ms(1);
+    }
+    double seconds = (platform_time_ns() - start_ns) / 1e9;
+    uint64_t stored = pipeline->store.sample_count.load();
+    printf("replay: as fast as possible, %llu samples in %.2f s, %.1f M samples/s, %.0f MB/s of payload, "
+           "store thread %.0f%% busy\n", (unsigned long long)stored, seconds, stored / seconds / 1e6,
+           rep->bytes_replayed.load() / 1048576.0 / seconds,
+           100.0 * platform_thread_cpu_ns(&pipeline->store_thread) / 1e9 / seconds);
+    replay_stop(rep);
+    ingest_pipeline_stop(pipeline);
+    int result = stored == sample_count ? 0 : 1;
+
+    // The replay clock has to keep up with the wall clock at the requested speed
+    ingest_pipeline_start(pipeline);
+    replay_start(rep, path, pipeline, 1.0, false);
+    platform_sleep_ms(1000);
+    int64_t real_time_us = rep->replayed_us.load();
+    replay_set_speed(rep, 10.0);
+    platform_sleep_ms(1000);
+    int64_t ten_times_us = rep->replayed_us.load() - real_time_us;
+    replay_stop(rep);
+    ingest_pipeline_stop(pipeline);
+    printf("replay: one second of wall clock replayed %.3f s at 1x and %.3f s at 10x\n", real_time_us / 1e6,
+           ten_times_us / 1e6);
+    result |= (real_time_us < 900000 || real_time_us > 1100000 || ten_times_us < 9000000 ||
+               ten_times_us > 11000000) ? 1 : 0;
+
+    // Two deterministic runs at 60 frames per second of capture time
+    const int steps = 600;
+    uint64_t *stored_at_step[2];
+    double step_ms[2];
+    for(int run = 0; run < 2; run++) {
+        stored_at_step[run] = (uint64_t *)malloc(steps * sizeof(uint64_t));
+        ingest_pipeline_start(pipeline);
+        replay_start(rep, path, pipeline, 0.0, true);
+        start_ns = platform_time_ns();
+        for(int step = 0; step < steps; step++) {
+            replay_step(rep, 16667);
+            stored_at_step[run][step] = pipeline->store.sample_count.load();
+        }
+        step_ms[run] = (platform_time_ns() - start_ns) / 1e6 / steps;
+        replay_stop(rep);
+        ingest_pipeline_stop(pipeline);
+    }
+    bool same = memcmp(stored_at_step[0], stored_at_step[1], steps * sizeof(uint64_t)) == 0;
+    printf("replay: deterministic, %d steps of 16.667 ms, %.3f ms per step, %llu samples after the last, runs %s\n",
+           steps, (step_ms[0] + step_ms[1]) / 2, (unsigned long long)stored_at_step[0][steps - 1],
+           same ? "identical" : "differ");
+    result |= same && stored_at_step[0][steps - 1] > 0 ? 0 : 1;
+    free(stored_at_step[0]);
+    free(stored_at_step[1]);
+
+    free(rep);
+    free(pipeline);
+    remove(path);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "ingest";
+
+    if(strcmp(mode, "ingest") == 0) {
+        int seconds = argc > 2 ? atoi(argv[2]) : 2;
+        int channel_count = argc > 3 ? atoi(argv[3]) : 16;
+        int sample_rate_hz = argc > 4 ? atoi(argv[4]) : 10000;
+        return run_ingest(seconds, channel_count, sample_rate_hz);
+    }
+
+    if(strcmp(mode, "reconnect") == 0) {
+        int seconds = argc > 2 ? atoi(argv[2]) : 6;
+        int drop_after_ms = argc > 3 ? atoi(argv[3]) : 1500;
+        int outage_ms = argc > 4 ? atoi(argv[4]) : 700;
+        return run_reconnect(seconds, drop_after_ms, outage_ms);
+    }
+
+    if(strcmp(mode, "pipeline") == 0) {
+        int request_count = argc > 2 ? atoi(argv[2]) : 200;
+        int reply_latency_ms = argc > 3 ? atoi(argv[3]) : 5;
+        return run_pipeline(request_count, reply_latency_ms);
+    }
+
+    if(strcmp(mode, "sessions") == 0) {
+        int max_sessions = argc > 2 ? atoi(argv[2]) : 32;
+        int seconds = argc > 3 ? atoi(argv[3]) : 2;
+        int sample_rate_hz = argc > 4 ? atoi(argv[4]) : 10000;
+        return run_sessions(max_sessions, seconds, sample_rate_hz);
+    }
+
+    if(strcmp(mode, "store") == 0) {
+        uint64_t sample_count = argc > 2 ? strtoull(argv[2], NULL, 10) : 100000000ULL;
+        int channel_count = argc > 3 ? atoi(argv[3]) : 16;
+        return run_store(sample_count, channel_count);
+    }
+
+    if(strcmp(mode, "pyramid") == 0) {
+        uint64_t max_samples = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000000ULL;
+        int pixel_count = argc > 3 ? atoi(argv[3]) : 1920;
+        return run_pyramid(max_samples, pixel_count);
+    }
+
+    if(strcmp(mode, "capture") == 0) {
+        uint64_t sample_count = argc > 2 ? strtoull(argv[2], NULL, 10) : 100000000ULL;
+        int result = 0;
+        for(int i = 3; i < argc; i++) {
+            result |= run_capture(argv[i], sample_count, 16, false) | run_capture(argv[i], sample_count, 16, true);
+        }
+        if(argc <= 3) {
+            result |= run_capture("/dev/shm/pedro_capture.bin", sample_count, 16, false);
+            result |= run_capture("/dev/shm/pedro_capture.bin", sample_count, 16, true);
+            result |= run_capture("pedro_capture.bin", sample_count, 16, false);
+            result |= run_capture("pedro_capture.bin", sample_count, 16, true);
+        }
+        return result;
+    }
+
+    if(strcmp(mode, "compress") == 0) {
+        return run_compress(argc > 2 ? strtoull(argv[2], NULL, 10) : 16777216ULL);
+    }
+
+    if(strcmp(mode, "decode") == 0) {
+        int sample_count = argc > 2 ? atoi(argv[2]) : 65536;
+        int rounds = argc > 3 ? atoi(argv[3]) : 2000;
+        return run_decode(sample_count, rounds);
+    }
+
+    if(strcmp(mode, "query") == 0) {
+        uint64_t sample_count = argc > 2 ? strtoull(argv[2], NULL, 10) : 32000000ULL;
+        return run_query(argc > 3 ? argv[3] : "pedro_query.bin", sample_count);
+    }
+
+    if(strcmp(mode, "stats") == 0) {
+        int channel_count = argc > 2 ? atoi(argv[2]) : 1000;
+        int seconds = argc > 3 ? atoi(argv[3]) : 10;
+        return run_stats(channel_count, seconds);
+    }
+
+    if(strcmp(mode, "fft") == 0) {
+        int max_log2 = argc > 2 ? atoi(argv[2]) : 20;
+        return run_fft(max_log2);
+    }
+
+    if(strcmp(mode, "derived") == 0) {
+        int sample_count = argc > 2 ? atoi(argv[2]) : 4000000;
+        return run_derived(sample_count);
+    }
+
+    if(strcmp(mode, "alarm") == 0) {
+        int channel_count = argc > 2 ? atoi(argv[2]) : 500;
+        int seconds = argc > 3 ? atoi(argv[3]) : 10;
+        return run_alarm(channel_count, seconds);
+    }
+
+    if(strcmp(mode, "logic") == 0) {
+        return run_logic(argc > 2 ? atoi(argv[2]) : 10000000);
+    }
+
+    if(strcmp(mode, "plot") == 0) {
+        return run_plot(argc > 2 ? atoi(argv[2]) : 1000000);
+    }
+
+    if(strcmp(mode, "polyline") == 0) {
+        return run_polyline(argc > 2 ? atoi(argv[2]) : 1000000);
+    }
+
+    if(strcmp(mode, "panels") == 0) {
+        int panel_count = argc > 2 ? atoi(argv[2]) : 16;
+        int max_workers = argc > 3 ? atoi(argv[3]) : 4;
+        return run_panels(panel_count < PLOT_MAX_PANELS ? panel_count : PLOT_MAX_PANELS, max_workers);
+    }
+
+    if(strcmp(mode, "retained") == 0) {
+        int panel_count = argc > 2 ? atoi(argv[2]) : 100;
+        int frames = argc > 3 ? atoi(argv[3]) : 200;
+        return run_retained(panel_count, frames);
+    }
+
+    if(strcmp(mode, "scheduler") == 0) {
+        int phase_ms = argc > 2 ? atoi(argv[2]) : 1000;
+        return run_scheduler(phase_ms);
+    }
+
+    if(strcmp(mode, "draw_hash") == 0) {
+        int panel_count = argc > 2 ? atoi(argv[2]) : 100;
+        int frames = argc > 3 ? atoi(argv[3]) : 200;
+        return run_draw_hash(panel_count, frames);
+    }
+
+    if(strcmp(mode, "view") == 0) {
+        double gigabytes = argc > 2 ? atof(argv[2]) : 10.0;
+        int64_t cache_megabytes = argc > 3 ? atoll(argv[3]) : 64;
+        const char *path = argc > 4 ? argv[4] : "pedro_view.bin";
+        return run_view(path, gigabytes, megabytes(cache_megabytes));
+    }
+
+    if(strcmp(mode, "replay") == 0) {
+        uint64_t sample_count = argc > 2 ? strtoull(argv[2], NULL, 10) : 50000000ULL;
+        return run_replay(argc > 3 ? argv[3] : "pedro_replay.bin", sample_count);
+    }
+
+    if(strcmp(mode, "discovery") == 0) {
+        int result = run_discovery(true);
+        return run_discovery(false) | result;
+    }
+
+    printf("usage: pedro_headless ingest [seconds] [channels] [sample_rate_hz]\n");
+    printf("       pedro_headless reconnect [seconds] [drop_after_ms] [outage_ms]\n");
+    printf("       pedro_headless pipeline [requests] [reply_latency_ms]\n");
+    printf("       pedro_headless sessions [max_sessions] [seconds] [sample_rate_hz]\n");
+    printf("       pedro_headless discovery\n");
+    printf("       pedro_headless store [samples] [channels]\n");
+    printf("       pedro_headless pyramid [max_samples] [pixels]\n");
+    printf("       pedro_headless capture [samples] [paths...]\n");
+    printf("       pedro_headless compress [samples]\n");
+    printf("       pedro_headless decode [samples] [rounds]\n");
+    printf("       pedro_headless query [samples] [path]\n");
+    printf("       pedro_headless stats [channels] [seconds]\n");
+    printf("       pedro_headless fft [max_log2_size]\n");
+    printf("       pedro_headless derived [samples]\n");
+    printf("       pedro_headless alarm [channels] [seconds]\n");
+    printf("       pedro_headless logic [max_edges]\n");
+    printf("       pedro_headless plot [points]\n");
+    printf("       pedro_headless polyline [max_points]\n");
+    printf("       pedro_headless panels [panels] [max_workers]\n");
+    printf("       pedro_headless retained [panels] [frames]\n");
+    printf("       pedro_headless scheduler [phase_ms]\n");
+    printf("       pedro_headless draw_hash [panels] [frames]\n");
+    printf("       pedro_headless view [gigabytes] [cache_megabytes] [path]\n");
+    printf("       pedro_headless replay [samples] [path]\n");
+    return 1;
+}
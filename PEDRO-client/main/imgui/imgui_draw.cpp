@@ -39,6 +39,9 @@ Index of this file:
 #endif
 
 #include <stdio.h>      // vsnprintf, sscanf, printf
+#if defined(_MSC_VER) && defined(IMGUI_ENABLE_SSE)
+#include <intrin.h>      // __cpuid, _xgetbv
+#endif
 
 // Visual Studio warnings
 #ifdef _MSC_VER
@@ -371,9 +374,32 @@ void ImGui::StyleColorsLight(ImGuiStyle* dst)
 // [SECTION] ImDrawList
 //-----------------------------------------------------------------------------
 
+// Best vector path AddPolyline() can use on this CPU, see ImDrawListSharedData::PolylineSimd
+static int ImPolylineDetectSimd()
+{
+#if !defined(IMGUI_ENABLE_SSE) || defined(IMGUI_OVERRIDE_DRAWVERT_STRUCT_LAYOUT)
+    return 0;
+#elif defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? 2 : 1;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return 1;
+    __cpuid(info, 1);
+    const bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+    __cpuidex(info, 7, 0);
+    return (os_saves_ymm && (info[1] & (1 << 5))) ? 2 : 1;
+#else
+    return 1;
+#endif
+}
+
 ImDrawListSharedData::ImDrawListSharedData()
 {
     memset(this, 0, sizeof(*this));
+    PolylineSimd = ImPolylineDetectSimd();
     for (int i = 0; i < IM_ARRAYSIZE(ArcFastVtx); i++)
     {
         const float a = ((float)i * 2 * IM_PI) / (float)IM_ARRAYSIZE(ArcFastVtx);
@@ -758,6 +784,294 @@ void ImDrawList::PrimQuadUV(const ImVec2& a, const ImVec2& b, const ImVec2& c, c
 #define IM_FIXNORMAL2F_MAX_INVLEN2          100.0f // 500.0f (see #4053, #3366)
 #define IM_FIXNORMAL2F(VX,VY)               { float d2 = VX*VX + VY*VY; if (d2 > 0.000001f) { float inv_len2 = 1.0f / d2; if (inv_len2 > IM_FIXNORMAL2F_MAX_INVLEN2) inv_len2 = IM_FIXNORMAL2F_MAX_INVLEN2; VX *= inv_len2; VY *= inv_len2; } } (void)0
 
+// Vector path for long anti-aliased polylines, see AddPolyline() and ImDrawListSharedData::PolylineSimd.
+// - Same operations in the same order as the scalar loops below, so the vertices and indices are bit-identical:
+//   _mm_rsqrt_ps() gives the same estimate as the _mm_rsqrt_ss() in ImRsqrt() and nothing gets fused.
+// - Normals and edge offsets are computed 4 (SSE2) or 8 (AVX2) at a time into TempBuffer as separate x/y arrays, then
+//   vertices are written 4 points at a time straight into the vertex buffer. Indices repeat every 4 segments so they are
+//   written from a pattern 8 at a time.
+#if defined(IMGUI_ENABLE_SSE) && !defined(IMGUI_OVERRIDE_DRAWVERT_STRUCT_LAYOUT)
+#define IM_POLYLINE_SIMD
+#define IM_POLYLINE_SIMD_MIN_POINTS         16
+#if defined(__GNUC__) || defined(__clang__)
+#define IM_POLYLINE_TARGET_AVX2             __attribute__((target("avx2")))
+#else
+#define IM_POLYLINE_TARGET_AVX2
+#endif
+
+enum ImPolylineMode { ImPolylineMode_Texture, ImPolylineMode_Thin, ImPolylineMode_Thick };
+
+struct ImPolylineStyle
+{
+    ImPolylineMode  Mode;
+    int             VtxStride;                  // Vertices per point: 2, 3 or 4
+    int             IdxStride;                  // Indices per segment: 6, 12 or 18
+    const int*      IdxOffsets;                 // Index of each of the segment's indices, relative to its first point's first vertex
+    ImU32           Col, ColTrans;
+    ImVec2          Uv0, Uv1;                   // Texture: uv of the + and - side, else both the white pixel
+    float           SizeOuter;                  // Half width to the outer edge: AA fringe included for thin and thick lines
+    float           SizeInner;                  // Half width of the opaque part of thick lines
+};
+
+static const int ImPolylineIdxTexture[6]    = { 2, 0, 1, 3, 1, 2 };
+static const int ImPolylineIdxThin[12]      = { 3, 0, 2, 2, 5, 3, 4, 1, 0, 0, 3, 4 };
+static const int ImPolylineIdxThick[18]     = { 5, 1, 2, 2, 6, 5, 5, 1, 0, 0, 4, 5, 6, 2, 3, 3, 7, 6 };
+
+static inline void ImPolylineWriteVtx(ImDrawVert* vtx, float x, float y, ImVec2 uv, ImU32 col)
+{
+    vtx->pos.x = x; vtx->pos.y = y; vtx->uv = uv; vtx->col = col;
+}
+
+// Vertices of one point, (dx, dy) is the unscaled offset to the edge
+static inline void ImPolylineEmit1(ImDrawVert* vtx, const ImPolylineStyle& s, ImVec2 p, float dx, float dy)
+{
+    const float ox = dx * s.SizeOuter, oy = dy * s.SizeOuter;
+    if (s.Mode == ImPolylineMode_Texture)
+    {
+        ImPolylineWriteVtx(vtx + 0, p.x + ox, p.y + oy, s.Uv0, s.Col);
+        ImPolylineWriteVtx(vtx + 1, p.x - ox, p.y - oy, s.Uv1, s.Col);
+    }
+    else if (s.Mode == ImPolylineMode_Thin)
+    {
+        ImPolylineWriteVtx(vtx + 0, p.x, p.y, s.Uv0, s.Col);
+        ImPolylineWriteVtx(vtx + 1, p.x + ox, p.y + oy, s.Uv0, s.ColTrans);
+        ImPolylineWriteVtx(vtx + 2, p.x - ox, p.y - oy, s.Uv0, s.ColTrans);
+    }
+    else
+    {
+        const float ix = dx * s.SizeInner, iy = dy * s.SizeInner;
+        ImPolylineWriteVtx(vtx + 0, p.x + ox, p.y + oy, s.Uv0, s.ColTrans);
+        ImPolylineWriteVtx(vtx + 1, p.x + ix, p.y + iy, s.Uv0, s.Col);
+        ImPolylineWriteVtx(vtx + 2, p.x - ix, p.y - iy, s.Uv0, s.Col);
+        ImPolylineWriteVtx(vtx + 3, p.x - ox, p.y - oy, s.Uv0, s.ColTrans);
+    }
+}
+
+// Same vertex of 4 points in a row, 'stride' vertices apart. Relies on ImDrawVert being { pos, uv, col }.
+static inline void ImPolylineWriteVtx4(ImDrawVert* vtx, int stride, __m128 xs, __m128 ys, __m128 uv, ImU32 col)
+{
+    const __m128 lo = _mm_unpacklo_ps(xs, ys), hi = _mm_unpackhi_ps(xs, ys);
+    _mm_storeu_ps(&vtx[0].pos.x, _mm_movelh_ps(lo, uv));
+    _mm_storeu_ps(&vtx[stride].pos.x, _mm_shuffle_ps(lo, uv, _MM_SHUFFLE(1, 0, 3, 2)));
+    _mm_storeu_ps(&vtx[stride * 2].pos.x, _mm_movelh_ps(hi, uv));
+    _mm_storeu_ps(&vtx[stride * 3].pos.x, _mm_shuffle_ps(hi, uv, _MM_SHUFFLE(1, 0, 3, 2)));
+    vtx[0].col = vtx[stride].col = vtx[stride * 2].col = vtx[stride * 3].col = col;
+}
+
+// x and y of 4 points in a row
+static inline void ImPolylineLoad4(const ImVec2* p, __m128* xs, __m128* ys)
+{
+    const __m128 lo = _mm_loadu_ps(&p[0].x), hi = _mm_loadu_ps(&p[2].x);
+    *xs = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+    *ys = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+static void ImPolylineEmit4(ImDrawVert* vtx, const ImPolylineStyle& s, const ImVec2* points, const float* dx_in, const float* dy_in)
+{
+    const int n = s.VtxStride;
+    __m128 px, py;
+    ImPolylineLoad4(points, &px, &py);
+    const __m128 dx = _mm_loadu_ps(dx_in), dy = _mm_loadu_ps(dy_in);
+    const __m128 size_outer = _mm_set1_ps(s.SizeOuter);
+    const __m128 ox = _mm_mul_ps(dx, size_outer), oy = _mm_mul_ps(dy, size_outer);
+    const __m128 uv0 = _mm_setr_ps(s.Uv0.x, s.Uv0.y, s.Uv0.x, s.Uv0.y);
+    if (s.Mode == ImPolylineMode_Texture)
+    {
+        const __m128 uv1 = _mm_setr_ps(s.Uv1.x, s.Uv1.y, s.Uv1.x, s.Uv1.y);
+        ImPolylineWriteVtx4(vtx + 0, n, _mm_add_ps(px, ox), _mm_add_ps(py, oy), uv0, s.Col);
+        ImPolylineWriteVtx4(vtx + 1, n, _mm_sub_ps(px, ox), _mm_sub_ps(py, oy), uv1, s.Col);
+    }
+    else if (s.Mode == ImPolylineMode_Thin)
+    {
+        ImPolylineWriteVtx4(vtx + 0, n, px, py, uv0, s.Col);
+        ImPolylineWriteVtx4(vtx + 1, n, _mm_add_ps(px, ox), _mm_add_ps(py, oy), uv0, s.ColTrans);
+        ImPolylineWriteVtx4(vtx + 2, n, _mm_sub_ps(px, ox), _mm_sub_ps(py, oy), uv0, s.ColTrans);
+    }
+    else
+    {
+        const __m128 size_inner = _mm_set1_ps(s.SizeInner);
+        const __m128 ix = _mm_mul_ps(dx, size_inner), iy = _mm_mul_ps(dy, size_inner);
+        ImPolylineWriteVtx4(vtx + 0, n, _mm_add_ps(px, ox), _mm_add_ps(py, oy), uv0, s.ColTrans);
+        ImPolylineWriteVtx4(vtx + 1, n, _mm_add_ps(px, ix), _mm_add_ps(py, iy), uv0, s.Col);
+        ImPolylineWriteVtx4(vtx + 2, n, _mm_sub_ps(px, ix), _mm_sub_ps(py, iy), uv0, s.Col);
+        ImPolylineWriteVtx4(vtx + 3, n, _mm_sub_ps(px, ox), _mm_sub_ps(py, oy), uv0, s.ColTrans);
+    }
+}
+
+// Normals of the segments that don't wrap around, 4 at a time. Returns the first segment left to do.
+static int ImPolylineNormalsSSE2(const ImVec2* points, int points_count, float* nx, float* ny)
+{
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), sign = _mm_set1_ps(-0.0f);
+    int i1 = 0;
+    for (; i1 + 4 <= points_count - 1; i1 += 4)
+    {
+        __m128 x1, y1, x2, y2;
+        ImPolylineLoad4(points + i1, &x1, &y1);
+        ImPolylineLoad4(points + i1 + 1, &x2, &y2);
+        __m128 dx = _mm_sub_ps(x2, x1), dy = _mm_sub_ps(y2, y1);
+        const __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        const __m128 over_zero = _mm_cmpgt_ps(d2, zero);
+        const __m128 inv_len = _mm_or_ps(_mm_and_ps(over_zero, _mm_rsqrt_ps(d2)), _mm_andnot_ps(over_zero, one));
+        dx = _mm_mul_ps(dx, inv_len);
+        dy = _mm_mul_ps(dy, inv_len);
+        _mm_storeu_ps(nx + i1, dy);
+        _mm_storeu_ps(ny + i1, _mm_xor_ps(dx, sign));
+    }
+    return i1;
+}
+
+// Offsets of the points from 1 on, each the average of the normals on either side, 4 at a time. Returns the first point left to do.
+static int ImPolylineOffsetsSSE2(const float* nx, const float* ny, float* dx, float* dy, int points_count)
+{
+    const __m128 one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+    const __m128 min_len2 = _mm_set1_ps(0.000001f), max_inv_len2 = _mm_set1_ps(IM_FIXNORMAL2F_MAX_INVLEN2);
+    int i = 1;
+    for (; i + 4 <= points_count; i += 4)
+    {
+        const __m128 dm_x = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(nx + i - 1), _mm_loadu_ps(nx + i)), half);
+        const __m128 dm_y = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(ny + i - 1), _mm_loadu_ps(ny + i)), half);
+        const __m128 d2 = _mm_add_ps(_mm_mul_ps(dm_x, dm_x), _mm_mul_ps(dm_y, dm_y));
+        const __m128 fix = _mm_cmpgt_ps(d2, min_len2);
+        const __m128 inv_len2 = _mm_min_ps(max_inv_len2, _mm_div_ps(one, d2));
+        const __m128 scale = _mm_or_ps(_mm_and_ps(fix, inv_len2), _mm_andnot_ps(fix, one));
+        _mm_storeu_ps(dx + i, _mm_mul_ps(dm_x, scale));
+        _mm_storeu_ps(dy + i, _mm_mul_ps(dm_y, scale));
+    }
+    return i;
+}
+
+// Same as ImPolylineNormalsSSE2(), 8 at a time. Points are loaded as [p0..p3] [p4..p7] and _mm256_shuffle_ps() stays
+// within 128-bit lanes, so x and y come out as 0 1 4 5 2 3 6 7 and get permuted back before the store.
+IM_POLYLINE_TARGET_AVX2
+static int ImPolylineNormalsAVX2(const ImVec2* points, int points_count, float* nx, float* ny)
+{
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), sign = _mm256_set1_ps(-0.0f);
+    int i1 = 0;
+    for (; i1 + 8 <= points_count - 1; i1 += 8)
+    {
+        const __m256 a_lo = _mm256_loadu_ps(&points[i1].x), a_hi = _mm256_loadu_ps(&points[i1 + 4].x);
+        const __m256 b_lo = _mm256_loadu_ps(&points[i1 + 1].x), b_hi = _mm256_loadu_ps(&points[i1 + 5].x);
+        __m256 dx = _mm256_sub_ps(_mm256_shuffle_ps(b_lo, b_hi, _MM_SHUFFLE(2, 0, 2, 0)), _mm256_shuffle_ps(a_lo, a_hi, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m256 dy = _mm256_sub_ps(_mm256_shuffle_ps(b_lo, b_hi, _MM_SHUFFLE(3, 1, 3, 1)), _mm256_shuffle_ps(a_lo, a_hi, _MM_SHUFFLE(3, 1, 3, 1)));
+        const __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        const __m256 inv_len = _mm256_blendv_ps(one, _mm256_rsqrt_ps(d2), _mm256_cmp_ps(d2, zero, _CMP_GT_OQ));
+        dx = _mm256_mul_ps(dx, inv_len);
+        dy = _mm256_mul_ps(dy, inv_len);
+        _mm256_storeu_ps(nx + i1, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(dy), _MM_SHUFFLE(3, 1, 2, 0))));
+        _mm256_storeu_ps(ny + i1, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_xor_ps(dx, sign)), _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+    _mm256_zeroupper();
+    return i1;
+}
+
+IM_POLYLINE_TARGET_AVX2
+static int ImPolylineOffsetsAVX2(const float* nx, const float* ny, float* dx, float* dy, int points_count)
+{
+    const __m256 one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f);
+    const __m256 min_len2 = _mm256_set1_ps(0.000001f), max_inv_len2 = _mm256_set1_ps(IM_FIXNORMAL2F_MAX_INVLEN2);
+    int i = 1;
+    for (; i + 8 <= points_count; i += 8)
+    {
+        const __m256 dm_x = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(nx + i - 1), _mm256_loadu_ps(nx + i)), half);
+        const __m256 dm_y = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(ny + i - 1), _mm256_loadu_ps(ny + i)), half);
+        const __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dm_x, dm_x), _mm256_mul_ps(dm_y, dm_y));
+        const __m256 inv_len2 = _mm256_min_ps(max_inv_len2, _mm256_div_ps(one, d2));
+        const __m256 scale = _mm256_blendv_ps(one, inv_len2, _mm256_cmp_ps(d2, min_len2, _CMP_GT_OQ));
+        _mm256_storeu_ps(dx + i, _mm256_mul_ps(dm_x, scale));
+        _mm256_storeu_ps(dy + i, _mm256_mul_ps(dm_y, scale));
+    }
+    _mm256_zeroupper();
+    return i;
+}
+
+// The AVX2 kernels only do the math on float arrays so no 256-bit state is live while the SSE code writes the vertices
+static void ImPolylineTessellate(ImDrawList* draw_list, const ImPolylineStyle& s, const ImVec2* points, int points_count, bool closed, int level)
+{
+    // TempBuffer as 4 arrays: normals then offsets, x and y apart
+    draw_list->_Data->TempBuffer.reserve_discard(points_count * 2);
+    float* nx = &draw_list->_Data->TempBuffer.Data[0].x;
+    float* ny = nx + points_count;
+    float* dx = ny + points_count;
+    float* dy = dx + points_count;
+
+    // Normals, same as the scalar loop. An open line's last point takes the last segment's.
+    const int count = closed ? points_count : points_count - 1;
+    for (int i1 = (level >= 2) ? ImPolylineNormalsAVX2(points, points_count, nx, ny) : ImPolylineNormalsSSE2(points, points_count, nx, ny); i1 < count; i1++)
+    {
+        const int i2 = (i1 + 1) == points_count ? 0 : i1 + 1;
+        float nx1 = points[i2].x - points[i1].x;
+        float ny1 = points[i2].y - points[i1].y;
+        IM_NORMALIZE2F_OVER_ZERO(nx1, ny1);
+        nx[i1] = ny1;
+        ny[i1] = -nx1;
+    }
+    if (!closed)
+    {
+        nx[points_count - 1] = nx[points_count - 2];
+        ny[points_count - 1] = ny[points_count - 2];
+    }
+
+    // Offsets: the fixed average of the normals on either side, the first point of a closed line wrapping around to the closing segment.
+    // The first point of an open line sits on its normal. Its end is averaged like the others, as the scalar loop does.
+    for (int i = (level >= 2) ? ImPolylineOffsetsAVX2(nx, ny, dx, dy, points_count) : ImPolylineOffsetsSSE2(nx, ny, dx, dy, points_count); i <= points_count; i++)
+    {
+        const int i_prev = (i == points_count) ? points_count - 1 : i - 1;
+        const int i_cur = (i == points_count) ? 0 : i;
+        if (i_cur == 0 && !closed)
+        {
+            dx[0] = nx[0];
+            dy[0] = ny[0];
+            continue;
+        }
+        float dm_x = (nx[i_prev] + nx[i_cur]) * 0.5f;
+        float dm_y = (ny[i_prev] + ny[i_cur]) * 0.5f;
+        IM_FIXNORMAL2F(dm_x, dm_y);
+        dx[i_cur] = dm_x;
+        dy[i_cur] = dm_y;
+    }
+
+    // Vertices
+    ImDrawVert* vtx = draw_list->_VtxWritePtr;
+    int i = 0;
+    for (; i + 4 <= points_count; i += 4)
+        ImPolylineEmit4(vtx + i * s.VtxStride, s, points + i, dx + i, dy + i);
+    for (; i < points_count; i++)
+        ImPolylineEmit1(vtx + i * s.VtxStride, s, points[i], dx[i], dy[i]);
+    draw_list->_VtxWritePtr += points_count * s.VtxStride;
+
+    // Indices, the closing segment of a closed line wraps around to the first point
+    const unsigned int idx_base = draw_list->_VtxCurrentIdx;
+    ImDrawIdx* idx = draw_list->_IdxWritePtr;
+    int i1 = 0;
+    if (sizeof(ImDrawIdx) == 2)
+    {
+        // 4 segments make 24, 48 or 72 indices: 3, 6 or 9 vectors of 8
+        ImU16 pattern[4 * 18];
+        for (int n = 0; n < 4 * s.IdxStride; n++)
+            pattern[n] = (ImU16)((n / s.IdxStride) * s.VtxStride + s.IdxOffsets[n % s.IdxStride]);
+        const int vectors = (4 * s.IdxStride) / 8;
+        const int simd_count = (closed ? count - 1 : count) & ~3;
+        for (; i1 < simd_count; i1 += 4, idx += 4 * s.IdxStride)
+        {
+            const __m128i base = _mm_set1_epi16((short)(idx_base + i1 * s.VtxStride));
+            for (int v = 0; v < vectors; v++)
+                _mm_storeu_si128((__m128i*)(idx + v * 8), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(pattern + v * 8)), base));
+        }
+    }
+    for (; i1 < count; i1++, idx += s.IdxStride)
+    {
+        const unsigned int idx1 = idx_base + i1 * s.VtxStride;
+        const unsigned int idx2 = (i1 + 1) == points_count ? idx_base : idx1 + s.VtxStride;
+        for (int n = 0; n < s.IdxStride; n++)
+        {
+            const int offset = s.IdxOffsets[n];
+            idx[n] = (ImDrawIdx)(offset >= s.VtxStride ? idx2 + offset - s.VtxStride : idx1 + offset);
+        }
+    }
+    draw_list->_IdxWritePtr = idx;
+}
+#endif // #ifdef IM_POLYLINE_SIMD
+
 // TODO: Thickness anti-aliased lines cap are missing their AA fringe.
 // We avoid using the ImVec2 math operators here to reduce cost to a minimum for debug/non-inlined builds.
 void ImDrawList::AddPolyline(const ImVec2* points, const int points_count, ImU32 col, ImDrawFlags flags, float thickness)
@@ -793,6 +1107,28 @@ void ImDrawList::AddPolyline(const ImVec2* points, const int points_count, ImU32
         const int vtx_count = use_texture ? (points_count * 2) : (thick_line ? points_count * 4 : points_count * 3);
         PrimReserve(idx_count, vtx_count);
 
+#ifdef IM_POLYLINE_SIMD
+        if (_Data->PolylineSimd > 0 && points_count >= IM_POLYLINE_SIMD_MIN_POINTS)
+        {
+            ImPolylineStyle style;
+            style.Mode = use_texture ? ImPolylineMode_Texture : thick_line ? ImPolylineMode_Thick : ImPolylineMode_Thin;
+            style.VtxStride = use_texture ? 2 : thick_line ? 4 : 3;
+            style.IdxStride = use_texture ? 6 : thick_line ? 18 : 12;
+            style.IdxOffsets = use_texture ? ImPolylineIdxTexture : thick_line ? ImPolylineIdxThick : ImPolylineIdxThin;
+            style.Col = col;
+            style.ColTrans = col_trans;
+            const ImVec4 tex_uvs = use_texture ? _Data->TexUvLines[integer_thickness] : ImVec4(opaque_uv.x, opaque_uv.y, opaque_uv.x, opaque_uv.y);
+            style.Uv0 = ImVec2(tex_uvs.x, tex_uvs.y);
+            style.Uv1 = ImVec2(tex_uvs.z, tex_uvs.w);
+            style.SizeInner = (thickness - AA_SIZE) * 0.5f;
+            style.SizeOuter = use_texture ? ((thickness * 0.5f) + 1) : thick_line ? (style.SizeInner + AA_SIZE) : AA_SIZE;
+
+            ImPolylineTessellate(this, style, points, points_count, closed, _Data->PolylineSimd);
+            _VtxCurrentIdx += (ImDrawIdx)vtx_count;
+            return;
+        }
+#endif
+
         // Temporary buffer
         // The first <points_count> items are normals at each line point, then after that there are either 2 or 4 temp points for each line point
         _Data->TempBuffer.reserve_discard(points_count * ((use_texture || !thick_line) ? 3 : 5));
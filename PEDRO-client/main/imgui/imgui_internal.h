@@ -780,6 +780,7 @@ struct IMGUI_API ImDrawListSharedData
     ImVec4          ClipRectFullscreen;         // Value for PushClipRectFullscreen()
     ImDrawListFlags InitialFlags;               // Initial flags at the beginning of the frame (it is possible to alter flags on a per-drawlist basis afterwards)
     ImVector<ImVec2> TempBuffer;                // Temporary write buffer
+    int             PolylineSimd;               // Vector path for long anti-aliased AddPolyline(): 0 scalar, 1 SSE2, 2 AVX2 (set from CPU)
 
     // Lookup tables
     ImVec2          ArcFastVtx[IM_DRAWLIST_ARCFAST_TABLE_SIZE]; // Sample points on the quarter of the circle.
@@ -0,0 +1,455 @@
+// Ingest pipeline.
+// The network thread decodes frames into sample_batch and pushes them onto an MPSC queue, the store
+// thread drains the queue into the sample store and the rolling statistics, runs the alarm rules, brings the
+// derived channels up to date and publishes a snapshot that the UI reads through a seqlock.
+// Nothing in here blocks the producers or the UI. The frame scheduler, if there is one, hears of the channels every
+// drain appended to so that the UI wakes for the ones it shows.
+
+#define INGEST_MAX_CHANNELS 1024
+// Defaults for the sample store, changed with ingest_set_retention
+#define INGEST_DEFAULT_RETENTION_US (60 * 60 * 1000000LL)
+#define INGEST_DEFAULT_RETENTION_BYTES megabytes(1024)
+
+// Channels of all devices end up in the same store, the device index goes in the upper half of the id
+#define device_channel_id(device, channel) (((uint32_t)(device) << 16) | (uint16_t)(channel))
+#define device_channel_device(id) ((int)((id) >> 16))
+#define device_channel_channel(id) ((uint16_t)((id) & 0xFFFF))
+
+typedef struct sample_batch sample_batch;
+struct sample_batch {
+    std::atomic<sample_batch *> next;
+    uint32_t channel_id;
+    int count;
+    int64_t *timestamps_us;
+    float *values;
+    // platform_time_ns when it went on the queue
+    uint64_t pushed_ns;
+};
+
+// Intrusive multi-producer single-consumer queue (Vyukov), push is wait-free
+typedef struct {
+    std::atomic<sample_batch *> head;
+    sample_batch *tail;
+    sample_batch stub;
+} mpsc_queue;
+
+typedef struct {
+    uint32_t channel_id;
+    int64_t first_timestamp_us;
+    int64_t timestamp_us;
+    float value;
+    uint64_t sample_count;
+    // Over the statistics window up to the newest sample
+    stats_summary stats;
+} channel_latest;
+
+typedef struct {
+    uint64_t version;
+    uint64_t total_samples;
+    uint64_t total_batches;
+    // What the sample store holds right now
+    uint64_t stored_samples;
+    int64_t stored_bytes;
+    int channel_count;
+    channel_latest channels[INGEST_MAX_CHANNELS];
+} ingest_snapshot;
+
+// Writer bumps the sequence to odd, writes, bumps it back to even. Readers retry on odd or changed sequence.
+typedef struct {
+    std::atomic<uint32_t> sequence;
+    ingest_snapshot data;
+} seqlock_snapshot;
+
+typedef struct {
+    mpsc_queue queue;
+    platform_event wake;
+    platform_thread store_thread;
+    std::atomic<int> running;
+    // Batches the store thread is done with, lets a producer see how far behind it is
+    std::atomic<uint64_t> consumed_batches;
+
+    // Store thread only
+    ingest_snapshot working;
+
+    // Appended to by the store thread only, see store.cpp for reading
+    sample_store store;
+    // Store thread only, apart from the window
+    stats_engine stats;
+    // Evaluated after every drain, their samples take the same way as the ones from the devices
+    derived_set derived;
+    // Run on every batch, the alarm states go the same way too
+    alarm_engine *alarms;
+
+    // Recording, if any. The store thread holds capture_lock only while it writes to it.
+    platform_mutex capture_lock;
+    capture_writer *capture;
+
+    std::atomic<frame_scheduler *> scheduler;
+    // Store thread only, frame_scheduler_channel_bit() of the channels appended to since the last publish
+    uint64_t appended_channels;
+
+    seqlock_snapshot published;
+    // Reader side, where a snapshot is copied before it is known to be consistent
+    ingest_snapshot reading;
+} ingest_pipeline;
+
+// Timestamps and values live in the same allocation, right after the struct
+sample_batch *sample_batch_alloc(int count) {
+    size_t size = sizeof(sample_batch) + count * (sizeof(int64_t) + sizeof(float));
+    sample_batch *batch = (sample_batch *)malloc(size);
+    if(!batch) {
+        return NULL;
+    }
+    new(&batch->next) std::atomic<sample_batch *>(NULL);
+    batch->channel_id = 0;
+    batch->count = count;
+    batch->pushed_ns = 0;
+    batch->timestamps_us = (int64_t *)(batch + 1);
+    batch->values = (float *)(batch->timestamps_us + count);
+    return batch;
+}
+
+void sample_batch_free(sample_batch *batch) {
+    free(batch);
+}
+
+void mpsc_queue_init(mpsc_queue *queue) {
+    queue->stub.next.store(NULL, std::memory_order_relaxed);
+    queue->head.store(&queue->stub, std::memory_order_relaxed);
+    queue->tail = &queue->stub;
+}
+
+void mpsc_queue_push(mpsc_queue *queue, sample_batch *batch) {
+    batch->next.store(NULL, std::memory_order_relaxed);
+    sample_batch *previous = queue->head.exchange(batch, std::memory_order_acq_rel);
+    previous->next.store(batch, std::memory_order_release);
+}
+
+// Consumer only. Can return NULL while a push is half way through, the batch shows up on the next call.
+sample_batch *mpsc_queue_pop(mpsc_queue *queue) {
+    sample_batch *tail = queue->tail;
+    sample_batch *next = tail->next.load(std::memory_order_acquire);
+    if(tail == &queue->stub) {
+        if(!next) {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if(next) {
+        queue->tail = next;
+        return tail;
+    }
+    if(tail != queue->head.load(std::memory_order_acquire)) {
+        return NULL;
+    }
+    mpsc_queue_push(queue, &queue->stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if(next) {
+        queue->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+void seqlock_write(seqlock_snapshot *lock, const ingest_snapshot *data) {
+    uint32_t sequence = lock->sequence.load(std::memory_order_relaxed);
+    lock->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&lock->data, data, offsetof(ingest_snapshot, channels) + data->channel_count * sizeof(channel_latest));
+    std::atomic_thread_fence(std::memory_order_release);
+    lock->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Never waits on the writer beyond yielding to it while it is mid-publish. Copies into scratch and only from there
+// into data once the copy is known to be consistent, returns false and leaves data as it was if that couldn't be
+// done in a few tries.
+bool seqlock_read(seqlock_snapshot *lock, ingest_snapshot *scratch, ingest_snapshot *data) {
+    for(int attempt = 0; attempt < 16; attempt++) {
+        uint32_t before = lock->sequence.load(std::memory_order_acquire);
+        if(before & 1) {
+            platform_yield();
+            continue;
+        }
+        int channel_count = lock->data.channel_count;
+        if(channel_count < 0 || channel_count > INGEST_MAX_CHANNELS) {
+            continue;
+        }
+        size_t size = offsetof(ingest_snapshot, channels) + channel_count * sizeof(channel_latest);
+        memcpy(scratch, &lock->data, size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint32_t after = lock->sequence.load(std::memory_order_relaxed);
+        if(before == after && scratch->channel_count == channel_count) {
+            memcpy(data, scratch, size);
+            return true;
+        }
+    }
+    return false;
+}
+
+channel_latest *ingest_find_channel(ingest_snapshot *snapshot, uint32_t channel_id) {
+    for(int i = 0; i < snapshot->channel_count; i++) {
+        if(snapshot->channels[i].channel_id == channel_id) {
+            return &snapshot->channels[i];
+        }
+    }
+    if(snapshot->channel_count >= INGEST_MAX_CHANNELS) {
+        return NULL;
+    }
+    channel_latest *channel = &snapshot->channels[snapshot->channel_count++];
+    memset(channel, 0, sizeof(*channel));
+    channel->channel_id = channel_id;
+    return channel;
+}
+
+void ingest_consume_samples(ingest_pipeline *pipeline, uint32_t channel_id, const int64_t *timestamps_us,
+                            const float *values, int count, uint64_t pushed_ns) {
+    store_append(&pipeline->store, channel_id, timestamps_us, values, count);
+    pipeline->appended_channels |= frame_scheduler_channel_bit(channel_id);
+    stats_update(&pipeline->stats, channel_id, timestamps_us, values, count);
+    platform_mutex_lock(&pipeline->capture_lock);
+    if(pipeline->capture) {
+        capture_writer_append(pipeline->capture, channel_id, timestamps_us, values, count);
+    }
+    platform_mutex_unlock(&pipeline->capture_lock);
+
+    channel_latest *channel = ingest_find_channel(&pipeline->working, channel_id);
+    if(channel && count > 0) {
+        if(channel->sample_count == 0) {
+            channel->first_timestamp_us = timestamps_us[0];
+        }
+        channel->timestamp_us = timestamps_us[count - 1];
+        channel->value = values[count - 1];
+        channel->sample_count += count;
+        stats_summarize(&pipeline->stats, channel_id, &channel->stats);
+    }
+
+    if(device_channel_device(channel_id) != ALARM_DEVICE) {
+        int fired = alarm_evaluate(pipeline->alarms, channel_id, timestamps_us, values, count, pushed_ns);
+        for(int i = 0; i < fired; i++) {
+            alarm_event *event = &pipeline->alarms->fired[i];
+            float state = event->raised ? 1.0f : 0.0f;
+            ingest_consume_samples(pipeline, device_channel_id(ALARM_DEVICE, event->rule), &event->timestamp_us,
+                                   &state, 1, pushed_ns);
+        }
+    }
+}
+
+void ingest_consume(ingest_pipeline *pipeline, sample_batch *batch) {
+    ingest_snapshot *snapshot = &pipeline->working;
+    snapshot->total_batches++;
+    snapshot->total_samples += batch->count;
+    ingest_consume_samples(pipeline, batch->channel_id, batch->timestamps_us, batch->values, batch->count,
+                           batch->pushed_ns);
+}
+
+// Drains everything that is queued and publishes once, returns the number of batches consumed
+int ingest_drain(ingest_pipeline *pipeline) {
+    int consumed = 0;
+    sample_batch *batch;
+    while((batch = mpsc_queue_pop(&pipeline->queue)) != NULL) {
+        ingest_consume(pipeline, batch);
+        sample_batch_free(batch);
+        consumed++;
+    }
+    derived_output output;
+    while(consumed > 0 && derived_next(&pipeline->derived, &pipeline->store, &output)) {
+        ingest_consume_samples(pipeline, output.channel_id, output.timestamps_us, output.values, output.count,
+                               platform_time_ns());
+    }
+    pipeline->consumed_batches.fetch_add(consumed, std::memory_order_release);
+    if(consumed > 0) {
+        pipeline->working.version++;
+        pipeline->working.stored_samples = pipeline->store.sample_count.load(std::memory_order_relaxed);
+        pipeline->working.stored_bytes = pipeline->store.bytes.load(std::memory_order_relaxed);
+        seqlock_write(&pipeline->published, &pipeline->working);
+        frame_scheduler *scheduler = pipeline->scheduler.load(std::memory_order_acquire);
+        if(scheduler) {
+            frame_scheduler_samples(scheduler, pipeline->appended_channels);
+        }
+        pipeline->appended_channels = 0;
+    }
+    return consumed;
+}
+
+void ingest_store_thread(void *parameters) {
+    ingest_pipeline *pipeline = (ingest_pipeline *)parameters;
+    while(pipeline->running.load(std::memory_order_acquire)) {
+        // The timeout covers a push that was half way through when the queue looked empty
+        platform_event_wait(&pipeline->wake, 10);
+        ingest_drain(pipeline);
+    }
+    ingest_drain(pipeline);
+}
+
+bool ingest_pipeline_start(ingest_pipeline *pipeline) {
+    pipeline->alarms = (alarm_engine *)calloc(1, sizeof(alarm_engine));
+    if(!pipeline->alarms) {
+        return false;
+    }
+    mpsc_queue_init(&pipeline->queue);
+    memset(&pipeline->working, 0, sizeof(pipeline->working));
+    pipeline->published.sequence.store(0);
+    pipeline->published.data.channel_count = 0;
+    pipeline->consumed_batches.store(0);
+    store_init(&pipeline->store, INGEST_DEFAULT_RETENTION_US, INGEST_DEFAULT_RETENTION_BYTES);
+    stats_init(&pipeline->stats, STATS_DEFAULT_WINDOW_US);
+    derived_init(&pipeline->derived);
+    alarm_init(pipeline->alarms);
+    platform_mutex_init(&pipeline->capture_lock);
+    pipeline->capture = NULL;
+    pipeline->scheduler.store(NULL);
+    pipeline->appended_channels = 0;
+    platform_event_init(&pipeline->wake);
+    pipeline->running.store(1);
+    if(!platform_thread_start(&pipeline->store_thread, ingest_store_thread, pipeline)) {
+        platform_event_destroy(&pipeline->wake);
+        platform_mutex_destroy(&pipeline->capture_lock);
+        store_destroy(&pipeline->store);
+        stats_destroy(&pipeline->stats);
+        derived_destroy(&pipeline->derived);
+        alarm_destroy(pipeline->alarms);
+        free(pipeline->alarms);
+        return false;
+    }
+    return true;
+}
+
+void ingest_pipeline_stop(ingest_pipeline *pipeline) {
+    pipeline->running.store(0, std::memory_order_release);
+    platform_event_signal(&pipeline->wake);
+    platform_thread_join(&pipeline->store_thread);
+    platform_event_destroy(&pipeline->wake);
+    platform_mutex_destroy(&pipeline->capture_lock);
+    store_destroy(&pipeline->store);
+    stats_destroy(&pipeline->stats);
+    derived_destroy(&pipeline->derived);
+    alarm_destroy(pipeline->alarms);
+    free(pipeline->alarms);
+}
+
+// Everything the store thread takes in from now on also goes to writer, NULL stops recording. Once this
+// returns the store thread is done with the previous writer and it can be stopped.
+void ingest_set_capture(ingest_pipeline *pipeline, capture_writer *writer) {
+    platform_mutex_lock(&pipeline->capture_lock);
+    pipeline->capture = writer;
+    platform_mutex_unlock(&pipeline->capture_lock);
+}
+
+// The store thread wakes scheduler for the channels it watches from now on, it has to outlive the pipeline
+void ingest_set_scheduler(ingest_pipeline *pipeline, frame_scheduler *scheduler) {
+    pipeline->scheduler.store(scheduler, std::memory_order_release);
+}
+
+// Either can be 0 for unlimited, takes effect with the next append
+void ingest_set_retention(ingest_pipeline *pipeline, int64_t retention_us, int64_t retention_bytes) {
+    pipeline->store.retention_us.store(retention_us, std::memory_order_relaxed);
+    pipeline->store.retention_bytes.store(retention_bytes, std::memory_order_relaxed);
+}
+
+// Length of the rolling statistics window, takes effect with the next samples
+void ingest_set_stats_window(ingest_pipeline *pipeline, int64_t window_us) {
+    stats_set_window(&pipeline->stats, window_us);
+}
+
+// Any thread. Returns the slot of the derived channel, channel slot of DERIVED_DEVICE, or -1 with a message in error.
+int ingest_add_derived(ingest_pipeline *pipeline, const char *source, char *error, int error_size) {
+    return derived_add(&pipeline->derived, &pipeline->store, source, error, error_size);
+}
+
+void ingest_remove_derived(ingest_pipeline *pipeline, int slot) {
+    derived_remove(&pipeline->derived, slot);
+}
+
+// Any thread. Returns the slot of the rule, its state channel is channel slot of ALARM_DEVICE, or -1 if full.
+int ingest_add_alarm(ingest_pipeline *pipeline, const alarm_rule *rule) {
+    return alarm_add(pipeline->alarms, rule);
+}
+
+void ingest_remove_alarm(ingest_pipeline *pipeline, int slot) {
+    alarm_remove(pipeline->alarms, slot);
+}
+
+// UI thread only
+bool ingest_pop_alarm(ingest_pipeline *pipeline, alarm_event *event) {
+    return alarm_pop(pipeline->alarms, event);
+}
+
+void ingest_push(ingest_pipeline *pipeline, sample_batch *batch) {
+    batch->pushed_ns = platform_time_ns();
+    mpsc_queue_push(&pipeline->queue, batch);
+}
+
+// Producers push a whole receive worth of batches and then notify once
+void ingest_notify(ingest_pipeline *pipeline) {
+    platform_event_signal(&pipeline->wake);
+}
+
+// UI side, one reader at a time, never blocks. On false snapshot still holds the last consistent one.
+bool ingest_read_snapshot(ingest_pipeline *pipeline, ingest_snapshot *snapshot) {
+    return seqlock_read(&pipeline->published, &pipeline->reading, snapshot);
+}
+
+// Device timestamps covered by a decoded payload
+typedef struct {
+    int64_t first_timestamp_us;
+    int64_t last_timestamp_us;
+    int sample_count;
+} sample_range;
+
+// Scale and offset of a channel from the device's schema, none if there is no schema or it doesn't list the channel
+void ingest_calibration(const device_schema *schema, uint16_t channel_id, float *scale, float *offset) {
+    *scale = 1.0f;
+    *offset = 0.0f;
+    for(int i = 0; schema && i < schema->channel_count; i++) {
+        if(schema->channels[i].channel_id == channel_id) {
+            *scale = schema->channels[i].scale;
+            *offset = schema->channels[i].offset;
+            return;
+        }
+    }
+}
+
+// Decodes a sample_batch payload into one batch per block, with the values in engineering units if there is a
+// schema. Returns false on a malformed payload.
+bool ingest_decode_sample_batch(ingest_pipeline *pipeline, int device, const char *payload, int length,
+                                const device_schema *schema, sample_range *range) {
+    range->first_timestamp_us = INT64_MAX;
+    range->last_timestamp_us = INT64_MIN;
+    range->sample_count = 0;
+    int offset = 0;
+    while(offset < length) {
+        sample_block_header block;
+        if(length - offset < (int)sizeof(block)) {
+            return false;
+        }
+        memcpy(&block, payload + offset, sizeof(block));
+        offset += sizeof(block);
+
+        int value_size = sample_format_size(block.sample_format);
+        int values_length = block.sample_count * value_size;
+        if(value_size == 0 || length - offset < values_length) {
+            return false;
+        }
+
+        sample_batch *batch = sample_batch_alloc(block.sample_count);
+        if(!batch) {
+            return false;
+        }
+        batch->channel_id = device_channel_id(device, block.channel_id);
+        float scale;
+        float value_offset;
+        ingest_calibration(schema, block.channel_id, &scale, &value_offset);
+        decode_sample_block(&block, payload + offset, scale, value_offset, batch->timestamps_us, batch->values);
+        offset += values_length;
+        if(block.sample_count > 0) {
+            int64_t last_timestamp_us = batch->timestamps_us[block.sample_count - 1];
+            if(batch->timestamps_us[0] < range->first_timestamp_us) range->first_timestamp_us = batch->timestamps_us[0];
+            if(last_timestamp_us > range->last_timestamp_us) range->last_timestamp_us = last_timestamp_us;
+            range->sample_count += block.sample_count;
+        }
+        ingest_push(pipeline, batch);
+    }
+    return true;
+}
@@ -0,0 +1,384 @@
+// Logic analyzer.
+// Digital channels drawn as stacked lanes of a timeline with ImDrawList. A lane is built as runs at the resolution
+// of the screen: a stretch where the line stays low or high is one run however long it lasts, and pixels with more
+// than one edge in them make up a busy run, a bar that stands for a burst too fast for the zoom. Runs come from an
+// edge list, the run-length form of a digital trace, with a galloping search that skips over the edges inside a
+// pixel, or from the min/max envelope of the store or of a recording. Either way a lane has at most two runs per
+// pixel and a run is a rectangle or two, so what a frame draws depends on the width of the view, not on how many
+// edges there are in it.
+// Bus lanes hold a multi-bit value, a port or a decoded word. Their runs are labelled with the value in hex where
+// the label fits, the way protocol analyzers show bytes.
+
+#define LOGIC_MAX_LANES 64
+#define LOGIC_MAX_NAME 32
+#define LOGIC_MAX_PIXELS 4096
+#define LOGIC_MAX_RUNS (2 * LOGIC_MAX_PIXELS + 2)
+#define LOGIC_NAME_WIDTH 120.0f
+
+enum logic_level {
+    // No data
+    logic_level_none = 0,
+    logic_level_low = 1,
+    logic_level_high = 2,
+    // More than one edge per pixel
+    logic_level_busy = 3,
+    // A bus value
+    logic_level_value = 4
+};
+
+// The line is at value from timestamp_us on until the next edge, a NaN value ends the data
+typedef struct {
+    int64_t timestamp_us;
+    float value;
+} logic_edge;
+
+typedef struct {
+    int64_t start_us;
+    int64_t end_us;
+    int level;
+    float value;
+    // Edges inside a busy run, 0 if not known
+    int edges;
+} logic_run;
+
+typedef struct {
+    char name[LOGIC_MAX_NAME];
+    uint32_t channel_id;
+    bool bus;
+    // Bit lanes are high at or above it
+    float threshold;
+} logic_lane;
+
+typedef struct {
+    logic_lane lanes[LOGIC_MAX_LANES];
+    int lane_count;
+    int64_t from_us;
+    int64_t to_us;
+    // Keeps the newest samples at the right edge, or the whole recording in view
+    bool follow;
+
+    store_envelope_pixel pixels[LOGIC_MAX_PIXELS];
+    logic_run runs[LOGIC_MAX_RUNS];
+    // Of the last frame, for all lanes
+    int run_count;
+    int vertex_count;
+} logic_view;
+
+void logic_view_init(logic_view *view) {
+    view->lane_count = 0;
+    view->from_us = 0;
+    view->to_us = 1000000;
+    view->follow = true;
+    view->run_count = 0;
+    view->vertex_count = 0;
+}
+
+bool logic_add_lane(logic_view *view, const logic_lane *lane) {
+    if(view->lane_count == LOGIC_MAX_LANES) {
+        return false;
+    }
+    view->lanes[view->lane_count] = *lane;
+    view->lanes[view->lane_count].name[LOGIC_MAX_NAME - 1] = 0;
+    view->lane_count++;
+    return true;
+}
+
+void logic_remove_lane(logic_view *view, int lane) {
+    memmove(&view->lanes[lane], &view->lanes[lane + 1], (view->lane_count - lane - 1) * sizeof(logic_lane));
+    view->lane_count--;
+}
+
+int logic_level_of(float value, bool bus, float threshold) {
+    if(value != value) {
+        return logic_level_none;
+    }
+    if(bus) {
+        return logic_level_value;
+    }
+    return value >= threshold ? logic_level_high : logic_level_low;
+}
+
+// Appends a run, or lengthens the last one if it is the same and ends where this one starts. Returns the new count.
+int logic_extend(logic_run *runs, int count, int level, float value, int edges, int64_t start_us, int64_t end_us) {
+    if(end_us <= start_us) {
+        return count;
+    }
+    logic_run *last = count ? &runs[count - 1] : NULL;
+    if(last && last->level == level && last->end_us == start_us &&
+       (level != logic_level_value || last->value == value)) {
+        last->end_us = end_us;
+        last->edges += edges;
+        return count;
+    }
+    logic_run *run = &runs[count];
+    run->start_us = start_us;
+    run->end_us = end_us;
+    run->level = level;
+    run->value = value;
+    run->edges = edges;
+    return count + 1;
+}
+
+// First edge in [from, count) at or after timestamp_us. Gallops before it bisects, most pixels have few edges.
+int logic_lower_bound(const logic_edge *edges, int from, int count, int64_t timestamp_us) {
+    int low = from;
+    int high = from;
+    for(int step = 1; high < count && edges[high].timestamp_us < timestamp_us; step *= 2) {
+        low = high + 1;
+        high += step;
+    }
+    high = high < count ? high : count;
+    while(low < high) {
+        int middle = low + (high - low) / 2;
+        if(edges[middle].timestamp_us < timestamp_us) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Start of pixel x of a view of [from_us, to_us] that is pixel_count pixels wide
+int64_t logic_pixel_us(int64_t from_us, int64_t to_us, int pixel_count, int x) {
+    return x < pixel_count ? from_us + (int64_t)((double)(to_us - from_us) * x / pixel_count) : to_us;
+}
+
+// Runs of a view of [from_us, to_us] from edges sorted by time. A pixel with one edge in it is split at the edge,
+// one with more is busy. Fills at most LOGIC_MAX_RUNS runs for up to LOGIC_MAX_PIXELS pixels, returns how many.
+int logic_runs_from_edges(const logic_edge *edges, int edge_count, int64_t from_us, int64_t to_us, int pixel_count,
+                          bool bus, float threshold, logic_run *runs) {
+    if(to_us <= from_us || pixel_count <= 0) {
+        return 0;
+    }
+    // The edge in effect at the start of the pixel, -1 before the first one
+    int current = logic_lower_bound(edges, 0, edge_count, from_us + 1) - 1;
+    int count = 0;
+    for(int x = 0; x < pixel_count; x++) {
+        int64_t start_us = logic_pixel_us(from_us, to_us, pixel_count, x);
+        int64_t end_us = logic_pixel_us(from_us, to_us, pixel_count, x + 1);
+        if(end_us <= start_us) {
+            continue;
+        }
+        int next = logic_lower_bound(edges, current + 1, edge_count, end_us);
+        int inside = next - current - 1;
+        float value = current >= 0 ? edges[current].value : NAN;
+        if(inside == 0) {
+            count = logic_extend(runs, count, logic_level_of(value, bus, threshold), value, 0, start_us, end_us);
+        } else if(inside == 1) {
+            const logic_edge *edge = &edges[current + 1];
+            count = logic_extend(runs, count, logic_level_of(value, bus, threshold), value, 0, start_us,
+                                 edge->timestamp_us);
+            count = logic_extend(runs, count, logic_level_of(edge->value, bus, threshold), edge->value, 0,
+                                 edge->timestamp_us, end_us);
+        } else {
+            count = logic_extend(runs, count, logic_level_busy, 0.0f, inside, start_us, end_us);
+        }
+        // An edge right on the boundary is where the next pixel starts from
+        current = next - 1;
+        while(current + 1 < edge_count && edges[current + 1].timestamp_us <= end_us) {
+            current++;
+        }
+    }
+    return count;
+}
+
+// Runs from the envelope of a view, a pixel whose samples are on both sides of the threshold or hold more than one
+// value of a bus is busy. Pixels without samples between ones that have them hold the level, after a busy pixel
+// the level the next samples start at. Returns how many runs there are, at most one per pixel.
+int logic_runs_from_envelope(const store_envelope_pixel *pixels, int pixel_count, int64_t from_us, int64_t to_us,
+                             bool bus, float threshold, logic_run *runs) {
+    int last = pixel_count - 1;
+    while(last >= 0 && pixels[last].count == 0) {
+        last--;
+    }
+    int count = 0;
+    int held = logic_level_none;
+    float held_value = 0.0f;
+    int64_t gap_us = -1;
+    for(int x = 0; x <= last; x++) {
+        const store_envelope_pixel *pixel = &pixels[x];
+        int64_t start_us = logic_pixel_us(from_us, to_us, pixel_count, x);
+        if(pixel->count == 0) {
+            gap_us = gap_us < 0 ? start_us : gap_us;
+            continue;
+        }
+        int level;
+        if(bus) {
+            level = pixel->min == pixel->max ? logic_level_value : logic_level_busy;
+        } else {
+            level = pixel->min >= threshold ? logic_level_high
+                                            : pixel->max < threshold ? logic_level_low : logic_level_busy;
+        }
+        if(gap_us >= 0 && held != logic_level_none) {
+            bool hold = held != logic_level_busy || level == logic_level_busy;
+            count = logic_extend(runs, count, hold ? held : level, hold ? held_value : pixel->min, 0, gap_us,
+                                 start_us);
+        }
+        gap_us = -1;
+        count = logic_extend(runs, count, level, pixel->min, 0, start_us,
+                             logic_pixel_us(from_us, to_us, pixel_count, x + 1));
+        held = level;
+        held_value = pixel->min;
+    }
+    return count;
+}
+
+// Draws the runs of a lane into [min, max] of the draw list, a view of [from_us, to_us]
+void logic_draw_lane(ImDrawList *draw, ImVec2 min, ImVec2 max, const logic_run *runs, int run_count, int64_t from_us,
+                     int64_t to_us, ImU32 color) {
+    double pixels_per_us = (max.x - min.x) / (double)(to_us - from_us);
+    ImU32 dim = (color & ~IM_COL32_A_MASK) | IM_COL32(0, 0, 0, 96);
+    ImU32 text_color = ImGui::GetColorU32(ImGuiCol_Text);
+    float text_y = (min.y + max.y - ImGui::GetTextLineHeight()) * 0.5f;
+    int previous = logic_level_none;
+    char label[32];
+    for(int i = 0; i < run_count; i++) {
+        const logic_run *run = &runs[i];
+        float x0 = min.x + (float)((run->start_us - from_us) * pixels_per_us);
+        float x1 = min.x + (float)((run->end_us - from_us) * pixels_per_us);
+        x0 = x0 > min.x ? x0 : min.x;
+        x1 = x1 < max.x ? x1 : max.x;
+        label[0] = 0;
+        if(run->level == logic_level_low || run->level == logic_level_high) {
+            bool high = run->level == logic_level_high;
+            if(previous == logic_level_low || previous == logic_level_high || previous == logic_level_value) {
+                draw->AddRectFilled(ImVec2(x0, min.y), ImVec2(x0 + 1.0f, max.y), color);
+            }
+            float y = high ? min.y : max.y - 1.0f;
+            draw->AddRectFilled(ImVec2(x0, y), ImVec2(x1 > x0 + 1.0f ? x1 : x0 + 1.0f, y + 1.0f), color);
+        } else if(run->level == logic_level_busy) {
+            // A burst no wider than a couple of pixels looks like an edge
+            if(x1 - x0 < 2.0f) {
+                draw->AddRectFilled(ImVec2(x0, min.y), ImVec2(x0 + 1.0f, max.y), color);
+            } else {
+                draw->AddRectFilled(ImVec2(x0, min.y), ImVec2(x1, max.y), dim);
+                if(run->edges > 0) {
+                    snprintf(label, sizeof(label), "%d edges", run->edges);
+                }
+            }
+        } else if(run->level == logic_level_value) {
+            float slant = (x1 - x0) * 0.5f < 3.0f ? (x1 - x0) * 0.5f : 3.0f;
+            draw->AddLine(ImVec2(x0, min.y), ImVec2(x0 + slant, max.y), color);
+            draw->AddLine(ImVec2(x0, max.y), ImVec2(x0 + slant, min.y), color);
+            draw->AddRectFilled(ImVec2(x0 + slant, min.y), ImVec2(x1, min.y + 1.0f), color);
+            draw->AddRectFilled(ImVec2(x0 + slant, max.y - 1.0f), ImVec2(x1, max.y), color);
+            if(run->value == floorf(run->value) && fabsf(run->value) < 1e9f) {
+                snprintf(label, sizeof(label), "%llX", (unsigned long long)(int64_t)run->value);
+            } else {
+                snprintf(label, sizeof(label), "%.3g", run->value);
+            }
+        }
+        // Only where it fits, so the text is bounded by the width too
+        if(label[0]) {
+            float width = ImGui::CalcTextSize(label).x;
+            if(width + 8.0f <= x1 - x0) {
+                draw->AddText(ImVec2((x0 + x1 - width) * 0.5f, text_y), text_color, label);
+            }
+        }
+        previous = run->level;
+    }
+}
+
+// Moves the view to the newest samples of the lanes keeping its span, or onto the whole recording
+void logic_view_follow(logic_view *view, sample_store *store, capture_view *capture) {
+    int64_t first_us = INT64_MAX;
+    int64_t last_us = INT64_MIN;
+    for(int i = 0; i < view->lane_count; i++) {
+        int64_t lane_first_us;
+        int64_t lane_last_us;
+        uint64_t count;
+        bool found = capture ? capture_view_span(capture, view->lanes[i].channel_id, &lane_first_us, &lane_last_us)
+                             : store_span(store, view->lanes[i].channel_id, &lane_first_us, &lane_last_us, &count);
+        if(found) {
+            first_us = lane_first_us < first_us ? lane_first_us : first_us;
+            last_us = lane_last_us > last_us ? lane_last_us : last_us;
+        }
+    }
+    if(last_us == INT64_MIN) {
+        return;
+    }
+    if(capture) {
+        view->from_us = first_us;
+        view->to_us = last_us > first_us ? last_us : first_us + 1;
+    } else {
+        view->from_us = last_us - (view->to_us - view->from_us);
+        view->to_us = last_us;
+    }
+}
+
+// The lanes at the cursor, width wide, from the recording when there is one and the live store otherwise.
+// The wheel zooms around the pointer and dragging pans, either stops the view from following.
+void logic_view_draw(logic_view *view, sample_store *store, capture_view *capture, float width) {
+    ImDrawList *draw = ImGui::GetWindowDrawList();
+    ImGuiIO &io = ImGui::GetIO();
+    float lane_height = ImGui::GetTextLineHeight() + 8.0f;
+    int pixel_count = (int)(width - LOGIC_NAME_WIDTH);
+    pixel_count = pixel_count < LOGIC_MAX_PIXELS ? pixel_count : LOGIC_MAX_PIXELS;
+    if(pixel_count <= 0) {
+        return;
+    }
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImVec2 size(LOGIC_NAME_WIDTH + pixel_count, lane_height * (view->lane_count + 1));
+    ImGui::InvisibleButton("##logic", size);
+
+    int64_t span_us = view->to_us - view->from_us;
+    float pointer = (io.MousePos.x - origin.x - LOGIC_NAME_WIDTH) / pixel_count;
+    if(ImGui::IsItemHovered() && io.MouseWheel != 0.0f && pointer >= 0.0f && pointer <= 1.0f) {
+        int64_t pivot_us = view->from_us + (int64_t)(span_us * (double)pointer);
+        double zoomed_us = span_us * pow(0.8, io.MouseWheel);
+        // No finer than a microsecond per pixel
+        span_us = zoomed_us > pixel_count ? (int64_t)zoomed_us : pixel_count;
+        view->from_us = pivot_us - (int64_t)(span_us * (double)pointer);
+        view->to_us = view->from_us + span_us;
+        view->follow = false;
+    }
+    if(ImGui::IsItemActive() && io.MouseDelta.x != 0.0f) {
+        int64_t shift_us = (int64_t)(-io.MouseDelta.x * (double)span_us / pixel_count);
+        view->from_us += shift_us;
+        view->to_us += shift_us;
+        view->follow = false;
+    }
+
+    int vertices = draw->VtxBuffer.Size;
+    view->run_count = 0;
+    ImU32 text_color = ImGui::GetColorU32(ImGuiCol_Text);
+    ImU32 separator = ImGui::GetColorU32(ImGuiCol_Separator);
+    draw->PushClipRect(origin, ImVec2(origin.x + size.x, origin.y + size.y), true);
+    for(int i = 0; i < view->lane_count; i++) {
+        const logic_lane *lane = &view->lanes[i];
+        float y = origin.y + lane_height * i;
+        draw->AddText(ImVec2(origin.x + 4.0f, y + 4.0f), text_color, lane->name);
+        draw->AddRectFilled(ImVec2(origin.x, y + lane_height - 1.0f), ImVec2(origin.x + size.x, y + lane_height),
+                            separator);
+        if(capture) {
+            capture_view_envelope(capture, lane->channel_id, view->from_us, view->to_us, pixel_count, view->pixels);
+        } else {
+            store_envelope(store, lane->channel_id, view->from_us, view->to_us, pixel_count, view->pixels);
+        }
+        int run_count = logic_runs_from_envelope(view->pixels, pixel_count, view->from_us, view->to_us, lane->bus,
+                                                 lane->threshold, view->runs);
+        logic_draw_lane(draw, ImVec2(origin.x + LOGIC_NAME_WIDTH, y + 4.0f),
+                        ImVec2(origin.x + LOGIC_NAME_WIDTH + pixel_count, y + lane_height - 4.0f), view->runs,
+                        run_count, view->from_us, view->to_us,
+                        lane->bus ? IM_COL32(230, 200, 80, 255) : IM_COL32(80, 220, 120, 255));
+        view->run_count += run_count;
+    }
+
+    // Time axis, and where the pointer is
+    char label[64];
+    float axis_y = origin.y + lane_height * view->lane_count + 4.0f;
+    snprintf(label, sizeof(label), "%.6f s", view->from_us / 1e6);
+    draw->AddText(ImVec2(origin.x + LOGIC_NAME_WIDTH, axis_y), text_color, label);
+    snprintf(label, sizeof(label), "%.6f s", view->to_us / 1e6);
+    draw->AddText(ImVec2(origin.x + size.x - ImGui::CalcTextSize(label).x, axis_y), text_color, label);
+    if(ImGui::IsItemHovered() && pointer >= 0.0f && pointer <= 1.0f) {
+        float x = io.MousePos.x;
+        draw->AddRectFilled(ImVec2(x, origin.y), ImVec2(x + 1.0f, axis_y - 4.0f), separator);
+        snprintf(label, sizeof(label), "%.6f s, %.3g s wide",
+                 (view->from_us + span_us * (double)pointer) / 1e6, span_us / 1e6);
+        draw->AddText(ImVec2(origin.x + LOGIC_NAME_WIDTH + pixel_count * 0.4f, axis_y), text_color, label);
+    }
+    draw->PopClipRect();
+    view->vertex_count = draw->VtxBuffer.Size - vertices;
+}
@@ -6,12 +6,35 @@
 #include <windows.h>
 
 #include "imgui/imgui.h"
+#include "imgui/imgui_internal.h"
 #include "imgui/imgui_impl_win32.h"
 #include "imgui/imgui_impl_dx11.h"
 
 #include <d3d11.h>
 
+#include "platform.cpp"
+#include "net_poll.cpp"
 #include "network.cpp"
+#include "requests.cpp"
+#include "discovery.cpp"
+#include "store.cpp"
+#include "compress.cpp"
+#include "capture.cpp"
+#include "capture_view.cpp"
+#include "decode.cpp"
+#include "query.cpp"
+#include "stats.cpp"
+#include "fft.cpp"
+#include "derived.cpp"
+#include "alarm.cpp"
+#include "scheduler.cpp"
+#include "draw_hash.cpp"
+#include "ingest.cpp"
+#include "connection.cpp"
+#include "replay.cpp"
+#include "logic.cpp"
+#include "retained.cpp"
+#include "plot.cpp"
 
 enum window_state {
     window_state_none = 0,
@@ -68,31 +91,119 @@ int WINAPI wWinMain(HINSTANCE h_instance, HINSTANCE h_prev_instance, PWSTR p_cmd
     ImGui_ImplDX11_Init(d3d_device, d3d_device_context);
 
 
-    // Initialize, create and connect socket to the server
+    // Initialize winsock and start the I/O thread, connecting happens on it so the UI never blocks
     WSADATA wsa_data;
     hr = (HRESULT)WSAStartup(MAKEWORD(2, 2), &wsa_data);
-    client_socket client = {};
-    /*
-    if(SUCCEEDED(hr)) {
-        client = create_socket();
-        connect_socket(&client);
+    ingest_pipeline *ingest = (ingest_pipeline *)calloc(1, sizeof(ingest_pipeline));
+    connection_manager connection = {};
+    bool ingest_started = SUCCEEDED(hr) && ingest && ingest_pipeline_start(ingest);
+    bool connection_started = ingest_started && connection_manager_start(&connection, ingest);
+    // The connect window drives the first device, more can be added from the data window
+    int device = connection_started ? connection_manager_add_device(&connection) : -1;
+    connection_started = connection_started && device >= 0;
+    // Devices announce themselves, the subnet probe fills the list before the first beacon is due
+    discovery *disc = (discovery *)calloc(1, sizeof(discovery));
+    bool discovery_started = SUCCEEDED(hr) && discovery_start(disc, DISCOVERY_CLIENT_PORT, DISCOVERY_DEVICE_PORT);
+    if(discovery_started) {
+        discovery_probe(disc);
     }
-    
-    tcp_message test = {};
-    test.buffer = (char *)malloc(512);
-    test.buffer_length = 512;
-    char **data_points = (char **)malloc(3 * strlen("GPIO4"));
-    data_points[0] = "GPIO4";
-    data_points[1] = "GPIO4";
-    data_points[2] = "GPIO4";
-    send_data_request(client.connect_socket, &test, data_points, 3);  
-    */
+    discovered_device *found_devices = (discovered_device *)calloc(DISCOVERY_MAX_DEVICES, sizeof(discovered_device));
+    ingest_snapshot *snapshot = (ingest_snapshot *)calloc(1, sizeof(ingest_snapshot));
+    device_schema *schema = (device_schema *)calloc(1, sizeof(device_schema));
+    bool subscribed = false;
+    float stats_window_s = STATS_DEFAULT_WINDOW_US / 1e6f;
+    // Recording goes through the store thread, the writer thread does the file I/O
+    capture_writer *capture = (capture_writer *)calloc(1, sizeof(capture_writer));
+    capture_channel *capture_channels = (capture_channel *)calloc(CAPTURE_MAX_CHANNELS, sizeof(capture_channel));
+    bool recording = false;
+    char capture_path[260] = "capture.pedro";
+    bool capture_compress = true;
+    // Recordings are viewed straight from the file
+    capture_view *viewer = (capture_view *)calloc(1, sizeof(capture_view));
+    bool viewing = false;
+    // Replays into the same pipeline as the devices, 0 is as fast as possible
+    replay *replayer = (replay *)calloc(1, sizeof(replay));
+    bool replaying = false;
+    float replay_speed = 1.0f;
+    // Searches the recording being viewed, or the live store, one step per frame
+    query_cursor *search = (query_cursor *)calloc(1, sizeof(query_cursor));
+    const int search_max_results = 10000;
+    const int search_page_size = 20;
+    query_match *search_results = (query_match *)calloc(search_max_results, sizeof(query_match));
+    bool searching = false;
+    int search_found = 0;
+    int search_page = 0;
+    int search_kind = query_kind_range;
+    int search_channel[2] = {};
+    float search_range[2] = {2.1f, 3.3f};
+    bool search_gated = false;
+    int search_gate_channel[2] = {};
+    float search_gate_range[2] = {0.5f, 1.5f};
+    // Spectra of the live store come from a worker thread, the panel drives the first analysis
+    fft_worker *spectrum_worker = (fft_worker *)calloc(1, sizeof(fft_worker));
+    bool spectrum_started = ingest_started && fft_worker_start(spectrum_worker, &ingest->store, 100);
+    fft_config spectrum_config = {false, 0, 14, fft_window_hann, 0.5f, 5000000, true};
+    int spectrum_channel[2] = {};
+    float spectrum_span_s = 5.0f;
+    // Derived channels are evaluated by the store thread, a source is empty where the slot is free
+    char derived_source[DERIVED_MAX_SOURCE] = "(c0 - c1) * 0.5";
+    char derived_error[128] = "";
+    char (*derived_sources)[DERIVED_MAX_SOURCE] = (char (*)[DERIVED_MAX_SOURCE])calloc(DERIVED_MAX_CHANNELS,
+                                                                                      DERIVED_MAX_SOURCE);
+    // Alarm rules run on the store thread, their events are taken every frame and the last ones kept for the log
+    const int alarm_log_size = 64;
+    alarm_rule alarm_form = {"", 0, alarm_kind_above, -1.0f, 1.0f, 0.1f, 0};
+    int alarm_channel[2] = {};
+    int alarm_debounce_ms = 10;
+    alarm_rule *alarm_rules = (alarm_rule *)calloc(ALARM_MAX_RULES, sizeof(alarm_rule));
+    bool *alarm_used = (bool *)calloc(ALARM_MAX_RULES, sizeof(bool));
+    bool *alarm_raised = (bool *)calloc(ALARM_MAX_RULES, sizeof(bool));
+    alarm_event *alarm_log = (alarm_event *)calloc(alarm_log_size, sizeof(alarm_event));
+    uint64_t alarm_events = 0;
+    uint64_t alarm_latency_total_ns = 0;
+    uint64_t alarm_latency_max_ns = 0;
+    // Digital lanes over the live store, or the recording being viewed
+    logic_view *logic = (logic_view *)calloc(1, sizeof(logic_view));
+    logic_view_init(logic);
+    logic_lane logic_form = {"GPIO", 0, false, 0.5f};
+    int logic_channel[2] = {};
+    // Channels over shared axes, from the live store or the recording
+    const ImU32 plot_colors[PLOT_MAX_SERIES] = {
+        IM_COL32(90, 170, 255, 255), IM_COL32(255, 150, 60, 255), IM_COL32(120, 220, 120, 255),
+        IM_COL32(220, 120, 220, 255), IM_COL32(240, 220, 90, 255), IM_COL32(90, 220, 220, 255),
+        IM_COL32(240, 100, 100, 255), IM_COL32(200, 200, 200, 255)
+    };
+    plot_view *plot = (plot_view *)calloc(1, sizeof(plot_view));
+    plot_view_init(plot);
+    plot->x_label_scale = 1e-6;
+    plot->follow = true;
+    plot_series *plot_channels = (plot_series *)calloc(PLOT_MAX_SERIES, sizeof(plot_series));
+    char (*plot_names)[32] = (char (*)[32])calloc(PLOT_MAX_SERIES, 32);
+    int plot_channel_count = 0;
+    int plot_channel[2] = {};
+    // Plots are built on workers, one less than there are processors so that the UI thread keeps one. With fewer
+    // than that started the UI thread builds the rest itself.
+    plot_workers *plot_builders = (plot_workers *)calloc(1, sizeof(plot_workers));
+    plot_workers_start(plot_builders, platform_cpu_count() - 1);
+    // Frames are rendered on input, samples for a channel on screen, animations and a timer, the loop sleeps in
+    // between
+    frame_scheduler *scheduler = (frame_scheduler *)calloc(1, sizeof(frame_scheduler));
+    frame_scheduler_init(scheduler, SCHEDULER_DEFAULT_SETTLE_FRAMES, SCHEDULER_DEFAULT_TIMER_NS,
+                         SCHEDULER_DEFAULT_DATA_INTERVAL_NS);
+    if(ingest_started) {
+        ingest_set_scheduler(ingest, scheduler);
+    }
+    // A frame that comes out the same as the one on screen isn't submitted or presented
+    draw_hash *presented = (draw_hash *)calloc(1, sizeof(draw_hash));
 
     float clear_color[4] = {0, 0, 0, 0};
     char ip_address[32] = {};
     char port[8] = {};
+    char other_ip_address[32] = {};
+    char other_port[8] = {};
 
-    UINT window_state = 0;
+    UINT window_state = window_state_connect;
+    ImGuiID last_hovered = 0;
     
     bool done = false;
     while(!done) {
@@ -103,6 +214,7 @@ int WINAPI wWinMain(HINSTANCE h_instance, HINSTANCE h_prev_instance, PWSTR p_cmd
             }
             TranslateMessage(&msg);
             DispatchMessage(&msg);
+            frame_scheduler_input(scheduler);
         }
 
         if(done) {
@@ -121,17 +233,485 @@ int WINAPI wWinMain(HINSTANCE h_instance, HINSTANCE h_prev_instance, PWSTR p_cmd
             resize_width = 0;
             resize_height = 0;
             create_render_target();
+            draw_hash_invalidate(presented);
+        }
+
+        uint64_t wait_ns;
+        if(!frame_scheduler_due(scheduler, platform_time_ns(), &wait_ns)) {
+            // Until a message comes in, samples for a channel on screen or the next deadline
+            MsgWaitForMultipleObjects(1, &scheduler->wake.handle, FALSE, frame_scheduler_wait_ms(wait_ns),
+                                      QS_ALLINPUT);
+            continue;
         }
+        uint64_t frame_ns = platform_time_ns();
+        frame_scheduler_begin(scheduler, frame_ns);
 
         ImGui_ImplDX11_NewFrame();
         ImGui_ImplWin32_NewFrame();
         ImGui::NewFrame();
 
+        int connection_state = connection_started ? connection_manager_state(&connection, device) 
+                                                  : connection_state_failed;
+        // Data keeps being shown while the connection comes back on its own
+        bool has_connection = connection_state == connection_state_connected 
+                           || connection_state == connection_state_reconnecting;
+        window_state = has_connection ? window_state_default : window_state_connect;
+
+        alarm_event alarm;
+        while(ingest_started && ingest_pop_alarm(ingest, &alarm)) {
+            uint64_t latency_ns = platform_time_ns() - alarm.pushed_ns;
+            alarm_latency_total_ns += latency_ns;
+            alarm_latency_max_ns = latency_ns > alarm_latency_max_ns ? latency_ns : alarm_latency_max_ns;
+            alarm_raised[alarm.rule] = alarm.raised;
+            alarm_log[alarm_events++ % alarm_log_size] = alarm;
+        }
+
         switch(window_state) {
             case window_state_connect: {
+                bool connecting = connection_state == connection_state_resolving 
+                               || connection_state == connection_state_connecting;
+
+                ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove 
+                                       | ImGuiWindowFlags_NoSavedSettings;
+                ImGuiViewport *viewport = ImGui::GetMainViewport();
+                ImGui::SetNextWindowPos(viewport->WorkPos);
+                ImGui::SetNextWindowSize(viewport->WorkSize);
+                ImGui::Begin("Connect Window", NULL);
+                ImGui::Text("Server address:");
+                ImGui::BeginDisabled(connecting);
+                ImGui::InputTextWithHint("ip_address_input", "IPv4: 192.168.0.1", ip_address, sizeof(ip_address), 
+                                         ImGuiInputTextFlags_CharsDecimal);
+                ImGui::SameLine();
+                ImGui::InputTextWithHint("port_input", "Port: 7777", port, sizeof(port), 
+                                         ImGuiInputTextFlags_CharsDecimal);
+                ImGui::EndDisabled();
+
+                if(!connecting) {
+                    if(ImGui::Button("Connect") && connection_started) {
+                        connection_manager_connect(&connection, device, ip_address, port, DEFAULT_CONNECT_TIMEOUT_MS);
+                    }
+                } else if(ImGui::Button("Cancel")) {
+                    connection_manager_cancel(&connection, device);
+                }
+
+                ImGui::Text("%s : %s - %s", ip_address[0] ? ip_address : DEFAULT_IP, port[0] ? port : DEFAULT_PORT,
+                            connection_state_name(connection_state));
+
+                ImGui::SeparatorText("Devices found");
+                int found_count = discovery_started ? discovery_devices(disc, found_devices, DISCOVERY_MAX_DEVICES) : 0;
+                for(int i = 0; i < found_count; i++) {
+                    discovered_device *found = &found_devices[i];
+                    uint8_t *id = found->beacon.device_id;
+                    ImGui::PushID(i);
+                    ImGui::BeginDisabled(connecting);
+                    if(ImGui::Button("Connect") && connection_started) {
+                        snprintf(ip_address, sizeof(ip_address), "%s", found->address);
+                        snprintf(port, sizeof(port), "%s", found->port);
+                        connection_manager_connect(&connection, device, ip_address, port, DEFAULT_CONNECT_TIMEOUT_MS);
+                    }
+                    ImGui::EndDisabled();
+                    ImGui::SameLine();
+                    ImGui::Text("%s : %s  %02X:%02X:%02X:%02X:%02X:%02X  firmware %08X, %u clients, %u streaming",
+                                found->address, found->port, id[0], id[1], id[2], id[3], id[4], id[5],
+                                found->beacon.firmware_hash, found->beacon.connected_clients,
+                                found->beacon.streaming_clients);
+                    ImGui::PopID();
+                }
+                if(discovery_started && ImGui::Button("Scan")) {
+                    discovery_probe(disc);
+                }
+
+                ImGui::End();
             } break;
 
             case window_state_default: {
+                // Keeps showing the last consistent snapshot if the store is mid-publish
+                ingest_read_snapshot(ingest, snapshot);
+
+                bool live_shown = ImGui::Begin("Live Data", NULL);
+                connection_metrics *metrics = connection_manager_metrics(&connection, device);
+                ImGui::Text("%s, reconnected %u times, last took %.0f ms with a %.1f ms gap", 
+                            connection_state_name(connection_state), metrics->reconnect_count.load(),
+                            metrics->last_reconnect_ns.load() / 1e6, metrics->last_gap_us.load() / 1e3);
+                ImGui::Text("%llu samples in %llu batches", (unsigned long long)snapshot->total_samples, 
+                            (unsigned long long)snapshot->total_batches);
+                if(ImGui::SliderFloat("Statistics window (s)", &stats_window_s, 0.01f, 60.0f, "%.2f",
+                                      ImGuiSliderFlags_Logarithmic)) {
+                    ingest_set_stats_window(ingest, (int64_t)(stats_window_s * 1e6f));
+                }
+                for(int i = 0; i < snapshot->channel_count; i++) {
+                    channel_latest *channel = &snapshot->channels[i];
+                    stats_summary *stats = &channel->stats;
+                    if(live_shown) {
+                        frame_scheduler_watch(scheduler, channel->channel_id);
+                    }
+                    ImGui::Text("Device %d channel %u: %.3f at %lld us", device_channel_device(channel->channel_id),
+                                device_channel_channel(channel->channel_id), channel->value,
+                                (long long)channel->timestamp_us);
+                    ImGui::Text("    mean %.3f, sd %.3f, min %.3f, max %.3f, rms %.3f, %.0f Hz, %.3f/s over %u",
+                                stats->mean, stats->stddev, stats->min, stats->max, stats->rms, stats->rate_hz,
+                                stats->slope_per_s, stats->count);
+                }
+                bool has_schema = connection_manager_schema(&connection, device, schema);
+                if(has_schema && !subscribed && ImGui::Button("Subscribe to all")) {
+                    uint16_t channel_ids[SUBSCRIPTION_MAX_CHANNELS];
+                    int channel_count = 0;
+                    for(int i = 0; i < schema->channel_count && channel_count < SUBSCRIPTION_MAX_CHANNELS; i++) {
+                        channel_ids[channel_count++] = schema->channels[i].channel_id;
+                    }
+                    subscribed = connection_manager_subscribe(&connection, device, channel_ids, channel_count, 1000);
+                }
+                if(ImGui::Button("Disconnect")) {
+                    connection_manager_cancel(&connection, device);
+                }
+
+                ImGui::SeparatorText("Recording");
+                if(!recording) {
+                    ImGui::InputText("capture_path_input", capture_path, sizeof(capture_path));
+                    ImGui::Checkbox("Compress", &capture_compress);
+                    if(ImGui::Button("Record")) {
+                        // The schema of every device that has one goes in the header
+                        int channel_count = 0;
+                        for(int i = 0; i < connection_manager_device_count(&connection); i++) {
+                            if(!connection_manager_schema(&connection, i, schema)) {
+                                continue;
+                            }
+                            for(int j = 0; j < schema->channel_count && channel_count < CAPTURE_MAX_CHANNELS; j++) {
+                                capture_channels[channel_count].channel_id =
+                                    device_channel_id(i, schema->channels[j].channel_id);
+                                capture_channels[channel_count++].schema = schema->channels[j];
+                            }
+                        }
+                        recording = capture_writer_start(capture, capture_path, capture_channels, channel_count,
+                                                         capture_compress);
+                        if(recording) {
+                            ingest_set_capture(ingest, capture);
+                        }
+                    }
+                    ImGui::SameLine();
+                    if(ImGui::Button(viewing ? "Close recording" : "Open recording")) {
+                        if(viewing) {
+                            capture_view_close(viewer);
+                            viewing = false;
+                            searching = false;
+                        } else {
+                            viewing = capture_view_open(viewer, capture_path, 0);
+                        }
+                    }
+                    ImGui::SameLine();
+                    if(ImGui::Button(replaying ? "Stop replay" : "Replay")) {
+                        if(replaying) {
+                            replay_stop(replayer);
+                            replaying = false;
+                        } else {
+                            replaying = replay_start(replayer, capture_path, ingest, replay_speed, false);
+                        }
+                    }
+                    ImGui::SameLine();
+                    if(ImGui::SliderFloat("Speed", &replay_speed, 0.0f, 100.0f, replay_speed == 0.0f
+                                          ? "as fast as possible" : "%.1fx", ImGuiSliderFlags_Logarithmic) &&
+                       replaying) {
+                        replay_set_speed(replayer, replay_speed);
+                    }
+                    if(replaying) {
+                        ImGui::Text("Replayed %.1f s of %.1f s%s", replayer->replayed_us.load() / 1e6,
+                                    (replayer->last_timestamp_us - replayer->first_timestamp_us) / 1e6,
+                                    replay_finished(replayer) ? ", done" : "");
+                    }
+                    if(viewing) {
+                        int64_t blocks = viewer->reader.block_count;
+                        ImGui::Text("%d channels, %lld blocks%s, overview %s, %.0f of %.0f MB cached",
+                                    viewer->channel_count, (long long)blocks,
+                                    viewer->reader.recovered ? " (recovered)" : "",
+                                    viewer->pyramid_ready.load() ? "ready" : "building",
+                                    viewer->regions_paged_in > viewer->regions_released
+                                    ? (viewer->regions_paged_in - viewer->regions_released) *
+                                      CAPTURE_VIEW_REGION_SIZE / 1048576.0 : 0.0,
+                                    viewer->slot_count * CAPTURE_VIEW_REGION_SIZE / 1048576.0);
+                        for(int i = 0; i < viewer->channel_count; i++) {
+                            capture_view_channel *channel = &viewer->channels[i];
+                            ImGui::Text("Device %d channel %u: %llu samples",
+                                        device_channel_device(channel->channel_id),
+                                        device_channel_channel(channel->channel_id),
+                                        (unsigned long long)channel->sample_count);
+                        }
+                    }
+                } else {
+                    uint64_t bytes_written = capture->bytes_written.load();
+                    ImGui::Text("%s: %.1f MB, %.1fx compressed, %llu samples, %llu dropped%s", capture_path,
+                                bytes_written / 1048576.0,
+                                bytes_written ? (double)capture->raw_bytes_written.load() / bytes_written : 1.0,
+                                (unsigned long long)capture->samples_written.load(),
+                                (unsigned long long)capture->samples_dropped.load(),
+                                capture->failed.load() ? ", write failed" : "");
+                    if(ImGui::Button("Stop recording")) {
+                        ingest_set_capture(ingest, NULL);
+                        capture_writer_stop(capture);
+                        recording = false;
+                    }
+                }
+
+                ImGui::SeparatorText(viewing ? "Search the recording" : "Search");
+                ImGui::Combo("Condition", &search_kind, "In range\0Rising through\0Falling through\0Crossing\0");
+                ImGui::InputInt2("Device, channel", search_channel);
+                if(search_kind == query_kind_range) {
+                    ImGui::InputFloat2("Low, high", search_range);
+                } else {
+                    ImGui::InputFloat("Threshold", &search_range[0]);
+                }
+                ImGui::Checkbox("While", &search_gated);
+                if(search_gated) {
+                    ImGui::InputInt2("Gate device, channel", search_gate_channel);
+                    ImGui::InputFloat2("Gate low, high", search_gate_range);
+                }
+                if(ImGui::Button("Search")) {
+                    query_condition condition = {search_kind, device_channel_id(search_channel[0], search_channel[1]),
+                                                 search_range[0], search_range[1]};
+                    query_condition gate = {query_kind_range,
+                                            device_channel_id(search_gate_channel[0], search_gate_channel[1]),
+                                            search_gate_range[0], search_gate_range[1]};
+                    query_open(search, &condition, search_gated ? &gate : NULL, &ingest->store,
+                               viewing ? viewer : NULL, INT64_MIN);
+                    searching = true;
+                    search_found = 0;
+                    search_page = 0;
+                }
+                if(searching) {
+                    if(search_found < search_max_results) {
+                        search_found += query_next(search, search_results + search_found,
+                                                   search_max_results - search_found);
+                    }
+                    // One step per frame until it is done
+                    if(!query_finished(search) && search_found < search_max_results) {
+                        frame_scheduler_animate(scheduler, frame_ns, 0);
+                    }
+                    ImGui::Text("%d matches%s, %llu chunks ruled out by their zone maps, %llu read", search_found,
+                                query_finished(search) || search_found == search_max_results ? "" : " so far",
+                                (unsigned long long)(search->scan.chunks_skipped + search->gate.chunks_skipped),
+                                (unsigned long long)(search->scan.chunks_scanned + search->gate.chunks_scanned));
+                    int page_count = (search_found + search_page_size - 1) / search_page_size;
+                    ImGui::BeginDisabled(search_page == 0);
+                    if(ImGui::Button("Previous")) {
+                        search_page--;
+                    }
+                    ImGui::EndDisabled();
+                    ImGui::SameLine();
+                    ImGui::BeginDisabled(search_page + 1 >= page_count);
+                    if(ImGui::Button("Next")) {
+                        search_page++;
+                    }
+                    ImGui::EndDisabled();
+                    ImGui::SameLine();
+                    ImGui::Text("Page %d of %d", page_count ? search_page + 1 : 0, page_count);
+                    for(int i = search_page * search_page_size;
+                        i < search_found && i < (search_page + 1) * search_page_size; i++) {
+                        query_match *match = &search_results[i];
+                        if(match->end_us == match->start_us) {
+                            ImGui::Text("%.6f s: %.3f", match->start_us / 1e6, match->value);
+                        } else {
+                            ImGui::Text("%.6f s to %.6f s", match->start_us / 1e6, match->end_us / 1e6);
+                        }
+                    }
+                }
+
+                ImGui::SeparatorText("Spectrum");
+                bool spectrum_changed = ImGui::Checkbox("Analyse", &spectrum_config.enabled);
+                spectrum_changed |= ImGui::InputInt2("Spectrum device, channel", spectrum_channel);
+                spectrum_changed |= ImGui::SliderInt("Points (log2)", &spectrum_config.log2_size, 10, FFT_MAX_LOG2);
+                spectrum_changed |= ImGui::Combo("Window", &spectrum_config.window,
+                                                 "Rectangular\0Hann\0Blackman\0Flat-top\0");
+                spectrum_changed |= ImGui::SliderFloat("Overlap", &spectrum_config.overlap, 0.0f, 0.9f, "%.2f");
+                spectrum_changed |= ImGui::SliderFloat("Span (s)", &spectrum_span_s, 0.1f, 60.0f, "%.1f",
+                                                       ImGuiSliderFlags_Logarithmic);
+                spectrum_changed |= ImGui::Checkbox("dB", &spectrum_config.decibels);
+                if(spectrum_changed && spectrum_started) {
+                    spectrum_config.channel_id = device_channel_id(spectrum_channel[0], spectrum_channel[1]);
+                    spectrum_config.span_us = (int64_t)(spectrum_span_s * 1e6f);
+                    fft_configure(spectrum_worker, 0, &spectrum_config);
+                }
+                const fft_spectrum *spectrum = spectrum_started ? fft_read(spectrum_worker, 0) : NULL;
+                if(spectrum_config.enabled) {
+                    frame_scheduler_watch(scheduler, spectrum_config.channel_id);
+                }
+                if(spectrum_config.enabled && spectrum && spectrum->bin_count) {
+                    ImGui::Text("%d points, %s window, %d segments over %.2f s, %.3f Hz per bin", spectrum->size,
+                                fft_window_name(spectrum->window), spectrum->segments,
+                                (spectrum->last_us - spectrum->first_us) / 1e6, spectrum->bin_hz);
+                    ImGui::PlotLines("##spectrum", spectrum->magnitudes, spectrum->bin_count, 0,
+                                     spectrum->decibels ? "dB" : NULL, FLT_MAX, FLT_MAX, ImVec2(-1.0f, 200.0f));
+                }
+
+                ImGui::SeparatorText("Derived channels");
+                ImGui::InputText("Expression", derived_source, sizeof(derived_source));
+                if(ImGui::Button("Add") && ingest_started) {
+                    int slot = ingest_add_derived(ingest, derived_source, derived_error, sizeof(derived_error));
+                    if(slot >= 0) {
+                        snprintf(derived_sources[slot], DERIVED_MAX_SOURCE, "%s", derived_source);
+                    }
+                }
+                if(derived_error[0]) {
+                    ImGui::SameLine();
+                    ImGui::Text("%s", derived_error);
+                }
+                for(int i = 0; i < DERIVED_MAX_CHANNELS; i++) {
+                    if(!derived_sources[i][0]) {
+                        continue;
+                    }
+                    ImGui::PushID(i);
+                    ImGui::Text("Device %d channel %d = %s", DERIVED_DEVICE, i, derived_sources[i]);
+                    ImGui::SameLine();
+                    if(ImGui::Button("Remove")) {
+                        ingest_remove_derived(ingest, i);
+                        derived_sources[i][0] = 0;
+                    }
+                    ImGui::PopID();
+                }
+
+                ImGui::SeparatorText("Alarms");
+                ImGui::InputText("Name", alarm_form.name, sizeof(alarm_form.name));
+                ImGui::InputInt2("Alarm device, channel", alarm_channel);
+                ImGui::Combo("Alarm when", &alarm_form.kind, "Above high\0Below low\0Outside low to high\0");
+                ImGui::InputFloat2("Low, high", &alarm_form.low);
+                ImGui::InputFloat("Hysteresis", &alarm_form.hysteresis);
+                ImGui::InputInt("Debounce (ms)", &alarm_debounce_ms);
+                if(ImGui::Button("Add alarm") && ingest_started) {
+                    alarm_form.channel_id = device_channel_id(alarm_channel[0], alarm_channel[1]);
+                    alarm_form.debounce_us = (int64_t)alarm_debounce_ms * 1000;
+                    int slot = ingest_add_alarm(ingest, &alarm_form);
+                    if(slot >= 0) {
+                        alarm_rules[slot] = alarm_form;
+                        alarm_used[slot] = true;
+                        alarm_raised[slot] = false;
+                    }
+                }
+                for(int i = 0; i < ALARM_MAX_RULES; i++) {
+                    if(!alarm_used[i]) {
+                        continue;
+                    }
+                    ImGui::PushID(i);
+                    const alarm_rule *rule = &alarm_rules[i];
+                    frame_scheduler_watch(scheduler, device_channel_id(ALARM_DEVICE, i));
+                    ImGui::Text("%s %s: device %d channel %d, state on device %d channel %d", rule->name,
+                                alarm_raised[i] ? "RAISED" : "clear", device_channel_device(rule->channel_id),
+                                device_channel_channel(rule->channel_id), ALARM_DEVICE, i);
+                    ImGui::SameLine();
+                    if(ImGui::Button("Remove")) {
+                        ingest_remove_alarm(ingest, i);
+                        alarm_used[i] = false;
+                    }
+                    ImGui::PopID();
+                }
+                if(alarm_events) {
+                    ImGui::Text("%llu events, pushed to shown avg %.1f ms, max %.1f ms",
+                                (unsigned long long)alarm_events, alarm_latency_total_ns / 1e6 / alarm_events,
+                                alarm_latency_max_ns / 1e6);
+                }
+                for(uint64_t i = 0; i < alarm_events && i < (uint64_t)alarm_log_size; i++) {
+                    const alarm_event *event = &alarm_log[(alarm_events - 1 - i) % alarm_log_size];
+                    ImGui::Text("%.6f s: %s %s at %.3f", event->timestamp_us / 1e6, alarm_rules[event->rule].name,
+                                event->raised ? "raised" : "cleared", event->value);
+                }
+
+                ImGui::SeparatorText("Logic analyzer");
+                ImGui::InputText("Lane name", logic_form.name, sizeof(logic_form.name));
+                ImGui::InputInt2("Lane device, channel", logic_channel);
+                ImGui::InputFloat("Lane threshold", &logic_form.threshold);
+                ImGui::Checkbox("Bus", &logic_form.bus);
+                ImGui::SameLine();
+                if(ImGui::Button("Add lane")) {
+                    logic_form.channel_id = device_channel_id(logic_channel[0], logic_channel[1]);
+                    logic_add_lane(logic, &logic_form);
+                }
+                ImGui::SameLine();
+                ImGui::Checkbox("Follow", &logic->follow);
+                for(int i = 0; i < logic->lane_count; i++) {
+                    ImGui::PushID(i);
+                    if(i % 8) {
+                        ImGui::SameLine();
+                    }
+                    if(ImGui::SmallButton(logic->lanes[i].name)) {
+                        logic_remove_lane(logic, i);
+                    }
+                    ImGui::SetItemTooltip("Remove the lane");
+                    ImGui::PopID();
+                }
+                if(logic->lane_count && ingest_started) {
+                    for(int i = 0; i < logic->lane_count; i++) {
+                        frame_scheduler_watch(scheduler, logic->lanes[i].channel_id);
+                    }
+                    if(logic->follow) {
+                        logic_view_follow(logic, &ingest->store, viewing ? viewer : NULL);
+                    }
+                    logic_view_draw(logic, &ingest->store, viewing ? viewer : NULL, ImGui::GetContentRegionAvail().x);
+                    ImGui::Text("%d runs, %d vertices", logic->run_count, logic->vertex_count);
+                }
+
+                ImGui::SeparatorText("Plot");
+                ImGui::InputInt2("Plot device, channel", plot_channel);
+                if(ImGui::Button("Add series") && plot_channel_count < PLOT_MAX_SERIES) {
+                    plot_series *added = &plot_channels[plot_channel_count];
+                    snprintf(plot_names[plot_channel_count], 32, "Device %d channel %d", plot_channel[0],
+                             plot_channel[1]);
+                    added->name = plot_names[plot_channel_count];
+                    added->color = plot_colors[plot_channel_count];
+                    added->format = plot_format_channel;
+                    added->channel_id = device_channel_id(plot_channel[0], plot_channel[1]);
+                    plot_channel_count++;
+                    plot->fit = true;
+                }
+                ImGui::SameLine();
+                if(ImGui::Button("Clear series")) {
+                    plot_channel_count = 0;
+                }
+                ImGui::SameLine();
+                ImGui::Checkbox("Follow##plot", &plot->follow);
+                if(plot_channel_count && ingest_started) {
+                    for(int i = 0; i < plot_channel_count; i++) {
+                        plot_channels[i].store = &ingest->store;
+                        plot_channels[i].capture = viewing ? viewer : NULL;
+                        frame_scheduler_watch(scheduler, plot_channels[i].channel_id);
+                    }
+                    plot_draw(plot, plot_channels, plot_channel_count,
+                              ImVec2(ImGui::GetContentRegionAvail().x, 300.0f), plot_builders);
+                    ImGui::Text("%d vertices, wheel zooms, with shift the values, double click fits",
+                                plot->vertex_count);
+                }
+
+                // Further devices run as sessions of their own, their channels show up next to the first one's
+                ImGui::SeparatorText("Devices");
+                for(int i = 1; i < connection_manager_device_count(&connection); i++) {
+                    ImGui::PushID(i);
+                    int state = connection_manager_state(&connection, i);
+                    ImGui::Text("Device %d: %s", i, connection_state_name(state));
+                    ImGui::SameLine();
+                    if(state == connection_state_connected && ImGui::Button("Subscribe to all") && 
+                       connection_manager_schema(&connection, i, schema)) {
+                        uint16_t channel_ids[SUBSCRIPTION_MAX_CHANNELS];
+                        int channel_count = 0;
+                        for(int j = 0; j < schema->channel_count && channel_count < SUBSCRIPTION_MAX_CHANNELS; j++) {
+                            channel_ids[channel_count++] = schema->channels[j].channel_id;
+                        }
+                        connection_manager_subscribe(&connection, i, channel_ids, channel_count, 1000);
+                    }
+                    ImGui::SameLine();
+                    if(ImGui::Button("Disconnect")) {
+                        connection_manager_cancel(&connection, i);
+                    }
+                    ImGui::PopID();
+                }
+                ImGui::InputTextWithHint("other_ip_address_input", "IPv4: 192.168.0.2", other_ip_address,
+                                         sizeof(other_ip_address), ImGuiInputTextFlags_CharsDecimal);
+                ImGui::SameLine();
+                ImGui::InputTextWithHint("other_port_input", "Port: 7777", other_port, sizeof(other_port),
+                                         ImGuiInputTextFlags_CharsDecimal);
+                if(ImGui::Button("Add device")) {
+                    int other_device = connection_manager_add_device(&connection);
+                    if(other_device >= 0) {
+                        connection_manager_connect(&connection, other_device, other_ip_address, other_port,
+                                                   DEFAULT_CONNECT_TIMEOUT_MS);
+                    }
+                }
+                ImGui::End();
             } break;
 
             case window_state_custom_1: {
@@ -141,41 +721,93 @@ int WINAPI wWinMain(HINSTANCE h_instance, HINSTANCE h_prev_instance, PWSTR p_cmd
             } break;
         }
 
-        ImGui::ShowDemoWindow();
-
-        ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove 
-                               | ImGuiWindowFlags_NoSavedSettings;
-        ImGuiViewport *viewport = ImGui::GetMainViewport();
-        ImGui::SetNextWindowPos(viewport->WorkPos);
-        ImGui::SetNextWindowSize(viewport->WorkSize);
-        ImGui::Begin("Connect Window", NULL);
-        ImGui::Text("Server address:");
-        ImGui::InputTextWithHint("ip_address_input", "IPv4: 192.168.0.1", ip_address, sizeof(ip_address), 
-                                 ImGuiInputTextFlags_CharsDecimal);
-        ImGui::SameLine();
-        ImGui::InputTextWithHint("port_input", "Port: 7777", port, sizeof(port), ImGuiInputTextFlags_CharsDecimal);
-
-        ImGui::Text("%s : %s", ip_address, port);
-
-        ImGui::End();
+        // The caret blinks and tooltips show up after a delay, without any input
+        if(io.WantTextInput && io.ConfigInputTextCursorBlink) {
+            frame_scheduler_animate(scheduler, frame_ns, 200000000ULL);
+        }
+        ImGuiID hovered = ImGui::GetHoveredID();
+        if(hovered && hovered != last_hovered) {
+            ImGuiStyle &style = ImGui::GetStyle();
+            frame_scheduler_animate(scheduler, frame_ns,
+                                    (uint64_t)((style.HoverStationaryDelay + style.HoverDelayNormal) * 1e9f));
+        }
+        last_hovered = hovered;
 
         // Rendering
         ImGui::Render();
-        d3d_device_context->OMSetRenderTargets(1, &main_rtv, nullptr);
-        d3d_device_context->ClearRenderTargetView(main_rtv, clear_color);
-        ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
-
-        HRESULT hr = swap_chain->Present(1, 0);
-        swap_chain_occluded = (hr == DXGI_STATUS_OCCLUDED);
+        plot_workers_finish(plot_builders, ImGui::GetDrawData());
+        if(!draw_hash_unchanged(presented, ImGui::GetDrawData())) {
+            d3d_device_context->OMSetRenderTargets(1, &main_rtv, nullptr);
+            d3d_device_context->ClearRenderTargetView(main_rtv, clear_color);
+            ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
+
+            HRESULT hr = swap_chain->Present(1, 0);
+            swap_chain_occluded = (hr == DXGI_STATUS_OCCLUDED);
+            // Nothing of it made it to the screen
+            if(swap_chain_occluded) {
+                draw_hash_invalidate(presented);
+            }
+        }
+        frame_scheduler_end(scheduler);
     }
 
     // Cleanup
+    plot_workers_stop(plot_builders);
     ImGui_ImplDX11_Shutdown();
     ImGui_ImplWin32_Shutdown();
     ImGui::DestroyContext();
 
     cleanup_device_d3d();
 
+    if(connection_started) {
+        connection_manager_stop(&connection);
+    }
+    if(replaying) {
+        replay_stop(replayer);
+    }
+    if(recording) {
+        ingest_set_capture(ingest, NULL);
+        capture_writer_stop(capture);
+    }
+    // Reads the store, which goes with the pipeline
+    if(spectrum_started) {
+        fft_worker_stop(spectrum_worker);
+    }
+    if(ingest_started) {
+        ingest_pipeline_stop(ingest);
+    }
+    free(ingest);
+    if(discovery_started) {
+        discovery_stop(disc);
+    }
+    free(disc);
+    free(found_devices);
+    free(snapshot);
+    free(schema);
+    free(capture);
+    free(capture_channels);
+    if(viewing) {
+        capture_view_close(viewer);
+    }
+    free(viewer);
+    free(replayer);
+    free(search);
+    free(search_results);
+    free(spectrum_worker);
+    free(derived_sources);
+    free(alarm_rules);
+    free(alarm_used);
+    free(alarm_raised);
+    free(alarm_log);
+    free(logic);
+    plot_view_free(plot);
+    free(plot);
+    free(plot_channels);
+    free(plot_names);
+    free(plot_builders);
+    frame_scheduler_destroy(scheduler);
+    free(scheduler);
+    free(presented);
     WSACleanup();
     network_cleanup();
 
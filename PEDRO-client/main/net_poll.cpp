@@ -0,0 +1,261 @@
+// Readiness notification for non-blocking sockets.
+// epoll on Linux, WSAPoll on Windows, both behind the same net_poller interface.
+
+#ifndef _WIN32
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+// Enough for every device session with all of its connect attempts
+#define NET_POLL_MAX_SOCKETS 320
+
+enum net_event {
+    net_event_none = 0,
+    net_event_read = 1 << 0,
+    net_event_write = 1 << 1,
+    net_event_error = 1 << 2
+};
+
+typedef struct {
+    SOCKET socket;
+    uint32_t events;
+    void *user_data;
+} net_poll_event;
+
+typedef struct {
+#ifdef _WIN32
+    WSAPOLLFD fds[NET_POLL_MAX_SOCKETS + 1];
+    void *user_data[NET_POLL_MAX_SOCKETS + 1];
+    int count;
+    // WSAPoll can't wait on an event, so a loopback UDP socket that sends to itself is used for waking up
+    SOCKET wake_socket;
+    struct sockaddr_in wake_address;
+#else
+    int epoll_fd;
+    int wake_fd;
+#endif
+} net_poller;
+
+int net_last_error() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+bool net_error_would_block(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS;
+#else
+    return error == EWOULDBLOCK || error == EAGAIN || error == EINPROGRESS;
+#endif
+}
+
+bool net_set_nonblocking(SOCKET socket) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(socket, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+void net_set_nodelay(SOCKET socket) {
+    int enable = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&enable, sizeof(enable));
+}
+
+// Pending error of a socket, used to find out how a non-blocking connect ended
+int net_socket_error(SOCKET socket) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if(getsockopt(socket, SOL_SOCKET, SO_ERROR, (char *)&error, &length) != 0) {
+        return net_last_error();
+    }
+    return error;
+}
+
+#ifdef _WIN32
+short net_events_to_poll(uint32_t events) {
+    short poll_events = 0;
+    if(events & net_event_read) poll_events |= POLLRDNORM;
+    if(events & net_event_write) poll_events |= POLLWRNORM;
+    return poll_events;
+}
+
+int net_poller_find(net_poller *poller, SOCKET socket) {
+    for(int i = 1; i < poller->count; i++) {
+        if(poller->fds[i].fd == socket) {
+            return i;
+        }
+    }
+    return -1;
+}
+#else
+uint32_t net_events_to_epoll(uint32_t events) {
+    uint32_t epoll_events = 0;
+    if(events & net_event_read) epoll_events |= EPOLLIN;
+    if(events & net_event_write) epoll_events |= EPOLLOUT;
+    return epoll_events;
+}
+#endif
+
+bool net_poller_init(net_poller *poller) {
+    memset(poller, 0, sizeof(*poller));
+#ifdef _WIN32
+    poller->wake_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(poller->wake_socket == INVALID_SOCKET) {
+        return false;
+    }
+    poller->wake_address.sin_family = AF_INET;
+    poller->wake_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    poller->wake_address.sin_port = 0;
+    int length = sizeof(poller->wake_address);
+    if(bind(poller->wake_socket, (struct sockaddr *)&poller->wake_address, length) != 0 ||
+       getsockname(poller->wake_socket, (struct sockaddr *)&poller->wake_address, &length) != 0) {
+        closesocket(poller->wake_socket);
+        return false;
+    }
+    net_set_nonblocking(poller->wake_socket);
+    poller->fds[0].fd = poller->wake_socket;
+    poller->fds[0].events = POLLRDNORM;
+    poller->count = 1;
+    return true;
+#else
+    poller->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    poller->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(poller->epoll_fd < 0 || poller->wake_fd < 0) {
+        if(poller->epoll_fd >= 0) close(poller->epoll_fd);
+        if(poller->wake_fd >= 0) close(poller->wake_fd);
+        return false;
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, poller->wake_fd, &event);
+    return true;
+#endif
+}
+
+void net_poller_destroy(net_poller *poller) {
+#ifdef _WIN32
+    closesocket(poller->wake_socket);
+#else
+    close(poller->wake_fd);
+    close(poller->epoll_fd);
+#endif
+}
+
+// user_data must not be NULL, NULL is reserved for the wake up notification
+bool net_poller_add(net_poller *poller, SOCKET socket, uint32_t events, void *user_data) {
+#ifdef _WIN32
+    if(poller->count >= (int)array_count(poller->fds)) {
+        return false;
+    }
+    poller->fds[poller->count].fd = socket;
+    poller->fds[poller->count].events = net_events_to_poll(events);
+    poller->fds[poller->count].revents = 0;
+    poller->user_data[poller->count] = user_data;
+    poller->count++;
+    return true;
+#else
+    struct epoll_event event = {};
+    event.events = net_events_to_epoll(events);
+    event.data.ptr = user_data;
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, socket, &event) == 0;
+#endif
+}
+
+bool net_poller_modify(net_poller *poller, SOCKET socket, uint32_t events, void *user_data) {
+#ifdef _WIN32
+    int index = net_poller_find(poller, socket);
+    if(index < 0) {
+        return false;
+    }
+    poller->fds[index].events = net_events_to_poll(events);
+    poller->user_data[index] = user_data;
+    return true;
+#else
+    struct epoll_event event = {};
+    event.events = net_events_to_epoll(events);
+    event.data.ptr = user_data;
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_MOD, socket, &event) == 0;
+#endif
+}
+
+void net_poller_remove(net_poller *poller, SOCKET socket) {
+#ifdef _WIN32
+    int index = net_poller_find(poller, socket);
+    if(index >= 0) {
+        poller->count--;
+        poller->fds[index] = poller->fds[poller->count];
+        poller->user_data[index] = poller->user_data[poller->count];
+    }
+#else
+    epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, socket, NULL);
+#endif
+}
+
+// Makes a blocked net_poller_wait return, safe to call from any thread
+void net_poller_wake(net_poller *poller) {
+#ifdef _WIN32
+    char byte = 0;
+    sendto(poller->wake_socket, &byte, 1, 0, (struct sockaddr *)&poller->wake_address, sizeof(poller->wake_address));
+#else
+    uint64_t value = 1;
+    ssize_t result = write(poller->wake_fd, &value, sizeof(value));
+    (void)result;
+#endif
+}
+
+// Returns the number of events written, wake ups are consumed here and not reported
+int net_poller_wait(net_poller *poller, net_poll_event *events, int max_events, int timeout_ms) {
+    int event_count = 0;
+#ifdef _WIN32
+    int result = WSAPoll(poller->fds, poller->count, timeout_ms);
+    if(result <= 0) {
+        return 0;
+    }
+    if(poller->fds[0].revents) {
+        char drain[64];
+        while(recv(poller->wake_socket, drain, sizeof(drain), 0) > 0) {}
+    }
+    for(int i = 1; i < poller->count && event_count < max_events; i++) {
+        short revents = poller->fds[i].revents;
+        if(revents == 0) {
+            continue;
+        }
+        net_poll_event *event = &events[event_count++];
+        event->socket = poller->fds[i].fd;
+        event->user_data = poller->user_data[i];
+        event->events = 0;
+        if(revents & (POLLRDNORM | POLLHUP)) event->events |= net_event_read;
+        if(revents & POLLWRNORM) event->events |= net_event_write;
+        if(revents & (POLLERR | POLLNVAL)) event->events |= net_event_error;
+    }
+#else
+    struct epoll_event epoll_events[NET_POLL_MAX_SOCKETS];
+    if(max_events > NET_POLL_MAX_SOCKETS) {
+        max_events = NET_POLL_MAX_SOCKETS;
+    }
+    int result = epoll_wait(poller->epoll_fd, epoll_events, max_events, timeout_ms);
+    for(int i = 0; i < result; i++) {
+        if(epoll_events[i].data.ptr == NULL) {
+            uint64_t value;
+            ssize_t drained = read(poller->wake_fd, &value, sizeof(value));
+            (void)drained;
+            continue;
+        }
+        net_poll_event *event = &events[event_count++];
+        event->socket = INVALID_SOCKET;
+        event->user_data = epoll_events[i].data.ptr;
+        event->events = 0;
+        if(epoll_events[i].events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) event->events |= net_event_read;
+        if(epoll_events[i].events & EPOLLOUT) event->events |= net_event_write;
+        if(epoll_events[i].events & EPOLLERR) event->events |= net_event_error;
+    }
+#endif
+    return event_count;
+}
@@ -1,14 +1,101 @@
-#include <Winsock2.h>
-#include <ws2tcpip.h>
-
 #define DEFAULT_IP "192.168.4.1"
 #define DEFAULT_PORT "7777"
 
+// Same numbering as the msg_type on the server
+enum message_type {
+    message_type_default = 0,
+    message_type_data_request = 1,
+    message_type_data_input = 2,
+    message_type_schema_request = 3,
+    message_type_schema = 4,
+    message_type_subscribe = 5,
+    message_type_sample_batch = 6,
+    message_type_history_request = 7,
+    message_type_keepalive = 8,
+    message_type_restart = 14,
+    message_type_shutdown = 15
+};
+
+enum sample_format {
+    sample_format_u8 = 0,
+    sample_format_i16 = 1,
+    sample_format_i32 = 2,
+    sample_format_f32 = 3
+};
+
+enum sample_block_flags {
+    // The values are big-endian, for samples passed through as the sensor sent them
+    sample_block_flag_big_endian = 0x01
+};
+
+// Every message on the wire starts with a frame_header, so a stream can be cut back into messages.
+// Everything is little-endian, same as both the ESP32 and x86, apart from sample values flagged otherwise.
+#pragma pack(push, 1)
+typedef struct {
+    uint16_t payload_length;
+    uint8_t message_type;
+    uint8_t flags;
+    uint32_t sequence;
+} frame_header;
+
+// A sample_batch payload is a list of these, each followed by sample_count values of sample_format.
+// Sample i was taken at first_timestamp_us + i * sample_period_us.
+typedef struct {
+    uint16_t channel_id;
+    uint16_t sample_count;
+    uint8_t sample_format;
+    // sample_block_flags
+    uint8_t flags;
+    uint8_t reserved[2];
+    uint64_t first_timestamp_us;
+    uint32_t sample_period_us;
+} sample_block_header;
+
+// A schema payload is a uint16_t channel count followed by this for every channel
+typedef struct {
+    uint16_t channel_id;
+    uint8_t sample_format;
+    uint8_t reserved;
+    float scale;
+    float offset;
+    char name[16];
+} schema_channel;
+
+// Discovery runs over UDP next to the TCP connection. Devices answer probes on DISCOVERY_DEVICE_PORT and
+// broadcast a beacon to DISCOVERY_CLIENT_PORT every DISCOVERY_BEACON_INTERVAL_MS.
+// Probes only need magic, version and kind, the rest is filled in by beacons.
 typedef struct {
-    SOCKET connect_socket;
-    struct addrinfo* server_address;
-    struct addrinfo socket_type;
-} client_socket;
+    uint32_t magic;
+    uint8_t version;
+    uint8_t kind;
+    uint16_t tcp_port;
+    uint8_t device_id[6];
+    uint8_t connected_clients;
+    uint8_t streaming_clients;
+    uint32_t firmware_hash;
+} discovery_packet;
+#pragma pack(pop)
+
+#define DISCOVERY_DEVICE_PORT 7778
+#define DISCOVERY_CLIENT_PORT 7779
+#define DISCOVERY_BEACON_INTERVAL_MS 1000
+#define DISCOVERY_MAGIC 0x4F524450
+#define DISCOVERY_VERSION 1
+
+enum discovery_kind {
+    discovery_kind_probe = 0,
+    discovery_kind_beacon = 1
+};
+
+#define FRAME_MAX_PAYLOAD 65535
+#define SCHEMA_MAX_CHANNELS 64
+
+// What the device can send, values are converted to engineering units with value * scale + offset
+typedef struct {
+    int channel_count;
+    schema_channel channels[SCHEMA_MAX_CHANNELS];
+    uint32_t hash;
+} device_schema;
 
 typedef struct {
     char *buffer;
@@ -19,107 +106,132 @@ typedef struct {
     char message_type;
 } tcp_message;
 
-client_socket create_socket() {
-    int result = 0;
-    client_socket client = {};
-    client.socket_type.ai_family = AF_INET;
-    client.socket_type.ai_socktype = SOCK_STREAM;
-    client.socket_type.ai_protocol = IPPROTO_TCP;
-
-    client.connect_socket = INVALID_SOCKET;
-
-    result = getaddrinfo(DEFAULT_IP, DEFAULT_PORT, &client.socket_type, &client.server_address);
-    if(result != 0) {
-        return client;
+int sample_format_size(int format) {
+    switch(format) {
+        case sample_format_u8: return 1;
+        case sample_format_i16: return 2;
+        case sample_format_i32: return 4;
+        case sample_format_f32: return 4;
+        default: return 0;
     }
+}
 
-    client.connect_socket = socket(client.server_address->ai_family, client.server_address->ai_socktype, 
-                                    client.server_address->ai_protocol);
-
-    if(client.connect_socket == INVALID_SOCKET) {
-        // Failed to create a socket
-        // Use WSAGetLastError
-        freeaddrinfo(client.server_address);
-        return client;
+// Starts a new frame in the message buffer, the payload is appended with frame_write
+bool frame_begin(tcp_message *message, char message_type) {
+    message->message_type = message_type;
+    message->bytes_to_transmit = 0;
+    message->transmitted_bytes = 0;
+    if(message->buffer_length < (int)sizeof(frame_header)) {
+        return false;
     }
-
-    return client;
+    frame_header header = {};
+    header.message_type = (uint8_t)message_type;
+    memcpy(message->buffer, &header, sizeof(header));
+    message->bytes_to_transmit = sizeof(header);
+    return true;
 }
 
-void connect_socket(client_socket *client) {
-    int result = 0;
-
-    result = connect(client->connect_socket, client->server_address->ai_addr, (int)(client->server_address->ai_addrlen));
-    if(result == SOCKET_ERROR) {
-        // Failed to connect
-        // Use WSAGetLastError
-        closesocket(client->connect_socket);
-        client->connect_socket = INVALID_SOCKET;
+bool frame_write(tcp_message *message, const void *data, int size) {
+    int payload_length = message->bytes_to_transmit - (int)sizeof(frame_header);
+    if(message->bytes_to_transmit + size > message->buffer_length || payload_length + size > FRAME_MAX_PAYLOAD) {
+        return false;
     }
+    memcpy(message->buffer + message->bytes_to_transmit, data, size);
+    message->bytes_to_transmit += size;
+    return true;
+}
 
-    // This assumes we don't want to step through different server addresses (if there are any)
-    freeaddrinfo(client->server_address);
+void frame_end(tcp_message *message) {
+    uint16_t payload_length = (uint16_t)(message->bytes_to_transmit - sizeof(frame_header));
+    memcpy(message->buffer + offsetof(frame_header, payload_length), &payload_length, sizeof(payload_length));
 }
 
-void send_message(SOCKET connect_socket, tcp_message *message) {
-    int result = 0;
-    result = send(connect_socket, message->buffer, message->bytes_to_transmit, message->flags);
-    if(result < 0) {
-        // Failed to send the message
-        // Use WSAGetLastError
-        message->transmitted_bytes = 0;
-    } else {
-        message->transmitted_bytes = result;
+// Requested data in the format of name (0 delimiter) size (in bytes)
+bool encode_data_request(tcp_message *message, char **data_points, int num_data_points) {
+    if(!frame_begin(message, message_type_data_request)) {
+        return false;
+    }
+    for(int i = 0; i < num_data_points; i++) {
+        // For now setting it as an int
+        char size[2] = {sizeof(int), 0};
+        if(!frame_write(message, data_points[i], (int)strlen(data_points[i]) + 1) ||
+           !frame_write(message, size, sizeof(size))) {
+            message->bytes_to_transmit = 0;
+            return false;
+        }
     }
+    frame_end(message);
+    return true;
 }
 
-void receive_message(SOCKET connect_socket, tcp_message *message) {
-    int result = 0;
-    result = recv(connect_socket, message->buffer, message->buffer_length, message->flags);
-    if(result < 0) {
-        // Failed to receive message
-        // Use WSAGetLastError
-        message->transmitted_bytes = 0;
-    } else {
-        message->transmitted_bytes = result;
+// A subscribe payload is the sample period followed by the requested channel ids
+bool encode_subscribe(tcp_message *message, const uint16_t *channel_ids, int channel_count,
+                      uint32_t sample_period_us) {
+    if(!frame_begin(message, message_type_subscribe) ||
+       !frame_write(message, &sample_period_us, sizeof(sample_period_us)) ||
+       !frame_write(message, channel_ids, channel_count * (int)sizeof(uint16_t))) {
+        message->bytes_to_transmit = 0;
+        return false;
     }
+    frame_end(message);
+    return true;
 }
 
-void disconnect_socket(SOCKET connect_socket) {
-    closesocket(connect_socket);
+// Asks the device to resend everything it still has in its history ring from since_timestamp_us on
+bool encode_history_request(tcp_message *message, uint64_t since_timestamp_us) {
+    if(!frame_begin(message, message_type_history_request) ||
+       !frame_write(message, &since_timestamp_us, sizeof(since_timestamp_us))) {
+        message->bytes_to_transmit = 0;
+        return false;
+    }
+    frame_end(message);
+    return true;
 }
 
-void send_data_request(SOCKET connect_socket, tcp_message *message, char **data_points, int num_data_points) {
-    message->message_type = 1;
-
-    message->bytes_to_transmit = 1;
-    for(int i = 0; i < num_data_points; i++) {
-        message->bytes_to_transmit += strlen(data_points[i]) + 1;
-        message->bytes_to_transmit += 2;
+// Frames without a payload, like keepalive and schema_request
+bool encode_empty(tcp_message *message, char message_type) {
+    if(!frame_begin(message, message_type)) {
+        return false;
     }
+    frame_end(message);
+    return true;
+}
 
-    if(message->buffer_length < message->bytes_to_transmit) {
-        // Debug info
-        message->bytes_to_transmit = 0;
+// FNV-1a, only used to tell whether a schema changed
+uint32_t hash_bytes(const void *data, int length, uint32_t hash = 2166136261u) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for(int i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
     }
+    return hash;
+}
 
-    if(message->bytes_to_transmit > 0) {
-        message->buffer[0] = message->message_type;
-
-        int offset = 1;
-        for(int i = 0; i < num_data_points; i++) {
-            strcpy(message->buffer + offset, data_points[i]);
-            offset += strlen(data_points[i]) + 1;
-
-            // For now setting it as an int
-            *(message->buffer + offset) = sizeof(int);
-            *(message->buffer + offset + 1) = 0;
-            offset += 2;
-        }
+bool decode_schema(const char *payload, int length, device_schema *schema) {
+    uint16_t channel_count;
+    if(length < (int)sizeof(channel_count)) {
+        return false;
+    }
+    memcpy(&channel_count, payload, sizeof(channel_count));
+    if(channel_count > SCHEMA_MAX_CHANNELS ||
+       length < (int)(sizeof(channel_count) + channel_count * sizeof(schema_channel))) {
+        return false;
     }
+    schema->channel_count = channel_count;
+    memcpy(schema->channels, payload + sizeof(channel_count), channel_count * sizeof(schema_channel));
+    for(int i = 0; i < channel_count; i++) {
+        schema->channels[i].name[sizeof(schema->channels[i].name) - 1] = 0;
+    }
+    schema->hash = hash_bytes(payload, (int)(sizeof(channel_count) + channel_count * sizeof(schema_channel)));
+    return true;
+}
 
-    // Send the message
-    send_message(connect_socket, message);
+// Returns true when data starts with a complete frame, whose header is copied out
+bool frame_peek(const char *data, int length, frame_header *header) {
+    if(length < (int)sizeof(frame_header)) {
+        return false;
+    }
+    memcpy(header, data, sizeof(frame_header));
+    return length >= (int)sizeof(frame_header) + header->payload_length;
 }
 
-void network_cleanup() {}
\ No newline at end of file
+void network_cleanup() {}
@@ -0,0 +1,498 @@
+// Small OS layer so that everything apart from the window/renderer can be built on Windows
+// as well as headless on Linux.
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define closesocket close
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <atomic>
+#include <new>
+
+#define kilobytes(x) ((x) * 1024LL)
+#define megabytes(x) (kilobytes(x) * 1024LL)
+#define array_count(x) (sizeof(x) / sizeof((x)[0]))
+
+typedef void (*platform_thread_proc)(void *parameters);
+
+typedef struct {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    platform_thread_proc proc;
+    void *parameters;
+} platform_thread;
+
+typedef struct {
+#ifdef _WIN32
+    CRITICAL_SECTION section;
+#else
+    pthread_mutex_t mutex;
+#endif
+} platform_mutex;
+
+// Auto-reset event, used to wake up a consumer thread without spinning
+typedef struct {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    bool signaled;
+#endif
+} platform_event;
+
+typedef struct {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int fd;
+#endif
+} platform_file;
+
+// Read-only view of a whole file
+typedef struct {
+    const char *data;
+    int64_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+} platform_map;
+
+#ifdef _WIN32
+DWORD WINAPI platform_thread_entry(LPVOID parameters) {
+    platform_thread *thread = (platform_thread *)parameters;
+    thread->proc(thread->parameters);
+    return 0;
+}
+#else
+void *platform_thread_entry(void *parameters) {
+    platform_thread *thread = (platform_thread *)parameters;
+    thread->proc(thread->parameters);
+    return NULL;
+}
+#endif
+
+// The thread struct has to stay alive until the thread has been joined
+bool platform_thread_start(platform_thread *thread, platform_thread_proc proc, void *parameters) {
+    thread->proc = proc;
+    thread->parameters = parameters;
+#ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, platform_thread_entry, thread, 0, NULL);
+    return thread->handle != NULL;
+#else
+    return pthread_create(&thread->handle, NULL, platform_thread_entry, thread) == 0;
+#endif
+}
+
+void platform_thread_join(platform_thread *thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    thread->handle = NULL;
+#else
+    pthread_join(thread->handle, NULL);
+#endif
+}
+
+void platform_mutex_init(platform_mutex *mutex) {
+#ifdef _WIN32
+    InitializeCriticalSection(&mutex->section);
+#else
+    pthread_mutex_init(&mutex->mutex, NULL);
+#endif
+}
+
+void platform_mutex_destroy(platform_mutex *mutex) {
+#ifdef _WIN32
+    DeleteCriticalSection(&mutex->section);
+#else
+    pthread_mutex_destroy(&mutex->mutex);
+#endif
+}
+
+void platform_mutex_lock(platform_mutex *mutex) {
+#ifdef _WIN32
+    EnterCriticalSection(&mutex->section);
+#else
+    pthread_mutex_lock(&mutex->mutex);
+#endif
+}
+
+void platform_mutex_unlock(platform_mutex *mutex) {
+#ifdef _WIN32
+    LeaveCriticalSection(&mutex->section);
+#else
+    pthread_mutex_unlock(&mutex->mutex);
+#endif
+}
+
+// Monotonic time in nanoseconds, only meaningful as a difference
+uint64_t platform_time_ns() {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency = {};
+    if(frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+    uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1000000000ULL + (remainder * 1000000000ULL) / frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
+
+// CPU time a thread has used so far, user and kernel
+uint64_t platform_thread_cpu_ns(platform_thread *thread) {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if(!GetThreadTimes(thread->handle, &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    uint64_t kernel_100ns = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t user_100ns = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (kernel_100ns + user_100ns) * 100;
+#else
+    clockid_t clock;
+    struct timespec used;
+    if(pthread_getcpuclockid(thread->handle, &clock) != 0 || clock_gettime(clock, &used) != 0) {
+        return 0;
+    }
+    return (uint64_t)used.tv_sec * 1000000000ULL + (uint64_t)used.tv_nsec;
+#endif
+}
+
+// Gives the rest of the time slice to another thread, for waiting on one that is mid-write
+void platform_yield() {
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+// Logical processors the process can run on, at least 1
+int platform_cpu_count() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+// Instruction sets that are picked at runtime, false on anything but x86
+bool platform_cpu_has_sse2() {
+#if defined(_M_X64) || defined(__x86_64__)
+    return true;
+#elif defined(_M_IX86)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#elif defined(__i386__)
+    return __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+// Also checks that the OS saves the AVX registers
+bool platform_cpu_has_avx2() {
+#if defined(_M_X64) || defined(_M_IX86)
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool os_saves_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return os_saves_avx && (info[1] & (1 << 5));
+#elif defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+void platform_sleep_ms(int milliseconds) {
+#ifdef _WIN32
+    Sleep(milliseconds);
+#else
+    struct timespec duration;
+    duration.tv_sec = milliseconds / 1000;
+    duration.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+    nanosleep(&duration, NULL);
+#endif
+}
+
+void platform_event_init(platform_event *event) {
+#ifdef _WIN32
+    event->handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+    pthread_mutex_init(&event->mutex, NULL);
+    pthread_cond_init(&event->condition, NULL);
+    event->signaled = false;
+#endif
+}
+
+void platform_event_destroy(platform_event *event) {
+#ifdef _WIN32
+    CloseHandle(event->handle);
+#else
+    pthread_cond_destroy(&event->condition);
+    pthread_mutex_destroy(&event->mutex);
+#endif
+}
+
+void platform_event_signal(platform_event *event) {
+#ifdef _WIN32
+    SetEvent(event->handle);
+#else
+    pthread_mutex_lock(&event->mutex);
+    event->signaled = true;
+    pthread_cond_signal(&event->condition);
+    pthread_mutex_unlock(&event->mutex);
+#endif
+}
+
+// Returns false on timeout
+bool platform_event_wait(platform_event *event, int timeout_ms) {
+#ifdef _WIN32
+    return WaitForSingleObject(event->handle, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms) == WAIT_OBJECT_0;
+#else
+    pthread_mutex_lock(&event->mutex);
+    if(!event->signaled && timeout_ms != 0) {
+        if(timeout_ms < 0) {
+            while(!event->signaled) {
+                pthread_cond_wait(&event->condition, &event->mutex);
+            }
+        } else {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += timeout_ms / 1000;
+            deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+            if(deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while(!event->signaled) {
+                if(pthread_cond_timedwait(&event->condition, &event->mutex, &deadline) != 0) {
+                    break;
+                }
+            }
+        }
+    }
+    bool signaled = event->signaled;
+    event->signaled = false;
+    pthread_mutex_unlock(&event->mutex);
+    return signaled;
+#endif
+}
+
+// Creates or truncates a file for writing
+bool platform_file_create(platform_file *file, const char *path) {
+#ifdef _WIN32
+    file->handle = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    return file->handle != INVALID_HANDLE_VALUE;
+#else
+    file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    return file->fd >= 0;
+#endif
+}
+
+bool platform_file_open(platform_file *file, const char *path) {
+#ifdef _WIN32
+    file->handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, NULL);
+    return file->handle != INVALID_HANDLE_VALUE;
+#else
+    file->fd = open(path, O_RDONLY);
+    return file->fd >= 0;
+#endif
+}
+
+void platform_file_close(platform_file *file) {
+#ifdef _WIN32
+    CloseHandle(file->handle);
+#else
+    close(file->fd);
+#endif
+}
+
+// Appends all of it or fails
+bool platform_file_write(platform_file *file, const void *data, int64_t size) {
+    const char *bytes = (const char *)data;
+    while(size > 0) {
+#ifdef _WIN32
+        DWORD written;
+        DWORD chunk = size > megabytes(64) ? (DWORD)megabytes(64) : (DWORD)size;
+        if(!WriteFile(file->handle, bytes, chunk, &written, NULL)) {
+            return false;
+        }
+#else
+        ssize_t written = write(file->fd, bytes, size);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+#endif
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Returns once everything written so far is on the disk
+bool platform_file_sync(platform_file *file) {
+#ifdef _WIN32
+    return FlushFileBuffers(file->handle) != 0;
+#else
+    return fsync(file->fd) == 0;
+#endif
+}
+
+// Reads exactly size bytes at offset, false if the file ends before that
+bool platform_file_read(platform_file *file, int64_t offset, void *data, int64_t size) {
+    char *bytes = (char *)data;
+    while(size > 0) {
+#ifdef _WIN32
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD read;
+        DWORD chunk = size > megabytes(64) ? (DWORD)megabytes(64) : (DWORD)size;
+        if(!ReadFile(file->handle, bytes, chunk, &read, &overlapped) || read == 0) {
+            return false;
+        }
+#else
+        ssize_t read = pread(file->fd, bytes, size, offset);
+        if(read < 0 && errno == EINTR) {
+            continue;
+        }
+        if(read <= 0) {
+            return false;
+        }
+#endif
+        bytes += read;
+        offset += read;
+        size -= read;
+    }
+    return true;
+}
+
+int64_t platform_file_size(platform_file *file) {
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    return GetFileSizeEx(file->handle, &size) ? size.QuadPart : -1;
+#else
+    struct stat info;
+    return fstat(file->fd, &info) == 0 ? (int64_t)info.st_size : -1;
+#endif
+}
+
+// Wall clock time in microseconds since 1970
+int64_t platform_unix_time_us() {
+#ifdef _WIN32
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    uint64_t ticks = ((uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime;
+    return (int64_t)(ticks / 10) - 11644473600000000LL;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+#endif
+}
+
+// The whole file is mapped at once, which is why the client is built for x64: a 32 bit process doesn't have a
+// contiguous range of address space for a capture of more than a few hundred MB and fails here.
+bool platform_file_map(platform_file *file, platform_map *map) {
+    map->size = platform_file_size(file);
+    if(map->size <= 0 || (uint64_t)map->size > (uint64_t)SIZE_MAX) {
+        return false;
+    }
+#ifdef _WIN32
+    map->mapping = CreateFileMappingA(file->handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!map->mapping) {
+        return false;
+    }
+    map->data = (const char *)MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!map->data) {
+        CloseHandle(map->mapping);
+        return false;
+    }
+#else
+    void *data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, file->fd, 0);
+    if(data == MAP_FAILED) {
+        return false;
+    }
+    map->data = (const char *)data;
+#endif
+    return true;
+}
+
+void platform_unmap(platform_map *map) {
+#ifdef _WIN32
+    UnmapViewOfFile(map->data);
+    CloseHandle(map->mapping);
+#else
+    munmap((void *)map->data, map->size);
+#endif
+}
+
+// Lets the OS take back the pages of a range, they are read from the file again when touched.
+// Pages the range only partly covers go as well.
+void platform_map_release(platform_map *map, int64_t offset, int64_t size) {
+    const int64_t page_size = 4096;
+    int64_t first = offset & ~(page_size - 1);
+    int64_t last = (offset + size + page_size - 1) & ~(page_size - 1);
+    last = last < map->size ? last : map->size;
+    if(last <= first) {
+        return;
+    }
+#ifdef _WIN32
+    // Unlocking pages that aren't locked takes them out of the working set
+    VirtualUnlock((void *)(map->data + first), last - first);
+#else
+    madvise((void *)(map->data + first), last - first, MADV_DONTNEED);
+#endif
+}
@@ -0,0 +1,812 @@
+// Plots.
+// Series drawn over shared axes with ImDrawList. A series is a contiguous span of floats or 16-bit integers at evenly
+// spaced x, or a channel of the store or of a recording. Every pixel column gets the min and max of the samples
+// under it, with kernels picked at runtime the way decode.cpp does it, in one pass over the visible span, and is
+// drawn as one quad that reaches over to the column before it so the trace stays connected. A frame draws a quad
+// per column and series however many samples there are. Once there are fewer samples than columns they are drawn
+// as a polyline instead. Store and recording channels come as an envelope already, from the pyramid.
+// The wheel zooms x around the pointer, y with shift held, dragging pans and a double click fits the data.
+// With plot_workers, the UI pass only handles input and takes down what the geometry needs. Each plot is then built
+// into a draw list of its own on a worker, and these go into the draw data after ImGui::Render(), each one right
+// after the window it is in, so they keep their place in front of and behind other windows.
+// A plot where nothing changed since the last frame is not drawn again, its last geometry is reused.
+
+#define PLOT_MAX_SERIES 8
+#define PLOT_MAX_PIXELS 4096
+#define PLOT_AXIS_WIDTH 64.0f
+#define PLOT_MAX_WORKERS 16
+#define PLOT_MAX_PANELS 64
+
+enum plot_format {
+    plot_format_f32 = 0,
+    // scale * value + offset
+    plot_format_i16 = 1,
+    // The envelope of a channel of the store, or of the recording if there is one, x in microseconds
+    plot_format_channel = 2
+};
+
+typedef struct {
+    const char *name;
+    ImU32 color;
+    int format;
+    const void *values;
+    int64_t count;
+    // Sample i is at x0 + i * dx
+    double x0;
+    double dx;
+    float scale;
+    float offset;
+    sample_store *store;
+    capture_view *capture;
+    uint32_t channel_id;
+    // Bumped by the owner when values change in place, the plot is only drawn again when something it shows changed
+    uint64_t version;
+} plot_series;
+
+typedef struct {
+    double x_from;
+    double x_to;
+    double y_min;
+    double y_max;
+    // Axis labels are x * x_label_scale
+    double x_label_scale;
+    // Fits the view to the data on the next frame
+    bool fit;
+    // Keeps the newest samples of channels at the right edge
+    bool follow;
+
+    // Per series, a column without samples has min > max
+    float mins[PLOT_MAX_SERIES][PLOT_MAX_PIXELS];
+    float maxs[PLOT_MAX_SERIES][PLOT_MAX_PIXELS];
+    // Where a series has fewer samples than there are columns, its points
+    ImVec2 points[PLOT_MAX_PIXELS + 4];
+    store_envelope_pixel pixels[PLOT_MAX_PIXELS];
+    // Of the last frame
+    int vertex_count;
+    // Last frame's geometry, used again while nothing changed
+    retained_panel retained;
+} plot_view;
+
+typedef void (*plot_minmax_f32_proc)(const float *values, int count, float *min, float *max);
+typedef void (*plot_minmax_i16_proc)(const int16_t *values, int count, int16_t *min, int16_t *max);
+
+typedef struct {
+    const char *name;
+    plot_minmax_f32_proc minmax_f32;
+    plot_minmax_i16_proc minmax_i16;
+} plot_kernels;
+
+// The kernels fold the values into *min and *max, NaNs are skipped
+void plot_minmax_f32_scalar(const float *values, int count, float *min, float *max) {
+    float low = *min;
+    float high = *max;
+    for(int i = 0; i < count; i++) {
+        low = values[i] < low ? values[i] : low;
+        high = values[i] > high ? values[i] : high;
+    }
+    *min = low;
+    *max = high;
+}
+
+void plot_minmax_i16_scalar(const int16_t *values, int count, int16_t *min, int16_t *max) {
+    int16_t low = *min;
+    int16_t high = *max;
+    for(int i = 0; i < count; i++) {
+        low = values[i] < low ? values[i] : low;
+        high = values[i] > high ? values[i] : high;
+    }
+    *min = low;
+    *max = high;
+}
+
+plot_kernels plot_scalar_kernels = {"scalar", plot_minmax_f32_scalar, plot_minmax_i16_scalar};
+
+#ifdef DECODE_X86
+// min(x, m) is x < m ? x : m, so a NaN in x leaves m as it is, same as the scalar code
+DECODE_TARGET_SSE2 void plot_minmax_f32_sse2(const float *values, int count, float *min, float *max) {
+    __m128 mins = _mm_set1_ps(*min);
+    __m128 maxs = _mm_set1_ps(*max);
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(values + i);
+        mins = _mm_min_ps(x, mins);
+        maxs = _mm_max_ps(x, maxs);
+    }
+    float lane_mins[4];
+    float lane_maxs[4];
+    _mm_storeu_ps(lane_mins, mins);
+    _mm_storeu_ps(lane_maxs, maxs);
+    // The min lanes only go into *min and the max lanes into *max, the other side of each is still the sentinel
+    float low = *min;
+    float high = *max;
+    for(int j = 0; j < 4; j++) {
+        low = lane_mins[j] < low ? lane_mins[j] : low;
+        high = lane_maxs[j] > high ? lane_maxs[j] : high;
+    }
+    *min = low;
+    *max = high;
+    plot_minmax_f32_scalar(values + i, count - i, min, max);
+}
+
+DECODE_TARGET_SSE2 void plot_minmax_i16_sse2(const int16_t *values, int count, int16_t *min, int16_t *max) {
+    __m128i mins = _mm_set1_epi16(*min);
+    __m128i maxs = _mm_set1_epi16(*max);
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(values + i));
+        mins = _mm_min_epi16(x, mins);
+        maxs = _mm_max_epi16(x, maxs);
+    }
+    int16_t lane_mins[8];
+    int16_t lane_maxs[8];
+    _mm_storeu_si128((__m128i *)lane_mins, mins);
+    _mm_storeu_si128((__m128i *)lane_maxs, maxs);
+    // The min lanes only go into *min and the max lanes into *max, the other side of each is still the sentinel
+    int16_t low = *min;
+    int16_t high = *max;
+    for(int j = 0; j < 8; j++) {
+        low = lane_mins[j] < low ? lane_mins[j] : low;
+        high = lane_maxs[j] > high ? lane_maxs[j] : high;
+    }
+    *min = low;
+    *max = high;
+    plot_minmax_i16_scalar(values + i, count - i, min, max);
+}
+
+plot_kernels plot_sse2_kernels = {"SSE2", plot_minmax_f32_sse2, plot_minmax_i16_sse2};
+
+// Two sets of accumulators to keep both compare ports busy. The tails are done here, in AVX code, rather than
+// handed to the scalar functions.
+DECODE_TARGET_AVX2 void plot_minmax_f32_avx2(const float *values, int count, float *min, float *max) {
+    __m256 mins[2] = {_mm256_set1_ps(*min), _mm256_set1_ps(*min)};
+    __m256 maxs[2] = {_mm256_set1_ps(*max), _mm256_set1_ps(*max)};
+    int i = 0;
+    for(; i + 16 <= count; i += 16) {
+        __m256 x0 = _mm256_loadu_ps(values + i);
+        __m256 x1 = _mm256_loadu_ps(values + i + 8);
+        mins[0] = _mm256_min_ps(x0, mins[0]);
+        maxs[0] = _mm256_max_ps(x0, maxs[0]);
+        mins[1] = _mm256_min_ps(x1, mins[1]);
+        maxs[1] = _mm256_max_ps(x1, maxs[1]);
+    }
+    float lanes[32];
+    _mm256_storeu_ps(lanes, mins[0]);
+    _mm256_storeu_ps(lanes + 8, mins[1]);
+    _mm256_storeu_ps(lanes + 16, maxs[0]);
+    _mm256_storeu_ps(lanes + 24, maxs[1]);
+    float low = *min;
+    float high = *max;
+    for(int j = 0; j < 16; j++) {
+        low = lanes[j] < low ? lanes[j] : low;
+        high = lanes[16 + j] > high ? lanes[16 + j] : high;
+    }
+    for(; i < count; i++) {
+        low = values[i] < low ? values[i] : low;
+        high = values[i] > high ? values[i] : high;
+    }
+    *min = low;
+    *max = high;
+}
+
+DECODE_TARGET_AVX2 void plot_minmax_i16_avx2(const int16_t *values, int count, int16_t *min, int16_t *max) {
+    __m256i mins = _mm256_set1_epi16(*min);
+    __m256i maxs = _mm256_set1_epi16(*max);
+    int i = 0;
+    for(; i + 16 <= count; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(values + i));
+        mins = _mm256_min_epi16(x, mins);
+        maxs = _mm256_max_epi16(x, maxs);
+    }
+    int16_t lanes[32];
+    _mm256_storeu_si256((__m256i *)lanes, mins);
+    _mm256_storeu_si256((__m256i *)(lanes + 16), maxs);
+    int16_t low = *min;
+    int16_t high = *max;
+    for(int j = 0; j < 16; j++) {
+        low = lanes[j] < low ? lanes[j] : low;
+        high = lanes[16 + j] > high ? lanes[16 + j] : high;
+    }
+    for(; i < count; i++) {
+        low = values[i] < low ? values[i] : low;
+        high = values[i] > high ? values[i] : high;
+    }
+    *min = low;
+    *max = high;
+}
+
+plot_kernels plot_avx2_kernels = {"AVX2", plot_minmax_f32_avx2, plot_minmax_i16_avx2};
+#endif
+
+// Every kernel set this build has, best last
+plot_kernels *plot_kernel_sets[] = {
+    &plot_scalar_kernels,
+#ifdef DECODE_X86
+    &plot_sse2_kernels,
+    &plot_avx2_kernels,
+#endif
+};
+
+bool plot_kernels_supported(const plot_kernels *kernels) {
+#ifdef DECODE_X86
+    if(kernels == &plot_avx2_kernels) {
+        return platform_cpu_has_avx2();
+    }
+    if(kernels == &plot_sse2_kernels) {
+        return platform_cpu_has_sse2();
+    }
+#endif
+    return true;
+}
+
+const plot_kernels *plot_pick_kernels() {
+    for(int i = (int)array_count(plot_kernel_sets) - 1; i > 0; i--) {
+        if(plot_kernels_supported(plot_kernel_sets[i])) {
+            return plot_kernel_sets[i];
+        }
+    }
+    return &plot_scalar_kernels;
+}
+
+const plot_kernels *plot_active_kernels() {
+    static const plot_kernels *kernels = plot_pick_kernels();
+    return kernels;
+}
+
+void plot_view_init(plot_view *view) {
+    view->x_from = 0.0;
+    view->x_to = 1.0;
+    view->y_min = -1.0;
+    view->y_max = 1.0;
+    view->x_label_scale = 1.0;
+    view->fit = true;
+    view->follow = false;
+    view->vertex_count = 0;
+    view->retained.valid = false;
+}
+
+void plot_view_free(plot_view *view) {
+    retained_free(&view->retained);
+}
+
+// First sample at or after x, clamped to the span
+int64_t plot_index_at(const plot_series *series, double x) {
+    double index = ceil((x - series->x0) / series->dx);
+    return index < 0.0 ? 0 : index > (double)series->count ? series->count : (int64_t)index;
+}
+
+// Min and max of every column of a span series over [x_from, x_to), one kernel call per column
+void plot_envelope_span(const plot_kernels *kernels, const plot_series *series, double x_from, double x_to,
+                        int pixel_count, float *mins, float *maxs) {
+    double x_per_pixel = (x_to - x_from) / pixel_count;
+    int64_t first = plot_index_at(series, x_from);
+    for(int x = 0; x < pixel_count; x++) {
+        int64_t last = plot_index_at(series, x_from + (x + 1) * x_per_pixel);
+        int count = (int)(last - first);
+        if(series->format == plot_format_f32) {
+            mins[x] = INFINITY;
+            maxs[x] = -INFINITY;
+            kernels->minmax_f32((const float *)series->values + first, count, &mins[x], &maxs[x]);
+        } else {
+            int16_t low = INT16_MAX;
+            int16_t high = INT16_MIN;
+            kernels->minmax_i16((const int16_t *)series->values + first, count, &low, &high);
+            float a = low * series->scale + series->offset;
+            float b = high * series->scale + series->offset;
+            mins[x] = count ? (a < b ? a : b) : INFINITY;
+            maxs[x] = count ? (a < b ? b : a) : -INFINITY;
+        }
+        first = last;
+    }
+}
+
+// Points of the samples in view and the one on either side, for when there are fewer of them than columns
+int plot_points_span(const plot_series *series, double x_from, double x_to, ImVec2 *points) {
+    int64_t first = plot_index_at(series, x_from);
+    int64_t last = plot_index_at(series, x_to);
+    first = first > 0 ? first - 1 : 0;
+    last = last < series->count ? last + 1 : series->count;
+    int count = 0;
+    for(int64_t i = first; i < last; i++) {
+        float value = series->format == plot_format_f32 ? ((const float *)series->values)[i]
+                                                        : ((const int16_t *)series->values)[i] * series->scale +
+                                                          series->offset;
+        points[count++] = ImVec2((float)(series->x0 + i * series->dx - x_from), value);
+    }
+    return count;
+}
+
+// Extent of a series in x, false if it has no samples
+bool plot_series_span(const plot_series *series, double *first, double *last) {
+    if(series->format != plot_format_channel) {
+        *first = series->x0;
+        *last = series->x0 + (series->count - 1) * series->dx;
+        return series->count > 0;
+    }
+    int64_t first_us;
+    int64_t last_us;
+    uint64_t count;
+    bool found = series->capture ? capture_view_span(series->capture, series->channel_id, &first_us, &last_us)
+                                 : store_span(series->store, series->channel_id, &first_us, &last_us, &count);
+    *first = (double)first_us;
+    *last = (double)last_us;
+    return found;
+}
+
+// A step between ticks of 1, 2 or 5 times a power of ten that gives no more than max_ticks over range
+double plot_tick_step(double range, int max_ticks) {
+    double step = pow(10.0, floor(log10(range / max_ticks)));
+    if(range / step > max_ticks * 5) {
+        return step * 10.0;
+    }
+    if(range / step > max_ticks * 2) {
+        return step * 5.0;
+    }
+    return range / step > max_ticks ? step * 2.0 : step;
+}
+
+// What the geometry of a plot needs, taken in the UI pass so that it can be built away from the ImGui context
+typedef struct {
+    plot_view *view;
+    plot_series series[PLOT_MAX_SERIES];
+    int series_count;
+    // Envelopes of recordings are made in the UI pass, a capture_view is for the UI thread only
+    bool ready[PLOT_MAX_SERIES];
+    ImVec2 min;
+    ImVec2 max;
+    int pixel_count;
+    bool fit_y;
+    // The pointer line, where the pointer is over the plot
+    bool pointer;
+    float pointer_x;
+    float pointer_y;
+    float mouse_x;
+    ImFont *font;
+    float font_size;
+    ImU32 text_color;
+    ImU32 grid_color;
+    ImU32 frame_color;
+    // Panels built on the workers go right after the host's list in the draw data, clipped the way it was
+    ImDrawList *host;
+    ImVec4 clip_rect;
+    ImTextureID texture;
+} plot_panel;
+
+// Panels are built on these threads and by the UI thread once it's done with the frame. Every thread tessellates
+// with a copy of the context's shared draw data, which has a scratch buffer in it.
+typedef struct {
+    platform_thread threads[PLOT_MAX_WORKERS];
+    int thread_count;
+    ImDrawListSharedData *shared[PLOT_MAX_WORKERS + 1];
+    plot_panel panels[PLOT_MAX_PANELS];
+    ImDrawList *lists[PLOT_MAX_PANELS];
+    int vertex_counts[PLOT_MAX_PANELS];
+    // UI thread only
+    int panel_count;
+    std::atomic<int> submitted;
+    std::atomic<int> taken;
+    std::atomic<int> built;
+    std::atomic<int> started;
+    std::atomic<int> running;
+    platform_event wake;
+    platform_event done;
+} plot_workers;
+
+// Envelope of a channel, from the recording if there is one
+void plot_channel_envelope(plot_view *view, int s, const plot_series *series, int pixel_count) {
+    int64_t from_us = (int64_t)floor(view->x_from);
+    int64_t to_us = (int64_t)ceil(view->x_to);
+    if(series->capture) {
+        capture_view_envelope(series->capture, series->channel_id, from_us, to_us, pixel_count, view->pixels);
+    } else {
+        store_envelope(series->store, series->channel_id, from_us, to_us, pixel_count, view->pixels);
+    }
+    for(int x = 0; x < pixel_count; x++) {
+        bool empty = view->pixels[x].count == 0;
+        view->mins[s][x] = empty ? INFINITY : view->pixels[x].min;
+        view->maxs[s][x] = empty ? -INFINITY : view->pixels[x].max;
+    }
+}
+
+// Rounded up like ImGui::CalcTextSize() does
+float plot_text_width(const plot_panel *panel, const char *text) {
+    return ceilf(panel->font->CalcTextSizeA(panel->font_size, FLT_MAX, 0.0f, text).x);
+}
+
+// Everything that is drawn, from the envelopes on, returns the vertices. Touches the view and the draw list only.
+int plot_build(const plot_panel *panel, ImDrawList *draw) {
+    plot_view *view = panel->view;
+    const plot_series *series = panel->series;
+    int series_count = panel->series_count;
+    int pixel_count = panel->pixel_count;
+    ImVec2 min = panel->min;
+    ImVec2 max = panel->max;
+    float line_height = panel->font_size;
+    double x_span = view->x_to - view->x_from;
+
+    // Envelopes first, fitting y needs all of them
+    const plot_kernels *kernels = plot_active_kernels();
+    int point_counts[PLOT_MAX_SERIES];
+    float fit_min = INFINITY;
+    float fit_max = -INFINITY;
+    for(int s = 0; s < series_count; s++) {
+        const plot_series *current = &series[s];
+        float *mins = view->mins[s];
+        float *maxs = view->maxs[s];
+        point_counts[s] = 0;
+        if(current->format == plot_format_channel) {
+            if(!panel->ready[s]) {
+                plot_channel_envelope(view, s, current, pixel_count);
+            }
+        } else if(x_span / current->dx < pixel_count) {
+            point_counts[s] = plot_points_span(current, view->x_from, view->x_to, view->points);
+            for(int x = 0; x < pixel_count; x++) {
+                mins[x] = INFINITY;
+                maxs[x] = -INFINITY;
+            }
+            for(int i = 0; i < point_counts[s]; i++) {
+                mins[0] = view->points[i].y < mins[0] ? view->points[i].y : mins[0];
+                maxs[0] = view->points[i].y > maxs[0] ? view->points[i].y : maxs[0];
+            }
+        } else {
+            plot_envelope_span(kernels, current, view->x_from, view->x_to, pixel_count, mins, maxs);
+        }
+        if(panel->fit_y) {
+            for(int x = 0; x < pixel_count; x++) {
+                fit_min = mins[x] < fit_min ? mins[x] : fit_min;
+                fit_max = maxs[x] > fit_max ? maxs[x] : fit_max;
+            }
+        }
+    }
+    if(panel->fit_y && fit_min <= fit_max) {
+        double margin = fit_max > fit_min ? (fit_max - fit_min) * 0.05 : 1.0;
+        view->y_min = fit_min - margin;
+        view->y_max = fit_max + margin;
+    }
+    double y_span = view->y_max - view->y_min;
+
+    // Grid and axes
+    int vertices = draw->VtxBuffer.Size;
+    ImU32 text_color = panel->text_color;
+    ImU32 grid_color = panel->grid_color;
+    draw->AddRectFilled(min, max, panel->frame_color);
+    char label[64];
+    double x_labels_from = view->x_from * view->x_label_scale;
+    double x_step = plot_tick_step(x_span * view->x_label_scale, (int)((max.x - min.x) / 100.0f) + 1);
+    for(double tick = ceil(x_labels_from / x_step) * x_step; tick <= view->x_to * view->x_label_scale;
+        tick += x_step) {
+        float x = min.x + (float)((tick - x_labels_from) / (x_span * view->x_label_scale) * (max.x - min.x));
+        draw->AddRectFilled(ImVec2(x, min.y), ImVec2(x + 1.0f, max.y), grid_color);
+        snprintf(label, sizeof(label), "%g", fabs(tick) < x_step * 1e-6 ? 0.0 : tick);
+        draw->AddText(panel->font, panel->font_size, ImVec2(x - plot_text_width(panel, label) * 0.5f, max.y + 2.0f),
+                      text_color, label);
+    }
+    double y_step = plot_tick_step(y_span, (int)((max.y - min.y) / (line_height * 3.0f)) + 1);
+    for(double tick = ceil(view->y_min / y_step) * y_step; tick <= view->y_max; tick += y_step) {
+        float y = max.y - (float)((tick - view->y_min) / y_span * (max.y - min.y));
+        draw->AddRectFilled(ImVec2(min.x, y), ImVec2(max.x, y + 1.0f), grid_color);
+        snprintf(label, sizeof(label), "%g", fabs(tick) < y_step * 1e-6 ? 0.0 : tick);
+        draw->AddText(panel->font, panel->font_size,
+                      ImVec2(min.x - plot_text_width(panel, label) - 4.0f, y - line_height * 0.5f), text_color, label);
+    }
+
+    draw->PushClipRect(min, max, true);
+    float y_scale = (float)((max.y - min.y) / y_span);
+    float y_base = max.y + (float)(view->y_min * y_scale);
+    for(int s = 0; s < series_count; s++) {
+        const plot_series *current = &series[s];
+        if(point_counts[s] > 0) {
+            // Few enough samples to draw them one by one, points holds x relative to x_from
+            float x_scale = (float)((max.x - min.x) / x_span);
+            int count = plot_points_span(current, view->x_from, view->x_to, view->points);
+            for(int i = 0; i < count; i++) {
+                view->points[i] = ImVec2(min.x + view->points[i].x * x_scale, y_base - view->points[i].y * y_scale);
+            }
+            draw->AddPolyline(view->points, count, current->color, ImDrawFlags_None, 1.0f);
+            continue;
+        }
+        const float *mins = view->mins[s];
+        const float *maxs = view->maxs[s];
+        draw->PrimReserve(pixel_count * 6, pixel_count * 4);
+        int drawn = 0;
+        // NaN until there is a column before, the comparisons fail
+        float previous_min = NAN;
+        float previous_max = NAN;
+        for(int x = 0; x < pixel_count; x++) {
+            if(mins[x] > maxs[x]) {
+                continue;
+            }
+            // Over to the column before so that steps between columns are drawn too
+            float low = previous_max < mins[x] ? previous_max : mins[x];
+            float high = previous_min > maxs[x] ? previous_min : maxs[x];
+            float top = y_base - high * y_scale;
+            float bottom = y_base - low * y_scale;
+            bottom = bottom > top + 1.0f ? bottom : top + 1.0f;
+            draw->PrimRect(ImVec2(min.x + x, top), ImVec2(min.x + x + 1.0f, bottom), current->color);
+            drawn++;
+            previous_min = mins[x];
+            previous_max = maxs[x];
+        }
+        draw->PrimUnreserve((pixel_count - drawn) * 6, (pixel_count - drawn) * 4);
+    }
+
+    // Legend, and where the pointer is
+    float legend_y = min.y + 4.0f;
+    for(int s = 0; s < series_count; s++) {
+        draw->AddRectFilled(ImVec2(min.x + 6.0f, legend_y + line_height * 0.25f),
+                            ImVec2(min.x + 6.0f + line_height * 0.5f, legend_y + line_height * 0.75f),
+                            series[s].color);
+        draw->AddText(panel->font, panel->font_size, ImVec2(min.x + 10.0f + line_height * 0.5f, legend_y),
+                      text_color, series[s].name);
+        legend_y += line_height;
+    }
+    if(panel->pointer) {
+        draw->AddRectFilled(ImVec2(panel->mouse_x, min.y), ImVec2(panel->mouse_x + 1.0f, max.y), text_color);
+        snprintf(label, sizeof(label), "%g, %g", (view->x_from + x_span * panel->pointer_x) * view->x_label_scale,
+                 view->y_min + y_span * panel->pointer_y);
+        draw->AddText(panel->font, panel->font_size, ImVec2(max.x - plot_text_width(panel, label) - 6.0f, min.y + 4.0f),
+                      text_color, label);
+    }
+    draw->PopClipRect();
+    return draw->VtxBuffer.Size - vertices;
+}
+
+// What a plot shows: the axes, the pointer and every series with how much data there is. A live channel changes
+// every frame it gets samples, a recording or a span doesn't unless its version is bumped.
+uint64_t plot_key(const plot_panel *panel) {
+    const plot_view *view = panel->view;
+    double ranges[5] = {view->x_from, view->x_to, view->y_min, view->y_max, view->x_label_scale};
+    float pointer[3] = {panel->pointer ? panel->pointer_x : -1.0f, panel->pointer ? panel->pointer_y : -1.0f,
+                        panel->pointer ? panel->mouse_x : -1.0f};
+    uint64_t key = retained_hash(ranges, sizeof(ranges));
+    key = retained_hash(pointer, sizeof(pointer), key);
+    key = retained_hash(&panel->fit_y, sizeof(panel->fit_y), key);
+    for(int s = 0; s < panel->series_count; s++) {
+        const plot_series *series = &panel->series[s];
+        const void *pointers[4] = {series->name, series->values, series->store, series->capture};
+        double numbers[4] = {series->x0, series->dx, series->scale, series->offset};
+        int64_t state[7] = {series->format, series->color, series->count, series->channel_id,
+                            (int64_t)series->version, 0, 0};
+        if(series->format == plot_format_channel && series->store && !series->capture) {
+            int64_t first_us = 0;
+            uint64_t count = 0;
+            store_span(series->store, series->channel_id, &first_us, &state[5], &count);
+            state[6] = (int64_t)count;
+        }
+        key = retained_hash(pointers, sizeof(pointers), key);
+        key = retained_hash(numbers, sizeof(numbers), key);
+        key = retained_hash(state, sizeof(state), key);
+    }
+    return key;
+}
+
+// Takes the next panel submitted and builds it into its list, false when there is none left
+bool plot_workers_build_next(plot_workers *workers, ImDrawListSharedData *shared) {
+    int index = workers->taken.load(std::memory_order_relaxed);
+    do {
+        if(index >= workers->submitted.load(std::memory_order_acquire)) {
+            return false;
+        }
+    } while(!workers->taken.compare_exchange_weak(index, index + 1));
+    if(index + 1 < workers->submitted.load(std::memory_order_acquire)) {
+        platform_event_signal(&workers->wake);
+    }
+    plot_panel *panel = &workers->panels[index];
+    ImDrawList *draw = workers->lists[index];
+    draw->_Data = shared;
+    draw->_ResetForNewFrame();
+    draw->PushClipRect(ImVec2(panel->clip_rect.x, panel->clip_rect.y), ImVec2(panel->clip_rect.z, panel->clip_rect.w));
+    draw->PushTextureID(panel->texture);
+    retained_begin(&panel->view->retained, draw);
+    workers->vertex_counts[index] = plot_build(panel, draw);
+    retained_end(&panel->view->retained, draw);
+    workers->built.fetch_add(1, std::memory_order_release);
+    platform_event_signal(&workers->done);
+    return true;
+}
+
+void plot_worker_thread(void *parameters) {
+    plot_workers *workers = (plot_workers *)parameters;
+    ImDrawListSharedData *shared = workers->shared[workers->started.fetch_add(1)];
+    while(workers->running.load(std::memory_order_acquire)) {
+        if(!plot_workers_build_next(workers, shared)) {
+            platform_event_wait(&workers->wake, 100);
+        }
+    }
+}
+
+// thread_count can be 0, the UI thread then builds every panel itself after ImGui::Render()
+bool plot_workers_start(plot_workers *workers, int thread_count) {
+    thread_count = thread_count < PLOT_MAX_WORKERS ? thread_count : PLOT_MAX_WORKERS;
+    for(int i = 0; i <= PLOT_MAX_WORKERS; i++) {
+        workers->shared[i] = IM_NEW(ImDrawListSharedData)();
+    }
+    for(int i = 0; i < PLOT_MAX_PANELS; i++) {
+        workers->lists[i] = IM_NEW(ImDrawList)(workers->shared[0]);
+    }
+    workers->panel_count = 0;
+    workers->submitted.store(0);
+    workers->taken.store(0);
+    workers->built.store(0);
+    workers->started.store(0);
+    workers->running.store(1);
+    platform_event_init(&workers->wake);
+    platform_event_init(&workers->done);
+    workers->thread_count = 0;
+    while(workers->thread_count < thread_count &&
+          platform_thread_start(&workers->threads[workers->thread_count], plot_worker_thread, workers)) {
+        workers->thread_count++;
+    }
+    return workers->thread_count == thread_count;
+}
+
+void plot_workers_stop(plot_workers *workers) {
+    workers->running.store(0);
+    for(int i = 0; i < workers->thread_count; i++) {
+        platform_event_signal(&workers->wake);
+    }
+    for(int i = 0; i < workers->thread_count; i++) {
+        platform_thread_join(&workers->threads[i]);
+    }
+    platform_event_destroy(&workers->done);
+    platform_event_destroy(&workers->wake);
+    for(int i = 0; i < PLOT_MAX_PANELS; i++) {
+        IM_DELETE(workers->lists[i]);
+    }
+    for(int i = 0; i <= PLOT_MAX_WORKERS; i++) {
+        IM_DELETE(workers->shared[i]);
+    }
+}
+
+// Hands a panel over from the UI pass, false when there are too many this frame
+bool plot_workers_submit(plot_workers *workers, const plot_panel *panel) {
+    if(workers->panel_count == PLOT_MAX_PANELS) {
+        return false;
+    }
+    // Nothing is being built before the first panel of a frame, the copies are taken then
+    if(workers->panel_count == 0) {
+        for(int i = 0; i <= workers->thread_count; i++) {
+            *workers->shared[i] = *ImGui::GetDrawListSharedData();
+        }
+    }
+    workers->panels[workers->panel_count++] = *panel;
+    workers->submitted.store(workers->panel_count, std::memory_order_release);
+    platform_event_signal(&workers->wake);
+    return true;
+}
+
+// After ImGui::Render(): builds what is left, waits for the rest and puts every panel right after its host's list.
+// A host that isn't in the draw data, collapsed or hidden, drops its panels.
+void plot_workers_finish(plot_workers *workers, ImDrawData *draw_data) {
+    while(plot_workers_build_next(workers, workers->shared[workers->thread_count])) {
+    }
+    while(workers->built.load(std::memory_order_acquire) < workers->panel_count) {
+        platform_event_wait(&workers->done, 100);
+    }
+    for(int i = 0; i < workers->panel_count; i++) {
+        workers->panels[i].view->vertex_count = workers->vertex_counts[i];
+        ImVector<ImDrawList *> &lists = draw_data->CmdLists;
+        int position = lists.find_index(workers->panels[i].host);
+        int count = lists.Size;
+        if(position < 0) {
+            continue;
+        }
+        draw_data->AddDrawList(workers->lists[i]);
+        if(lists.Size == count) {
+            continue;
+        }
+        // After the host and the panels that went after it already
+        position++;
+        for(int j = 0; j < i && position < count; j++) {
+            position += workers->panels[j].host == workers->panels[i].host && lists[position] == workers->lists[j];
+        }
+        lists.pop_back();
+        lists.insert(lists.Data + position, workers->lists[i]);
+    }
+    workers->panel_count = 0;
+    workers->submitted.store(0, std::memory_order_release);
+    workers->taken.store(0);
+    workers->built.store(0);
+}
+
+// The series over shared axes at the cursor, size big. Input is handled here, the rest goes to the workers if there
+// are any, or is drawn right away. A view is drawn once a frame, the workers write to it until plot_workers_finish().
+void plot_draw(plot_view *view, const plot_series *series, int series_count, ImVec2 size, plot_workers *workers) {
+    ImGuiIO &io = ImGui::GetIO();
+    series_count = series_count < PLOT_MAX_SERIES ? series_count : PLOT_MAX_SERIES;
+    float line_height = ImGui::GetTextLineHeight();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::InvisibleButton("##plot", size);
+    ImVec2 min(origin.x + PLOT_AXIS_WIDTH, origin.y);
+    ImVec2 max(origin.x + size.x, origin.y + size.y - line_height - 4.0f);
+    int pixel_count = (int)(max.x - min.x);
+    pixel_count = pixel_count < PLOT_MAX_PIXELS ? pixel_count : PLOT_MAX_PIXELS;
+    if(pixel_count <= 0 || max.y <= min.y) {
+        return;
+    }
+    max.x = min.x + pixel_count;
+
+    if(ImGui::IsItemHovered() && ImGui::IsMouseDoubleClicked(ImGuiMouseButton_Left)) {
+        view->fit = true;
+    }
+    bool fit_y = view->fit;
+    if(view->fit || view->follow) {
+        double first = INFINITY;
+        double last = -INFINITY;
+        for(int s = 0; s < series_count; s++) {
+            double series_first;
+            double series_last;
+            if(plot_series_span(&series[s], &series_first, &series_last)) {
+                first = series_first < first ? series_first : first;
+                last = series_last > last ? series_last : last;
+            }
+        }
+        if(last > first) {
+            view->x_from = view->fit ? first : last - (view->x_to - view->x_from);
+            view->x_to = last;
+        }
+        view->fit = false;
+    }
+    double x_span = view->x_to - view->x_from;
+    double y_span = view->y_max - view->y_min;
+    float pointer_x = (io.MousePos.x - min.x) / (max.x - min.x);
+    float pointer_y = (max.y - io.MousePos.y) / (max.y - min.y);
+    if(ImGui::IsItemHovered() && io.MouseWheel != 0.0f) {
+        double zoom = pow(0.8, io.MouseWheel);
+        if(io.KeyShift) {
+            double pivot = view->y_min + y_span * pointer_y;
+            view->y_min = pivot - y_span * zoom * pointer_y;
+            view->y_max = view->y_min + y_span * zoom;
+        } else {
+            double pivot = view->x_from + x_span * pointer_x;
+            view->x_from = pivot - x_span * zoom * pointer_x;
+            view->x_to = view->x_from + x_span * zoom;
+            view->follow = false;
+        }
+    }
+    if(ImGui::IsItemActive() && (io.MouseDelta.x != 0.0f || io.MouseDelta.y != 0.0f)) {
+        double dx = -io.MouseDelta.x * x_span / (max.x - min.x);
+        double dy = io.MouseDelta.y * y_span / (max.y - min.y);
+        view->x_from += dx;
+        view->x_to += dx;
+        view->y_min += dy;
+        view->y_max += dy;
+        view->follow = dx != 0.0 ? false : view->follow;
+    }
+
+    plot_panel panel;
+    panel.view = view;
+    memcpy(panel.series, series, series_count * sizeof(plot_series));
+    panel.series_count = series_count;
+    panel.min = min;
+    panel.max = max;
+    panel.pixel_count = pixel_count;
+    panel.fit_y = fit_y;
+    panel.pointer = ImGui::IsItemHovered() && pointer_x >= 0.0f && pointer_x <= 1.0f;
+    panel.pointer_x = pointer_x;
+    panel.pointer_y = pointer_y;
+    panel.mouse_x = io.MousePos.x;
+    panel.font = ImGui::GetFont();
+    panel.font_size = ImGui::GetFontSize();
+    panel.text_color = ImGui::GetColorU32(ImGuiCol_Text);
+    panel.grid_color = ImGui::GetColorU32(ImGuiCol_Separator, 0.5f);
+    panel.frame_color = ImGui::GetColorU32(ImGuiCol_FrameBg);
+    panel.host = ImGui::GetWindowDrawList();
+    panel.clip_rect = panel.host->_CmdHeader.ClipRect;
+    panel.texture = panel.host->_CmdHeader.TextureId;
+    if(retained_reuse(&view->retained, panel.host, plot_key(&panel), origin,
+                      ImVec2(origin.x + size.x, origin.y + size.y))) {
+        view->vertex_count = view->retained.vertex_count;
+        return;
+    }
+    for(int s = 0; s < series_count; s++) {
+        panel.ready[s] = workers && series[s].format == plot_format_channel && series[s].capture;
+        if(panel.ready[s]) {
+            plot_channel_envelope(view, s, &series[s], pixel_count);
+        }
+    }
+    if(!workers || !plot_workers_submit(workers, &panel)) {
+        retained_begin(&view->retained, panel.host);
+        view->vertex_count = plot_build(&panel, panel.host);
+        retained_end(&view->retained, panel.host);
+    }
+}
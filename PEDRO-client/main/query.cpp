@@ -0,0 +1,530 @@
+// Searches over channel history.
+// A query finds the stretches where a channel is inside a range of values, or the samples where it crosses a
+// threshold, in the live store or in a capture. Store chunks and capture blocks carry a zone map, their min, max,
+// first and last value, and most of them are settled by it alone: nothing in range or everything in range, no
+// crossing inside and maybe one at the boundary to the chunk before. Only the rest gets its samples read. Compare
+// kernels turn those into bitmasks, one bit per sample, and the matches are read off the transitions of the bits.
+// NaN is never in range, but zone maps don't see NaN samples, so a chunk settled by its zone map treats them
+// like the samples around them.
+// A range on a second channel can gate the matches, "GPIO4 went high while ADC0 was above 2.1 V". The gate
+// channel's value holds from one of its samples to the next.
+// Results come a step at a time through a cursor, a step looks at no more than QUERY_STEP_CHUNKS chunks, so the
+// UI thread can take one per frame. The kernel targets come from decode.cpp.
+
+#define QUERY_STEP_CHUNKS 256
+#define QUERY_MAX_CHUNK_SAMPLES (STORE_CHUNK_SAMPLES > CAPTURE_BLOCK_SAMPLES ? STORE_CHUNK_SAMPLES \
+                                                                             : CAPTURE_BLOCK_SAMPLES)
+#define QUERY_PENDING_MATCHES 64
+#define QUERY_GATE_RANGES 64
+
+enum query_kind {
+    // Stretches of samples with low <= value <= high
+    query_kind_range = 0,
+    // Samples at or above low after one below it
+    query_kind_rising = 1,
+    // Samples below low after one at or above it
+    query_kind_falling = 2,
+    query_kind_crossing = 3
+};
+
+typedef struct {
+    int kind;
+    uint32_t channel_id;
+    // The threshold of the crossing kinds, high is only for ranges
+    float low;
+    float high;
+} query_condition;
+
+// Crossings are a single sample, start_us == end_us. Ranges are [start_us, end_us), they end at the sample that
+// left the range, or a microsecond after the last sample of a capture. value is the first sample of the match,
+// NaN for a gated range that starts after the range itself did.
+typedef struct {
+    int64_t start_us;
+    int64_t end_us;
+    float value;
+} query_match;
+
+// Sets bit i of bits if low <= values[i] <= high, bits are zero past count
+typedef void (*query_mask_proc)(const float *values, int count, float low, float high, uint64_t *bits);
+
+typedef struct {
+    const char *name;
+    query_mask_proc mask;
+} query_kernels;
+
+typedef struct {
+    int64_t first_us;
+    int64_t last_us;
+    float min;
+    float max;
+    float first;
+    float last;
+} query_zone;
+
+typedef struct {
+    query_condition condition;
+    // Exactly one of them
+    sample_store *store;
+    capture_view *view;
+    const query_kernels *kernels;
+    // Off only to measure what the zone maps save
+    bool zone_maps;
+
+    // Everything before next_us has been looked at
+    int64_t next_us;
+    // Whether the last sample looked at was at or above the threshold, for crossings
+    bool has_previous;
+    bool previous_above;
+    // A range that is still going on
+    bool open;
+    int64_t open_start_us;
+    float open_value;
+    // Nothing new to look at right now, for a capture that means for good
+    bool caught_up;
+    bool finished;
+
+    uint64_t chunks_skipped;
+    uint64_t chunks_scanned;
+    uint64_t samples_scanned;
+    uint64_t bits[QUERY_MAX_CHUNK_SAMPLES / 64];
+} query_scan;
+
+typedef struct {
+    query_scan scan;
+    bool gated;
+    query_scan gate;
+
+    // Matches of the scan waiting for the gate to get as far
+    query_match pending[QUERY_PENDING_MATCHES];
+    int pending_first;
+    int pending_count;
+    // Ranges of the gate that the pending matches haven't got past yet
+    query_match gate_ranges[QUERY_GATE_RANGES];
+    int gate_first;
+    int gate_count;
+
+    uint64_t matches;
+} query_cursor;
+
+void query_mask_scalar(const float *values, int count, float low, float high, uint64_t *bits) {
+    for(int word = 0; word * 64 < count; word++) {
+        int n = count - word * 64 < 64 ? count - word * 64 : 64;
+        const float *v = values + word * 64;
+        uint64_t mask = 0;
+        for(int i = 0; i < n; i++) {
+            mask |= (uint64_t)(v[i] >= low && v[i] <= high) << i;
+        }
+        bits[word] = mask;
+    }
+}
+
+query_kernels query_scalar_kernels = {"scalar", query_mask_scalar};
+
+#ifdef DECODE_X86
+DECODE_TARGET_SSE2 void query_mask_sse2(const float *values, int count, float low, float high, uint64_t *bits) {
+    __m128 lows = _mm_set1_ps(low);
+    __m128 highs = _mm_set1_ps(high);
+    int word = 0;
+    for(; word * 64 + 64 <= count; word++) {
+        const float *v = values + word * 64;
+        uint64_t mask = 0;
+        for(int i = 0; i < 64; i += 4) {
+            __m128 x = _mm_loadu_ps(v + i);
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(x, lows), _mm_cmple_ps(x, highs));
+            mask |= (uint64_t)_mm_movemask_ps(inside) << i;
+        }
+        bits[word] = mask;
+    }
+    query_mask_scalar(values + word * 64, count - word * 64, low, high, bits + word);
+}
+
+query_kernels query_sse2_kernels = {"SSE2", query_mask_sse2};
+
+DECODE_TARGET_AVX2 void query_mask_avx2(const float *values, int count, float low, float high, uint64_t *bits) {
+    __m256 lows = _mm256_set1_ps(low);
+    __m256 highs = _mm256_set1_ps(high);
+    int word = 0;
+    for(; word * 64 + 64 <= count; word++) {
+        const float *v = values + word * 64;
+        uint64_t mask = 0;
+        for(int i = 0; i < 64; i += 8) {
+            __m256 x = _mm256_loadu_ps(v + i);
+            __m256 inside = _mm256_and_ps(_mm256_cmp_ps(x, lows, _CMP_GE_OQ), _mm256_cmp_ps(x, highs, _CMP_LE_OQ));
+            mask |= (uint64_t)_mm256_movemask_ps(inside) << i;
+        }
+        bits[word] = mask;
+    }
+    // The tail is SSE code, without this every instruction of it pays for the dirty upper halves
+    _mm256_zeroupper();
+    query_mask_scalar(values + word * 64, count - word * 64, low, high, bits + word);
+}
+
+query_kernels query_avx2_kernels = {"AVX2", query_mask_avx2};
+#endif
+
+// Every kernel set this build has, best last
+query_kernels *query_kernel_sets[] = {
+    &query_scalar_kernels,
+#ifdef DECODE_X86
+    &query_sse2_kernels,
+    &query_avx2_kernels,
+#endif
+};
+
+bool query_kernels_supported(const query_kernels *kernels) {
+#ifdef DECODE_X86
+    if(kernels == &query_avx2_kernels) {
+        return platform_cpu_has_avx2();
+    }
+    if(kernels == &query_sse2_kernels) {
+        return platform_cpu_has_sse2();
+    }
+#endif
+    return true;
+}
+
+const query_kernels *query_pick_kernels() {
+    for(int i = (int)array_count(query_kernel_sets) - 1; i > 0; i--) {
+        if(query_kernels_supported(query_kernel_sets[i])) {
+            return query_kernel_sets[i];
+        }
+    }
+    return &query_scalar_kernels;
+}
+
+const query_kernels *query_active_kernels() {
+    static const query_kernels *kernels = query_pick_kernels();
+    return kernels;
+}
+
+int query_count_trailing_zeros(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+#ifdef _M_X64
+    _BitScanForward64(&index, value);
+#else
+    if(!_BitScanForward(&index, (unsigned long)value)) {
+        _BitScanForward(&index, (unsigned long)(value >> 32));
+        index += 32;
+    }
+#endif
+    return (int)index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+void query_scan_init(query_scan *scan, const query_condition *condition, sample_store *store, capture_view *view,
+                     int64_t from_us) {
+    memset(scan, 0, sizeof(*scan));
+    scan->condition = *condition;
+    scan->store = store;
+    scan->view = view;
+    scan->kernels = query_active_kernels();
+    scan->zone_maps = true;
+    scan->next_us = from_us;
+}
+
+// Settles a chunk that starts at or after next_us by its zone map if it can, adding at most one match.
+// Returns false if its samples have to be looked at.
+bool query_scan_zone(query_scan *scan, const query_zone *zone, query_match *matches, int *found) {
+    const query_condition *condition = &scan->condition;
+    if(condition->kind == query_kind_range) {
+        if(zone->max < condition->low || zone->min > condition->high) {
+            if(scan->open) {
+                query_match *match = &matches[(*found)++];
+                match->start_us = scan->open_start_us;
+                match->end_us = zone->first_us;
+                match->value = scan->open_value;
+                scan->open = false;
+            }
+        } else if(zone->min >= condition->low && zone->max <= condition->high) {
+            if(!scan->open) {
+                scan->open = true;
+                scan->open_start_us = zone->first_us;
+                scan->open_value = zone->first;
+            }
+        } else {
+            return false;
+        }
+    } else {
+        bool above = zone->min >= condition->low;
+        if(!above && !(zone->max < condition->low)) {
+            return false;
+        }
+        bool wanted = condition->kind == query_kind_crossing || (condition->kind == query_kind_rising) == above;
+        if(scan->has_previous && scan->previous_above != above && wanted) {
+            query_match *match = &matches[(*found)++];
+            match->start_us = zone->first_us;
+            match->end_us = zone->first_us;
+            match->value = zone->first;
+        }
+        scan->previous_above = above;
+    }
+    scan->has_previous = true;
+    scan->next_us = zone->last_us + 1;
+    return true;
+}
+
+// Looks at samples [first, count) of a chunk, returns the number of matches. Stops early once max_matches is
+// reached, next_us is right after the sample of the last match then.
+int query_scan_samples(query_scan *scan, const int64_t *timestamps_us, const float *values, int first, int count,
+                       query_match *matches, int max_matches) {
+    const query_condition *condition = &scan->condition;
+    bool range = condition->kind == query_kind_range;
+    int n = count - first;
+    if(n <= 0) {
+        return 0;
+    }
+    scan->kernels->mask(values + first, n, condition->low, range ? condition->high : INFINITY, scan->bits);
+    scan->samples_scanned += n;
+
+    // Whether the sample before was in, the first sample of a crossing query without one can't be a crossing
+    uint64_t carry;
+    if(range) {
+        carry = scan->open ? 1 : 0;
+    } else {
+        carry = scan->has_previous ? (scan->previous_above ? 1 : 0) : (scan->bits[0] & 1);
+    }
+    int found = 0;
+    for(int word = 0; word * 64 < n; word++) {
+        int valid = n - word * 64 < 64 ? n - word * 64 : 64;
+        uint64_t valid_mask = valid == 64 ? ~0ULL : (1ULL << valid) - 1;
+        uint64_t inside = scan->bits[word];
+        uint64_t before = (inside << 1) | carry;
+        uint64_t rises = inside & ~before & valid_mask;
+        uint64_t falls = ~inside & before & valid_mask;
+        carry = (inside >> (valid - 1)) & 1;
+
+        uint64_t events = rises | falls;
+        if(condition->kind == query_kind_rising) {
+            events = rises;
+        } else if(condition->kind == query_kind_falling) {
+            events = falls;
+        }
+        while(events) {
+            int bit = query_count_trailing_zeros(events);
+            events &= events - 1;
+            int i = first + word * 64 + bit;
+            if(range && (rises >> bit) & 1) {
+                scan->open = true;
+                scan->open_start_us = timestamps_us[i];
+                scan->open_value = values[i];
+                continue;
+            }
+            query_match *match = &matches[found++];
+            if(range) {
+                match->start_us = scan->open_start_us;
+                match->end_us = timestamps_us[i];
+                match->value = scan->open_value;
+                scan->open = false;
+            } else {
+                match->start_us = timestamps_us[i];
+                match->end_us = timestamps_us[i];
+                match->value = values[i];
+            }
+            if(found == max_matches) {
+                scan->has_previous = true;
+                scan->previous_above = (inside >> bit) & 1;
+                scan->next_us = timestamps_us[i] + 1;
+                return found;
+            }
+        }
+    }
+    scan->has_previous = true;
+    scan->previous_above = carry != 0;
+    scan->next_us = timestamps_us[count - 1] + 1;
+    return found;
+}
+
+// One step of a single channel, returns the number of matches
+int query_scan_step(query_scan *scan, query_match *matches, int max_matches) {
+    if(scan->finished || max_matches <= 0) {
+        return 0;
+    }
+    int found = 0;
+    int visited = 0;
+    scan->caught_up = false;
+    if(scan->store) {
+        store_column *column = store_find_column(scan->store, scan->condition.channel_id);
+        if(!column) {
+            scan->caught_up = true;
+            return 0;
+        }
+        platform_mutex_lock(&column->lock);
+        store_position position = store_lower_bound(column, scan->next_us);
+        for(int chunk_index = position.chunk; chunk_index < column->chunk_count && visited < QUERY_STEP_CHUNKS &&
+            found < max_matches; chunk_index++, visited++) {
+            store_chunk *chunk = store_column_chunk(column, chunk_index);
+            if(chunk->count == 0) {
+                continue;
+            }
+            query_zone zone = {chunk->timestamps_us[0], chunk->timestamps_us[chunk->count - 1], chunk->min,
+                               chunk->max, chunk->values[0], chunk->values[chunk->count - 1]};
+            // The chunk being appended to can only be settled for what it holds so far, next_us takes care of that
+            if(scan->zone_maps && zone.first_us >= scan->next_us && query_scan_zone(scan, &zone, matches, &found)) {
+                scan->chunks_skipped++;
+                continue;
+            }
+            int first = capture_block_lower_bound(chunk->timestamps_us, chunk->count, scan->next_us);
+            found += query_scan_samples(scan, chunk->timestamps_us, chunk->values, first, chunk->count,
+                                        matches + found, max_matches - found);
+            scan->chunks_scanned++;
+        }
+        scan->caught_up = column->chunk_count == 0 || scan->next_us > column->last_timestamp_us;
+        platform_mutex_unlock(&column->lock);
+        return found;
+    }
+
+    capture_view *view = scan->view;
+    capture_view_channel *channel = capture_view_find_channel(view, scan->condition.channel_id);
+    if(!channel) {
+        scan->caught_up = true;
+        scan->finished = true;
+        return 0;
+    }
+    int64_t block_index = capture_view_first_block(view, channel, scan->next_us);
+    for(; block_index < channel->block_count && visited < QUERY_STEP_CHUNKS && found < max_matches;
+        block_index++, visited++) {
+        int64_t block = channel->blocks[block_index];
+        capture_index_entry *entry = &view->reader.index[block];
+        query_zone zone = {entry->first_timestamp_us, entry->last_timestamp_us, entry->min_value, entry->max_value,
+                           entry->first_value, entry->last_value};
+        if(scan->zone_maps && zone.first_us >= scan->next_us && query_scan_zone(scan, &zone, matches, &found)) {
+            scan->chunks_skipped++;
+            continue;
+        }
+        const int64_t *timestamps_us;
+        const float *values;
+        int count = capture_view_samples(view, block, &timestamps_us, &values);
+        if(count <= 0) {
+            // Can't be read, it is left out as if it had been settled without a match
+            scan->next_us = zone.last_us + 1;
+            continue;
+        }
+        int first = capture_block_lower_bound(timestamps_us, count, scan->next_us);
+        found += query_scan_samples(scan, timestamps_us, values, first, count, matches + found, max_matches - found);
+        scan->chunks_scanned++;
+    }
+    int64_t last_us = channel->block_count
+                    ? view->reader.index[channel->blocks[channel->block_count - 1]].last_timestamp_us : INT64_MIN;
+    scan->caught_up = scan->next_us > last_us;
+    // A capture doesn't grow, a range that is still going on ends with it
+    if(scan->caught_up && scan->open && found < max_matches) {
+        query_match *match = &matches[found++];
+        match->start_us = scan->open_start_us;
+        match->end_us = last_us + 1;
+        match->value = scan->open_value;
+        scan->open = false;
+    }
+    scan->finished = scan->caught_up && !scan->open;
+    return found;
+}
+
+// Searches the live store, or the capture if view isn't NULL, from from_us on. gate is NULL or a range condition on
+// another channel that matches have to fall into.
+void query_open(query_cursor *cursor, const query_condition *condition, const query_condition *gate,
+                sample_store *store, capture_view *view, int64_t from_us) {
+    memset(cursor, 0, sizeof(*cursor));
+    query_scan_init(&cursor->scan, condition, view ? NULL : store, view, from_us);
+    cursor->gated = gate != NULL;
+    if(gate) {
+        query_condition range = *gate;
+        range.kind = query_kind_range;
+        query_scan_init(&cursor->gate, &range, view ? NULL : store, view, from_us);
+    }
+}
+
+void query_set_kernels(query_cursor *cursor, const query_kernels *kernels, bool zone_maps) {
+    cursor->scan.kernels = kernels;
+    cursor->scan.zone_maps = zone_maps;
+    cursor->gate.kernels = kernels;
+    cursor->gate.zone_maps = zone_maps;
+}
+
+// Nothing more to find, only ever true for captures
+bool query_finished(query_cursor *cursor) {
+    return cursor->scan.finished && cursor->pending_count == 0;
+}
+
+// Nothing more to find until more samples come in, once query_next has returned 0
+bool query_caught_up(query_cursor *cursor) {
+    return cursor->scan.caught_up &&
+           (!cursor->gated || cursor->pending_count == 0 || (cursor->gate.caught_up && cursor->gate_count == 0));
+}
+
+// Matches the pending ones against the gate ranges, returns false if the gate has to get further first
+bool query_apply_gate(query_cursor *cursor, query_match *matches, int max_matches, int *found) {
+    bool range = cursor->scan.condition.kind == query_kind_range;
+    query_scan *gate = &cursor->gate;
+    while(cursor->pending_count > 0 && *found < max_matches) {
+        query_match *match = &cursor->pending[cursor->pending_first];
+        // The last moment of the match that the gate has to be known for
+        int64_t until_us = range ? match->end_us - 1 : match->start_us;
+        query_match open_range = {gate->open_start_us, INT64_MAX, NAN};
+        query_match *covering = NULL;
+        if(cursor->gate_count > 0) {
+            covering = &cursor->gate_ranges[cursor->gate_first];
+            if(covering->end_us <= match->start_us) {
+                // Over before the match starts
+                cursor->gate_first = (cursor->gate_first + 1) % QUERY_GATE_RANGES;
+                cursor->gate_count--;
+                continue;
+            }
+        } else if(!gate->finished && gate->next_us <= until_us) {
+            return false;
+        } else if(gate->open) {
+            // Goes on past the match
+            covering = &open_range;
+        }
+
+        bool done = true;
+        if(covering && covering->start_us <= until_us) {
+            query_match *out = &matches[(*found)++];
+            *out = *match;
+            if(range) {
+                // The part of the match inside the gate range
+                out->start_us = covering->start_us > match->start_us ? covering->start_us : match->start_us;
+                out->end_us = covering->end_us < match->end_us ? covering->end_us : match->end_us;
+                out->value = out->start_us == match->start_us ? match->value : NAN;
+                if(covering->end_us < match->end_us) {
+                    // The next gate range can cover more of it
+                    match->start_us = covering->end_us;
+                    match->value = NAN;
+                    cursor->gate_first = (cursor->gate_first + 1) % QUERY_GATE_RANGES;
+                    cursor->gate_count--;
+                    done = false;
+                }
+            }
+        }
+        if(done) {
+            cursor->pending_first = (cursor->pending_first + 1) % QUERY_PENDING_MATCHES;
+            cursor->pending_count--;
+        }
+    }
+    return true;
+}
+
+// One step, returns up to max_matches matches in time order. Returns 0 when there is nothing more right now, or
+// the step ran out of chunks to look at before finding anything, query_finished tells them apart for captures.
+int query_next(query_cursor *cursor, query_match *matches, int max_matches) {
+    if(!cursor->gated) {
+        int found = query_scan_step(&cursor->scan, matches, max_matches);
+        cursor->matches += found;
+        return found;
+    }
+
+    if(cursor->pending_count == 0) {
+        cursor->pending_first = 0;
+        cursor->pending_count = query_scan_step(&cursor->scan, cursor->pending, QUERY_PENDING_MATCHES);
+    }
+    int found = 0;
+    if(!query_apply_gate(cursor, matches, max_matches, &found)) {
+        // Only ever stuck with no gate ranges left
+        cursor->gate_first = 0;
+        cursor->gate_count = query_scan_step(&cursor->gate, cursor->gate_ranges, QUERY_GATE_RANGES);
+        query_apply_gate(cursor, matches, max_matches, &found);
+    }
+    cursor->matches += found;
+    return found;
+}
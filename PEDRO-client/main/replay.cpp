@@ -0,0 +1,227 @@
+// Capture replay.
+// Feeds a recording into the ingest pipeline the way a device connection does: blocks are turned back into
+// sample_batch payloads and go through ingest_decode_sample_batch, so replay exercises the same decode, store
+// and UI path as live data. A block is replayed once the replay clock passes its last sample, which is when
+// the device would have sent it.
+// Real time and N times speed run on a thread of their own against the wall clock. As fast as possible keeps
+// at most REPLAY_MAX_QUEUED_BATCHES ahead of the store thread. Deterministic replay has no thread, the caller
+// advances it by a fixed amount of capture time per step and gets control back once the store has it all,
+// so every run sees the same data at the same frame.
+
+#define REPLAY_MAX_QUEUED_BATCHES 256
+#define REPLAY_MAX_SLEEP_MS 10
+
+typedef struct {
+    capture_reader reader;
+    ingest_pipeline *pipeline;
+    // Index entries in the order of their last sample
+    int64_t *order;
+    int64_t next;
+    int64_t first_timestamp_us;
+    int64_t last_timestamp_us;
+    // Replayed up to here
+    int64_t position_us;
+    uint64_t batches_pushed;
+
+    // Scratch for reading a block and encoding it into payloads
+    int64_t *timestamps_us;
+    float *values;
+    char *payload;
+
+    // 0 for as fast as possible
+    std::atomic<double> speed;
+    bool deterministic;
+    platform_thread thread;
+    std::atomic<int> running;
+    std::atomic<int> finished;
+
+    std::atomic<uint64_t> samples_replayed;
+    std::atomic<uint64_t> bytes_replayed;
+    std::atomic<int64_t> replayed_us;
+} replay;
+
+// qsort has no context argument
+static capture_index_entry *replay_sort_index;
+
+int replay_compare(const void *a, const void *b) {
+    int64_t left = replay_sort_index[*(const int64_t *)a].last_timestamp_us;
+    int64_t right = replay_sort_index[*(const int64_t *)b].last_timestamp_us;
+    if(left != right) {
+        return left < right ? -1 : 1;
+    }
+    return *(const int64_t *)a < *(const int64_t *)b ? -1 : 1;
+}
+
+// Re-encodes one block as f32 sample blocks, one per run of evenly spaced samples, and pushes it
+bool replay_push_block(replay *rep, int64_t block) {
+    int count = capture_reader_read_block(&rep->reader, block, rep->timestamps_us, rep->values);
+    uint32_t channel_id = rep->reader.index[block].channel_id;
+    if(count <= 0) {
+        return count == 0;
+    }
+    int length = 0;
+    int i = 0;
+    while(i < count) {
+        int64_t period_us = i + 1 < count ? rep->timestamps_us[i + 1] - rep->timestamps_us[i] : 0;
+        int run = 1;
+        while(i + run < count && rep->timestamps_us[i + run] - rep->timestamps_us[i + run - 1] == period_us) {
+            run++;
+        }
+        int size = sizeof(sample_block_header) + run * sizeof(float);
+        if(length + size > FRAME_MAX_PAYLOAD && length > 0) {
+            sample_range range;
+            ingest_decode_sample_batch(rep->pipeline, device_channel_device(channel_id), rep->payload, length, NULL,
+                                       &range);
+            rep->bytes_replayed.fetch_add(length, std::memory_order_relaxed);
+            length = 0;
+        }
+        sample_block_header header = {};
+        header.channel_id = device_channel_channel(channel_id);
+        header.sample_count = (uint16_t)run;
+        header.sample_format = sample_format_f32;
+        header.first_timestamp_us = (uint64_t)rep->timestamps_us[i];
+        header.sample_period_us = (uint32_t)period_us;
+        memcpy(rep->payload + length, &header, sizeof(header));
+        memcpy(rep->payload + length + sizeof(header), rep->values + i, run * sizeof(float));
+        length += size;
+        i += run;
+        rep->batches_pushed++;
+    }
+    sample_range range;
+    ingest_decode_sample_batch(rep->pipeline, device_channel_device(channel_id), rep->payload, length, NULL, &range);
+    rep->bytes_replayed.fetch_add(length, std::memory_order_relaxed);
+    rep->samples_replayed.fetch_add(count, std::memory_order_relaxed);
+    return true;
+}
+
+// Pushes every block that ends at or before position_us, returns false once the capture is done
+bool replay_advance(replay *rep, int64_t position_us) {
+    bool pushed = false;
+    while(rep->next < rep->reader.block_count) {
+        int64_t block = rep->order[rep->next];
+        if(rep->reader.index[block].last_timestamp_us > position_us) {
+            break;
+        }
+        // As fast as possible stays a bounded distance ahead of the store thread
+        while(rep->speed.load(std::memory_order_relaxed) == 0.0 && !rep->deterministic &&
+              rep->batches_pushed - rep->pipeline->consumed_batches.load(std::memory_order_acquire) >
+              REPLAY_MAX_QUEUED_BATCHES && rep->running.load(std::memory_order_relaxed)) {
+            ingest_notify(rep->pipeline);
+            platform_sleep_ms(1);
+        }
+        replay_push_block(rep, block);
+        rep->next++;
+        pushed = true;
+    }
+    if(pushed) {
+        ingest_notify(rep->pipeline);
+    }
+    rep->position_us = position_us < rep->last_timestamp_us ? position_us : rep->last_timestamp_us;
+    rep->replayed_us.store(rep->position_us - rep->first_timestamp_us, std::memory_order_relaxed);
+    return rep->next < rep->reader.block_count;
+}
+
+void replay_thread(void *parameters) {
+    replay *rep = (replay *)parameters;
+    uint64_t last_ns = platform_time_ns();
+    int64_t position_us = rep->first_timestamp_us;
+    while(rep->running.load(std::memory_order_acquire)) {
+        // Speed can change while running, so the clock moves on in steps
+        uint64_t now_ns = platform_time_ns();
+        double speed = rep->speed.load(std::memory_order_relaxed);
+        position_us = speed == 0.0 ? INT64_MAX : position_us + (int64_t)((now_ns - last_ns) / 1000 * speed);
+        last_ns = now_ns;
+        if(!replay_advance(rep, position_us)) {
+            break;
+        }
+        if(speed != 0.0) {
+            // Until the next block is due
+            int64_t due_us = rep->reader.index[rep->order[rep->next]].last_timestamp_us - position_us;
+            int64_t sleep_ms = (int64_t)(due_us / speed / 1000);
+            sleep_ms = sleep_ms < REPLAY_MAX_SLEEP_MS ? sleep_ms : REPLAY_MAX_SLEEP_MS;
+            platform_sleep_ms(sleep_ms > 1 ? (int)sleep_ms : 1);
+        }
+    }
+    rep->finished.store(1, std::memory_order_release);
+}
+
+// speed is 1 for real time, N for N times as fast and 0 for as fast as the pipeline takes it. Deterministic
+// replay ignores speed and only moves on in replay_step.
+bool replay_start(replay *rep, const char *path, ingest_pipeline *pipeline, double speed, bool deterministic) {
+    new(rep) replay();
+    if(!capture_reader_open(&rep->reader, path)) {
+        return false;
+    }
+    int64_t block_count = rep->reader.block_count;
+    rep->pipeline = pipeline;
+    rep->order = (int64_t *)malloc(block_count * sizeof(int64_t) + 1);
+    rep->timestamps_us = (int64_t *)malloc(CAPTURE_BLOCK_SAMPLES * sizeof(int64_t));
+    rep->values = (float *)malloc(CAPTURE_BLOCK_SAMPLES * sizeof(float));
+    rep->payload = (char *)malloc(FRAME_MAX_PAYLOAD);
+    if(!rep->order || !rep->timestamps_us || !rep->values || !rep->payload) {
+        free(rep->order);
+        free(rep->timestamps_us);
+        free(rep->values);
+        free(rep->payload);
+        capture_reader_close(&rep->reader);
+        return false;
+    }
+    rep->first_timestamp_us = INT64_MAX;
+    rep->last_timestamp_us = INT64_MIN;
+    for(int64_t i = 0; i < block_count; i++) {
+        capture_index_entry *entry = &rep->reader.index[i];
+        rep->order[i] = i;
+        rep->first_timestamp_us = entry->first_timestamp_us < rep->first_timestamp_us
+                                ? entry->first_timestamp_us : rep->first_timestamp_us;
+        rep->last_timestamp_us = entry->last_timestamp_us > rep->last_timestamp_us
+                               ? entry->last_timestamp_us : rep->last_timestamp_us;
+    }
+    replay_sort_index = rep->reader.index;
+    qsort(rep->order, block_count, sizeof(int64_t), replay_compare);
+    rep->position_us = rep->first_timestamp_us;
+    rep->speed.store(speed);
+    rep->deterministic = deterministic;
+    rep->running.store(1);
+    if(!deterministic && !platform_thread_start(&rep->thread, replay_thread, rep)) {
+        free(rep->order);
+        free(rep->timestamps_us);
+        free(rep->values);
+        free(rep->payload);
+        capture_reader_close(&rep->reader);
+        return false;
+    }
+    return true;
+}
+
+// Deterministic replay only: replays the next step_us of the capture and returns once the store thread has
+// consumed it. Returns false once the capture is done.
+bool replay_step(replay *rep, int64_t step_us) {
+    bool more = replay_advance(rep, rep->position_us + step_us);
+    while(rep->pipeline->consumed_batches.load(std::memory_order_acquire) < rep->batches_pushed) {
+        platform_sleep_ms(0);
+    }
+    if(!more) {
+        rep->finished.store(1, std::memory_order_release);
+    }
+    return more;
+}
+
+void replay_set_speed(replay *rep, double speed) {
+    rep->speed.store(speed, std::memory_order_relaxed);
+}
+
+bool replay_finished(replay *rep) {
+    return rep->finished.load(std::memory_order_acquire) != 0;
+}
+
+void replay_stop(replay *rep) {
+    if(!rep->deterministic) {
+        rep->running.store(0, std::memory_order_release);
+        platform_thread_join(&rep->thread);
+    }
+    free(rep->order);
+    free(rep->timestamps_us);
+    free(rep->values);
+    free(rep->payload);
+    capture_reader_close(&rep->reader);
+}
@@ -0,0 +1,143 @@
+// Request pipelining.
+// Every request gets a sequence id in its frame header and the device echoes it in the reply, so several
+// requests can be in flight and replies can be matched in any order. The UI queues requests, the I/O
+// thread moves them into the in-flight window and completes them from the replies.
+
+#define REQUEST_MAX_FRAME_SIZE 512
+#define REQUEST_QUEUE_SIZE 64
+// Has to be a power of two, the in-flight slot of a request is sequence % REQUEST_MAX_IN_FLIGHT
+#define REQUEST_MAX_IN_FLIGHT 64
+#define REQUEST_DEFAULT_WINDOW 8
+#define REQUEST_TIMEOUT_MS 2000
+
+enum request_status {
+    request_status_pending = 0,
+    request_status_ok,
+    request_status_failed,
+    request_status_timed_out
+};
+
+// Called on the I/O thread, header and payload are NULL unless status is request_status_ok
+typedef void (*request_callback)(void *user_data, int status, const frame_header *header, const char *payload);
+
+typedef struct {
+    char frame[REQUEST_MAX_FRAME_SIZE];
+    int length;
+    request_callback callback;
+    void *user_data;
+} request;
+
+typedef struct {
+    request entries[REQUEST_QUEUE_SIZE];
+    int head;
+    int count;
+} request_queue;
+
+typedef struct {
+    // 0 when the slot is free
+    uint32_t sequence;
+    uint64_t sent_ns;
+    request_callback callback;
+    void *user_data;
+} in_flight_request;
+
+typedef struct {
+    in_flight_request slots[REQUEST_MAX_IN_FLIGHT];
+    int in_flight;
+    uint32_t next_sequence;
+} request_table;
+
+// For callers that would rather poll than get a callback, pass request_future_complete with the future
+typedef struct {
+    std::atomic<int> status;
+    frame_header header;
+    char payload[REQUEST_MAX_FRAME_SIZE];
+    int payload_length;
+} request_future;
+
+void request_future_complete(void *user_data, int status, const frame_header *header, const char *payload) {
+    request_future *future = (request_future *)user_data;
+    if(status == request_status_ok) {
+        future->header = *header;
+        future->payload_length = header->payload_length < REQUEST_MAX_FRAME_SIZE
+                               ? header->payload_length : REQUEST_MAX_FRAME_SIZE;
+        memcpy(future->payload, payload, future->payload_length);
+    }
+    future->status.store(status, std::memory_order_release);
+}
+
+bool request_queue_push(request_queue *queue, const tcp_message *message, request_callback callback,
+                        void *user_data) {
+    if(queue->count == REQUEST_QUEUE_SIZE || message->bytes_to_transmit < (int)sizeof(frame_header) ||
+       message->bytes_to_transmit > REQUEST_MAX_FRAME_SIZE) {
+        return false;
+    }
+    request *entry = &queue->entries[(queue->head + queue->count) % REQUEST_QUEUE_SIZE];
+    memcpy(entry->frame, message->buffer, message->bytes_to_transmit);
+    entry->length = message->bytes_to_transmit;
+    entry->callback = callback;
+    entry->user_data = user_data;
+    queue->count++;
+    return true;
+}
+
+request *request_queue_front(request_queue *queue) {
+    return queue->count ? &queue->entries[queue->head] : NULL;
+}
+
+void request_queue_pop(request_queue *queue) {
+    queue->head = (queue->head + 1) % REQUEST_QUEUE_SIZE;
+    queue->count--;
+}
+
+// Returns the slot the next request would go into, NULL if it is still taken by an old request
+in_flight_request *request_table_next_slot(request_table *table) {
+    if(table->next_sequence == 0) {
+        // 0 means "not a reply" on the wire
+        table->next_sequence = 1;
+    }
+    in_flight_request *slot = &table->slots[table->next_sequence % REQUEST_MAX_IN_FLIGHT];
+    return slot->sequence == 0 ? slot : NULL;
+}
+
+// Stamps the sequence into the frame and takes the slot
+void request_table_begin(request_table *table, in_flight_request *slot, request *entry, uint64_t now) {
+    uint32_t sequence = table->next_sequence++;
+    memcpy(entry->frame + offsetof(frame_header, sequence), &sequence, sizeof(sequence));
+    slot->sequence = sequence;
+    slot->sent_ns = now;
+    slot->callback = entry->callback;
+    slot->user_data = entry->user_data;
+    table->in_flight++;
+}
+
+// Returns false if nothing is waiting for this sequence, e.g. it timed out already
+bool request_table_complete(request_table *table, const frame_header *header, const char *payload,
+                            uint64_t *round_trip_ns) {
+    in_flight_request *slot = &table->slots[header->sequence % REQUEST_MAX_IN_FLIGHT];
+    if(slot->sequence != header->sequence) {
+        return false;
+    }
+    *round_trip_ns = platform_time_ns() - slot->sent_ns;
+    slot->sequence = 0;
+    table->in_flight--;
+    if(slot->callback) {
+        slot->callback(slot->user_data, request_status_ok, header, payload);
+    }
+    return true;
+}
+
+// Fails everything in flight that is older than timeout_ns, or everything if timeout_ns is 0
+void request_table_fail(request_table *table, int status, uint64_t now, uint64_t timeout_ns) {
+    for(int i = 0; i < REQUEST_MAX_IN_FLIGHT && table->in_flight > 0; i++) {
+        in_flight_request *slot = &table->slots[i];
+        if(slot->sequence == 0 || (timeout_ns && now - slot->sent_ns < timeout_ns)) {
+            continue;
+        }
+        slot->sequence = 0;
+        table->in_flight--;
+        if(slot->callback) {
+            slot->callback(slot->user_data, status, NULL, NULL);
+        }
+    }
+}
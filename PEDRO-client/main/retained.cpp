@@ -0,0 +1,197 @@
+// Retained panels.
+// A panel whose content didn't change since the last frame gets last frame's vertices and indices copied back into
+// the draw list instead of being drawn again. The caller says what the panel shows with a key, a version or a hash
+// of its content, and draws between retained_begin() and retained_end() when the key changed. The rect, the clip
+// rect, the style and the font are checked here, changing any of them draws the panel again. Only what goes into
+// the draw list is kept, so widgets, which have to be submitted every frame, don't belong in a retained panel.
+//
+//     if(!retained_reuse(&panel, draw, key, min, max)) {
+//         retained_begin(&panel, draw);
+//         ...
+//         retained_end(&panel, draw);
+//     }
+
+typedef struct {
+    ImVec4 clip_rect;
+    ImTextureID texture;
+    int vertex_count;
+    int index_count;
+} retained_command;
+
+typedef struct {
+    bool valid;
+    uint64_t key;
+    uint64_t style_key;
+    ImVec4 rect;
+    ImVec4 clip_rect;
+    // Where the panel started in the draw list it is being drawn into
+    int first_command;
+    int first_index;
+    // Indices are relative to the first vertex of their command
+    retained_command *commands;
+    int command_count;
+    int command_capacity;
+    ImDrawVert *vertices;
+    int vertex_count;
+    int vertex_capacity;
+    ImDrawIdx *indices;
+    int index_count;
+    int index_capacity;
+    uint64_t reused;
+    uint64_t drawn;
+} retained_panel;
+
+// Off draws every panel every frame, to compare against
+bool retained_enabled = true;
+
+// 8 bytes at a time, for keys over a style or a few fields
+uint64_t retained_hash(const void *data, int size, uint64_t hash = 0x9E3779B97F4A7C15ull) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    int i = 0;
+    for(; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    for(; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Everything besides the content that changes how a panel looks. Colors and vars pushed for a panel count, as does
+// the font and its size, the atlas texture and the anti-aliasing flags.
+uint64_t retained_style_key() {
+    ImGuiIO &io = ImGui::GetIO();
+    ImFont *font = ImGui::GetFont();
+    float font_size = ImGui::GetFontSize();
+    ImTextureID texture = io.Fonts->TexID;
+    ImDrawListFlags flags = ImGui::GetDrawListSharedData()->InitialFlags;
+    uint64_t key = retained_hash(&ImGui::GetStyle(), sizeof(ImGuiStyle));
+    key = retained_hash(&font, sizeof(font), key);
+    key = retained_hash(&font_size, sizeof(font_size), key);
+    key = retained_hash(&texture, sizeof(texture), key);
+    return retained_hash(&flags, sizeof(flags), key);
+}
+
+void retained_free(retained_panel *panel) {
+    free(panel->commands);
+    free(panel->vertices);
+    free(panel->indices);
+    *panel = {};
+}
+
+// Grows *data to hold count items, false if it couldn't
+bool retained_reserve(void **data, int *capacity, int count, size_t item_size) {
+    if(count <= *capacity) {
+        return true;
+    }
+    int grown = *capacity * 2 > count ? *capacity * 2 : count;
+    void *resized = realloc(*data, grown * item_size);
+    if(!resized) {
+        return false;
+    }
+    *data = resized;
+    *capacity = grown;
+    return true;
+}
+
+// Adds what was kept to draw when the key, the rect and the rest are the same as then. Otherwise takes them down
+// for retained_end() and the panel has to be drawn.
+bool retained_reuse(retained_panel *panel, ImDrawList *draw, uint64_t key, ImVec2 min, ImVec2 max) {
+    uint64_t style_key = retained_style_key();
+    ImVec4 rect(min.x, min.y, max.x, max.y);
+    ImVec4 clip_rect = draw->_CmdHeader.ClipRect;
+    bool same = panel->valid && retained_enabled && panel->key == key && panel->style_key == style_key &&
+                memcmp(&panel->rect, &rect, sizeof(rect)) == 0 &&
+                memcmp(&panel->clip_rect, &clip_rect, sizeof(clip_rect)) == 0;
+    if(!same) {
+        panel->valid = false;
+        panel->key = key;
+        panel->style_key = style_key;
+        panel->rect = rect;
+        panel->clip_rect = clip_rect;
+        panel->drawn++;
+        return false;
+    }
+
+    const ImDrawVert *vertices = panel->vertices;
+    const ImDrawIdx *indices = panel->indices;
+    for(int c = 0; c < panel->command_count; c++) {
+        const retained_command *command = &panel->commands[c];
+        draw->PushClipRect(ImVec2(command->clip_rect.x, command->clip_rect.y),
+                           ImVec2(command->clip_rect.z, command->clip_rect.w));
+        draw->PushTextureID(command->texture);
+        draw->PrimReserve(command->index_count, command->vertex_count);
+        memcpy(draw->_VtxWritePtr, vertices, command->vertex_count * sizeof(ImDrawVert));
+        ImDrawIdx base = (ImDrawIdx)draw->_VtxCurrentIdx;
+        for(int i = 0; i < command->index_count; i++) {
+            draw->_IdxWritePtr[i] = (ImDrawIdx)(base + indices[i]);
+        }
+        draw->_VtxWritePtr += command->vertex_count;
+        draw->_IdxWritePtr += command->index_count;
+        draw->_VtxCurrentIdx += command->vertex_count;
+        draw->PopTextureID();
+        draw->PopClipRect();
+        vertices += command->vertex_count;
+        indices += command->index_count;
+    }
+    panel->reused++;
+    return true;
+}
+
+void retained_begin(retained_panel *panel, ImDrawList *draw) {
+    panel->first_command = draw->CmdBuffer.Size - 1;
+    panel->first_index = draw->IdxBuffer.Size;
+}
+
+// Keeps what was drawn since retained_begin(), every command's part of it with the vertices it uses
+void retained_end(retained_panel *panel, ImDrawList *draw) {
+    panel->command_count = 0;
+    panel->vertex_count = 0;
+    panel->index_count = 0;
+    // An empty command at the start can have been merged into the one before it
+    int first_command = panel->first_command > 0 ? panel->first_command - 1 : 0;
+    for(int c = first_command; c < draw->CmdBuffer.Size; c++) {
+        const ImDrawCmd *command = &draw->CmdBuffer[c];
+        int from = (int)command->IdxOffset > panel->first_index ? (int)command->IdxOffset : panel->first_index;
+        int to = (int)(command->IdxOffset + command->ElemCount);
+        if(to <= from) {
+            continue;
+        }
+        // Callbacks can't be played back
+        if(command->UserCallback) {
+            return;
+        }
+        const ImDrawIdx *indices = draw->IdxBuffer.Data + from;
+        int lowest = indices[0];
+        int highest = indices[0];
+        for(int i = 1; i < to - from; i++) {
+            lowest = indices[i] < lowest ? indices[i] : lowest;
+            highest = indices[i] > highest ? indices[i] : highest;
+        }
+        int vertex_count = highest - lowest + 1;
+        if(!retained_reserve((void **)&panel->commands, &panel->command_capacity, panel->command_count + 1,
+                             sizeof(retained_command)) ||
+           !retained_reserve((void **)&panel->vertices, &panel->vertex_capacity, panel->vertex_count + vertex_count,
+                             sizeof(ImDrawVert)) ||
+           !retained_reserve((void **)&panel->indices, &panel->index_capacity, panel->index_count + to - from,
+                             sizeof(ImDrawIdx))) {
+            return;
+        }
+        retained_command *kept = &panel->commands[panel->command_count++];
+        kept->clip_rect = command->ClipRect;
+        kept->texture = command->TextureId;
+        kept->vertex_count = vertex_count;
+        kept->index_count = to - from;
+        memcpy(panel->vertices + panel->vertex_count, draw->VtxBuffer.Data + command->VtxOffset + lowest,
+               vertex_count * sizeof(ImDrawVert));
+        for(int i = 0; i < to - from; i++) {
+            panel->indices[panel->index_count + i] = (ImDrawIdx)(indices[i] - lowest);
+        }
+        panel->vertex_count += vertex_count;
+        panel->index_count += to - from;
+    }
+    panel->valid = true;
+}
@@ -0,0 +1,169 @@
+// Frame scheduling.
+// The UI renders a frame when something it shows could have changed and sleeps otherwise. Four things are due a
+// frame: input, samples for a channel that was on screen in the last frame, an animation deadline asked for while
+// drawing, and a timer for what is only polled (connection states, discovery, recording counters). Input is owed a
+// few frames more, ImGui settles a click or a resize over the frames after it. Frames for samples are spaced by at
+// least data_interval_ns, a channel streaming at kHz doesn't render at kHz.
+// The store thread reports the channels every drain appended to, the UI says while drawing which channels it shows.
+// Both go through a 64 bit mask with a bit per channel hash, a collision costs a frame and nothing else.
+//
+//     while(!frame_scheduler_due(scheduler, platform_time_ns(), &wait_ns)) {
+//         // input calls frame_scheduler_input()
+//         wait on scheduler->wake, the input, for at most frame_scheduler_wait_ms(wait_ns)
+//     }
+//     frame_scheduler_begin(scheduler, platform_time_ns());
+//     ... frame_scheduler_watch(), frame_scheduler_animate() while drawing ...
+//     frame_scheduler_end(scheduler);
+
+#define SCHEDULER_DEFAULT_SETTLE_FRAMES 3
+#define SCHEDULER_DEFAULT_TIMER_NS (250 * 1000000ULL)
+// 60 Hz
+#define SCHEDULER_DEFAULT_DATA_INTERVAL_NS (1000000000ULL / 60)
+
+enum frame_reason {
+    frame_reason_input = 0,
+    frame_reason_data = 1,
+    frame_reason_animation = 2,
+    frame_reason_timer = 3,
+    frame_reason_count = 4
+};
+
+typedef struct {
+    // Any thread
+    // Channels shown in the last frame
+    std::atomic<uint64_t> watched;
+    // Bumped for every drain that appended to a watched channel
+    std::atomic<uint64_t> data_version;
+    // Signaled along with data_version
+    platform_event wake;
+
+    // UI thread only
+    int settle_frames;
+    uint64_t timer_ns;
+    uint64_t data_interval_ns;
+    uint64_t watching;
+    uint64_t seen_data_version;
+    int owed_frames;
+    // 0 when no animation asked for a frame
+    uint64_t animation_ns;
+    uint64_t next_timer_ns;
+    uint64_t last_frame_ns;
+    // What the frame that is due is for, a bit per frame_reason
+    int reasons;
+
+    uint64_t frames;
+    uint64_t input_events;
+    // A frame can have more than one reason
+    uint64_t reason_frames[frame_reason_count];
+} frame_scheduler;
+
+uint64_t frame_scheduler_channel_bit(uint32_t channel_id) {
+    return 1ULL << ((channel_id * 0x9E3779B1u) >> 26);
+}
+
+void frame_scheduler_init(frame_scheduler *scheduler, int settle_frames, uint64_t timer_ns,
+                          uint64_t data_interval_ns) {
+    scheduler->watched.store(0);
+    scheduler->data_version.store(0);
+    platform_event_init(&scheduler->wake);
+    scheduler->settle_frames = settle_frames;
+    scheduler->timer_ns = timer_ns;
+    scheduler->data_interval_ns = data_interval_ns;
+    scheduler->watching = 0;
+    scheduler->seen_data_version = 0;
+    // The first frame is due right away
+    scheduler->owed_frames = 1;
+    scheduler->animation_ns = 0;
+    scheduler->next_timer_ns = 0;
+    scheduler->last_frame_ns = 0;
+    scheduler->reasons = 0;
+    scheduler->frames = 0;
+    scheduler->input_events = 0;
+    memset(scheduler->reason_frames, 0, sizeof(scheduler->reason_frames));
+}
+
+void frame_scheduler_destroy(frame_scheduler *scheduler) {
+    platform_event_destroy(&scheduler->wake);
+}
+
+// Store thread, channels is the mask of frame_scheduler_channel_bit() of the channels a drain appended to
+void frame_scheduler_samples(frame_scheduler *scheduler, uint64_t channels) {
+    if(channels & scheduler->watched.load(std::memory_order_relaxed)) {
+        scheduler->data_version.fetch_add(1, std::memory_order_release);
+        platform_event_signal(&scheduler->wake);
+    }
+}
+
+void frame_scheduler_input(frame_scheduler *scheduler) {
+    scheduler->owed_frames = scheduler->settle_frames > 1 ? scheduler->settle_frames : 1;
+    scheduler->input_events++;
+}
+
+// While drawing, the channel is on screen
+void frame_scheduler_watch(frame_scheduler *scheduler, uint32_t channel_id) {
+    scheduler->watching |= frame_scheduler_channel_bit(channel_id);
+}
+
+// While drawing, something moves on its own and wants a frame in delay_ns, 0 for the next one
+void frame_scheduler_animate(frame_scheduler *scheduler, uint64_t now_ns, uint64_t delay_ns) {
+    uint64_t deadline_ns = now_ns + delay_ns;
+    if(scheduler->animation_ns == 0 || deadline_ns < scheduler->animation_ns) {
+        scheduler->animation_ns = deadline_ns;
+    }
+}
+
+// True if a frame is due, otherwise *wait_ns is how long until one is unless something happens before
+bool frame_scheduler_due(frame_scheduler *scheduler, uint64_t now_ns, uint64_t *wait_ns) {
+    int reasons = 0;
+    uint64_t next_ns = scheduler->next_timer_ns;
+    if(scheduler->owed_frames > 0) {
+        reasons |= 1 << frame_reason_input;
+    }
+    if(now_ns >= scheduler->next_timer_ns) {
+        reasons |= 1 << frame_reason_timer;
+    }
+    if(scheduler->animation_ns) {
+        if(now_ns >= scheduler->animation_ns) {
+            reasons |= 1 << frame_reason_animation;
+        }
+        next_ns = scheduler->animation_ns < next_ns ? scheduler->animation_ns : next_ns;
+    }
+    if(scheduler->data_version.load(std::memory_order_acquire) != scheduler->seen_data_version) {
+        uint64_t data_ns = scheduler->last_frame_ns + scheduler->data_interval_ns;
+        if(now_ns >= data_ns) {
+            reasons |= 1 << frame_reason_data;
+        }
+        next_ns = data_ns < next_ns ? data_ns : next_ns;
+    }
+    scheduler->reasons = reasons;
+    *wait_ns = reasons ? 0 : next_ns - now_ns;
+    return reasons != 0;
+}
+
+// Rounded up, a wait that ends early only comes back to frame_scheduler_due()
+int frame_scheduler_wait_ms(uint64_t wait_ns) {
+    uint64_t wait_ms = (wait_ns + 999999) / 1000000;
+    return wait_ms < 1000 ? (int)wait_ms : 1000;
+}
+
+void frame_scheduler_begin(frame_scheduler *scheduler, uint64_t now_ns) {
+    for(int reason = 0; reason < frame_reason_count; reason++) {
+        if(scheduler->reasons & (1 << reason)) {
+            scheduler->reason_frames[reason]++;
+        }
+    }
+    scheduler->owed_frames -= scheduler->owed_frames > 0;
+    if(scheduler->animation_ns && now_ns >= scheduler->animation_ns) {
+        scheduler->animation_ns = 0;
+    }
+    scheduler->seen_data_version = scheduler->data_version.load(std::memory_order_acquire);
+    scheduler->next_timer_ns = now_ns + scheduler->timer_ns;
+    scheduler->last_frame_ns = now_ns;
+    scheduler->watching = 0;
+    scheduler->frames++;
+}
+
+// What was watched while drawing is what wakes the next frame
+void frame_scheduler_end(frame_scheduler *scheduler) {
+    scheduler->watched.store(scheduler->watching, std::memory_order_relaxed);
+}
@@ -0,0 +1,255 @@
+// Rolling statistics.
+// Every channel keeps mean, standard deviation, min, max, RMS and rates over a sliding time window that ends at its
+// newest sample, updated as samples come in at a constant cost per sample whatever the window holds. The samples of
+// the window are kept in a ring. Mean and variance are Welford sums that samples are added to and taken back out of
+// as they leave the window, min and max come from monotonic deques of ring positions: the min deque holds the
+// samples that are smaller than everything after them, so the oldest entry is the min of the window.
+// Taking samples out of Welford sums loses a little precision every time, so they are recomputed from the ring once
+// as many samples have left as it holds, which keeps the cost per sample constant too.
+// NaN samples are left out. Only the ingest store thread updates, the UI gets the summaries through the ingest
+// snapshot.
+
+#define STATS_MAX_CHANNELS 1024
+#define STATS_DEFAULT_WINDOW_US 1000000LL
+// Samples that have to leave the window before the sums are recomputed, at least
+#define STATS_MIN_REBUILD 65536
+
+typedef struct {
+    uint32_t count;
+    float mean;
+    // Of the samples in the window, not an estimate for a larger population
+    float stddev;
+    float min;
+    float max;
+    float rms;
+    // Samples per second, and how fast the value changed from the oldest sample to the newest
+    float rate_hz;
+    float slope_per_s;
+} stats_summary;
+
+typedef struct {
+    uint32_t channel_id;
+    // Samples head..tail-1 of the channel, sample n is at n & (capacity - 1)
+    int64_t *timestamps_us;
+    float *values;
+    uint64_t capacity;
+    uint64_t head;
+    uint64_t tail;
+    // Welford sums of the samples in the window
+    double mean;
+    double m2;
+    uint64_t removed;
+    // Sample numbers, the same ring layout. Values increase from the front of the min deque, decrease in the max one.
+    uint64_t *min_deque;
+    uint64_t min_head;
+    uint64_t min_tail;
+    uint64_t *max_deque;
+    uint64_t max_head;
+    uint64_t max_tail;
+} stats_channel;
+
+typedef struct {
+    std::atomic<int64_t> window_us;
+    stats_channel *channels[STATS_MAX_CHANNELS];
+    int channel_count;
+    stats_channel *last_channel;
+} stats_engine;
+
+void stats_init(stats_engine *stats, int64_t window_us) {
+    stats->window_us.store(window_us);
+    stats->channel_count = 0;
+    stats->last_channel = NULL;
+}
+
+void stats_destroy(stats_engine *stats) {
+    for(int i = 0; i < stats->channel_count; i++) {
+        free(stats->channels[i]->timestamps_us);
+        free(stats->channels[i]->values);
+        free(stats->channels[i]->min_deque);
+        free(stats->channels[i]->max_deque);
+        free(stats->channels[i]);
+    }
+    stats->channel_count = 0;
+    stats->last_channel = NULL;
+}
+
+// Can be called from any thread, takes effect with the next samples of every channel
+void stats_set_window(stats_engine *stats, int64_t window_us) {
+    stats->window_us.store(window_us > 0 ? window_us : 1, std::memory_order_relaxed);
+}
+
+stats_channel *stats_channel_for(stats_engine *stats, uint32_t channel_id) {
+    if(stats->last_channel && stats->last_channel->channel_id == channel_id) {
+        return stats->last_channel;
+    }
+    stats_channel *channel = NULL;
+    for(int i = 0; i < stats->channel_count && !channel; i++) {
+        if(stats->channels[i]->channel_id == channel_id) {
+            channel = stats->channels[i];
+        }
+    }
+    if(!channel && stats->channel_count < STATS_MAX_CHANNELS) {
+        channel = (stats_channel *)calloc(1, sizeof(stats_channel));
+        if(!channel) {
+            return NULL;
+        }
+        channel->channel_id = channel_id;
+        stats->channels[stats->channel_count++] = channel;
+    }
+    stats->last_channel = channel;
+    return channel;
+}
+
+// Doubles the rings, the deques keep their sample numbers
+bool stats_grow(stats_channel *channel) {
+    uint64_t capacity = channel->capacity ? channel->capacity * 2 : 1024;
+    int64_t *timestamps_us = (int64_t *)malloc(capacity * sizeof(int64_t));
+    float *values = (float *)malloc(capacity * sizeof(float));
+    uint64_t *min_deque = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+    uint64_t *max_deque = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+    if(!timestamps_us || !values || !min_deque || !max_deque) {
+        free(timestamps_us);
+        free(values);
+        free(min_deque);
+        free(max_deque);
+        return false;
+    }
+    uint64_t old_mask = channel->capacity - 1;
+    uint64_t mask = capacity - 1;
+    for(uint64_t n = channel->head; n < channel->tail; n++) {
+        timestamps_us[n & mask] = channel->timestamps_us[n & old_mask];
+        values[n & mask] = channel->values[n & old_mask];
+    }
+    for(uint64_t n = channel->min_head; n < channel->min_tail; n++) {
+        min_deque[n & mask] = channel->min_deque[n & old_mask];
+    }
+    for(uint64_t n = channel->max_head; n < channel->max_tail; n++) {
+        max_deque[n & mask] = channel->max_deque[n & old_mask];
+    }
+    free(channel->timestamps_us);
+    free(channel->values);
+    free(channel->min_deque);
+    free(channel->max_deque);
+    channel->timestamps_us = timestamps_us;
+    channel->values = values;
+    channel->min_deque = min_deque;
+    channel->max_deque = max_deque;
+    channel->capacity = capacity;
+    return true;
+}
+
+// Two passes over the window, exact again
+void stats_rebuild(stats_channel *channel) {
+    uint64_t mask = channel->capacity - 1;
+    uint64_t count = channel->tail - channel->head;
+    double sum = 0.0;
+    for(uint64_t n = channel->head; n < channel->tail; n++) {
+        sum += channel->values[n & mask];
+    }
+    double mean = count ? sum / count : 0.0;
+    double m2 = 0.0;
+    for(uint64_t n = channel->head; n < channel->tail; n++) {
+        double delta = channel->values[n & mask] - mean;
+        m2 += delta * delta;
+    }
+    channel->mean = mean;
+    channel->m2 = m2;
+    channel->removed = 0;
+}
+
+// Store thread only. Timestamps have to increase within a channel, the store drops the ones that don't and so
+// does this.
+void stats_update(stats_engine *stats, uint32_t channel_id, const int64_t *timestamps_us, const float *values,
+                  int count) {
+    stats_channel *channel = stats_channel_for(stats, channel_id);
+    if(!channel) {
+        return;
+    }
+    int64_t window_us = stats->window_us.load(std::memory_order_relaxed);
+    for(int i = 0; i < count; i++) {
+        float value = values[i];
+        int64_t timestamp_us = timestamps_us[i];
+        if(value != value ||
+           (channel->tail > channel->head &&
+            timestamp_us <= channel->timestamps_us[(channel->tail - 1) & (channel->capacity - 1)])) {
+            continue;
+        }
+        uint64_t mask = channel->capacity - 1;
+
+        // Out with what falls out of the window, the new sample stays in whatever the window is
+        int64_t oldest_us = timestamp_us - window_us;
+        while(channel->head < channel->tail && channel->timestamps_us[channel->head & mask] <= oldest_us) {
+            double old = channel->values[channel->head & mask];
+            uint64_t remaining = channel->tail - channel->head - 1;
+            if(remaining == 0) {
+                channel->mean = 0.0;
+                channel->m2 = 0.0;
+            } else {
+                double mean = channel->mean - (old - channel->mean) / remaining;
+                channel->m2 -= (old - channel->mean) * (old - mean);
+                channel->mean = mean;
+            }
+            channel->head++;
+            channel->removed++;
+        }
+        while(channel->min_head < channel->min_tail && channel->min_deque[channel->min_head & mask] < channel->head) {
+            channel->min_head++;
+        }
+        while(channel->max_head < channel->max_tail && channel->max_deque[channel->max_head & mask] < channel->head) {
+            channel->max_head++;
+        }
+
+        if(channel->tail - channel->head == channel->capacity) {
+            if(!stats_grow(channel)) {
+                return;
+            }
+            mask = channel->capacity - 1;
+        }
+        uint64_t n = channel->tail++;
+        channel->timestamps_us[n & mask] = timestamp_us;
+        channel->values[n & mask] = value;
+        double delta = value - channel->mean;
+        channel->mean += delta / (channel->tail - channel->head);
+        channel->m2 += delta * (value - channel->mean);
+        while(channel->min_head < channel->min_tail &&
+              channel->values[channel->min_deque[(channel->min_tail - 1) & mask] & mask] >= value) {
+            channel->min_tail--;
+        }
+        channel->min_deque[channel->min_tail++ & mask] = n;
+        while(channel->max_head < channel->max_tail &&
+              channel->values[channel->max_deque[(channel->max_tail - 1) & mask] & mask] <= value) {
+            channel->max_tail--;
+        }
+        channel->max_deque[channel->max_tail++ & mask] = n;
+
+        uint64_t in_window = channel->tail - channel->head;
+        if(channel->removed >= (in_window > STATS_MIN_REBUILD ? in_window : STATS_MIN_REBUILD)) {
+            stats_rebuild(channel);
+        }
+    }
+}
+
+// Store thread only
+void stats_summarize(stats_engine *stats, uint32_t channel_id, stats_summary *summary) {
+    memset(summary, 0, sizeof(*summary));
+    stats_channel *channel = stats_channel_for(stats, channel_id);
+    if(!channel || channel->tail == channel->head) {
+        return;
+    }
+    uint64_t mask = channel->capacity - 1;
+    uint64_t count = channel->tail - channel->head;
+    double variance = channel->m2 > 0.0 ? channel->m2 / count : 0.0;
+    summary->count = (uint32_t)count;
+    summary->mean = (float)channel->mean;
+    summary->stddev = (float)sqrt(variance);
+    summary->min = channel->values[channel->min_deque[channel->min_head & mask] & mask];
+    summary->max = channel->values[channel->max_deque[channel->max_head & mask] & mask];
+    summary->rms = (float)sqrt(variance + channel->mean * channel->mean);
+    int64_t span_us = channel->timestamps_us[(channel->tail - 1) & mask] -
+                      channel->timestamps_us[channel->head & mask];
+    if(span_us > 0) {
+        summary->rate_hz = (float)((count - 1) * 1e6 / span_us);
+        summary->slope_per_s = (float)(((double)channel->values[(channel->tail - 1) & mask] -
+                                        channel->values[channel->head & mask]) * 1e6 / span_us);
+    }
+}
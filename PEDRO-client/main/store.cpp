@@ -0,0 +1,687 @@
+// Sample store.
+// One append-only column per channel, kept as fixed-size chunks with timestamps and values in separate
+// arrays. The chunks of a column form a ring, the oldest ones are dropped once they fall out of the
+// retention window or the store goes over its memory budget.
+// Every column also keeps a min/max/mean pyramid, level n has one bucket per STORE_PYRAMID_BASE << n samples.
+// Zoomed out views read about two buckets per pixel from it instead of the samples, so drawing costs the
+// same for an hour of history as for a second. The pyramid isn't subject to the memory budget, only to the
+// time retention, it outlives the samples.
+// Every chunk also keeps the min and max of its values, a zone map that lets searches skip it, see query.cpp.
+// Only one thread appends (the ingest store thread), it reads column metadata without locking and takes
+// the column lock to change it. Readers hold the column lock for as long as they look at the data.
+
+#define STORE_CHUNK_SAMPLES 4096
+#define STORE_MAX_COLUMNS 1024
+#define STORE_PYRAMID_BASE 64
+#define STORE_PYRAMID_LEVELS 24
+
+typedef struct {
+    int count;
+    float min;
+    float max;
+    int64_t timestamps_us[STORE_CHUNK_SAMPLES];
+    float values[STORE_CHUNK_SAMPLES];
+} store_chunk;
+
+// A ring of buckets in separate arrays plus the bucket that is still being filled. Buckets of level 0
+// summarise STORE_PYRAMID_BASE samples, the ones above two buckets of the level below.
+typedef struct {
+    int64_t *timestamps_us;
+    float *mins;
+    float *maxs;
+    float *means;
+    int capacity;
+    int head;
+    int count;
+
+    int64_t partial_timestamp_us;
+    float partial_min;
+    float partial_max;
+    double partial_sum;
+    int partial_count;
+} store_level;
+
+typedef struct {
+    uint32_t channel_id;
+    platform_mutex lock;
+    store_level levels[STORE_PYRAMID_LEVELS];
+    // Ring of chunk pointers, the capacity is a power of two and doubles when it runs out
+    store_chunk **chunks;
+    int capacity;
+    int head;
+    int chunk_count;
+    uint64_t sample_count;
+    int64_t last_timestamp_us;
+    // Samples that didn't come after the last one, they'd break the binary search
+    uint64_t out_of_order;
+    uint64_t evicted;
+} store_column;
+
+typedef struct {
+    // Oldest data goes first once either is exceeded, 0 means unlimited
+    std::atomic<int64_t> retention_us;
+    std::atomic<int64_t> retention_bytes;
+
+    // Columns are never removed, a column is in place before column_count covers it
+    store_column *columns[STORE_MAX_COLUMNS];
+    std::atomic<int> column_count;
+    store_column *last_column;
+
+    // Samples only, the budget applies to these
+    std::atomic<int64_t> bytes;
+    std::atomic<int64_t> pyramid_bytes;
+    std::atomic<uint64_t> sample_count;
+    // One evicted chunk is kept around for the next allocation
+    store_chunk *spare;
+} sample_store;
+
+// Position of a sample, chunk is relative to the oldest chunk of the column
+typedef struct {
+    int chunk;
+    int index;
+} store_position;
+
+// One horizontal pixel of a plot, count is 0 where there is no data
+typedef struct {
+    float min;
+    float max;
+    float mean;
+    int count;
+} store_envelope_pixel;
+
+void store_init(sample_store *store, int64_t retention_us, int64_t retention_bytes) {
+    store->retention_us.store(retention_us);
+    store->retention_bytes.store(retention_bytes);
+    store->column_count.store(0);
+    store->last_column = NULL;
+    store->bytes.store(0);
+    store->pyramid_bytes.store(0);
+    store->sample_count.store(0);
+    store->spare = NULL;
+}
+
+void store_destroy(sample_store *store) {
+    for(int i = 0; i < store->column_count.load(); i++) {
+        store_column *column = store->columns[i];
+        for(int j = 0; j < column->chunk_count; j++) {
+            free(column->chunks[(column->head + j) & (column->capacity - 1)]);
+        }
+        free(column->chunks);
+        for(int j = 0; j < STORE_PYRAMID_LEVELS; j++) {
+            free(column->levels[j].timestamps_us);
+            free(column->levels[j].mins);
+            free(column->levels[j].maxs);
+            free(column->levels[j].means);
+        }
+        platform_mutex_destroy(&column->lock);
+        free(column);
+    }
+    free(store->spare);
+    store->column_count.store(0);
+}
+
+store_chunk *store_column_chunk(store_column *column, int chunk) {
+    return column->chunks[(column->head + chunk) & (column->capacity - 1)];
+}
+
+// Readers only, returns NULL for a channel nothing was stored for yet
+store_column *store_find_column(sample_store *store, uint32_t channel_id) {
+    int column_count = store->column_count.load(std::memory_order_acquire);
+    for(int i = 0; i < column_count; i++) {
+        if(store->columns[i]->channel_id == channel_id) {
+            return store->columns[i];
+        }
+    }
+    return NULL;
+}
+
+// Writer only, creates the column on first use
+store_column *store_column_for(sample_store *store, uint32_t channel_id) {
+    if(store->last_column && store->last_column->channel_id == channel_id) {
+        return store->last_column;
+    }
+    store_column *column = store_find_column(store, channel_id);
+    int column_count = store->column_count.load(std::memory_order_relaxed);
+    if(!column && column_count < STORE_MAX_COLUMNS) {
+        column = (store_column *)calloc(1, sizeof(store_column));
+        if(!column) {
+            return NULL;
+        }
+        column->channel_id = channel_id;
+        column->last_timestamp_us = INT64_MIN;
+        platform_mutex_init(&column->lock);
+        store->columns[column_count] = column;
+        store->column_count.store(column_count + 1, std::memory_order_release);
+        store->bytes.fetch_add(sizeof(store_column), std::memory_order_relaxed);
+    }
+    store->last_column = column;
+    return column;
+}
+
+// Drops the oldest chunk, the caller holds the column lock
+void store_evict_chunk(sample_store *store, store_column *column) {
+    store_chunk *chunk = store_column_chunk(column, 0);
+    column->head = (column->head + 1) & (column->capacity - 1);
+    column->chunk_count--;
+    column->sample_count -= chunk->count;
+    column->evicted += chunk->count;
+    store->sample_count.fetch_sub(chunk->count, std::memory_order_relaxed);
+    if(!store->spare) {
+        store->spare = chunk;
+    } else {
+        free(chunk);
+        store->bytes.fetch_sub(sizeof(store_chunk), std::memory_order_relaxed);
+    }
+}
+
+// Adds an empty chunk at the end of the ring, the caller holds the column lock
+store_chunk *store_push_chunk(sample_store *store, store_column *column) {
+    if(column->chunk_count == column->capacity) {
+        int capacity = column->capacity ? column->capacity * 2 : 16;
+        store_chunk **chunks = (store_chunk **)malloc(capacity * sizeof(store_chunk *));
+        if(!chunks) {
+            return NULL;
+        }
+        for(int i = 0; i < column->chunk_count; i++) {
+            chunks[i] = store_column_chunk(column, i);
+        }
+        free(column->chunks);
+        store->bytes.fetch_add((capacity - column->capacity) * sizeof(store_chunk *), std::memory_order_relaxed);
+        column->chunks = chunks;
+        column->capacity = capacity;
+        column->head = 0;
+    }
+
+    store_chunk *chunk = store->spare;
+    store->spare = NULL;
+    if(!chunk) {
+        chunk = (store_chunk *)malloc(sizeof(store_chunk));
+        if(!chunk) {
+            return NULL;
+        }
+        store->bytes.fetch_add(sizeof(store_chunk), std::memory_order_relaxed);
+    }
+    chunk->count = 0;
+    column->chunks[(column->head + column->chunk_count) & (column->capacity - 1)] = chunk;
+    column->chunk_count++;
+    return chunk;
+}
+
+int store_level_slot(store_level *level, int bucket) {
+    return (level->head + bucket) & (level->capacity - 1);
+}
+
+// Writer only, the caller holds the column lock. Completes a bucket and feeds it into the level above.
+void store_level_push(sample_store *store, store_column *column, int level_index, int64_t timestamp_us, float min,
+                      float max, float mean) {
+    store_level *level = &column->levels[level_index];
+    if(level->count == level->capacity) {
+        int capacity = level->capacity ? level->capacity * 2 : 64;
+        int64_t *timestamps_us = (int64_t *)malloc(capacity * sizeof(int64_t));
+        float *mins = (float *)malloc(capacity * sizeof(float));
+        float *maxs = (float *)malloc(capacity * sizeof(float));
+        float *means = (float *)malloc(capacity * sizeof(float));
+        if(!timestamps_us || !mins || !maxs || !means) {
+            free(timestamps_us);
+            free(mins);
+            free(maxs);
+            free(means);
+            return;
+        }
+        for(int i = 0; i < level->count; i++) {
+            int slot = store_level_slot(level, i);
+            timestamps_us[i] = level->timestamps_us[slot];
+            mins[i] = level->mins[slot];
+            maxs[i] = level->maxs[slot];
+            means[i] = level->means[slot];
+        }
+        free(level->timestamps_us);
+        free(level->mins);
+        free(level->maxs);
+        free(level->means);
+        store->pyramid_bytes.fetch_add((int64_t)(capacity - level->capacity) * (sizeof(int64_t) + 3 * sizeof(float)),
+                                       std::memory_order_relaxed);
+        level->timestamps_us = timestamps_us;
+        level->mins = mins;
+        level->maxs = maxs;
+        level->means = means;
+        level->capacity = capacity;
+        level->head = 0;
+    }
+    int slot = store_level_slot(level, level->count++);
+    level->timestamps_us[slot] = timestamp_us;
+    level->mins[slot] = min;
+    level->maxs[slot] = max;
+    level->means[slot] = mean;
+
+    if(level_index + 1 == STORE_PYRAMID_LEVELS) {
+        return;
+    }
+    store_level *parent = &column->levels[level_index + 1];
+    if(parent->partial_count == 0) {
+        parent->partial_timestamp_us = timestamp_us;
+        parent->partial_min = min;
+        parent->partial_max = max;
+        parent->partial_sum = mean;
+        parent->partial_count = 1;
+        return;
+    }
+    parent->partial_min = min < parent->partial_min ? min : parent->partial_min;
+    parent->partial_max = max > parent->partial_max ? max : parent->partial_max;
+    parent->partial_sum += mean;
+    parent->partial_count = 0;
+    store_level_push(store, column, level_index + 1, parent->partial_timestamp_us, parent->partial_min,
+                     parent->partial_max, (float)(parent->partial_sum / 2));
+}
+
+// Writer only, the caller holds the column lock. chunk is NULL or the chunk the samples went into, its min and max
+// are widened to them. Chunks start at a multiple of STORE_PYRAMID_BASE samples, the bucket is always in the chunk.
+void store_pyramid_append(sample_store *store, store_column *column, const int64_t *timestamps_us,
+                          const float *values, int count, store_chunk *chunk) {
+    store_level *level = &column->levels[0];
+    int i = 0;
+    while(i < count) {
+        if(level->partial_count == 0) {
+            level->partial_timestamp_us = timestamps_us[i];
+            level->partial_min = values[i];
+            level->partial_max = values[i];
+            level->partial_sum = 0.0;
+        }
+        // Whatever is left of the bucket in one go
+        int run = STORE_PYRAMID_BASE - level->partial_count;
+        run = run < count - i ? run : count - i;
+        float min = level->partial_min;
+        float max = level->partial_max;
+        float sum = 0.0f;
+        for(int j = i; j < i + run; j++) {
+            min = values[j] < min ? values[j] : min;
+            max = values[j] > max ? values[j] : max;
+            sum += values[j];
+        }
+        level->partial_min = min;
+        level->partial_max = max;
+        level->partial_sum += sum;
+        if(chunk) {
+            chunk->min = min < chunk->min ? min : chunk->min;
+            chunk->max = max > chunk->max ? max : chunk->max;
+        }
+        level->partial_count += run;
+        i += run;
+
+        if(level->partial_count == STORE_PYRAMID_BASE) {
+            level->partial_count = 0;
+            store_level_push(store, column, 0, level->partial_timestamp_us, min, max,
+                             (float)(level->partial_sum / STORE_PYRAMID_BASE));
+        }
+    }
+}
+
+// First bucket at or after timestamp_us, level->count if there is none
+int store_level_lower_bound(store_level *level, int64_t timestamp_us) {
+    int low = 0;
+    int high = level->count;
+    while(low < high) {
+        int middle = (low + high) / 2;
+        if(level->timestamps_us[store_level_slot(level, middle)] < timestamp_us) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Drops whole chunks that ended before the retention window, never the chunk being appended to
+void store_apply_time_retention(sample_store *store, store_column *column) {
+    int64_t retention_us = store->retention_us.load(std::memory_order_relaxed);
+    if(retention_us <= 0 || column->last_timestamp_us == INT64_MIN) {
+        return;
+    }
+    int64_t oldest_us = column->last_timestamp_us - retention_us;
+    while(column->chunk_count > 1) {
+        store_chunk *chunk = store_column_chunk(column, 0);
+        if(chunk->timestamps_us[chunk->count - 1] >= oldest_us) {
+            break;
+        }
+        store_evict_chunk(store, column);
+    }
+    // A bucket goes once the one after it starts before the window
+    for(int i = 0; i < STORE_PYRAMID_LEVELS; i++) {
+        store_level *level = &column->levels[i];
+        while(level->count > 1 && level->timestamps_us[store_level_slot(level, 1)] < oldest_us) {
+            level->head = store_level_slot(level, 1);
+            level->count--;
+        }
+    }
+}
+
+// Drops the oldest chunk of the whole store until it fits its memory budget again
+void store_apply_memory_retention(sample_store *store) {
+    int64_t retention_bytes = store->retention_bytes.load(std::memory_order_relaxed);
+    int column_count = store->column_count.load(std::memory_order_relaxed);
+    while(retention_bytes > 0 && store->bytes.load(std::memory_order_relaxed) > retention_bytes) {
+        store_column *oldest = NULL;
+        for(int i = 0; i < column_count; i++) {
+            store_column *column = store->columns[i];
+            if(column->chunk_count > 1 && (!oldest || store_column_chunk(column, 0)->timestamps_us[0] <
+                                                      store_column_chunk(oldest, 0)->timestamps_us[0])) {
+                oldest = column;
+            }
+        }
+        if(!oldest) {
+            break;
+        }
+        platform_mutex_lock(&oldest->lock);
+        store_evict_chunk(store, oldest);
+        platform_mutex_unlock(&oldest->lock);
+        // Not needed any more, the budget is what counts
+        if(store->spare) {
+            free(store->spare);
+            store->spare = NULL;
+            store->bytes.fetch_sub(sizeof(store_chunk), std::memory_order_relaxed);
+        }
+    }
+}
+
+// Writer only. Timestamps have to increase within a channel, samples that don't are dropped.
+void store_append(sample_store *store, uint32_t channel_id, const int64_t *timestamps_us, const float *values,
+                  int count) {
+    store_column *column = store_column_for(store, channel_id);
+    if(!column) {
+        return;
+    }
+
+    platform_mutex_lock(&column->lock);
+    int appended = 0;
+    int i = 0;
+    while(i < count) {
+        store_chunk *chunk = column->chunk_count ? store_column_chunk(column, column->chunk_count - 1) : NULL;
+        if(!chunk || chunk->count == STORE_CHUNK_SAMPLES) {
+            chunk = store_push_chunk(store, column);
+            if(!chunk) {
+                break;
+            }
+        }
+        int64_t last_timestamp_us = column->last_timestamp_us;
+        int chunk_count = chunk->count;
+        int chunk_first = chunk_count;
+        for(; i < count && chunk_count < STORE_CHUNK_SAMPLES; i++) {
+            if(timestamps_us[i] <= last_timestamp_us) {
+                column->out_of_order++;
+                continue;
+            }
+            chunk->timestamps_us[chunk_count] = timestamps_us[i];
+            chunk->values[chunk_count] = values[i];
+            last_timestamp_us = timestamps_us[i];
+            chunk_count++;
+        }
+        if(chunk_first == 0) {
+            chunk->min = INFINITY;
+            chunk->max = -INFINITY;
+        }
+        appended += chunk_count - chunk->count;
+        chunk->count = chunk_count;
+        column->last_timestamp_us = last_timestamp_us;
+        store_pyramid_append(store, column, chunk->timestamps_us + chunk_first, chunk->values + chunk_first,
+                             chunk_count - chunk_first, chunk);
+    }
+    column->sample_count += appended;
+    store->sample_count.fetch_add(appended, std::memory_order_relaxed);
+    store_apply_time_retention(store, column);
+    platform_mutex_unlock(&column->lock);
+
+    store_apply_memory_retention(store);
+}
+
+// First sample at or after timestamp_us, chunk == chunk_count if there is none. Caller holds the column lock.
+store_position store_lower_bound(store_column *column, int64_t timestamp_us) {
+    // First chunk whose last sample is at or after the timestamp
+    int low = 0;
+    int high = column->chunk_count;
+    while(low < high) {
+        int middle = (low + high) / 2;
+        store_chunk *chunk = store_column_chunk(column, middle);
+        if(chunk->count == 0 || chunk->timestamps_us[chunk->count - 1] < timestamp_us) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    store_position position = {low, 0};
+    if(low == column->chunk_count) {
+        return position;
+    }
+
+    store_chunk *chunk = store_column_chunk(column, low);
+    int first = 0;
+    int last = chunk->count;
+    while(first < last) {
+        int middle = (first + last) / 2;
+        if(chunk->timestamps_us[middle] < timestamp_us) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+    position.index = first;
+    return position;
+}
+
+// Copies out the samples in [from_us, to_us], at most max_samples of them. Returns how many were copied.
+int store_read(sample_store *store, uint32_t channel_id, int64_t from_us, int64_t to_us, int64_t *timestamps_us,
+               float *values, int max_samples) {
+    store_column *column = store_find_column(store, channel_id);
+    if(!column) {
+        return 0;
+    }
+    platform_mutex_lock(&column->lock);
+    store_position position = store_lower_bound(column, from_us);
+    int copied = 0;
+    for(int chunk_index = position.chunk; chunk_index < column->chunk_count && copied < max_samples; chunk_index++) {
+        store_chunk *chunk = store_column_chunk(column, chunk_index);
+        int first = chunk_index == position.chunk ? position.index : 0;
+        int last = first;
+        while(last < chunk->count && last - first < max_samples - copied && chunk->timestamps_us[last] <= to_us) {
+            last++;
+        }
+        memcpy(timestamps_us + copied, chunk->timestamps_us + first, (last - first) * sizeof(int64_t));
+        memcpy(values + copied, chunk->values + first, (last - first) * sizeof(float));
+        copied += last - first;
+        if(last < chunk->count) {
+            break;
+        }
+    }
+    platform_mutex_unlock(&column->lock);
+    return copied;
+}
+
+// Newest sample at or before timestamp_us, false if the store has none
+bool store_value_at(sample_store *store, uint32_t channel_id, int64_t timestamp_us, int64_t *sample_us, float *value) {
+    store_column *column = store_find_column(store, channel_id);
+    if(!column || timestamp_us == INT64_MAX) {
+        return false;
+    }
+    platform_mutex_lock(&column->lock);
+    store_position position = store_lower_bound(column, timestamp_us + 1);
+    store_chunk *chunk = NULL;
+    int index = 0;
+    if(position.index > 0) {
+        chunk = store_column_chunk(column, position.chunk);
+        index = position.index - 1;
+    } else if(position.chunk > 0) {
+        chunk = store_column_chunk(column, position.chunk - 1);
+        index = chunk->count - 1;
+    }
+    bool found = chunk && index >= 0;
+    if(found) {
+        *sample_us = chunk->timestamps_us[index];
+        *value = chunk->values[index];
+    }
+    platform_mutex_unlock(&column->lock);
+    return found;
+}
+
+// Time span and sample count of what is stored for a channel, false if there is nothing
+bool store_span(sample_store *store, uint32_t channel_id, int64_t *first_us, int64_t *last_us, uint64_t *count) {
+    store_column *column = store_find_column(store, channel_id);
+    if(!column) {
+        return false;
+    }
+    platform_mutex_lock(&column->lock);
+    bool has_samples = column->sample_count > 0;
+    if(has_samples) {
+        *first_us = store_column_chunk(column, 0)->timestamps_us[0];
+        *last_us = column->last_timestamp_us;
+        *count = column->sample_count;
+    }
+    platform_mutex_unlock(&column->lock);
+    return has_samples;
+}
+
+double store_bytes_per_million_samples(sample_store *store) {
+    uint64_t samples = store->sample_count.load(std::memory_order_relaxed);
+    return samples ? (double)store->bytes.load(std::memory_order_relaxed) * 1e6 / samples : 0.0;
+}
+
+// Mean holds the sum until store_envelope is done, count is samples or buckets
+void store_envelope_add(store_envelope_pixel *pixel, float min, float max, float sum, int count) {
+    if(pixel->count == 0) {
+        pixel->min = min;
+        pixel->max = max;
+        pixel->mean = sum;
+    } else {
+        pixel->min = min < pixel->min ? min : pixel->min;
+        pixel->max = max > pixel->max ? max : pixel->max;
+        pixel->mean += sum;
+    }
+    pixel->count += count;
+}
+
+// Folds samples [first, count) up to to_us into the pixels a pixel at a time, returns false once it got past to_us
+bool store_envelope_fold(const int64_t *timestamps_us, const float *values, int first, int count, int64_t from_us,
+                         int64_t to_us, double pixels_per_us, int pixel_count, store_envelope_pixel *pixels) {
+    int i = first;
+    while(i < count) {
+        if(timestamps_us[i] > to_us) {
+            return false;
+        }
+        int x = (int)((timestamps_us[i] - from_us) * pixels_per_us);
+        x = x < pixel_count ? x : pixel_count - 1;
+        // Everything up to where the next pixel starts
+        int64_t end_us = x + 1 < pixel_count ? from_us + (int64_t)((x + 1) / pixels_per_us) : to_us;
+        end_us = end_us > timestamps_us[i] ? end_us : timestamps_us[i];
+        end_us = end_us < to_us ? end_us : to_us;
+        float min = values[i];
+        float max = values[i];
+        float sum = 0.0f;
+        int run_first = i;
+        for(; i < count && timestamps_us[i] <= end_us; i++) {
+            min = values[i] < min ? values[i] : min;
+            max = values[i] > max ? values[i] : max;
+            sum += values[i];
+        }
+        store_envelope_add(&pixels[x], min, max, sum, i - run_first);
+    }
+    return true;
+}
+
+// Samples in [from_us, to_us] straight into the pixels, caller holds the column lock
+void store_envelope_samples(store_column *column, int64_t from_us, int64_t to_us, double pixels_per_us,
+                            int pixel_count, store_envelope_pixel *pixels) {
+    store_position position = store_lower_bound(column, from_us);
+    for(int chunk_index = position.chunk; chunk_index < column->chunk_count; chunk_index++) {
+        store_chunk *chunk = store_column_chunk(column, chunk_index);
+        int first = chunk_index == position.chunk ? position.index : 0;
+        if(!store_envelope_fold(chunk->timestamps_us, chunk->values, first, chunk->count, from_us, to_us,
+                                pixels_per_us, pixel_count, pixels)) {
+            return;
+        }
+    }
+}
+
+// Turns the sums into means
+void store_envelope_finish(store_envelope_pixel *pixels, int pixel_count) {
+    for(int x = 0; x < pixel_count; x++) {
+        if(pixels[x].count) {
+            pixels[x].mean /= pixels[x].count;
+        }
+    }
+}
+
+void store_envelope_bucket(store_level *level, int bucket, int64_t from_us, double pixels_per_us, int pixel_count,
+                           store_envelope_pixel *pixels) {
+    int slot = store_level_slot(level, bucket);
+    // The bucket that started before the view is drawn at its left edge
+    int64_t offset_us = level->timestamps_us[slot] - from_us;
+    int x = offset_us > 0 ? (int)(offset_us * pixels_per_us) : 0;
+    x = x < pixel_count ? x : pixel_count - 1;
+    store_envelope_add(&pixels[x], level->mins[slot], level->maxs[slot], level->means[slot], 1);
+}
+
+// Min/max/mean of every pixel column for a view of [from_us, to_us] that is pixel_count pixels wide.
+// Reads the finest pyramid level that has no more than two buckets per pixel, or the samples themselves when
+// there are no more than two of them per pixel, so the cost depends on the width of the view rather than the
+// history length.
+// Returns the level that was used, -1 for the samples.
+int store_envelope(sample_store *store, uint32_t channel_id, int64_t from_us, int64_t to_us, int pixel_count,
+                   store_envelope_pixel *pixels) {
+    memset(pixels, 0, pixel_count * sizeof(store_envelope_pixel));
+    store_column *column = store_find_column(store, channel_id);
+    if(!column || to_us <= from_us || pixel_count <= 0) {
+        return -1;
+    }
+    double pixels_per_us = (double)pixel_count / (double)(to_us - from_us);
+
+    platform_mutex_lock(&column->lock);
+    store_level *base = &column->levels[0];
+    int first_bucket = store_level_lower_bound(base, from_us);
+    int buckets = store_level_lower_bound(base, to_us + 1) - first_bucket;
+    // Samples that have been dropped for the memory budget only exist in the pyramid any more. A view that starts
+    // before the oldest sample only needs it if the pyramid goes back further than the samples do.
+    int64_t oldest_us = column->chunk_count > 0 ? store_column_chunk(column, 0)->timestamps_us[0] : INT64_MAX;
+    bool dropped = from_us < oldest_us && base->count > 0 && base->timestamps_us[store_level_slot(base, 0)] < oldest_us;
+    bool has_samples = column->chunk_count > 0 && !dropped;
+
+    int level_index = 0;
+    // Samples in the view, the bucket that is still being filled counts as whole
+    int64_t samples = (int64_t)buckets * STORE_PYRAMID_BASE + (base->partial_count > 0 ? base->partial_count : 0);
+    if(has_samples && samples <= 2 * (int64_t)pixel_count) {
+        level_index = -1;
+        store_envelope_samples(column, from_us, to_us, pixels_per_us, pixel_count, pixels);
+    } else {
+        while(level_index + 1 < STORE_PYRAMID_LEVELS && (buckets >> level_index) > 2 * pixel_count &&
+              column->levels[level_index + 1].count > 0) {
+            level_index++;
+        }
+        store_level *level = &column->levels[level_index];
+        int bucket = store_level_lower_bound(level, from_us);
+        for(bucket = bucket > 0 ? bucket - 1 : 0; bucket < level->count; bucket++) {
+            if(level->timestamps_us[store_level_slot(level, bucket)] > to_us) {
+                break;
+            }
+            store_envelope_bucket(level, bucket, from_us, pixels_per_us, pixel_count, pixels);
+        }
+
+        // The newest data hasn't made it up to this level yet: at most one bucket of every level below
+        // and the samples of the bucket that is still being filled
+        int64_t last_drawn_us = level->count ? level->timestamps_us[store_level_slot(level, level->count - 1)]
+                                             : INT64_MIN;
+        for(int i = level_index - 1; i >= 0; i--) {
+            store_level *lower = &column->levels[i];
+            if(column->levels[i + 1].partial_count == 1 && lower->count > 0) {
+                int last = lower->count - 1;
+                int64_t timestamp_us = lower->timestamps_us[store_level_slot(lower, last)];
+                if(timestamp_us > last_drawn_us && timestamp_us >= from_us && timestamp_us <= to_us) {
+                    store_envelope_bucket(lower, last, from_us, pixels_per_us, pixel_count, pixels);
+                }
+            }
+        }
+        if(base->partial_count > 0 && base->partial_timestamp_us <= to_us) {
+            int64_t tail_from_us = base->partial_timestamp_us > from_us ? base->partial_timestamp_us : from_us;
+            store_envelope_samples(column, tail_from_us, to_us, pixels_per_us, pixel_count, pixels);
+        }
+    }
+    platform_mutex_unlock(&column->lock);
+    store_envelope_finish(pixels, pixel_count);
+    return level_index;
+}
@@ -0,0 +1,82 @@
+#include <stddef.h>
+
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_app_desc.h"
+#include "sys/socket.h"
+#include "netinet/in.h"
+
+#include "protocol.h"
+#include "discovery.h"
+#include "tcp.h"
+
+// Lets clients find the device without typing in an address: a beacon is broadcast every
+// DISCOVERY_BEACON_INTERVAL_MS and probes from a client's subnet scan are answered right away.
+
+#define DISCOVERY_RECV_TIMEOUT_MS 100
+
+static const char* DISCOVERY_TAG = "DISCOVERY";
+
+void fill_beacon(discovery_packet* beacon) {
+    memset(beacon, 0, sizeof(*beacon));
+    beacon->magic = DISCOVERY_MAGIC;
+    beacon->version = DISCOVERY_VERSION;
+    beacon->kind = DISCOVERY_BEACON;
+    beacon->tcp_port = PORT;
+    esp_read_mac(beacon->device_id, ESP_MAC_WIFI_SOFTAP);
+
+    int connected, streaming;
+    tcp_client_counts(&connected, &streaming);
+    beacon->connected_clients = (uint8_t)connected;
+    beacon->streaming_clients = (uint8_t)streaming;
+
+    // The first bytes of the ELF hash are enough to tell firmware builds apart
+    const esp_app_desc_t* app_description = esp_app_get_description();
+    memcpy(&beacon->firmware_hash, app_description->app_elf_sha256, sizeof(beacon->firmware_hash));
+}
+
+void send_beacon(int socket_id, const struct sockaddr_in* destination) {
+    discovery_packet beacon;
+    fill_beacon(&beacon);
+    if(sendto(socket_id, &beacon, sizeof(beacon), 0, (const struct sockaddr*)destination, 
+              sizeof(*destination)) < 0) {
+        ESP_LOGW(DISCOVERY_TAG, "Failed to send a beacon, errno: %d.", errno);
+    }
+}
+
+void discovery_task(void* parameters) {
+    int socket_id;
+    struct sockaddr bind_addr;
+    ESP_ERROR_CHECK(create_socket(&socket_id, AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+    config_socket((struct sockaddr_in*)&bind_addr, AF_INET, DISCOVERY_DEVICE_PORT, IPADDR_ANY);
+    ESP_ERROR_CHECK(bind_socket(socket_id, &bind_addr));
+
+    int broadcast = 1;
+    setsockopt(socket_id, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+    // recvfrom only waits a little, so that beacons go out on time
+    struct timeval timeout = {};
+    timeout.tv_usec = DISCOVERY_RECV_TIMEOUT_MS * 1000;
+    setsockopt(socket_id, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in broadcast_addr;
+    config_socket(&broadcast_addr, AF_INET, DISCOVERY_CLIENT_PORT, IPADDR_BROADCAST);
+
+    TickType_t next_beacon = xTaskGetTickCount();
+    while(true) {
+        if((int32_t)(xTaskGetTickCount() - next_beacon) >= 0) {
+            send_beacon(socket_id, &broadcast_addr);
+            next_beacon += pdMS_TO_TICKS(DISCOVERY_BEACON_INTERVAL_MS);
+        }
+
+        discovery_packet probe;
+        struct sockaddr_in source_addr;
+        socklen_t source_addrlen = sizeof(source_addr);
+        int received = recvfrom(socket_id, &probe, sizeof(probe), 0, (struct sockaddr*)&source_addr, &source_addrlen);
+        if(received < (int)offsetof(discovery_packet, tcp_port) || probe.magic != DISCOVERY_MAGIC || 
+           probe.kind != DISCOVERY_PROBE) {
+            continue;
+        }
+        // Answered straight to whoever asked, the client scan doesn't have to wait for the next beacon
+        send_beacon(socket_id, &source_addr);
+    }
+}
@@ -13,7 +13,9 @@
 #define TAG "MAIN"
 
 #include "wifi.c"
+#include "sampler.c"
 #include "tcp.c"
+#include "discovery.c"
 
 void app_main(void) {
 
@@ -33,5 +35,10 @@ void app_main(void) {
 
     access_point_start("*test*", "", 1, WIFI_AUTH_OPEN, 0, ESP_WIFI_MAX_CONN_NUM, 100);
 
+    // Fills the history ring that reconnecting clients catch up from
+    ESP_ERROR_CHECK(sampler_start());
+
     xTaskCreatePinnedToCore(tcp_server_task, "TCP_SERVER", STACK_SIZE, NULL, tskIDLE_PRIORITY, NULL, tskNO_AFFINITY);
+    // Beacons and probe replies, so that clients can find the server without knowing its address
+    xTaskCreatePinnedToCore(discovery_task, "DISCOVERY", STACK_SIZE, NULL, tskIDLE_PRIORITY, NULL, tskNO_AFFINITY);
 }
\ No newline at end of file
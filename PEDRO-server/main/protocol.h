@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+
+// Wire format shared with the client (PEDRO-client/main/network.cpp), everything is little-endian apart from
+// sample values flagged SAMPLE_BLOCK_BIG_ENDIAN
+
+// msg_type: 0 - default message,
+// msg_type: 1 - data request,
+// msg_type: 2 - data input,
+// msg_type: 3 - schema request,
+// msg_type: 4 - schema,
+// msg_type: 5 - subscribe,
+// msg_type: 6 - sample batch,
+// msg_type: 7 - history request,
+// msg_type: 8 - keepalive,
+// ...
+// msg_type: 14 - restart,
+// msg_type: 15 - shutdown
+typedef enum {
+    MSG_DEFAULT = 0,
+    MSG_DATA_REQUEST = 1,
+    MSG_DATA_INPUT = 2,
+    MSG_SCHEMA_REQUEST = 3,
+    MSG_SCHEMA = 4,
+    MSG_SUBSCRIBE = 5,
+    MSG_SAMPLE_BATCH = 6,
+    MSG_HISTORY_REQUEST = 7,
+    MSG_KEEPALIVE = 8,
+    MSG_RESTART = 14,
+    MSG_SHUTDOWN = 15
+} MESSAGE_TYPE;
+
+typedef enum {
+    SAMPLE_FORMAT_U8 = 0,
+    SAMPLE_FORMAT_I16 = 1,
+    SAMPLE_FORMAT_I32 = 2,
+    SAMPLE_FORMAT_F32 = 3
+} SAMPLE_FORMAT;
+
+#define FRAME_MAX_PAYLOAD 65535
+
+// Every message starts with a frame_header, replies carry the sequence of the request
+typedef struct __attribute__((packed)) {
+    uint16_t payload_length;
+    uint8_t message_type;
+    uint8_t flags;
+    uint32_t sequence;
+} frame_header;
+
+// Values of a block are big-endian, for samples passed through as the sensor sent them
+#define SAMPLE_BLOCK_BIG_ENDIAN 0x01
+
+// A sample batch payload is a list of these, each followed by sample_count values.
+// Sample i was taken at first_timestamp_us + i * sample_period_us.
+typedef struct __attribute__((packed)) {
+    uint16_t channel_id;
+    uint16_t sample_count;
+    uint8_t sample_format;
+    uint8_t flags;
+    uint8_t reserved[2];
+    uint64_t first_timestamp_us;
+    uint32_t sample_period_us;
+} sample_block_header;
+
+// A schema payload is a uint16_t channel count followed by this for every channel
+typedef struct __attribute__((packed)) {
+    uint16_t channel_id;
+    uint8_t sample_format;
+    uint8_t reserved;
+    float scale;
+    float offset;
+    char name[16];
+} schema_channel;
+
+// Discovery runs over UDP next to the TCP server. Devices answer probes on DISCOVERY_DEVICE_PORT and
+// broadcast a beacon to DISCOVERY_CLIENT_PORT every DISCOVERY_BEACON_INTERVAL_MS.
+#define DISCOVERY_DEVICE_PORT 7778
+#define DISCOVERY_CLIENT_PORT 7779
+#define DISCOVERY_BEACON_INTERVAL_MS 1000
+#define DISCOVERY_MAGIC 0x4F524450
+#define DISCOVERY_VERSION 1
+
+typedef enum {
+    DISCOVERY_PROBE = 0,
+    DISCOVERY_BEACON = 1
+} DISCOVERY_KIND;
+
+// Probes only need magic, version and kind, the rest is filled in by beacons
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t kind;
+    uint16_t tcp_port;
+    uint8_t device_id[6];
+    uint8_t connected_clients;
+    uint8_t streaming_clients;
+    uint32_t firmware_hash;
+} discovery_packet;
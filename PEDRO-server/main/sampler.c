@@ -0,0 +1,99 @@
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+
+#include "protocol.h"
+
+#include "sampler.h"
+
+// Samples every data point on a fixed period into a history ring, so that a client that lost its
+// connection can ask for what it missed. Row n was sampled at n * SAMPLE_PERIOD_US.
+
+// Rows, has to be a power of two. 8192 rows at 1 kHz is a bit over 8 seconds of history.
+#define HISTORY_LENGTH 8192
+
+static const char* SAMPLER_TAG = "SAMPLER";
+
+#define DATA_POINTS_NUM 5
+static const gpio_num_t data_point_pins[DATA_POINTS_NUM] = {
+    GPIO_NUM_0,
+    GPIO_NUM_1,
+    GPIO_NUM_2,
+    GPIO_NUM_3,
+    GPIO_NUM_4
+};
+
+static uint8_t history[HISTORY_LENGTH][DATA_POINTS_NUM];
+static uint64_t history_rows = 0;
+static portMUX_TYPE history_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t sampler_timer = NULL;
+
+void sampler_callback(void* arg) {
+    uint64_t row;
+    portENTER_CRITICAL(&history_lock);
+    row = history_rows;
+    portEXIT_CRITICAL(&history_lock);
+
+    uint8_t* values = history[row & (HISTORY_LENGTH - 1)];
+    for(int i = 0; i < DATA_POINTS_NUM; i++) {
+        values[i] = (uint8_t)gpio_get_level(data_point_pins[i]);
+    }
+
+    // Only published once the row is complete
+    portENTER_CRITICAL(&history_lock);
+    history_rows = row + 1;
+    portEXIT_CRITICAL(&history_lock);
+}
+
+esp_err_t sampler_start() {
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = sampler_callback;
+    timer_args.name = "sampler";
+
+    esp_err_t err = esp_timer_create(&timer_args, &sampler_timer);
+    if(err != ESP_OK) {
+        ESP_LOGE(SAMPLER_TAG, "Failed to create the sampler timer.");
+        return err;
+    }
+    err = esp_timer_start_periodic(sampler_timer, SAMPLE_PERIOD_US);
+    if(err != ESP_OK) {
+        ESP_LOGE(SAMPLER_TAG, "Failed to start the sampler timer.");
+        return err;
+    }
+    ESP_LOGD(SAMPLER_TAG, "Sampling %d data points every %d us.", DATA_POINTS_NUM, SAMPLE_PERIOD_US);
+    return ESP_OK;
+}
+
+// Number of rows sampled so far, rows [sampler_oldest_row(), sampler_row_count()) are in the ring
+uint64_t sampler_row_count() {
+    uint64_t rows;
+    portENTER_CRITICAL(&history_lock);
+    rows = history_rows;
+    portEXIT_CRITICAL(&history_lock);
+    return rows;
+}
+
+uint64_t sampler_oldest_row() {
+    uint64_t rows = sampler_row_count();
+    // One row of slack for the one the timer might be writing
+    return rows > HISTORY_LENGTH - 1 ? rows - (HISTORY_LENGTH - 1) : 0;
+}
+
+// Copies up to row_count values of a data point, every stride-th row starting at first_row.
+// Returns how many were copied.
+int sampler_read(int data_point, uint64_t first_row, int row_count, int stride, uint8_t* values) {
+    uint64_t rows = sampler_row_count();
+    uint64_t oldest = sampler_oldest_row();
+    if(data_point < 0 || data_point >= DATA_POINTS_NUM || first_row < oldest || first_row >= rows) {
+        return 0;
+    }
+    uint64_t available = (rows - first_row + stride - 1) / stride;
+    if(row_count > available) {
+        row_count = (int)available;
+    }
+    for(int i = 0; i < row_count; i++) {
+        values[i] = history[(first_row + (uint64_t)i * stride) & (HISTORY_LENGTH - 1)][data_point];
+    }
+    return row_count;
+}
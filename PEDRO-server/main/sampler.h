@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+#define SAMPLE_PERIOD_US 1000
+
+esp_err_t sampler_start();
+uint64_t sampler_row_count();
+uint64_t sampler_oldest_row();
+int sampler_read(int data_point, uint64_t first_row, int row_count, int stride, uint8_t* values);
@@ -3,6 +3,9 @@
 #include "netinet/in.h"
 #include "driver/gpio.h"
 
+#include "protocol.h"
+#include "sampler.h"
+
 #define PORT 7777
 #define MAX_PENDING_CONNECTIONS 32
 
@@ -31,19 +34,44 @@ typedef enum {
     GPIO4
 } DATA_POINTS;
 
-typedef struct message {
-    int buffer_size;
-    char *buffer;
+#define RECV_BUFF_SIZE (8 * 1024)
+#define SEND_BUFF_SIZE (8 * 1024)
+#define RECV_TIMEOUT_MS 10
+// Rows per sample block when streaming
+#define STREAM_BLOCK_ROWS 250
+
+// Reported in the discovery beacon as the current load
+static int connected_clients = 0;
+static int streaming_clients = 0;
+static portMUX_TYPE client_count_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void tcp_client_counts(int* connected, int* streaming) {
+    portENTER_CRITICAL(&client_count_lock);
+    *connected = connected_clients;
+    *streaming = streaming_clients;
+    portEXIT_CRITICAL(&client_count_lock);
+}
 
-    int message_type;
-};
+void update_client_counts(int connected_change, int streaming_change) {
+    portENTER_CRITICAL(&client_count_lock);
+    connected_clients += connected_change;
+    streaming_clients += streaming_change;
+    portEXIT_CRITICAL(&client_count_lock);
+}
 
 typedef struct client_data {
     int client_id;
 
-    message recv_message;
-    message send_message;
-};
+    char* recv_buff;
+    int recv_size;
+    char* send_buff;
+
+    // Streaming state, set up by subscribe and rewound by history requests
+    uint32_t subscribed_mask;
+    uint32_t decimation;
+    int streaming;
+    uint64_t next_row;
+} client_data;
 
 esp_err_t create_socket(int* socket_id, int domain, int type, int protocol) {
     int res = 0;
@@ -108,145 +136,300 @@ int send_message(int client_id, char *buffer, int message_size) {
     return bytes_sent;
 }
 
-void tcp_data_transfer(void *parameters) {
-    while(true) {
-        // receive_message();
+// Sends a frame whose payload is already in the send buffer after the header
+int send_frame(client_data* client_socket, char msg_type, uint32_t sequence, int payload_length) {
+    frame_header header = {};
+    header.payload_length = (uint16_t)payload_length;
+    header.message_type = (uint8_t)msg_type;
+    header.sequence = sequence;
+    memcpy(client_socket->send_buff, &header, sizeof(header));
+
+    int size = sizeof(header) + payload_length;
+    int sent = 0;
+    while(sent < size) {
+        int result = send(client_socket->client_id, client_socket->send_buff + sent, size - sent, 0);
+        if(result < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                vTaskDelay(1);
+                continue;
+            }
+            ESP_LOGE(SOCKET_TAG, "Failed to send to the client_id: %d, with errno: %d.", 
+                     client_socket->client_id, errno);
+            return 0;
+        }
+        sent += result;
+    }
+    return sent;
+}
 
-        // parse_message();
+int find_data_point(const char* name) {
+    for(int data_point = 0; data_point < data_points_num; data_point++) {
+        if(!strcmp(data_points_array[data_point], name)) {
+            return data_point;
+        }
+    }
+    return -1;
+}
 
-        // prepare_message();
+// Requested data in the format of
+// name (0 delimiter) size (in bytes) 0
+void handle_data_request(client_data* client_socket, const frame_header* header, const char* payload) {
+    char* send_data = client_socket->send_buff + sizeof(frame_header);
+    char* send_end = client_socket->send_buff + SEND_BUFF_SIZE;
+    int offset = 0;
+
+    while(offset < header->payload_length) {
+        int name_length = strnlen(payload + offset, header->payload_length - offset);
+        if(offset + name_length + 3 > header->payload_length) {
+            ESP_LOGW(SOCKET_TAG, "Malformed data request from client_id: %i", client_socket->client_id);
+            break;
+        }
+        const char* var_name = payload + offset;
+        int size = (unsigned char)payload[offset + name_length + 1];
+        offset += name_length + 3;
 
-        // send_message();
+        if(send_data + name_length + 1 + size + 1 > send_end) {
+            break;
+        }
+        memcpy(send_data, var_name, name_length + 1);
+        send_data += name_length + 1;
+
+        // Latest sampled value, unknown data points are sent as 0
+        uint8_t value = 0;
+        int data_point = find_data_point(var_name);
+        if(data_point < 0) {
+            ESP_LOGW(SOCKET_TAG, "Client requested unavailable data point! client_id: %i, requested_name: %s", 
+                     client_socket->client_id, var_name);
+        } else {
+            uint64_t rows = sampler_row_count();
+            if(rows > 0) {
+                sampler_read(data_point, rows - 1, 1, 1, &value);
+            }
+        }
+        memset(send_data, 0, size);
+        if(size > 0) {
+            *send_data = value;
+        }
+        send_data += size;
+
+        *send_data = 0;
+        send_data += sizeof(char);
     }
+
+    int payload_length = send_data - (client_socket->send_buff + sizeof(frame_header));
+    send_frame(client_socket, MSG_DATA_INPUT, header->sequence, payload_length);
 }
 
-void tcp_data_transfer(void* parameters) {
-    client_data *client_socket = parameters;
-    int recv_buff_size = kilobytes(64);
-    client_socket->recv_buff = malloc(recv_buff_size);
-    void* recv_data = client_socket->recv_buff;
-
-    int send_buff_size = kilobytes(64);
-    client_socket->send_buff = malloc(send_buff_size);
-    void* send_data = client_socket->send_buff;
+void handle_schema_request(client_data* client_socket, const frame_header* header) {
+    char* payload = client_socket->send_buff + sizeof(frame_header);
+    uint16_t channel_count = data_points_num;
+    memcpy(payload, &channel_count, sizeof(channel_count));
+
+    for(int data_point = 0; data_point < data_points_num; data_point++) {
+        schema_channel channel = {};
+        channel.channel_id = data_point;
+        channel.sample_format = SAMPLE_FORMAT_U8;
+        channel.scale = 1.0f;
+        channel.offset = 0.0f;
+        strncpy(channel.name, data_points_array[data_point], sizeof(channel.name) - 1);
+        memcpy(payload + sizeof(channel_count) + data_point * sizeof(channel), &channel, sizeof(channel));
+    }
+
+    int payload_length = sizeof(channel_count) + channel_count * sizeof(schema_channel);
+    send_frame(client_socket, MSG_SCHEMA, header->sequence, payload_length);
+}
+
+// Subscribe payload: sample period in us followed by the channel ids
+void handle_subscribe(client_data* client_socket, const frame_header* header, const char* payload) {
+    uint32_t sample_period_us = 0;
+    if(header->payload_length < sizeof(sample_period_us)) {
+        return;
+    }
+    memcpy(&sample_period_us, payload, sizeof(sample_period_us));
+    for(int offset = sizeof(sample_period_us); offset + 1 < header->payload_length; offset += sizeof(uint16_t)) {
+        uint16_t channel_id;
+        memcpy(&channel_id, payload + offset, sizeof(channel_id));
+        if(channel_id < data_points_num) {
+            client_socket->subscribed_mask |= 1 << channel_id;
+        }
+    }
+
+    uint32_t decimation = sample_period_us / SAMPLE_PERIOD_US;
+    client_socket->decimation = decimation > 0 ? decimation : 1;
+    if(!client_socket->streaming) {
+        client_socket->streaming = 1;
+        client_socket->next_row = sampler_row_count();
+        update_client_counts(0, 1);
+    }
+    ESP_LOGD(SOCKET_TAG, "client_id: %d subscribed, mask: 0x%lx, decimation: %lu", client_socket->client_id,
+             (unsigned long)client_socket->subscribed_mask, (unsigned long)client_socket->decimation);
+}
+
+// Rewinds the stream to the requested timestamp, as far back as the history ring goes
+void handle_history_request(client_data* client_socket, const frame_header* header, const char* payload) {
+    uint64_t since_us = 0;
+    if(header->payload_length < sizeof(since_us)) {
+        return;
+    }
+    memcpy(&since_us, payload, sizeof(since_us));
+    uint64_t row = (since_us + SAMPLE_PERIOD_US - 1) / SAMPLE_PERIOD_US;
+    uint64_t oldest = sampler_oldest_row();
+    if(row < oldest) {
+        ESP_LOGW(SOCKET_TAG, "History request from client_id: %d goes past the history ring, %llu rows lost.", 
+                 client_socket->client_id, (unsigned long long)(oldest - row));
+        row = oldest;
+    }
+    client_socket->next_row = row;
+}
+
+// Sends whatever was sampled since the last call, one block per subscribed data point
+void stream_samples(client_data* client_socket) {
+    if(!client_socket->streaming || !client_socket->subscribed_mask) {
+        return;
+    }
+
     while(true) {
-        client_socket->recv_size = recv(client_socket->client_id, client_socket->recv_buff, recv_buff_size, 0);
-        if(client_socket->recv_size < 0) {
-            ESP_LOGE(SOCKET_TAG, "Failed to receive data from the client socket id: %d, with errno: %d.", 
-                                    client_socket->client_id, errno);
-            ESP_LOGE(SOCKET_TAG, "Closing connection with the client_id: %d.", client_socket->client_id);
-            close(client_socket->client_id);
-            free(client_socket->recv_buff);
-            free(client_socket->send_buff);
-            free(client_socket);
-            vTaskDelete(NULL);
+        uint64_t rows = sampler_row_count();
+        uint64_t oldest = sampler_oldest_row();
+        if(client_socket->next_row < oldest) {
+            // Fell behind further than the history ring goes
+            client_socket->next_row = oldest;
+        }
+        uint32_t decimation = client_socket->decimation;
+        uint64_t available = rows > client_socket->next_row ? (rows - client_socket->next_row) / decimation : 0;
+        int row_count = available < STREAM_BLOCK_ROWS ? (int)available : STREAM_BLOCK_ROWS;
+        if(row_count == 0) {
+            return;
         }
 
-        // msg_type: 0 - default message,
-        // msg_type: 1 - data request,
-        // msg_type: 2 - data input,
-        // ...
-        // msg_type: 14 - restart,
-        // msg_type: 15 - shutdown
-        char msg_type = *((char *)recv_data);
-        recv_data += sizeof(char);
-
-        ESP_LOGD(SOCKET_TAG, "msg_type: %i", msg_type);
-
-        switch(msg_type) {
-            case 0: {
-                ESP_LOGD(SOCKET_TAG, "%s", (char *)recv_data);
-            } break;
-
-            case 1: {
-                ESP_LOGD(SOCKET_TAG, "Requested data!");
-                // Requested data in the format of
-                // name (0 delimiter) size (in bytes)
-                // Setting the msg_type to data input
-                *(char *)send_data = 2;
-                send_data += sizeof(char);
-
-                while(recv_data - client_socket->recv_buff < client_socket->recv_size) {
-                    int name_length = 0;
-                    int size = 0;
-                    while(*((char *)recv_data + name_length)) {
-                        name_length++;
-                    }
-
-                    name_length++;
-                    char *var_name = malloc(name_length * sizeof(char));
-                    memcpy(var_name, recv_data, name_length * sizeof(char));
-                    recv_data += name_length * sizeof(char);
-
-                    size = *(int *)recv_data;
-                    recv_data += sizeof(int) + 1;
-
-                    // Preparing the data to be sent
-                    memcpy(send_data, var_name, name_length * sizeof(char));
-                    send_data += name_length * sizeof(char);
-
-                    // Determine which data point
-                    DATA_POINTS data_point = 0;
-                    while(strcmp(data_points_array[data_point], var_name)) {
-                        data_point++;
-                        if(data_point >= data_points_num) {
-                            ESP_LOGW(SOCKET_TAG, 
-                                "Client requested unavailable data point! client_id: %i, requested_name: %s", 
-                                client_socket->client_id, var_name);
-                            break;
-                        }
-                    }
-
-                    switch(data_point) {
-                        case GPIO0: {
-                        } break;
-
-                        case GPIO1: {
-                        } break;
-
-                        case GPIO2: {
-                        } break;
-
-                        case GPIO3: {
-                        } break;
-
-                        case GPIO4: {
-                            // for testing purposes now
-                            int value = gpio_get_level(GPIO_NUM_4);
-                            memset(send_data, value, 1);
-                            send_data += size;
-                        } break;
-
-                        default: {
-                            // Unknown data point sending 0 value
-                            memset(send_data, 0, size);
-                            send_data += size;
-                        } break;
-                    }
-
-                    *(char *)send_data = 0;
-                    send_data += sizeof(char);
-                }
+        char* send_data = client_socket->send_buff + sizeof(frame_header);
+        for(int data_point = 0; data_point < data_points_num; data_point++) {
+            if(!(client_socket->subscribed_mask & (1 << data_point))) {
+                continue;
+            }
+            sample_block_header block = {};
+            block.channel_id = data_point;
+            block.sample_format = SAMPLE_FORMAT_U8;
+            block.first_timestamp_us = client_socket->next_row * SAMPLE_PERIOD_US;
+            block.sample_period_us = SAMPLE_PERIOD_US * decimation;
+            block.sample_count = sampler_read(data_point, client_socket->next_row, row_count, decimation, 
+                                              (uint8_t *)send_data + sizeof(block));
+            memcpy(send_data, &block, sizeof(block));
+            send_data += sizeof(block) + block.sample_count;
+        }
+
+        int payload_length = send_data - (client_socket->send_buff + sizeof(frame_header));
+        if(!send_frame(client_socket, MSG_SAMPLE_BATCH, 0, payload_length)) {
+            return;
+        }
+        client_socket->next_row += (uint64_t)row_count * decimation;
+    }
+}
 
-                // Send the message back to the client
-                int send_size = send_data - client_socket->send_buff;
-                send_size = send(client_socket->client_id, client_socket->send_buff, send_size, 0);
-            } break;
+void handle_frame(client_data* client_socket, const frame_header* header, const char* payload) {
+    ESP_LOGD(SOCKET_TAG, "msg_type: %i", header->message_type);
+
+    switch(header->message_type) {
+        case MSG_DEFAULT: {
+            ESP_LOGD(SOCKET_TAG, "%.*s", header->payload_length, payload);
+        } break;
+
+        case MSG_DATA_REQUEST: {
+            ESP_LOGD(SOCKET_TAG, "Requested data!");
+            handle_data_request(client_socket, header, payload);
+        } break;
+
+        case MSG_SCHEMA_REQUEST: {
+            handle_schema_request(client_socket, header);
+        } break;
+
+        case MSG_SUBSCRIBE: {
+            handle_subscribe(client_socket, header, payload);
+        } break;
+
+        case MSG_HISTORY_REQUEST: {
+            handle_history_request(client_socket, header, payload);
+        } break;
+
+        case MSG_KEEPALIVE: {
+            // Echoed back so the client can tell the connection is still alive
+            send_frame(client_socket, MSG_KEEPALIVE, header->sequence, 0);
+        } break;
+
+        case MSG_RESTART: {
+            ESP_LOGD(SOCKET_TAG, "Received a restart message, restarting!");
+            // TODO: restarting procedure
+        } break;
+
+        case MSG_SHUTDOWN: {
+            ESP_LOGD(SOCKET_TAG, "Received a shutdown message, shutting down!");
+            // TODO: shutting down procedure
+        } break;
+
+        default: {
+            ESP_LOGW(SOCKET_TAG, "Unknown message type received!");
+        } break;
+    }
+}
+
+void close_client(client_data* client_socket) {
+    ESP_LOGE(SOCKET_TAG, "Closing connection with the client_id: %d.", client_socket->client_id);
+    close(client_socket->client_id);
+    free(client_socket->recv_buff);
+    free(client_socket->send_buff);
+    update_client_counts(-1, client_socket->streaming ? -1 : 0);
+    free(client_socket);
+    vTaskDelete(NULL);
+}
 
-            case 14: {
-                ESP_LOGD(SOCKET_TAG, "Received a restart message, restarting!");
-                // TODO: restarting procedure
-            } break;
+void tcp_data_transfer(void* parameters) {
+    client_data* client_socket = parameters;
+    client_socket->recv_buff = malloc(RECV_BUFF_SIZE);
+    client_socket->recv_size = 0;
+    client_socket->send_buff = malloc(SEND_BUFF_SIZE);
+    client_socket->subscribed_mask = 0;
+    client_socket->decimation = 1;
+    client_socket->streaming = 0;
+    client_socket->next_row = 0;
+    update_client_counts(1, 0);
+
+    // recv only waits a little, so that streaming keeps going while the client is quiet
+    struct timeval timeout = {};
+    timeout.tv_usec = RECV_TIMEOUT_MS * 1000;
+    setsockopt(client_socket->client_id, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
-            case 15: {
-                ESP_LOGD(SOCKET_TAG, "Received a shutdown message, shutting down!");
-                // TODO: shutting down procedure
-            } break;
+    while(true) {
+        int received = recv(client_socket->client_id, client_socket->recv_buff + client_socket->recv_size, 
+                            RECV_BUFF_SIZE - client_socket->recv_size, 0);
+        if(received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            ESP_LOGE(SOCKET_TAG, "Failed to receive data from the client socket id: %d, with errno: %d.", 
+                     client_socket->client_id, errno);
+            close_client(client_socket);
+        }
 
-            default: {
-                ESP_LOGW(SOCKET_TAG, "Unknown message type received!");
-            } break;
+        if(received > 0) {
+            client_socket->recv_size += received;
+
+            // Cut the received bytes into frames, a partial frame stays at the start of the buffer
+            int offset = 0;
+            while(client_socket->recv_size - offset >= sizeof(frame_header)) {
+                frame_header header;
+                memcpy(&header, client_socket->recv_buff + offset, sizeof(header));
+                if(sizeof(header) + header.payload_length > RECV_BUFF_SIZE) {
+                    ESP_LOGE(SOCKET_TAG, "Frame too large from client_id: %d.", client_socket->client_id);
+                    close_client(client_socket);
+                }
+                if(client_socket->recv_size - offset < sizeof(header) + header.payload_length) {
+                    break;
+                }
+                handle_frame(client_socket, &header, client_socket->recv_buff + offset + sizeof(header));
+                offset += sizeof(header) + header.payload_length;
+            }
+            memmove(client_socket->recv_buff, client_socket->recv_buff + offset, client_socket->recv_size - offset);
+            client_socket->recv_size -= offset;
         }
+
+        stream_samples(client_socket);
     }
 }
 
@@ -264,7 +447,7 @@ void tcp_server_task() {
 
     struct sockaddr_in client_addr;
     memset(&client_addr, 0, sizeof(client_addr));
-    socklen_t client_addrlen;
+    socklen_t client_addrlen = sizeof(client_addr);
     char addr_str[128];
     while(true) {
         client_data* client_socket = malloc(sizeof(client_data));
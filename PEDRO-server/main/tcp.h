@@ -4,4 +4,5 @@ esp_err_t create_socket(int* socket_id, int domain, int type, int protocol);
 void config_socket(struct sockaddr_in* socket_addr, int domain, int port, unsigned long addr);
 esp_err_t bind_socket(int socket_id, const struct sockaddr* socket_addr);
 esp_err_t listen_socket(int socket_id);
-void tcp_server_task();
\ No newline at end of file
+void tcp_server_task();
+void tcp_client_counts(int* connected, int* streaming);
\ No newline at end of file